@@ -0,0 +1,529 @@
+"""
+Decoder for the binary frames the simulator sends on the 'imageFrame' event.
+The layout is documented in Source/Mower3/Public/FrameWireFormat.h, keep both in sync.
+LZ4 and QOI planes decode much faster with the lz4 and qoi packages installed. The pure Python fallbacks are
+orders of magnitude slower, importing without the packages warns. Frames with delta planes only carry the tiles
+that changed, FrameDecoder rebuilds them.
+"""
+
+import struct
+import warnings
+from io import BytesIO
+
+import numpy as np
+from PIL import Image
+
+try:
+    import lz4.block as _lz4_block
+except ImportError:
+    _lz4_block = None
+try:
+    import qoi as _qoi
+except ImportError:
+    _qoi = None
+_missing = [name for name, module in (('lz4', _lz4_block), ('qoi', _qoi)) if module is None]
+if _missing:
+    warnings.warn('%s planes are decoded in pure Python, which is very slow. pip install %s'
+                  % (' and '.join(name.upper() for name in _missing), ' '.join(_missing)), RuntimeWarning)
+
+MAGIC = b'MWFR'
+VERSION = 8
+
+HEADER = struct.Struct('<4sHHQdHHHBx32s')
+PLANE_ENTRY = struct.Struct('<IIHHBBBB')
+SECTION_ENTRY = struct.Struct('<18sBBIII')
+STRIP_HEADER = struct.Struct('<HH')
+# FrameWire::FDeltaInfo: plane, keyframe, tile size, dirty tiles, reference frame id
+DELTA_INFO = struct.Struct('<BBHIQ')
+# FrameWire::FObservationInfo: width, height, channels, layout, precision, reserved, RGB mean, RGB std
+OBSERVATION_INFO = struct.Struct('<HHBBBx3f3f')
+
+PLANE_SEGMENTATION_MARKS = 0
+PLANE_COLOR = 1
+PLANE_CLASS_IDS = 2
+PLANE_DEPTH = 3
+# R16 instance id of every pixel, 0 for background
+PLANE_INSTANCE_IDS = 4
+
+PIXEL_FORMAT_BGRA8 = 0
+PIXEL_FORMAT_R8 = 1
+# depth in uint16 millimetres, DEPTH_NO_HIT beyond 65.5 m
+PIXEL_FORMAT_R16 = 2
+# depth in half float metres
+PIXEL_FORMAT_R16F = 3
+
+DEPTH_NO_HIT = 65535
+
+PLANE_RAW = 0
+PLANE_PNG = 1
+# LZ4 block of each strip's bytes grouped by channel
+PLANE_LZ4 = 2
+# QOI image of each strip, BGRA8 pixels with B in the R channel
+PLANE_QOI = 3
+PLANE_JPEG = 4
+
+SECTION_POINTS = 0
+SECTION_SPANS = 1
+SECTION_REGIONS = 2
+SECTION_DEPTH_STATS = 3
+SECTION_VIEW = 4
+SECTION_DELTA = 5
+SECTION_OBSERVATION = 6
+SECTION_STREAM = 7
+SECTION_INSTANCES = 8
+
+OBSERVATION_NCHW = 0
+OBSERVATION_NHWC = 1
+
+# FMaskSpan and FMaskRegion in Source/Mower3/Public/SegmentationClassifier.h
+SPAN = np.dtype([('y', '<u2'), ('x', '<u2'), ('length', '<u2')])
+REGION = np.dtype([('min_x', '<u2'), ('min_y', '<u2'), ('max_x', '<u2'), ('max_y', '<u2'), ('area', '<u4'),
+                   ('centroid_x', '<f4'), ('centroid_y', '<f4')])
+# FClassDepthStats, distances in millimetres
+DEPTH_STATS = np.dtype([('pixels', '<u4'), ('min_mm', '<u2'), ('mean_mm', '<u2'), ('percentile_mm', '<u2'),
+                        ('nearest_x', '<u2'), ('nearest_y', '<u2'), ('percentile', 'u1'), ('reserved', 'u1')])
+# FInstanceStats, pixel count and inclusive bounds of one actor
+INSTANCE = np.dtype([('instance_id', '<u2'), ('class_id', 'u1'), ('reserved', 'u1'), ('min_x', '<u2'),
+                     ('min_y', '<u2'), ('max_x', '<u2'), ('max_y', '<u2'), ('pixels', '<u4')])
+# FrameWire::FViewInfo, where a sensor rig view was taken from relative to the rig, centimetres and degrees
+VIEW = np.dtype([('view', 'u1'), ('capture_source', 'u1'), ('rate_divisor', '<u2'), ('fov', '<f4'),
+                 ('location', '<f4', 3), ('rotation', '<f4', 3)])
+# FrameWire::FStreamInfo, a lower resolution stream of the main camera
+STREAM = np.dtype([('view', 'u1'), ('downsample', 'u1'), ('rate_divisor', '<u2')])
+
+
+def _read_name(raw):
+    return raw.split(b'\0', 1)[0].decode('utf-8', errors='replace')
+
+
+def decode_frame(buf):
+    """
+    Returns a dict with the header fields, 'planes' (list of dicts with kind, view, pixel_format, encoding, width,
+    height and the bytes-like payload in data), 'sections' (tag -> (n, 2) uint16 array of x, y pixel coordinates) and
+    'masks' (tag -> dict with 'spans', a SPAN array of row-wise runs, and 'regions', a REGION array holding the whole
+    mask then its connected components) and 'class_ids' (tag -> class id, the value of the tag's pixels in a class id
+    plane). A frame has either sections or masks, depending on the simulator's MaskEncoding. 'depth' maps tags to a
+    DEPTH_STATS record when the simulator captures depth. 'views' maps sensor names to a VIEW record, its 'view'
+    field is the view of the sensor's planes. View 0 is the main camera, whose planes are missing from the frames the
+    simulator's FullResolutionRateDivisor skips. 'streams' maps stream names to a STREAM record, its 'view' field is
+    the view of the stream's planes, the main camera's shrunk by 'downsample'. 'deltas' maps plane indices to a dict
+    with 'keyframe', 'tile_size', 'reference_frame_id' and for delta planes 'tiles', a (tiles_y, tiles_x) bool array
+    of the tiles the plane carries. The other pixels of a delta plane are zero, see FrameDecoder. 'observation' is the
+    normalized RGB model input tensor, (3, height, width) or (height, width, 3) float16 or float32, or None, and
+    'observation_info' a dict with its 'layout', 'mean' and 'std'. 'instances' is an INSTANCE array sorted by instance
+    id, the actors seen in the PLANE_INSTANCE_IDS plane, or None when the simulator's instance segmentation is off.
+    Raises ValueError on a malformed frame. Planes and sections are views into buf, nothing is copied.
+    """
+    buf = memoryview(buf)
+    if len(buf) < HEADER.size:
+        raise ValueError('frame too short')
+    (magic, version, header_size, frame_id, timestamp, width, height,
+     num_sections, num_planes, instance_name) = HEADER.unpack_from(buf, 0)
+    if magic != MAGIC:
+        raise ValueError('bad frame magic')
+    if version != VERSION:
+        raise ValueError('unsupported frame version %d' % version)
+    if header_size + num_planes * PLANE_ENTRY.size + num_sections * SECTION_ENTRY.size > len(buf):
+        raise ValueError('frame too short')
+
+    offset = header_size
+    planes = []
+    for _ in range(num_planes):
+        (plane_offset, plane_size, plane_width, plane_height, kind, pixel_format,
+         encoding, view) = PLANE_ENTRY.unpack_from(buf, offset)
+        offset += PLANE_ENTRY.size
+        if plane_offset + plane_size > len(buf):
+            raise ValueError('plane out of bounds')
+        planes.append({
+            'kind': kind,
+            'view': view,
+            'pixel_format': pixel_format,
+            'encoding': encoding,
+            'width': plane_width,
+            'height': plane_height,
+            'data': buf[plane_offset:plane_offset + plane_size],
+        })
+
+    sections = {}
+    masks = {}
+    depth = {}
+    views = {}
+    streams = {}
+    class_ids = {}
+    deltas = {}
+    observation = None
+    observation_info = None
+    instances = None
+    for _ in range(num_sections):
+        tag, class_id, kind, section_offset, section_size, count = SECTION_ENTRY.unpack_from(buf, offset)
+        offset += SECTION_ENTRY.size
+        if section_offset + section_size > len(buf):
+            raise ValueError('section out of bounds')
+        if kind == SECTION_DELTA:
+            deltas.update(_decode_delta(buf, section_offset, section_size, count, planes))
+            continue
+        if kind == SECTION_OBSERVATION:
+            observation, observation_info = _decode_observation(buf, section_offset, section_size, count)
+            continue
+        item_size = {SECTION_POINTS: 4, SECTION_SPANS: SPAN.itemsize, SECTION_REGIONS: REGION.itemsize,
+                     SECTION_DEPTH_STATS: DEPTH_STATS.itemsize, SECTION_VIEW: VIEW.itemsize,
+                     SECTION_STREAM: STREAM.itemsize, SECTION_INSTANCES: INSTANCE.itemsize}.get(kind)
+        if item_size is None:
+            continue
+        if count * item_size > section_size:
+            raise ValueError('section out of bounds')
+        tag = _read_name(tag)
+        if kind == SECTION_VIEW:
+            views[tag] = np.frombuffer(buf, dtype=VIEW, count=1, offset=section_offset)[0]
+            continue
+        if kind == SECTION_STREAM:
+            streams[tag] = np.frombuffer(buf, dtype=STREAM, count=1, offset=section_offset)[0]
+            continue
+        if kind == SECTION_INSTANCES:
+            instances = np.frombuffer(buf, dtype=INSTANCE, count=count, offset=section_offset)
+            continue
+        class_ids[tag] = class_id
+        if kind == SECTION_POINTS:
+            points = np.frombuffer(buf, dtype='<u2', count=count * 2, offset=section_offset)
+            sections[tag] = points.reshape(count, 2)
+        elif kind == SECTION_DEPTH_STATS:
+            depth[tag] = np.frombuffer(buf, dtype=DEPTH_STATS, count=1, offset=section_offset)[0]
+        elif kind == SECTION_SPANS:
+            masks.setdefault(tag, {})['spans'] = np.frombuffer(buf, dtype=SPAN, count=count, offset=section_offset)
+        else:
+            masks.setdefault(tag, {})['regions'] = np.frombuffer(buf, dtype=REGION, count=count, offset=section_offset)
+
+    return {
+        'frame_id': frame_id,
+        'timestamp': timestamp,
+        'instance_name': _read_name(instance_name),
+        'width': width,
+        'height': height,
+        'planes': planes,
+        'sections': sections,
+        'masks': masks,
+        'depth': depth,
+        'views': views,
+        'streams': streams,
+        'class_ids': class_ids,
+        'deltas': deltas,
+        'observation': observation,
+        'observation_info': observation_info,
+        'instances': instances,
+    }
+
+
+def _decode_delta(buf, offset, size, count, planes):
+    """{plane index: delta dict} of one Delta section"""
+    if size < DELTA_INFO.size:
+        raise ValueError('section out of bounds')
+    plane, keyframe, tile_size, dirty_tiles, reference_frame_id = DELTA_INFO.unpack_from(buf, offset)
+    if plane >= len(planes) or tile_size == 0:
+        raise ValueError('bad delta section')
+    delta = {'keyframe': bool(keyframe), 'tile_size': tile_size, 'reference_frame_id': reference_frame_id}
+    if not keyframe:
+        tiles_x = -(-planes[plane]['width'] // tile_size)
+        tiles_y = -(-planes[plane]['height'] // tile_size)
+        if count != tiles_x * tiles_y or DELTA_INFO.size + -(-count // 8) > size:
+            raise ValueError('bad delta section')
+        bitmap = np.frombuffer(buf, dtype=np.uint8, count=-(-count // 8), offset=offset + DELTA_INFO.size)
+        delta['tiles'] = np.unpackbits(bitmap, bitorder='little')[:count].astype(bool).reshape(tiles_y, tiles_x)
+    return {plane: delta}
+
+
+def _decode_observation(buf, offset, size, count):
+    """(tensor, info) of an Observation section"""
+    if size < OBSERVATION_INFO.size:
+        raise ValueError('section out of bounds')
+    width, height, channels, layout, precision, *normalization = OBSERVATION_INFO.unpack_from(buf, offset)
+    dtype = np.dtype('<f2' if precision == 0 else '<f4')
+    if count != width * height * channels or OBSERVATION_INFO.size + count * dtype.itemsize > size:
+        raise ValueError('bad observation section')
+    tensor = np.frombuffer(buf, dtype=dtype, count=count, offset=offset + OBSERVATION_INFO.size)
+    shape = (channels, height, width) if layout == OBSERVATION_NCHW else (height, width, channels)
+    info = {'layout': layout, 'mean': tuple(normalization[:3]), 'std': tuple(normalization[3:])}
+    return tensor.reshape(shape), info
+
+
+def spans_to_mask(spans, width, height):
+    """Returns the (height, width) bool mask covered by a SPAN array, the inverse of the simulator's encoding"""
+    mask = np.zeros(height * width, dtype=bool)
+    if len(spans) == 0:
+        return mask.reshape(height, width)
+    y = spans['y'].astype(np.int64)
+    x = spans['x'].astype(np.int64)
+    length = spans['length'].astype(np.int64)
+    if (y >= height).any() or (x + length > width).any():
+        raise ValueError('span out of bounds')
+    # index of every covered pixel: each span's start repeated over its length plus the position within the span
+    starts = np.repeat(y * width + x - np.cumsum(length) + length, length)
+    mask[starts + np.arange(length.sum())] = True
+    return mask.reshape(height, width)
+
+
+def masks_to_class_ids(frame):
+    """Rebuilds the (height, width) uint8 class id image from the masks of a decoded frame"""
+    class_ids = np.zeros((frame['height'], frame['width']), dtype=np.uint8)
+    for tag, mask in frame['masks'].items():
+        class_ids[spans_to_mask(mask['spans'], frame['width'], frame['height'])] = frame['class_ids'][tag]
+    return class_ids
+
+
+def find_plane(frame, kind, view=0):
+    """Returns the index of the first plane of kind in view, or None"""
+    for index, plane in enumerate(frame['planes']):
+        if plane['kind'] == kind and plane['view'] == view:
+            return index
+    return None
+
+
+def _bytes_per_pixel(pixel_format):
+    return {PIXEL_FORMAT_BGRA8: 4, PIXEL_FORMAT_R8: 1}.get(pixel_format, 2)
+
+
+def _strips(plane):
+    """Yields (rows, data) of each strip of a plane that isn't raw, see FrameWire::FStripHeader"""
+    data = plane['data']
+    if len(data) < STRIP_HEADER.size:
+        raise ValueError('plane too short')
+    num_strips, rows_per_strip = STRIP_HEADER.unpack_from(data, 0)
+    if rows_per_strip == 0 or -(-plane['height'] // rows_per_strip) != num_strips:
+        raise ValueError('bad strip header')
+    offset = STRIP_HEADER.size + 4 * num_strips
+    if offset > len(data):
+        raise ValueError('plane too short')
+    sizes = struct.unpack_from('<%dI' % num_strips, data, STRIP_HEADER.size)
+    for i, size in enumerate(sizes):
+        if offset + size > len(data):
+            raise ValueError('strip out of bounds')
+        yield min(rows_per_strip, plane['height'] - i * rows_per_strip), data[offset:offset + size]
+        offset += size
+
+
+def _lz4_decompress(data, size):
+    if _lz4_block is not None:
+        return _lz4_block.decompress(data, uncompressed_size=size)
+    data = bytes(data)
+    out = bytearray()
+    pos = 0
+    while pos < len(data):
+        token = data[pos]
+        pos += 1
+        length = token >> 4
+        if length == 15:
+            while True:
+                byte = data[pos]
+                pos += 1
+                length += byte
+                if byte != 255:
+                    break
+        out += data[pos:pos + length]
+        pos += length
+        if pos >= len(data):
+            break
+        offset = data[pos] | data[pos + 1] << 8
+        pos += 2
+        length = token & 15
+        if length == 15:
+            while True:
+                byte = data[pos]
+                pos += 1
+                length += byte
+                if byte != 255:
+                    break
+        length += 4
+        if offset == 0 or offset > len(out):
+            raise ValueError('bad lz4 match offset')
+        start = len(out) - offset
+        for i in range(length):
+            out.append(out[start + i])
+    if len(out) != size:
+        raise ValueError('lz4 strip decompressed to %d bytes, expected %d' % (len(out), size))
+    return bytes(out)
+
+
+def _qoi_decode(data, width, height):
+    """The pixels of a QOI image as bytes, in the image's channel order"""
+    data = bytes(data)
+    if len(data) < 22 or data[:4] != b'qoif' or struct.unpack_from('>II', data, 4) != (width, height):
+        raise ValueError('bad qoi strip')
+    out = bytearray(width * height * 4)
+    index = [(0, 0, 0, 0)] * 64
+    r, g, b, a = 0, 0, 0, 255
+    pos = 14
+    end = len(data) - 8
+    run = 0
+    for pixel in range(0, len(out), 4):
+        if run > 0:
+            run -= 1
+        elif pos < end:
+            op = data[pos]
+            pos += 1
+            if op == 0xFE:
+                r, g, b = data[pos:pos + 3]
+                pos += 3
+            elif op == 0xFF:
+                r, g, b, a = data[pos:pos + 4]
+                pos += 4
+            elif op >> 6 == 0:
+                r, g, b, a = index[op]
+            elif op >> 6 == 1:
+                r = (r + (op >> 4 & 3) - 2) & 255
+                g = (g + (op >> 2 & 3) - 2) & 255
+                b = (b + (op & 3) - 2) & 255
+            elif op >> 6 == 2:
+                second = data[pos]
+                pos += 1
+                dg = (op & 0x3F) - 32
+                r = (r + dg - 8 + (second >> 4)) & 255
+                g = (g + dg) & 255
+                b = (b + dg - 8 + (second & 0x0F)) & 255
+            else:
+                run = op & 0x3F
+            index[(r * 3 + g * 5 + b * 7 + a * 11) % 64] = (r, g, b, a)
+        else:
+            raise ValueError('qoi strip too short')
+        out[pixel:pixel + 4] = bytes((r, g, b, a))
+    return bytes(out)
+
+
+def _decode_strip(encoding, pixel_format, width, rows, data):
+    """One strip as an array like plane_to_array returns"""
+    if encoding in (PLANE_PNG, PLANE_JPEG):
+        image = Image.open(BytesIO(data))
+        if pixel_format == PIXEL_FORMAT_R8:
+            return np.asarray(image.convert('L'))
+        if pixel_format in (PIXEL_FORMAT_R16, PIXEL_FORMAT_R16F):
+            # 16 bit grayscale, half floats are stored bit for bit
+            pixels = np.asarray(image).astype(np.uint16)
+            return pixels.view(np.float16) if pixel_format == PIXEL_FORMAT_R16F else pixels
+        return np.asarray(image.convert('RGBA'))
+    bytes_per_pixel = _bytes_per_pixel(pixel_format)
+    if encoding == PLANE_QOI:
+        raw = _qoi.decode(bytes(data)).tobytes() if _qoi is not None else _qoi_decode(data, width, rows)
+    elif encoding == PLANE_LZ4:
+        grouped = np.frombuffer(_lz4_decompress(data, width * rows * bytes_per_pixel), dtype=np.uint8)
+        raw = grouped.reshape(bytes_per_pixel, width * rows).T.tobytes()
+    else:
+        raise ValueError('unsupported plane encoding %d' % encoding)
+    return _raw_to_array(raw, pixel_format, width, rows)
+
+
+def _raw_to_array(data, pixel_format, width, height):
+    if pixel_format in (PIXEL_FORMAT_R16, PIXEL_FORMAT_R16F):
+        dtype = '<f2' if pixel_format == PIXEL_FORMAT_R16F else '<u2'
+        return np.frombuffer(data, dtype=dtype).reshape(height, width)
+    pixels = np.frombuffer(data, dtype=np.uint8)
+    if pixel_format == PIXEL_FORMAT_R8:
+        return pixels.reshape(height, width)
+    if pixel_format == PIXEL_FORMAT_BGRA8:
+        return pixels.reshape(height, width, 4)[..., [2, 1, 0, 3]]
+    raise ValueError('unsupported pixel format %d' % pixel_format)
+
+
+def plane_to_array(frame, index):
+    """
+    Returns plane index of a decoded frame as a numpy array, (h, w) uint8 for R8 planes, (h, w) uint16 for R16,
+    (h, w) float16 for R16F and (h, w, 4) uint8 in RGBA order for BGRA8 planes
+    """
+    plane = frame['planes'][index]
+    if 'array' in plane:
+        return plane['array']
+    if plane['encoding'] == PLANE_RAW:
+        return _raw_to_array(plane['data'], plane['pixel_format'], plane['width'], plane['height'])
+    strips = [_decode_strip(plane['encoding'], plane['pixel_format'], plane['width'], rows, data)
+              for rows, data in _strips(plane)]
+    return strips[0] if len(strips) == 1 else np.concatenate(strips)
+
+
+def plane_to_image(frame, index):
+    """Returns plane index of a decoded frame as a PIL image, 'L' for R8, 'I;16' for R16 and 'RGBA' for BGRA8 planes"""
+    if frame['planes'][index]['pixel_format'] == PIXEL_FORMAT_R16F:
+        raise ValueError('half float planes have no image mode, use plane_to_array')
+    # pillow picks the mode from the array's shape and dtype
+    return Image.fromarray(np.ascontiguousarray(plane_to_array(frame, index)))
+
+
+class FrameDecoder:
+    """
+    Rebuilds the whole planes of a stream of frames with delta planes. Frames have to be decoded in the order they
+    were sent, one decoder per simulator instance.
+    """
+
+    def __init__(self):
+        # (kind, view) -> (frame id, array)
+        self.references = {}
+
+    def decode(self, frame):
+        """
+        Returns a copy of a decoded frame whose planes hold the whole image as 'array', which plane_to_array returns,
+        and 'deltas' empty. Returns None if a delta plane's reference is missing, because frames were lost since the
+        last keyframe or decoding started between two keyframes, the frames up to the next keyframe will fail too.
+        """
+        planes = []
+        for index, plane in enumerate(frame['planes']):
+            array = plane_to_array(frame, index)
+            delta = frame['deltas'].get(index)
+            key = (plane['kind'], plane['view'])
+            if delta is not None and not delta['keyframe']:
+                reference_id, reference = self.references.get(key, (None, None))
+                if reference_id != delta['reference_frame_id'] or reference.shape != array.shape:
+                    return None
+                size = delta['tile_size']
+                mask = np.repeat(np.repeat(delta['tiles'], size, axis=0), size, axis=1)
+                mask = mask[:plane['height'], :plane['width']]
+                array = np.where(mask[..., None] if array.ndim == 3 else mask, array, reference)
+            # arrays of raw planes are views into the frame's buffer, which may be reused
+            array = np.array(array)
+            if delta is not None:
+                self.references[key] = (frame['frame_id'], array)
+            planes.append(dict(plane, encoding=PLANE_RAW, data=None, array=array))
+        observation = frame['observation']
+        if observation is not None:
+            observation = np.array(observation)
+        return dict(frame, planes=planes, deltas={}, observation=observation)
+
+    def reset(self):
+        self.references.clear()
+
+
+class ObservationBatch:
+    """
+    The latest observation of every simulator instance, in one preallocated (max_instances, ...) array, so a model
+    can run on all instances at once without gathering their tensors first. Instances get the rows in the order their
+    first observation arrives.
+    """
+
+    def __init__(self, max_instances):
+        self.max_instances = max_instances
+        # instance name -> row
+        self.rows = {}
+        self.array = None
+        self.frame_ids = np.zeros(max_instances, dtype=np.uint64)
+
+    def add(self, frame):
+        """
+        Copies the observation of a decoded frame into its instance's row. Returns False if the frame has none, its
+        shape or precision differs from the first one's, or every row is taken.
+        """
+        observation = frame.get('observation')
+        if observation is None:
+            return False
+        if self.array is None:
+            self.array = np.zeros((self.max_instances,) + observation.shape, dtype=observation.dtype)
+        elif self.array.shape[1:] != observation.shape or self.array.dtype != observation.dtype:
+            return False
+        row = self.rows.get(frame['instance_name'])
+        if row is None:
+            if len(self.rows) == self.max_instances:
+                return False
+            row = self.rows[frame['instance_name']] = len(self.rows)
+        self.array[row] = observation
+        self.frame_ids[row] = frame['frame_id']
+        return True
+
+    def batch(self):
+        """View of the rows of the instances seen so far, None before the first observation"""
+        if self.array is None:
+            return None
+        return self.array[:len(self.rows)]
@@ -0,0 +1,267 @@
+"""
+Reader for the recordings the simulator writes when UCaptureManager.bRecord is set, through the C ABI of
+Source/Mower3/Public/RecordingReader.h. Build the library with Tools/RecordingReader/CMakeLists.txt, or point
+MOWER_RECORDING_LIB at it. The file layout is only parsed there, see Source/Mower3/Public/FrameRecorder.h.
+Records, frames, planes and entries are views into the mapped file, valid until the reader is closed. Nothing is
+copied until a plane has to be decoded.
+"""
+
+import ctypes
+import os
+import sys
+from concurrent.futures import ProcessPoolExecutor
+
+import numpy as np
+
+from frame_format import decode_frame, find_plane, plane_to_array, FrameDecoder, PIXEL_FORMAT_BGRA8, PIXEL_FORMAT_R8, \
+    PIXEL_FORMAT_R16, PIXEL_FORMAT_R16F, PLANE_RAW
+
+_LIBRARY_NAMES = {'win32': ['mower_recording.dll', 'Release/mower_recording.dll'],
+                  'darwin': ['libmower_recording.dylib']}
+_BUILD_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..', 'Tools', 'RecordingReader',
+                          'Build')
+
+MWREC_OK = 0
+MWREC_ERROR_RANGE = 3
+
+RECORD_FRAME = 0
+RECORD_VEHICLE_STATE = 1
+RECORD_ACTION = 2
+
+# FrameRecording::FIndexEntry
+INDEX_ENTRY = np.dtype([('offset', '<u8'), ('frame_id', '<u8'), ('timestamp', '<f8'), ('size', '<u4'), ('kind', 'u1'),
+                        ('reserved', 'u1', 3)])
+# FrameRecording::FVehicleState, world space centimetres and degrees
+VEHICLE_STATE = np.dtype([('location', '<f4', 3), ('rotation', '<f4', 3), ('velocity', '<f4', 3),
+                          ('angular_velocity', '<f4', 3), ('left_throttle', '<f4'), ('right_throttle', '<f4')])
+# FrameRecording::FAction
+ACTION = np.dtype([('left_throttle', '<f4'), ('right_throttle', '<f4')])
+
+
+class _Record(ctypes.Structure):
+    _fields_ = [('frame_id', ctypes.c_uint64), ('timestamp', ctypes.c_double),
+                ('data', ctypes.POINTER(ctypes.c_uint8)), ('size', ctypes.c_uint64)]
+
+
+class _Plane(ctypes.Structure):
+    _fields_ = [('data', ctypes.POINTER(ctypes.c_uint8)), ('size', ctypes.c_uint64), ('width', ctypes.c_uint32),
+                ('height', ctypes.c_uint32), ('kind', ctypes.c_uint8), ('pixel_format', ctypes.c_uint8),
+                ('encoding', ctypes.c_uint8), ('view', ctypes.c_uint8)]
+
+
+def _load_library():
+    path = os.environ.get('MOWER_RECORDING_LIB')
+    if not path:
+        names = _LIBRARY_NAMES.get(sys.platform, ['libmower_recording.so'])
+        candidates = [os.path.join(_BUILD_DIR, name) for name in names]
+        path = next((candidate for candidate in candidates if os.path.exists(candidate)), candidates[0])
+    lib = ctypes.CDLL(path)
+    reader_p = ctypes.c_void_p
+    u64_p = ctypes.POINTER(ctypes.c_uint64)
+    signatures = {
+        'mwrec_open': (ctypes.c_int, [ctypes.c_char_p, ctypes.POINTER(reader_p)]),
+        'mwrec_close': (None, [reader_p]),
+        'mwrec_is_complete': (ctypes.c_int, [reader_p]),
+        'mwrec_start_time': (ctypes.c_double, [reader_p]),
+        'mwrec_instance_name': (ctypes.c_char_p, [reader_p]),
+        'mwrec_count': (ctypes.c_uint64, [reader_p, ctypes.c_int]),
+        'mwrec_entries': (ctypes.c_void_p, [reader_p, ctypes.c_int]),
+        'mwrec_get': (ctypes.c_int, [reader_p, ctypes.c_int, ctypes.c_uint64, ctypes.POINTER(_Record)]),
+        'mwrec_time_range': (None, [reader_p, ctypes.c_int, ctypes.c_double, ctypes.c_double, u64_p, u64_p]),
+        'mwrec_find_frame': (ctypes.c_int, [reader_p, ctypes.c_int, ctypes.c_uint64, u64_p]),
+        'mwrec_shard': (None, [ctypes.c_uint64, ctypes.c_uint32, ctypes.c_uint32, u64_p, u64_p]),
+        'mwrec_find_plane': (ctypes.c_int, [ctypes.POINTER(ctypes.c_uint8), ctypes.c_uint64, ctypes.c_uint8,
+                                            ctypes.c_uint8, ctypes.POINTER(_Plane)]),
+        'mwrec_error_string': (ctypes.c_char_p, [ctypes.c_int]),
+    }
+    for name, (restype, argtypes) in signatures.items():
+        function = getattr(lib, name)
+        function.restype = restype
+        function.argtypes = argtypes
+    return lib
+
+
+_lib = None
+
+
+def _library():
+    global _lib
+    if _lib is None:
+        _lib = _load_library()
+    return _lib
+
+
+def _view(pointer, size):
+    """A read-only memoryview of size bytes at pointer, no copy"""
+    if size == 0:
+        return memoryview(b'')
+    return memoryview((ctypes.c_uint8 * size).from_address(ctypes.addressof(pointer.contents))).toreadonly()
+
+
+def shard(count, index, num_shards):
+    """The range of shard index when count records are split into num_shards contiguous shards"""
+    first, n = ctypes.c_uint64(), ctypes.c_uint64()
+    _library().mwrec_shard(count, index, num_shards, ctypes.byref(first), ctypes.byref(n))
+    return range(first.value, first.value + n.value)
+
+
+class RecordingReader:
+    """
+    A recording mapped by the native reader. Records of each kind are numbered in timestamp order, entries(kind) is
+    their INDEX_ENTRY array. Safe to share between threads, processes should open their own reader.
+    """
+
+    def __init__(self, path):
+        self.lib = _library()
+        self.path = path
+        self.handle = ctypes.c_void_p()
+        error = self.lib.mwrec_open(os.fsencode(path), ctypes.byref(self.handle))
+        if error != MWREC_OK:
+            raise ValueError('%s: %s' % (path, self.lib.mwrec_error_string(error).decode()))
+        self.complete = bool(self.lib.mwrec_is_complete(self.handle))
+        self.start_time = self.lib.mwrec_start_time(self.handle)
+        self.instance_name = self.lib.mwrec_instance_name(self.handle).decode('utf-8', errors='replace')
+
+    def count(self, kind=RECORD_FRAME):
+        return self.lib.mwrec_count(self.handle, kind)
+
+    def __len__(self):
+        return self.count(RECORD_FRAME)
+
+    def entries(self, kind):
+        """INDEX_ENTRY array of every record of kind, a view of the reader's index"""
+        count = self.count(kind)
+        if count == 0:
+            return np.empty(0, dtype=INDEX_ENTRY)
+        address = self.lib.mwrec_entries(self.handle, kind)
+        buf = (ctypes.c_uint8 * (count * INDEX_ENTRY.itemsize)).from_address(address)
+        return np.frombuffer(buf, dtype=INDEX_ENTRY)
+
+    def record(self, index, kind=RECORD_FRAME):
+        """(frame id, timestamp, payload memoryview) of record index of kind"""
+        record = _Record()
+        if self.lib.mwrec_get(self.handle, kind, index, ctypes.byref(record)) != MWREC_OK:
+            raise IndexError(index)
+        return record.frame_id, record.timestamp, _view(record.data, record.size)
+
+    def frame(self, index):
+        """Frame index decoded with frame_format.decode_frame, its planes are views into the file"""
+        return decode_frame(self.record(index)[2])
+
+    def find(self, frame_id, kind=RECORD_FRAME):
+        """Index of the record of kind with frame_id, or None"""
+        index = ctypes.c_uint64()
+        if self.lib.mwrec_find_frame(self.handle, kind, frame_id, ctypes.byref(index)) != MWREC_OK:
+            return None
+        return index.value
+
+    def time_range(self, begin, end, kind=RECORD_FRAME):
+        """The range of indices of the records of kind with begin <= timestamp < end"""
+        first, n = ctypes.c_uint64(), ctypes.c_uint64()
+        self.lib.mwrec_time_range(self.handle, kind, begin, end, ctypes.byref(first), ctypes.byref(n))
+        return range(first.value, first.value + n.value)
+
+    def shard(self, index, num_shards, kind=RECORD_FRAME):
+        return shard(self.count(kind), index, num_shards)
+
+    def plane(self, index, kind, view=0):
+        """
+        The first plane of kind in view of frame index as an array like frame_format.plane_to_array, or None. Raw
+        planes are returned as views into the file, BGRA8 planes in BGRA order. Delta planes are rebuilt from the
+        frames since the last keyframe, see whole_frames.
+        """
+        record = _Record()
+        if self.lib.mwrec_get(self.handle, RECORD_FRAME, index, ctypes.byref(record)) != MWREC_OK:
+            raise IndexError(index)
+        plane = _Plane()
+        error = self.lib.mwrec_find_plane(record.data, record.size, kind, view, ctypes.byref(plane))
+        if error == MWREC_ERROR_RANGE:
+            return None
+        if error != MWREC_OK:
+            raise ValueError('frame %d: %s' % (index, self.lib.mwrec_error_string(error).decode()))
+        frame = decode_frame(_view(record.data, record.size))
+        plane_index = find_plane(frame, kind, view)
+        delta = frame['deltas'].get(plane_index)
+        if delta is not None and not delta['keyframe']:
+            for _, whole in self.whole_frames(range(index, index + 1)):
+                return plane_to_array(whole, plane_index)
+            raise ValueError('frame %d: the delta plane can not be rebuilt' % index)
+        if plane.encoding != PLANE_RAW:
+            return plane_to_array(frame, plane_index)
+        data = _view(plane.data, plane.size)
+        shape = (plane.height, plane.width)
+        if plane.pixel_format == PIXEL_FORMAT_R8:
+            return np.frombuffer(data, dtype=np.uint8).reshape(shape)
+        if plane.pixel_format in (PIXEL_FORMAT_R16, PIXEL_FORMAT_R16F):
+            dtype = '<f2' if plane.pixel_format == PIXEL_FORMAT_R16F else '<u2'
+            return np.frombuffer(data, dtype=dtype).reshape(shape)
+        if plane.pixel_format == PIXEL_FORMAT_BGRA8:
+            return np.frombuffer(data, dtype=np.uint8).reshape(plane.height, plane.width, 4)
+        raise ValueError('unsupported pixel format %d' % plane.pixel_format)
+
+    def frames(self, indices=None):
+        """Yields (index, decoded frame) for indices, a range from time_range or shard, or every frame"""
+        for index in indices if indices is not None else range(len(self)):
+            yield index, self.frame(index)
+
+    def whole_frames(self, indices=None):
+        """
+        Like frames, with the delta planes rebuilt by a frame_format.FrameDecoder. Decoding starts at the last frame
+        without delta planes before indices, frames that can't be rebuilt because a record was dropped are skipped.
+        """
+        indices = indices if indices is not None else range(len(self))
+        if len(indices) == 0:
+            return
+        first = indices[0]
+        while first > 0 and any(not delta['keyframe'] for delta in self.frame(first)['deltas'].values()):
+            first -= 1
+        decoder = FrameDecoder()
+        for index in range(first, indices[-1] + 1):
+            frame = decoder.decode(self.frame(index))
+            if frame is not None and index in indices:
+                yield index, frame
+
+    def _records(self, kind, dtype):
+        entries = self.entries(kind)
+        records = np.empty(len(entries), dtype=dtype)
+        for i in range(len(entries)):
+            records[i] = np.frombuffer(self.record(i, kind)[2], dtype=dtype, count=1)[0]
+        return entries['frame_id'], records
+
+    def vehicle_states(self):
+        """Returns (frame ids, VEHICLE_STATE array), the state of the vehicle when each frame was captured"""
+        return self._records(RECORD_VEHICLE_STATE, VEHICLE_STATE)
+
+    def actions(self):
+        """Returns (frame ids, ACTION array), the throttles the server answered each frame with"""
+        return self._records(RECORD_ACTION, ACTION)
+
+    def close(self):
+        if self.handle:
+            self.lib.mwrec_close(self.handle)
+            self.handle = ctypes.c_void_p()
+
+    def __del__(self):
+        self.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+
+def _run_shard(path, index, num_shards, function):
+    with RecordingReader(path) as reader:
+        return function(reader, reader.shard(index, num_shards))
+
+
+def map_shards(path, function, num_shards=None):
+    """
+    Calls function(reader, indices) for num_shards contiguous shards of the frames of a recording, each in its own
+    process with its own reader, and returns the results in shard order. function must be picklable.
+    """
+    num_shards = num_shards or os.cpu_count() or 1
+    with ProcessPoolExecutor(max_workers=num_shards) as executor:
+        futures = [executor.submit(_run_shard, path, index, num_shards, function) for index in range(num_shards)]
+        return [future.result() for future in futures]
@@ -1,16 +1,25 @@
 import base64
+import logging
 from io import BytesIO
 
+import numpy as np
 from PIL import Image
 from flask import Flask
 from flask_socketio import SocketIO
 from flask_celery import make_celery
+from frame_format import (decode_frame, find_plane, plane_to_image, FrameDecoder, ObservationBatch, PLANE_CLASS_IDS,
+                          PLANE_COLOR, PLANE_SEGMENTATION_MARKS, PLANE_DEPTH, plane_to_array)
+from shm_ring import FrameRing
 
 # need monkey patch for message queue: https://flask-socketio.readthedocs.io/en/latest/deployment.html#using-multiple-workers
 import eventlet
+from eventlet import tpool
 
 eventlet.monkey_patch()
 
+# the per frame summaries are logged at DEBUG, e.g. logging.basicConfig(level=logging.DEBUG) to see them
+logger = logging.getLogger(__name__)
+
 app = Flask(__name__)
 app.config['SECRET_KEY'] = 'there is no secret'
 
@@ -36,27 +45,172 @@ def process_image(payload):
     file_name_1 = name1 + '.png'
     file_name_2 = name2 + '.png'
 
-    arr = payload['arr2']
-    print(len(arr))
-    i = 0
-    vals = []
-    print(arr[0], arr[int(arr[0])+1])
-    # print('start')
-    while i < len(arr):
-        s = int(arr[i])
-        sli = arr[i: s+1]
-        vals.append(sli)
-        i+=s+1
-    # print('end')
-    print(len(vals))
-    print(len(vals[0]) + len(vals[1]))
-    print(len(vals[1]))
-
-    process_image_task.delay(encoded_image_data_1, file_name_1, encoded_image_data_2, file_name_2)
+    if 'masks' in payload:
+        if logger.isEnabledFor(logging.DEBUG):
+            for tag, mask in payload['masks'].items():
+                regions = mask['regions']
+                logger.debug('%s %d spans %d pixels %d components', tag, len(mask['spans']) // 3, regions[0]['area'],
+                             len(regions) - 1)
+    else:
+        arr = payload['arr2']
+        print(len(arr))
+        i = 0
+        vals = []
+        print(arr[0], arr[int(arr[0])+1])
+        # print('start')
+        while i < len(arr):
+            s = int(arr[i])
+            sli = arr[i: s+1]
+            vals.append(sli)
+            i+=s+1
+        # print('end')
+        print(len(vals))
+        print(len(vals[0]) + len(vals[1]))
+        print(len(vals[1]))
+
+    process_image_task.delay(encoded_image_data_1, file_name_1, encoded_image_data_2, file_name_2,
+                             name1[:-len('_1')], payload.get('frame_id'))
+
+
+def log_frame_summary(frame):
+    if not logger.isEnabledFor(logging.DEBUG):
+        return
+    frame_id = frame['frame_id']
+    for tag, points in frame['sections'].items():
+        logger.debug('%d %s %d', frame_id, tag, len(points))
+    for tag, mask in frame['masks'].items():
+        regions = mask['regions']
+        logger.debug('%d %s %d pixels %d components', frame_id, tag, regions[0]['area'], len(regions) - 1)
+    for tag, stats in frame['depth'].items():
+        logger.debug('%d %s nearest %.3f m at %s', frame_id, tag, stats['min_mm'] / 1000.0,
+                     (stats['nearest_x'], stats['nearest_y']))
+    if frame['views']:
+        logger.debug('%d views %s', frame_id, ', '.join(frame['views']))
+    if frame['streams']:
+        logger.debug('%d streams %s', frame_id, ', '.join(frame['streams']))
+
+
+# one FrameDecoder per simulator instance. Delta planes have to be rebuilt in the order frames arrive, so this happens
+# here and not in the celery workers.
+frame_decoders = {}
+# the latest model input of every instance, batched for a policy that runs on all of them at once
+observations = ObservationBatch(max_instances=16)
+
+
+def rebuild_frame(frame):
+    """The frame with its delta planes rebuilt, or None after asking the simulator for a keyframe"""
+    whole = frame_decoders.setdefault(frame['instance_name'], FrameDecoder()).decode(frame)
+    if whole is None:
+        print('frame', frame['frame_id'], 'of', frame['instance_name'], 'is a delta against a frame that was lost')
+        socketio.emit('requestKeyframe', {'name': frame['instance_name']})
+        # acknowledged anyway, the simulator's scheduler would take it for a server that fell behind
+        acknowledge_frame(frame['instance_name'], frame['frame_id'])
+        return None
+    observations.add(whole)
+    return whole
+
+
+@socketio.on('imageFrame')
+def process_frame(payload):
+    frame = decode_frame(payload)
+    log_frame_summary(frame)
+
+    frame = rebuild_frame(frame)
+    if frame is not None:
+        save_and_answer(frame)
+
+
+# shared memory frame rings by name, one per simulator instance
+frame_rings = {}
+
+
+@socketio.on('frameReady')
+def process_frame_ready(payload):
+    ring = frame_rings.get(payload['ring'])
+    if ring is None:
+        ring = frame_rings[payload['ring']] = FrameRing(payload['ring'])
+    view = ring.read(payload['slot'], payload['sequence'])
+    if view is None:
+        print('frame', payload['sequence'], 'of', payload['name'], 'was overwritten before it was read')
+        return
+    # copied before it is decoded, the slot is reused once the simulator laps the ring
+    frame_bytes = bytes(view)
+    del view
+    if not ring.is_valid(payload['slot'], payload['sequence']):
+        print('frame', payload['sequence'], 'of', payload['name'], 'was overwritten while it was read')
+        return
+    frame = decode_frame(frame_bytes)
+    log_frame_summary(frame)
+
+    frame = rebuild_frame(frame)
+    if frame is not None:
+        save_and_answer(frame)
+
+
+def save_and_answer(frame):
+    """Saves a rebuilt frame on eventlet's thread pool, so the PNG encodes don't stall the other instances' events,
+    then has the celery task answer it"""
+    tpool.execute(save_frame, frame)
+    process_frame_task.delay(frame['instance_name'], frame['frame_id'])
+
+
+def save_frame(frame):
+    """Writes the planes of a frame rebuilt by a FrameDecoder. Done here rather than in the celery task, so the
+    decoded planes, megabytes a frame, never go through the broker"""
+    # _1 is the segmentation plane, class ids or marks depending on the simulator's SegmentationOutput. Frames the
+    # simulator's FullResolutionRateDivisor skips don't have them.
+    segmentation = find_plane(frame, PLANE_CLASS_IDS)
+    if segmentation is None:
+        segmentation = find_plane(frame, PLANE_SEGMENTATION_MARKS)
+    file_name_1 = frame['instance_name'] + '_1.png'
+    file_name_2 = frame['instance_name'] + '_2.png'
+    if segmentation is not None:
+        plane_to_image(frame, segmentation).save('images/' + file_name_1, "PNG")
+    color = find_plane(frame, PLANE_COLOR)
+    if color is not None:
+        plane_to_image(frame, color).save('images/' + file_name_2, "PNG")
+    depth = find_plane(frame, PLANE_DEPTH)
+    if depth is not None:
+        np.save('images/' + frame['instance_name'] + '_depth.npy', plane_to_array(frame, depth))
+    # sensor rig views and streams, e.g. default_Rear.png, default_Rear_depth.npy or default_Policy_class_ids.png
+    named_views = [(name, record['view']) for name, record in frame['views'].items()]
+    named_views += [(name, record['view']) for name, record in frame['streams'].items()]
+    for name, view in named_views:
+        prefix = 'images/' + frame['instance_name'] + '_' + name
+        color = find_plane(frame, PLANE_COLOR, view)
+        if color is not None:
+            plane_to_image(frame, color).save(prefix + '.png', "PNG")
+        class_ids = find_plane(frame, PLANE_CLASS_IDS, view)
+        if class_ids is not None:
+            plane_to_image(frame, class_ids).save(prefix + '_class_ids.png', "PNG")
+        depth = find_plane(frame, PLANE_DEPTH, view)
+        if depth is not None:
+            np.save(prefix + '_depth.npy', plane_to_array(frame, depth))
+    if frame['observation'] is not None:
+        np.save('images/' + frame['instance_name'] + '_observation.npy', frame['observation'])
+
+
+@celery.task(name='tasks.process_frame_task')
+def process_frame_task(instance_name, frame_id):
+    """Answers a frame whose planes save_frame wrote"""
+    file_name_1 = instance_name + '_1.png'
+    left_throttle = 1
+    right_throttle = -1
+    # emit response to client
+    response = {
+        'name': file_name_1,
+        'instance': instance_name,
+        'frame_id': frame_id,
+        'leftThrottle': left_throttle,
+        'rightThrottle': right_throttle
+    }
+    socketio.emit('processedImage', response)
+    acknowledge_frame(instance_name, frame_id)
 
 
 @celery.task(name='tasks.process_image_task')
-def process_image_task(encoded_image_data_1, file_name_1, encoded_image_data_2, file_name_2):
+def process_image_task(encoded_image_data_1, file_name_1, encoded_image_data_2, file_name_2, instance_name=None,
+                       frame_id=None):
     save_image(encoded_image_data_1, file_name_1)
     save_image(encoded_image_data_2, file_name_2)
 
@@ -68,7 +222,19 @@ def process_image_task(encoded_image_data_1, file_name_1, encoded_image_data_2,
         'leftThrottle': left_throttle,
         'rightThrottle': right_throttle
     }
+    if instance_name is not None:
+        response['instance'] = instance_name
+    if frame_id is not None:
+        # the simulator records the action against the frame it answers
+        response['frame_id'] = frame_id
     socketio.emit('processedImage', response)
+    if frame_id is not None:
+        acknowledge_frame(instance_name, frame_id)
+
+
+def acknowledge_frame(instance_name, frame_id):
+    """Tells the simulator the frame was consumed, its capture scheduler slows down when these fall behind"""
+    socketio.emit('frameAck', {'name': instance_name, 'frame_id': frame_id})
 
 
 def save_image(encoded_image_data, file_name):
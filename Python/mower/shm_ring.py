@@ -0,0 +1,57 @@
+"""
+Reader for the shared memory frame rings the simulator writes when its capture transport is SharedMemory.
+The layout is documented in Source/Mower3/Public/SharedMemoryFrameRing.h, keep both in sync.
+Each slot holds one binary frame, see frame_format.decode_frame.
+"""
+
+import struct
+from multiprocessing import shared_memory
+
+MAGIC = b'MWSR'
+VERSION = 1
+
+RING_HEADER = struct.Struct('<4sIIIq40x')
+SLOT_HEADER = struct.Struct('<qI52x')
+
+
+def _open_shared_memory(name):
+    try:
+        # python >= 3.13, don't let the resource tracker unlink a region the simulator owns
+        return shared_memory.SharedMemory(name=name, create=False, track=False)
+    except TypeError:
+        shm = shared_memory.SharedMemory(name=name, create=False)
+        from multiprocessing import resource_tracker
+        resource_tracker.unregister(shm._name, 'shared_memory')
+        return shm
+
+
+class FrameRing:
+    def __init__(self, name):
+        self.name = name
+        self.shm = _open_shared_memory(name)
+        magic, version, self.num_slots, self.slot_size, _ = RING_HEADER.unpack_from(self.shm.buf, 0)
+        if magic != MAGIC or version != VERSION:
+            self.shm.close()
+            raise ValueError('%s is not a frame ring of version %d' % (name, VERSION))
+
+    def _slot_offset(self, slot):
+        return RING_HEADER.size + slot * (SLOT_HEADER.size + self.slot_size)
+
+    def read(self, slot, sequence):
+        """
+        Returns a memoryview of the frame in slot, or None if it no longer holds frame sequence.
+        The view is only valid until the writer laps the ring, check is_valid after using it.
+        """
+        offset = self._slot_offset(slot)
+        slot_sequence, size = SLOT_HEADER.unpack_from(self.shm.buf, offset)
+        if slot_sequence != sequence:
+            return None
+        start = offset + SLOT_HEADER.size
+        return self.shm.buf[start:start + size]
+
+    def is_valid(self, slot, sequence):
+        slot_sequence, _ = SLOT_HEADER.unpack_from(self.shm.buf, self._slot_offset(slot))
+        return slot_sequence == sequence
+
+    def close(self):
+        self.shm.close()
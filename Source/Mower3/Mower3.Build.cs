@@ -10,7 +10,7 @@ public class Mower3 : ModuleRules
 
 		PrivateDependencyModuleNames.AddRange(new string[]
 		{
-			"Foliage", "Landscape", "ProceduralMeshComponent",
+			"Foliage", "Landscape", "ProceduralMeshComponent", "ImageWrapper",
 			// "SocketIOClient", "SIOJson"
 		});
 
@@ -4,17 +4,22 @@
 #include "Mower3OffroadCar.h"
 
 #include "CaptureManager.h"
+#include "CaptureSensorRig.h"
+#include "CoverageMap.h"
 #include "Mower3OffroadWheelFront.h"
 #include "Mower3OffroadWheelRear.h"
 #include "ChaosWheeledVehicleMovementComponent.h"
 #include "FoliageInstancedStaticMeshComponent.h"
+#include "GrassMowingSubsystem.h"
 #include "MowerVehicleMovementComponent.h"
+#include "TaggedActorRegistry.h"
 #include "SocketIOClientComponent.h"
 #include "Components/BoxComponent.h"
 #include "Components/SceneCaptureComponent2D.h"
 #include "Engine/StaticMeshActor.h"
 #include "GameFramework/SpringArmComponent.h"
 #include "DrawDebugHelpers.h"
+#include "Algo/Unique.h"
 #include "Engine/SceneCapture2D.h"
 
 AMower3OffroadCar::AMower3OffroadCar(const FObjectInitializer& ObjectInitializer) :
@@ -103,12 +108,19 @@ Super(ObjectInitializer.SetDefaultSubobjectClass<UMowerVehicleMovementComponent>
 	MyCaptureManager = CreateDefaultSubobject<UCaptureManager>(TEXT("MyCaptureManager"));
 	MyCaptureManager->MySceneCap = MySceneCapture11;
 
+	MySensorRig = CreateDefaultSubobject<UCaptureSensorRig>(TEXT("SensorRig"));
+	MySensorRig->SetupAttachment(GetMesh());
+	// no sensors by default, each one is another scene render and readback. Add them in the Blueprint or map.
+	MyCaptureManager->SensorRig = MySensorRig;
+
 	SIOClientComponent = CreateDefaultSubobject<USocketIOClientComponent>(TEXT("SocketIOClientComponent"));
 	SIOClientComponent->URLParams.AddressAndPort = TEXT("http://127.0.0.1:8000");
 	SIOClientComponent->URLParams.Path = TEXT("");
 
 	MyCaptureManager->SIOClientComponent = SIOClientComponent;
 	// MyCaptureManager->RegisterComponent();
+
+	MyCoverageMap = CreateDefaultSubobject<UCoverageMapComponent>(TEXT("CoverageMap"));
 }
 
 void AMower3OffroadCar::Tick(float DeltaSeconds)
@@ -136,20 +148,15 @@ void AMower3OffroadCar::OnBeginOverlap(UPrimitiveComponent* OverlappedComp, AAct
 	{
 		UE_LOG(LogTemp, Warning, TEXT("Tag: %s"), *tag.ToString());
 	}
-	const TSet<FName> SetOfTagsToAccept = {"Tree", "Wall"};
-	// get the tag of the other actor and check if it is in the set of tags to accept
-	// first check if the other actor has any tags
-	if(OtherActor->Tags.Num() == 0)
-	{
-		return;
-	}
-	const FName OtherActorTag = OtherActor->Tags[0];
-	if(!SetOfTagsToAccept.Contains(OtherActorTag))
+	// only actors tagged with a segmentation class
+	const UTaggedActorRegistry* Registry = GetWorld()->GetSubsystem<UTaggedActorRegistry>();
+	const FTaggedActor* TaggedActor = Registry ? Registry->Find(OtherActor) : nullptr;
+	if(!TaggedActor)
 	{
 		return;
 	}
 		
-	UE_LOG(LogTemp, Warning, TEXT("OnBeginOverlap"));
+	UE_LOG(LogTemp, Warning, TEXT("OnBeginOverlap: %s, class %d"), *TaggedActor->Tag.ToString(), TaggedActor->ClassId);
 	// log the overlapped component and other component
 	UE_LOG(LogTemp, Warning, TEXT("OverlappedComp: %s"), *OverlappedComp->GetName());
 	UE_LOG(LogTemp, Warning, TEXT("OtherComp: %s"), *OtherComp->GetName());
@@ -173,6 +180,12 @@ void AMower3OffroadCar::ReceiveProcessedImageEvent()
 		TSharedPtr<FJsonObject> JsonObject = Message->AsObject();
 		// FString name = JsonObject->GetStringField("name");
 		// UE_LOG(LogTemp, Warning, TEXT("Received name: %s"), *name);
+		// every instance gets every answer
+		FString Instance;
+		if (JsonObject->TryGetStringField(TEXT("instance"), Instance) && Instance != MyCaptureManager->InstanceName)
+		{
+			return;
+		}
 
 		auto LeftThrottle = JsonObject->GetField<EJson::Number>("leftThrottle");
 		auto RightThrottle = JsonObject->GetField<EJson::Number>("rightThrottle");
@@ -183,6 +196,11 @@ void AMower3OffroadCar::ReceiveProcessedImageEvent()
 		}
 		auto LeftThrottleValue = LeftThrottle->AsNumber();
 		auto RightThrottleValue = RightThrottle->AsNumber();
+		double FrameId;
+		if (JsonObject->TryGetNumberField(TEXT("frame_id"), FrameId))
+		{
+			MyCaptureManager->RecordAction(static_cast<uint64>(FrameId), LeftThrottleValue, RightThrottleValue);
+		}
 		// UE_LOG(LogTemp, Warning, TEXT("Received LeftThrottle: %f"), LeftThrottleValue);
 		// UE_LOG(LogTemp, Warning, TEXT("Received RightThrottle: %f"), RightThrottleValue);
 		// ChaosVehicleMovement->SetLeftThrottleInput(LeftThrottleValue);
@@ -196,93 +214,117 @@ void AMower3OffroadCar::BeginPlay()
 	MyBoxComponent->OnComponentBeginOverlap.AddDynamic(this, &AMower3OffroadCar::OnBeginOverlap);\
 	
 	ReceiveProcessedImageEvent();
+
+	if (UGrassMowingSubsystem* Mowing = GetWorld()->GetSubsystem<UGrassMowingSubsystem>())
+	{
+		Mowing->Build(GrassMowing);
+	}
 }
 
-void AMower3OffroadCar::ReplaceOrRemoveGrass(const bool bDebug, const FString& grassNameToReplace)
+bool AMower3OffroadCar::GetMowingDeck(FMowingDeck& OutDeck) const
 {
-	const bool isGrassNameEmpty = grassNameToReplace.IsEmpty();
+	const UStaticMesh* TireMesh = TireFrontLeft->GetStaticMesh();
+	if (!TireMesh)
+	{
+		return false;
+	}
 	const FVector fl = TireFrontLeft->GetComponentLocation();
-	const FVector fr = TireFrontRight->GetComponentLocation();
-	const double fd2d = FVector2D::Distance(FVector2D(fl.X, fl.Y), FVector2D(fr.X, fr.Y)); // front width
-	
-	const FVector bl = TireRearLeft->GetComponentLocation();
-	const double bd2d = FVector2D::Distance(FVector2D(fl.X, fl.Y), FVector2D(bl.X, bl.Y)); // left length
-	
-	const UE::Math::TVector2<double> fl2d = FVector2D(fl.X, fl.Y);
-	const UE::Math::TVector2<double> fr2d = FVector2D(fr.X, fr.Y);
-	const UE::Math::TVector2<double> width2d = fr2d - fl2d;
-	const UE::Math::TVector2<double> bl2d = FVector2D(bl.X, bl.Y);
-	const UE::Math::TVector2<double> length2d = bl2d - fl2d;
-	
-	const UE::Math::TVector<double> CenterLength = fl + FVector(length2d.X / 2, length2d.Y / 2, 0);
-	const double Height = TireFrontLeft->GetStaticMesh()->GetBounds().BoxExtent.Z;
-	UE::Math::TVector<double> Center = fl + FVector(width2d.X / 2 + length2d.X / 2, width2d.Y / 2 + length2d.Y / 2, 0);
-
-	// The width is currently outside of the wheels, so we need to add the wheel radius to the width
-	const double WheelX = TireFrontLeft->GetStaticMesh()->GetBounds().BoxExtent.X;
-	const double OffsetX = WheelX/2;
-	const double WheelY = TireFrontLeft->GetStaticMesh()->GetBounds().BoxExtent.Y;
-	const double OffsetY = WheelY/2;
-	const FVector HalfSize = FVector(fd2d/2 - OffsetY, bd2d/2 - OffsetX, Height/2);
-
-	const UWorld* World = GetWorld();
-	const double LengthAngle = (CenterLength-fl).HeadingAngle();
-	const FQuat ShapeRotation = FQuat(FVector(0, 0, 1), LengthAngle);
-	if(bDebug)
+	const FVector2D fl2d = FVector2D(fl.X, fl.Y);
+	const FVector2D width2d = FVector2D(TireFrontRight->GetComponentLocation()) - fl2d;
+	const FVector2D length2d = FVector2D(TireRearLeft->GetComponentLocation()) - fl2d;
+	FVector2D Forward;
+	double Length;
+	(-length2d).ToDirectionAndLength(Forward, Length);
+	if (Length <= UE_KINDA_SMALL_NUMBER)
 	{
-		DrawDebugLine(GetWorld(), fl, fl + FVector(width2d.X, width2d.Y, 0), FColor::Red, false, 0);
-		DrawDebugLine(GetWorld(), fl, fl + FVector(length2d.X, length2d.Y, 0), FColor::Red, false, 0);
-		DrawDebugBox(World, Center, HalfSize, ShapeRotation, FColor::Green, false, 0);
+		return false;
 	}
 
-	const ECollisionChannel TraceChannel = ECC_WorldDynamic;
-	TArray<FHitResult> HitResults;
+	// the deck is inside the wheels, half a tire in from their centres
+	const FVector TireExtent = TireMesh->GetBounds().BoxExtent;
+	OutDeck.Center = fl2d + (width2d + length2d) / 2;
+	OutDeck.Forward = Forward;
+	OutDeck.HalfLength = Length / 2 - TireExtent.X / 2;
+	OutDeck.HalfWidth = width2d.Size() / 2 - TireExtent.Y / 2;
+	OutDeck.MinZ = fl.Z - TireExtent.Z / 2;
+	OutDeck.MaxZ = fl.Z + TireExtent.Z / 2;
+	return true;
+}
+
+void AMower3OffroadCar::ReplaceOrRemoveGrass(const bool bDebug, const FString& grassNameToReplace)
+{
+	const bool isGrassNameEmpty = grassNameToReplace.IsEmpty();
+	UWorld* World = GetWorld();
+	UGrassMowingSubsystem* Mowing = World ? World->GetSubsystem<UGrassMowingSubsystem>() : nullptr;
+	FMowingDeck Deck;
+	if (!Mowing || !GetMowingDeck(Deck))
+	{
+		return;
+	}
 
-	if (World)
+	// everything the deck passed over since the last tick, so what is cut doesn't depend on the frame rate
+	TArray<FMowingArea> Areas;
+	if (bHasPreviousDeck && FVector2D::Distance(PreviousDeck.Center, Deck.Center) <= MaxSweepDistance)
 	{
-		bool bHit = World->SweepMultiByChannel(HitResults, Center, Center, ShapeRotation, TraceChannel, FCollisionShape::MakeBox(HalfSize));
+		FMowingArea::Sweep(PreviousDeck, Deck, FMath::DegreesToRadians(MaxSweepStepAngle), Areas);
+	}
+	else
+	{
+		Areas.Emplace(Deck);
+	}
+	PreviousDeck = Deck;
+	bHasPreviousDeck = true;
 
-		if (bHit)
+	// instances in the areas from the grid, rather than sweeping the physics scene for their bodies
+	TArray<int32> Handles;
+	for (const FMowingArea& Area : Areas)
+	{
+		MyCoverageMap->AddArea(Area);
+		Mowing->Query(Area, Handles);
+		if(bDebug)
 		{
-			UFoliageInstancedStaticMeshComponent* NewFoliageComp = NewObject<UFoliageInstancedStaticMeshComponent>(this);
-			NewFoliageComp->SetStaticMesh(ParentStaticMesh);
-			NewFoliageComp->RegisterComponent();
-			TArray<FTransform> NewInstanceTransforms;
-		
-			for(FHitResult HitResult: HitResults)
-			{ // TODO: parallel for
-				UFoliageInstancedStaticMeshComponent* FoliageComp = Cast<UFoliageInstancedStaticMeshComponent>(HitResult.GetComponent());
-				if(!FoliageComp)
-				{
-					continue;
-				}
-
-				int32 InstanceIndex = HitResult.Item;
-
-				if(isGrassNameEmpty)
-				{
-					FoliageComp->RemoveInstance(InstanceIndex);
-					continue;
-				}
-				else
-				{
-					const FString name1 = FoliageComp->GetStaticMesh()->GetName();
-					if(!name1.Contains(grassNameToReplace))
-					{
-						continue;
-					}
-			
-					FTransform InstanceTransform;
-					FoliageComp->GetInstanceTransform(InstanceIndex, InstanceTransform, true);
-					FoliageComp->RemoveInstance(InstanceIndex);
-					const FString name = FoliageComp->GetStaticMesh()->GetName();
-					NewInstanceTransforms.Add(InstanceTransform);
-				}
-			}
-			if(!isGrassNameEmpty)
+			for (int32 i = 0; i < Area.Vertices.Num(); ++i)
 			{
-				NewFoliageComp->AddInstances(NewInstanceTransforms, false);
+				const FVector2D& Start = Area.Vertices[i];
+				const FVector2D& End = Area.Vertices[(i + 1) % Area.Vertices.Num()];
+				DrawDebugLine(World, FVector(Start, Area.MaxZ), FVector(End, Area.MaxZ), FColor::Green, false, 0);
 			}
 		}
 	}
+	if (Handles.Num() == 0)
+	{
+		return;
+	}
+	// the areas of a turn overlap
+	Handles.Sort();
+	Handles.SetNum(Algo::Unique(Handles));
+
+	// removed together at the end of the frame, by handles that stay valid meanwhile
+	for (const int32 Handle : Handles)
+	{
+		int32 InstanceIndex;
+		const UFoliageInstancedStaticMeshComponent* FoliageComp = Mowing->GetInstance(Handle, InstanceIndex);
+		if(!FoliageComp)
+		{
+			continue;
+		}
+
+		if(isGrassNameEmpty)
+		{
+			Mowing->QueueRemoval(Handle);
+			continue;
+		}
+		const FString name1 = FoliageComp->GetStaticMesh()->GetName();
+		if(!name1.Contains(grassNameToReplace))
+		{
+			continue;
+		}
+
+		// stubble in its place, pooled by the subsystem
+		FTransform InstanceTransform;
+		if (Mowing->QueueRemoval(Handle, &InstanceTransform))
+		{
+			Mowing->AddStubble(ParentStaticMesh, InstanceTransform);
+		}
+	}
 }
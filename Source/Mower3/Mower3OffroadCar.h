@@ -3,6 +3,7 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "GrassMowingSubsystem.h"
 #include "Mower3Pawn.h"
 #include "Mower3OffroadCar.generated.h"
 
@@ -64,6 +65,10 @@ class MOWER3_API AMower3OffroadCar : public AMower3Pawn
 
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Camera, meta = (AllowPrivateAccess = "true"))
 	class UCaptureManager* MyCaptureManager;
+
+	// extra cameras, e.g. rear and side, read back by MyCaptureManager with its own captures. Empty by default.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Camera, meta = (AllowPrivateAccess = "true"))
+	class UCaptureSensorRig* MySensorRig;
 	
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Meshes, meta = (AllowPrivateAccess = "true"))
 	UStaticMesh* ParentStaticMesh;
@@ -71,9 +76,28 @@ class MOWER3_API AMower3OffroadCar : public AMower3Pawn
 	// Collision Box
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Meshes, meta = (AllowPrivateAccess = "true"))
 	UBoxComponent* MyBoxComponent;
+
+	// which foliage the deck mows, indexed when play begins
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Mowing, meta = (AllowPrivateAccess = "true"))
+	FGrassMowingSettings GrassMowing;
+
+	// the deck sweeps from its last pose in steps turning at most this much, in degrees
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Mowing, meta = (AllowPrivateAccess = "true"))
+	float MaxSweepStepAngle = 2.0f;
+
+	// moving further than this in centimetres between ticks is a teleport, mowing only around the new pose
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Mowing, meta = (AllowPrivateAccess = "true"))
+	float MaxSweepDistance = 500.0f;
+
+	// what the deck has covered so far
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Mowing, meta = (AllowPrivateAccess = "true"))
+	class UCoverageMapComponent* MyCoverageMap;
 	
 private:
 	FAiVehicleInputs AiVehicleInputs;
+	// the deck when grass was last mowed
+	FMowingDeck PreviousDeck;
+	bool bHasPreviousDeck = false;
 	
 public:
 
@@ -87,5 +111,7 @@ public:
 	                    int32 OtherBodyIndex, bool bFromSweep, const FHitResult& SweepResult);
 	void ReceiveProcessedImageEvent();
 
+	// the deck between the wheels, false while the tires have no mesh
+	bool GetMowingDeck(FMowingDeck& OutDeck) const;
 	void ReplaceOrRemoveGrass( const bool bDebug = false, const FString& grassNameToReplace = "");
 };
@@ -0,0 +1,1235 @@
+// Console commands that time the capture processing code on synthetic frames, so changes can be compared without
+// running the renderer. Results are written to the log.
+
+#include "CaptureStreams.h"
+#include "CoverageMap.h"
+#include "FrameCodec.h"
+#include "FrameDelta.h"
+#include "FrameRecorder.h"
+#include "FrameWireFormat.h"
+#include "GrassInstanceGrid.h"
+#include "LabelRasterizer.h"
+#include "ObservationPacker.h"
+#include "RecordingReader.h"
+#include "SegmentationClassifier.h"
+#include "Async/MappedFileHandle.h"
+#include "Async/ParallelFor.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformFileManager.h"
+#include "Misc/Paths.h"
+
+namespace CaptureBenchmarks
+{
+	const TArray<FSegmentationClassDefinition> BenchClasses = {
+		{133, "Wall", FColor(255, 0, 0, 255)},
+		{250, "Tree", FColor(0, 0, 255, 255)}
+	};
+
+	const TMap<int, TPair<FString, FColor>> BenchMarks = {
+		{133, {"Wall", FColor(255, 0, 0, 255)}},
+		{250, {"Tree", FColor(0, 0, 255, 255)}}
+	};
+
+	const FIntPoint BenchResolutions[] = {{400, 400}, {1920, 1080}};
+
+	/**
+	 * @brief Fills a segmentation image with a few rectangular walls and trees on noise background, roughly like a
+	 * frame from the lawn
+	 */
+	void MakeSegmentationFrame(int32 Width, int32 Height, TArray<FColor>& OutImage)
+	{
+		FRandomStream Random(1234);
+		OutImage.SetNumUninitialized(Width * Height);
+		for (FColor& Pixel : OutImage)
+		{
+			// R stays below the smallest mark, so the noise never hits a mark by accident
+			Pixel = FColor(Random.RandRange(0, 132), Random.RandRange(0, 255), Random.RandRange(0, 120), 255);
+		}
+		for (int32 Blob = 0; Blob < 12; Blob++)
+		{
+			const uint8 Mark = Blob % 2 == 0 ? 133 : 250;
+			const int32 X0 = Random.RandRange(0, Width - 1);
+			const int32 Y0 = Random.RandRange(0, Height - 1);
+			const int32 X1 = FMath::Min(Width, X0 + Random.RandRange(Width / 16, Width / 4));
+			const int32 Y1 = FMath::Min(Height, Y0 + Random.RandRange(Height / 16, Height / 2));
+			for (int32 y = Y0; y < Y1; y++)
+			{
+				for (int32 x = X0; x < X1; x++)
+				{
+					OutImage[y * Width + x].R = Mark;
+				}
+			}
+		}
+	}
+
+	/**
+	 * @brief A color frame with the statistics of a rendered one: a sky gradient above a grass texture with a few
+	 * flat shaded obstacles, unlike the noise behind MakeSegmentationFrame, which no codec can compress
+	 */
+	void MakeColorFrame(int32 Width, int32 Height, TArray<FColor>& OutImage)
+	{
+		FRandomStream Random(4321);
+		OutImage.SetNumUninitialized(Width * Height);
+		const int32 Horizon = Height / 3;
+		for (int32 y = 0; y < Height; y++)
+		{
+			for (int32 x = 0; x < Width; x++)
+			{
+				FColor& Pixel = OutImage[y * Width + x];
+				if (y < Horizon)
+				{
+					Pixel = FColor(110 + y * 60 / Horizon, 160 + y * 40 / Horizon, 235, 255);
+				}
+				else
+				{
+					const int32 Shade = Random.RandRange(-12, 12) + (y - Horizon) * 30 / (Height - Horizon);
+					Pixel = FColor(60 + Shade / 2, 120 + Shade, 40 + Shade / 3, 255);
+				}
+			}
+		}
+		for (int32 Box = 0; Box < 6; Box++)
+		{
+			const FColor Color(Random.RandRange(60, 200), Random.RandRange(40, 120), Random.RandRange(20, 90), 255);
+			const int32 X0 = Random.RandRange(0, Width - 1);
+			const int32 Y0 = Random.RandRange(Horizon / 2, Height - 1);
+			const int32 X1 = FMath::Min(Width, X0 + Random.RandRange(Width / 16, Width / 4));
+			const int32 Y1 = FMath::Min(Height, Y0 + Random.RandRange(Height / 16, Height / 3));
+			for (int32 y = Y0; y < Y1; y++)
+			{
+				for (int32 x = X0; x < X1; x++)
+				{
+					// lit from the left
+					const int32 Light = (X1 - x) * 24 / (X1 - X0);
+					OutImage[y * Width + x] = FColor(FMath::Min(Color.R + Light, 255), FMath::Min(Color.G + Light, 255),
+					                                 FMath::Min(Color.B + Light, 255), 255);
+				}
+			}
+		}
+	}
+
+	// Millimetre depth of a flat lawn seen from the mower's camera, no hit above the horizon
+	void MakeDepthFrame(int32 Width, int32 Height, TArray<uint16>& OutDepthMm)
+	{
+		FRandomStream Random(2468);
+		OutDepthMm.SetNumUninitialized(Width * Height);
+		const int32 Horizon = Height / 3;
+		for (int32 y = 0; y < Height; y++)
+		{
+			const int32 RowMm = y <= Horizon ? 65535 : FMath::Min(65534, 400 * Height / (y - Horizon));
+			for (int32 x = 0; x < Width; x++)
+			{
+				OutDepthMm[y * Width + x] = static_cast<uint16>(
+					RowMm == 65535 ? RowMm : FMath::Clamp(RowMm + Random.RandRange(-3, 3), 0, 65534));
+			}
+		}
+	}
+
+	// the per pixel TMap version UCaptureManager::ColorImageObjects used before the lookup table classifier
+	void LegacyColorImageObjects(const TArray<FColor>& ImageData1, TArray<FColor>& ImageData2, int32 Width,
+	                             TMap<FString, TArray<float>>& MapTagToPixelData)
+	{
+		MapTagToPixelData.Empty();
+		for (int i = 0; i < ImageData1.Num(); i++)
+		{
+			const FColor& color1 = ImageData1[i];
+			if (BenchMarks.Find(color1.R) != nullptr)
+			{
+				auto tag = BenchMarks[color1.R].Key;
+				int32 x = i % Width;
+				int32 y = i / Width;
+				MapTagToPixelData.FindOrAdd(tag).Add(x);
+				MapTagToPixelData.FindOrAdd(tag).Add(y);
+				ImageData2[i] = BenchMarks[color1.R].Value;
+			}
+		}
+	}
+
+	template <typename FunctionType>
+	double TimeMs(int32 Iterations, FunctionType&& Function)
+	{
+		// warm up caches and the task graph
+		Function();
+		const double Start = FPlatformTime::Seconds();
+		for (int32 i = 0; i < Iterations; i++)
+		{
+			Function();
+		}
+		return (FPlatformTime::Seconds() - Start) * 1000.0 / Iterations;
+	}
+
+	void BenchClassifier()
+	{
+		FSegmentationClassifier Classifier;
+		Classifier.Build(BenchClasses);
+
+		UE_LOG(LogTemp, Display, TEXT("Classifier benchmark (ms per frame)"));
+		UE_LOG(LogTemp, Display, TEXT("%-12s %10s %10s %8s"), TEXT("resolution"), TEXT("legacy"), TEXT("table"),
+		       TEXT("speedup"));
+		for (const FIntPoint& Resolution : BenchResolutions)
+		{
+			TArray<FColor> Marks;
+			MakeSegmentationFrame(Resolution.X, Resolution.Y, Marks);
+			TArray<FColor> Recolor = Marks;
+			TArray<uint8> ClassIds;
+			ClassIds.SetNumUninitialized(Marks.Num());
+			TArray<TArray<uint16>> ClassPixels;
+			TMap<FString, TArray<float>> LegacyPixels;
+
+			const int32 Iterations = Resolution.X * Resolution.Y > 1000000 ? 20 : 100;
+			const double LegacyMs = TimeMs(Iterations, [&]()
+			{
+				LegacyColorImageObjects(Marks, Recolor, Resolution.X, LegacyPixels);
+			});
+			const double TableMs = TimeMs(Iterations, [&]()
+			{
+				Classifier.Classify(Marks.GetData(), Recolor.GetData(), ClassIds.GetData(), Resolution.X,
+				                    Resolution.Y, ClassPixels);
+			});
+
+			// both versions have to agree before the numbers mean anything
+			for (int32 ClassId = 1; ClassId < Classifier.GetNumClasses(); ClassId++)
+			{
+				const TArray<float>* Legacy = LegacyPixels.Find(Classifier.GetClassTag(ClassId));
+				bool bSame = Legacy && Legacy->Num() == ClassPixels[ClassId].Num();
+				for (int32 i = 0; bSame && i < Legacy->Num(); i++)
+				{
+					bSame = (*Legacy)[i] == ClassPixels[ClassId][i];
+				}
+				if (!ensure(bSame))
+				{
+					UE_LOG(LogTemp, Error, TEXT("BenchClassifier: %s pixels differ from the legacy classifier"),
+					       *Classifier.GetClassTag(ClassId));
+				}
+			}
+
+			UE_LOG(LogTemp, Display, TEXT("%-12s %10.3f %10.3f %7.1fx"),
+			       *FString::Printf(TEXT("%dx%d"), Resolution.X, Resolution.Y), LegacyMs, TableMs,
+			       LegacyMs / FMath::Max(TableMs, 1e-6));
+		}
+	}
+
+	void BenchMasks()
+	{
+		FSegmentationClassifier Classifier;
+		Classifier.Build(BenchClasses);
+
+		UE_LOG(LogTemp, Display, TEXT("Mask encoding benchmark (ms per frame, bytes per frame)"));
+		UE_LOG(LogTemp, Display, TEXT("%-12s %10s %10s %12s %12s"), TEXT("resolution"), TEXT("points"), TEXT("spans"),
+		       TEXT("point bytes"), TEXT("span bytes"));
+		for (const FIntPoint& Resolution : BenchResolutions)
+		{
+			TArray<FColor> Marks;
+			MakeSegmentationFrame(Resolution.X, Resolution.Y, Marks);
+			TArray<uint8> ClassIds;
+			ClassIds.SetNumUninitialized(Marks.Num());
+			TArray<TArray<uint16>> ClassPixels;
+			TArray<FClassMask> ClassMasks;
+
+			const int32 Iterations = Resolution.X * Resolution.Y > 1000000 ? 20 : 100;
+			const double PointsMs = TimeMs(Iterations, [&]()
+			{
+				Classifier.Classify(Marks.GetData(), nullptr, ClassIds.GetData(), Resolution.X, Resolution.Y,
+				                    ClassPixels);
+			});
+			const double SpansMs = TimeMs(Iterations, [&]()
+			{
+				Classifier.ClassifyMasks(Marks.GetData(), nullptr, ClassIds.GetData(), Resolution.X, Resolution.Y,
+				                         ClassMasks);
+			});
+
+			// the spans have to give back exactly the class id plane they were made from
+			TArray<uint8> Decoded;
+			Decoded.SetNumZeroed(ClassIds.Num());
+			int64 PointBytes = 0;
+			int64 SpanBytes = 0;
+			for (int32 ClassId = 1; ClassId < Classifier.GetNumClasses(); ClassId++)
+			{
+				FSegmentationClassifier::DecodeSpans(ClassMasks[ClassId].Spans, static_cast<uint8>(ClassId),
+				                                     Decoded.GetData(), Resolution.X, Resolution.Y);
+				PointBytes += ClassPixels[ClassId].Num() * sizeof(uint16);
+				SpanBytes += ClassMasks[ClassId].Spans.Num() * sizeof(FMaskSpan) + ClassMasks[ClassId].Regions.Num() *
+					sizeof(FMaskRegion);
+			}
+			if (!ensure(Decoded == ClassIds))
+			{
+				UE_LOG(LogTemp, Error, TEXT("BenchMasks: decoded spans differ from the class id plane"));
+			}
+
+			UE_LOG(LogTemp, Display, TEXT("%-12s %10.3f %10.3f %12lld %12lld"),
+			       *FString::Printf(TEXT("%dx%d"), Resolution.X, Resolution.Y), PointsMs, SpansMs, PointBytes,
+			       SpanBytes);
+		}
+	}
+
+	void BenchInstances()
+	{
+		FSegmentationClassifier Classifier;
+		Classifier.Build(BenchClasses);
+
+		UE_LOG(LogTemp, Display, TEXT("Instance stats benchmark (ms per frame)"));
+		UE_LOG(LogTemp, Display, TEXT("%-12s %10s %10s %10s"), TEXT("resolution"), TEXT("instances"), TEXT("marks"),
+		       TEXT("ids"));
+		for (const FIntPoint& Resolution : BenchResolutions)
+		{
+			// every 64x64 block of a blob is its own instance, ids in G and B
+			TArray<FColor> Marks;
+			MakeSegmentationFrame(Resolution.X, Resolution.Y, Marks);
+			TArray<uint8> ClassIds;
+			ClassIds.SetNumUninitialized(Marks.Num());
+			TArray<TArray<uint16>> ClassPixels;
+			Classifier.Classify(Marks.GetData(), nullptr, ClassIds.GetData(), Resolution.X, Resolution.Y, ClassPixels);
+			int64 NumMarked = 0;
+			for (int32 i = 0; i < Marks.Num(); i++)
+			{
+				const int32 InstanceId = 1 + (i % Resolution.X) / 64 + (i / Resolution.X) / 64 * 64;
+				Marks[i].G = static_cast<uint8>(InstanceId >> 8);
+				Marks[i].B = static_cast<uint8>(InstanceId);
+				NumMarked += ClassIds[i] != FSegmentationClassifier::BackgroundClass;
+			}
+			TArray<uint16> InstanceIds;
+			InstanceIds.SetNumUninitialized(Marks.Num());
+			TArray<FInstanceStats> Instances;
+
+			const int32 Iterations = Resolution.X * Resolution.Y > 1000000 ? 20 : 100;
+			const double MarksMs = TimeMs(Iterations, [&]()
+			{
+				FSegmentationClassifier::GatherInstances(Marks.GetData(), ClassIds.GetData(), InstanceIds.GetData(),
+				                                         Resolution.X, Resolution.Y, Instances);
+			});
+			// the rasterizer's path, the ids are already in place
+			const double IdsMs = TimeMs(Iterations, [&]()
+			{
+				FSegmentationClassifier::GatherInstances(nullptr, ClassIds.GetData(), InstanceIds.GetData(),
+				                                         Resolution.X, Resolution.Y, Instances);
+			});
+
+			int64 NumCounted = 0;
+			for (const FInstanceStats& Stats : Instances)
+			{
+				NumCounted += Stats.NumPixels;
+				if (!ensure(Stats.MaxX - Stats.MinX < 64 && Stats.MaxY - Stats.MinY < 64))
+				{
+					UE_LOG(LogTemp, Error, TEXT("BenchInstances: instance %d is larger than its block"),
+					       Stats.InstanceId);
+				}
+			}
+			if (!ensure(NumCounted == NumMarked))
+			{
+				UE_LOG(LogTemp, Error, TEXT("BenchInstances: %lld pixels counted, %lld are marked"), NumCounted,
+				       NumMarked);
+			}
+
+			UE_LOG(LogTemp, Display, TEXT("%-12s %10d %10.3f %10.3f"),
+			       *FString::Printf(TEXT("%dx%d"), Resolution.X, Resolution.Y), Instances.Num(), MarksMs, IdsMs);
+		}
+	}
+
+	void BenchRecorder()
+	{
+		// a raw 400x400 binary frame: class ids, color and millimetre depth
+		constexpr int32 NumFrames = 600;
+		TArray<uint8> Frame;
+		Frame.SetNumUninitialized(400 * 400 * (1 + 4 + 2));
+		FRandomStream Random(1234);
+		for (uint8& Byte : Frame)
+		{
+			Byte = static_cast<uint8>(Random.RandRange(0, 255));
+		}
+		const FrameRecording::FVehicleState VehicleState = {};
+
+		const FString Path = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Recordings"), TEXT("bench.mwrec"));
+		FFrameRecorder Recorder;
+		if (!Recorder.Open(Path, TEXT("bench"), 8 * 1024 * 1024, 8))
+		{
+			return;
+		}
+		// unlike the capture manager this waits for the disk, so the rate is what the disk sustains
+		int32 Waits = 0;
+		const double Start = FPlatformTime::Seconds();
+		for (int32 FrameId = 0; FrameId < NumFrames; FrameId++)
+		{
+			while (!Recorder.Append(FrameRecording::ERecordKind::Frame, FrameId, FrameId / 60.0, Frame))
+			{
+				Waits++;
+				FPlatformProcess::Sleep(0.001f);
+			}
+			Recorder.AppendStruct(FrameRecording::ERecordKind::VehicleState, FrameId, FrameId / 60.0, VehicleState);
+		}
+		Recorder.Close();
+		const double Seconds = FPlatformTime::Seconds() - Start;
+
+		UE_LOG(LogTemp, Display, TEXT("Recorder benchmark: %d frames of %d bytes in %.2f s, %.0f frames/s, %.0f MB/s, "
+			       "%d waits for the disk"), NumFrames, Frame.Num(), Seconds, NumFrames / Seconds,
+		       Recorder.GetBytesWritten() / Seconds / (1024.0 * 1024.0), Waits);
+		IFileManager::Get().Delete(*Path);
+	}
+
+	void BenchReader()
+	{
+		// 600 raw 400x400 frames with class ids, color and millimetre depth planes
+		constexpr int32 NumFrames = 600;
+		constexpr int32 Size = 400;
+		TArray<uint8> ClassIds;
+		TArray<FColor> Color;
+		TArray<uint16> Depth;
+		ClassIds.SetNumZeroed(Size * Size);
+		Color.SetNumZeroed(Size * Size);
+		Depth.SetNumZeroed(Size * Size);
+		FrameWire::FPlane Planes[3];
+		Planes[0].Kind = FrameWire::EPlaneKind::ClassIds;
+		Planes[0].PixelFormat = FrameWire::EPixelFormat::R8;
+		Planes[0].Data = ClassIds;
+		Planes[1].Kind = FrameWire::EPlaneKind::Color;
+		Planes[1].PixelFormat = FrameWire::EPixelFormat::BGRA8;
+		Planes[1].Data = TConstArrayView<uint8>(reinterpret_cast<const uint8*>(Color.GetData()), Color.Num() * 4);
+		Planes[2].Kind = FrameWire::EPlaneKind::Depth;
+		Planes[2].PixelFormat = FrameWire::EPixelFormat::R16;
+		Planes[2].Data = TConstArrayView<uint8>(reinterpret_cast<const uint8*>(Depth.GetData()), Depth.Num() * 2);
+		for (FrameWire::FPlane& Plane : Planes)
+		{
+			Plane.Width = Size;
+			Plane.Height = Size;
+		}
+
+		const FString Path = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Recordings"), TEXT("bench_reader.mwrec"));
+		{
+			FFrameRecorder Recorder;
+			if (!Recorder.Open(Path, TEXT("bench"), 8 * 1024 * 1024, 8))
+			{
+				return;
+			}
+			TArray<uint8> Frame;
+			FrameWire::FFrameInfo Info;
+			Info.Width = Size;
+			Info.Height = Size;
+			for (int32 FrameId = 0; FrameId < NumFrames; FrameId++)
+			{
+				Info.FrameId = FrameId;
+				Info.Timestamp = FrameId / 60.0;
+				Depth[0] = static_cast<uint16>(FrameId);
+				FrameWire::Write(Info, Planes, {}, Frame);
+				while (!Recorder.Append(FrameRecording::ERecordKind::Frame, FrameId, Info.Timestamp, Frame))
+				{
+					FPlatformProcess::Sleep(0.001f);
+				}
+			}
+		}
+
+		const double Start = FPlatformTime::Seconds();
+		TUniquePtr<IMappedFileHandle> File(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*Path));
+		TUniquePtr<IMappedFileRegion> Region(File ? File->MapRegion() : nullptr);
+		mwrec_reader* Reader = nullptr;
+		if (!Region || mwrec_open_memory(Region->GetMappedPtr(), Region->GetMappedSize(), &Reader) != MWREC_OK)
+		{
+			UE_LOG(LogTemp, Error, TEXT("BenchReader: could not open %s"), *Path);
+			return;
+		}
+		const double OpenSeconds = FPlatformTime::Seconds() - Start;
+
+		// every shard decodes its frames and sums their depth planes, so the pages are actually read
+		const int32 NumShards = FMath::Max(FPlatformMisc::NumberOfCoresIncludingHyperthreads(), 1);
+		TArray<uint64> ShardSums;
+		ShardSums.SetNumZeroed(NumShards);
+		TAtomic<int64> BytesRead{0};
+		const double IterateStart = FPlatformTime::Seconds();
+		ParallelFor(NumShards, [&](int32 Shard)
+		{
+			uint64 First;
+			uint64 Count;
+			mwrec_shard(mwrec_count(Reader, MWREC_RECORD_FRAME), Shard, NumShards, &First, &Count);
+			FrameWire::FFrameView View;
+			uint64 ShardSum = 0;
+			for (uint64 i = First; i < First + Count; i++)
+			{
+				mwrec_record Record;
+				mwrec_get(Reader, MWREC_RECORD_FRAME, i, &Record);
+				if (!FrameWire::Read(TConstArrayView<uint8>(Record.data, static_cast<int32>(Record.size)), View))
+				{
+					continue;
+				}
+				for (const uint8 Byte : View.Planes[2].Data)
+				{
+					ShardSum += Byte;
+				}
+				BytesRead += Record.size;
+			}
+			ShardSums[Shard] = ShardSum;
+		});
+		const double IterateSeconds = FPlatformTime::Seconds() - IterateStart;
+		uint64 Sum = 0;
+		for (const uint64 ShardSum : ShardSums)
+		{
+			Sum += ShardSum;
+		}
+
+		UE_LOG(LogTemp, Display, TEXT("Reader benchmark: indexed %llu frames in %.2f ms, read them in %d shards in "
+			       "%.2f ms, %.0f frames/s, %.0f MB/s (checksum %llu)"),
+		       mwrec_count(Reader, MWREC_RECORD_FRAME), OpenSeconds * 1000.0, NumShards, IterateSeconds * 1000.0,
+		       NumFrames / IterateSeconds, BytesRead.Load() / IterateSeconds / (1024.0 * 1024.0), Sum);
+		mwrec_close(Reader);
+		Region.Reset();
+		File.Reset();
+		IFileManager::Get().Delete(*Path);
+	}
+
+	void BenchCodecs()
+	{
+		FFrameCodecs Codecs;
+		Codecs.Build();
+		FSegmentationClassifier Classifier;
+		Classifier.Build(BenchClasses);
+		const TCHAR* CodecNames[] = {TEXT("raw"), TEXT("lz4"), TEXT("qoi"), TEXT("png"), TEXT("jpeg")};
+
+		UE_LOG(LogTemp, Display, TEXT("Plane codec benchmark (KB and ms per plane, strips of %d rows on %d workers)"),
+		       FFrameCodecSettings().RowsPerStrip, FTaskGraphInterface::Get().GetNumWorkerThreads());
+		UE_LOG(LogTemp, Display, TEXT("%-10s %-9s %-5s %9s %7s %10s %10s %10s"), TEXT("resolution"), TEXT("plane"),
+		       TEXT("codec"), TEXT("KB"), TEXT("ratio"), TEXT("strips ms"), TEXT("whole ms"), TEXT("decode ms"));
+		for (const FIntPoint& Resolution : BenchResolutions)
+		{
+			TArray<FColor> Color;
+			MakeColorFrame(Resolution.X, Resolution.Y, Color);
+			TArray<FColor> Marks;
+			MakeSegmentationFrame(Resolution.X, Resolution.Y, Marks);
+			TArray<uint8> ClassIds;
+			ClassIds.SetNumUninitialized(Marks.Num());
+			TArray<TArray<uint16>> ClassPixels;
+			Classifier.Classify(Marks.GetData(), nullptr, ClassIds.GetData(), Resolution.X, Resolution.Y, ClassPixels);
+			TArray<uint16> DepthMm;
+			MakeDepthFrame(Resolution.X, Resolution.Y, DepthMm);
+
+			TArray<FrameWire::FPlane, TInlineAllocator<3>> Planes;
+			for (int32 i = 0; i < 3; i++)
+			{
+				FrameWire::FPlane& Plane = Planes.AddDefaulted_GetRef();
+				Plane.Width = Resolution.X;
+				Plane.Height = Resolution.Y;
+			}
+			Planes[0].Kind = FrameWire::EPlaneKind::Color;
+			Planes[0].PixelFormat = FrameWire::EPixelFormat::BGRA8;
+			Planes[0].Data = FrameWire::ItemsData(TConstArrayView<FColor>(Color));
+			Planes[1].Kind = FrameWire::EPlaneKind::ClassIds;
+			Planes[1].PixelFormat = FrameWire::EPixelFormat::R8;
+			Planes[1].Data = ClassIds;
+			Planes[2].Kind = FrameWire::EPlaneKind::Depth;
+			Planes[2].PixelFormat = FrameWire::EPixelFormat::R16;
+			Planes[2].Data = FrameWire::ItemsData(TConstArrayView<uint16>(DepthMm));
+
+			const int32 Iterations = Resolution.X * Resolution.Y > 1000000 ? 5 : 20;
+			for (const FrameWire::FPlane& Plane : Planes)
+			{
+				for (int32 CodecIndex = 0; CodecIndex < UE_ARRAY_COUNT(CodecNames); CodecIndex++)
+				{
+					const EFrameCodec Codec = static_cast<EFrameCodec>(CodecIndex);
+					// codecs that fall back to another one for this pixel format are already in the table
+					const FrameWire::EPlaneEncoding Encoding = FFrameCodecs::Resolve(Codec, Plane.PixelFormat);
+					if ((Codec == EFrameCodec::QOI && Encoding != FrameWire::EPlaneEncoding::QOI) ||
+						(Codec == EFrameCodec::JPEG && Encoding != FrameWire::EPlaneEncoding::JPEG))
+					{
+						continue;
+					}
+					FFrameCodecSettings Strips;
+					FFrameCodecSettings Whole;
+					Whole.RowsPerStrip = 0;
+					TArray64<uint8> Encoded;
+					const double StripsMs = TimeMs(Iterations, [&]() { Codecs.Encode(Plane, Codec, Strips, Encoded); });
+					const double WholeMs = TimeMs(Iterations, [&]() { Codecs.Encode(Plane, Codec, Whole, Encoded); });
+					Codecs.Encode(Plane, Codec, Strips, Encoded);
+
+					double DecodeMs = 0.0;
+					int64 Size = Plane.Data.Num();
+					if (Encoding != FrameWire::EPlaneEncoding::Raw)
+					{
+						FrameWire::FPlane EncodedPlane = Plane;
+						EncodedPlane.Encoding = Encoding;
+						EncodedPlane.Data = TConstArrayView<uint8>(Encoded.GetData(), Encoded.Num());
+						TArray64<uint8> Decoded;
+						DecodeMs = TimeMs(Iterations, [&]() { Codecs.Decode(EncodedPlane, Decoded); });
+						Size = Encoded.Num();
+						// the lossless codecs have to give back exactly what they were given
+						const bool bLossless = Encoding != FrameWire::EPlaneEncoding::JPEG;
+						if (!ensure(Decoded.Num() == Plane.Data.Num()) || (bLossless && !ensure(
+							FMemory::Memcmp(Decoded.GetData(), Plane.Data.GetData(), Plane.Data.Num()) == 0)))
+						{
+							UE_LOG(LogTemp, Error, TEXT("BenchCodecs: %s does not decode to its input"),
+							       CodecNames[CodecIndex]);
+						}
+					}
+
+					UE_LOG(LogTemp, Display, TEXT("%-10s %-9s %-5s %9.1f %6.1fx %10.3f %10.3f %10.3f"),
+					       *FString::Printf(TEXT("%dx%d"), Resolution.X, Resolution.Y),
+					       Plane.Kind == FrameWire::EPlaneKind::Color
+						       ? TEXT("color")
+						       : Plane.Kind == FrameWire::EPlaneKind::Depth
+						       ? TEXT("depth mm")
+						       : TEXT("class ids"),
+					       CodecNames[CodecIndex], Size / 1024.0, static_cast<double>(Plane.Data.Num()) / Size,
+					       StripsMs, WholeMs, DecodeMs);
+				}
+			}
+		}
+	}
+
+	void BenchDeltas()
+	{
+		FFrameCodecs Codecs;
+		Codecs.Build();
+		FSegmentationClassifier Classifier;
+		Classifier.Build(BenchClasses);
+		constexpr int32 NumFrames = 120;
+		FFrameDeltaSettings Settings;
+		Settings.bEnabled = true;
+		const FFrameCodecSettings CodecSettings;
+		const TCHAR* PlaneNames[] = {TEXT("color"), TEXT("class ids"), TEXT("depth mm")};
+
+		UE_LOG(LogTemp, Display, TEXT("Delta frame benchmark (%d frames of an obstacle crossing a still scene, %dx%d "
+			       "tiles, a keyframe every %d frames, LZ4 planes, KB and ms per frame)"), NumFrames, Settings.TileSize,
+		       Settings.TileSize, Settings.KeyframeInterval);
+		UE_LOG(LogTemp, Display, TEXT("%-10s %-9s %9s %9s %7s %7s %8s"), TEXT("resolution"), TEXT("plane"),
+		       TEXT("whole KB"), TEXT("delta KB"), TEXT("ratio"), TEXT("dirty"), TEXT("diff ms"));
+		for (const FIntPoint& Resolution : BenchResolutions)
+		{
+			TArray<FColor> Color;
+			MakeColorFrame(Resolution.X, Resolution.Y, Color);
+			TArray<FColor> Marks;
+			MakeSegmentationFrame(Resolution.X, Resolution.Y, Marks);
+			TArray<uint8> ClassIds;
+			ClassIds.SetNumUninitialized(Marks.Num());
+			TArray<TArray<uint16>> ClassPixels;
+			Classifier.Classify(Marks.GetData(), nullptr, ClassIds.GetData(), Resolution.X, Resolution.Y, ClassPixels);
+			TArray<uint16> DepthMm;
+			MakeDepthFrame(Resolution.X, Resolution.Y, DepthMm);
+
+			TArray<FColor> MovingColor;
+			TArray<uint8> MovingClassIds;
+			TArray<uint16> MovingDepthMm;
+			TArray<FrameWire::FPlane, TInlineAllocator<3>> Planes;
+			for (int32 i = 0; i < 3; i++)
+			{
+				FrameWire::FPlane& Plane = Planes.AddDefaulted_GetRef();
+				Plane.Width = Resolution.X;
+				Plane.Height = Resolution.Y;
+			}
+			Planes[0].Kind = FrameWire::EPlaneKind::Color;
+			Planes[0].PixelFormat = FrameWire::EPixelFormat::BGRA8;
+			Planes[1].Kind = FrameWire::EPlaneKind::ClassIds;
+			Planes[1].PixelFormat = FrameWire::EPixelFormat::R8;
+			Planes[2].Kind = FrameWire::EPlaneKind::Depth;
+			Planes[2].PixelFormat = FrameWire::EPixelFormat::R16;
+
+			FFrameDeltaEncoder Encoder;
+			FFrameDeltaDecoder Decoder;
+			TArray<uint8> DeltaPixels[3];
+			TArray<uint8> DeltaSections[3];
+			int32 NumTiles[3];
+			TArray64<uint8> Encoded[3];
+			TArray64<uint8> WholeEncoded;
+			double WholeBytes[3] = {};
+			double DeltaBytes[3] = {};
+			double DirtyTiles[3] = {};
+			double AllTiles[3] = {};
+			double DiffSeconds[3] = {};
+			double RebuildSeconds = 0.0;
+			bool bExact = true;
+			for (int32 Frame = 0; Frame < NumFrames; Frame++)
+			{
+				// an obstacle an eighth of the frame wide crosses the lower half, everything else stands still
+				MovingColor = Color;
+				MovingClassIds = ClassIds;
+				MovingDepthMm = DepthMm;
+				const int32 ObstacleX = Frame * Resolution.X / NumFrames;
+				for (int32 y = Resolution.Y / 2; y < Resolution.Y * 2 / 3; y++)
+				{
+					for (int32 x = ObstacleX; x < FMath::Min(ObstacleX + Resolution.X / 8, Resolution.X); x++)
+					{
+						MovingColor[y * Resolution.X + x] = FColor(200, 40 + x % 7, 40, 255);
+						MovingClassIds[y * Resolution.X + x] = 1;
+						MovingDepthMm[y * Resolution.X + x] = 3000;
+					}
+				}
+				Planes[0].Data = FrameWire::ItemsData(TConstArrayView<FColor>(MovingColor));
+				Planes[1].Data = MovingClassIds;
+				Planes[2].Data = FrameWire::ItemsData(TConstArrayView<uint16>(MovingDepthMm));
+
+				FrameWire::FFrameView View;
+				View.Info.FrameId = Frame;
+				Encoder.BeginFrame(Frame, Settings);
+				for (int32 i = 0; i < 3; i++)
+				{
+					const double Start = FPlatformTime::Seconds();
+					const bool bDelta = Encoder.EncodePlane(i, Planes[i], Settings, DeltaPixels[i], DeltaSections[i],
+					                                        NumTiles[i]);
+					DiffSeconds[i] += FPlatformTime::Seconds() - Start;
+
+					Codecs.Encode(Planes[i], EFrameCodec::LZ4, CodecSettings, WholeEncoded);
+					WholeBytes[i] += WholeEncoded.Num();
+					FrameWire::FPlane& Plane = View.Planes.Add_GetRef(Planes[i]);
+					if (bDelta)
+					{
+						Plane.Data = DeltaPixels[i];
+						FrameWire::FDeltaInfo Info;
+						FMemory::Memcpy(&Info, DeltaSections[i].GetData(), sizeof(Info));
+						DirtyTiles[i] += Info.NumDirtyTiles;
+						AllTiles[i] += NumTiles[i];
+					}
+					Plane.Encoding = Codecs.Encode(Plane, EFrameCodec::LZ4, CodecSettings, Encoded[i]);
+					if (Plane.Encoding != FrameWire::EPlaneEncoding::Raw)
+					{
+						Plane.Data = TConstArrayView<uint8>(Encoded[i].GetData(), Encoded[i].Num());
+					}
+					DeltaBytes[i] += Plane.Data.Num() + DeltaSections[i].Num();
+
+					FrameWire::FSection& Section = View.Sections.AddDefaulted_GetRef();
+					Section.Kind = FrameWire::ESectionKind::Delta;
+					Section.Count = NumTiles[i];
+					Section.Data = DeltaSections[i];
+				}
+
+				const double Start = FPlatformTime::Seconds();
+				bExact &= Decoder.Decode(View, Codecs);
+				RebuildSeconds += FPlatformTime::Seconds() - Start;
+				for (int32 i = 0; i < 3 && bExact; i++)
+				{
+					bExact = View.Planes[i].Data.Num() == Planes[i].Data.Num() && FMemory::Memcmp(
+						View.Planes[i].Data.GetData(), Planes[i].Data.GetData(), Planes[i].Data.Num()) == 0;
+				}
+			}
+			if (!ensure(bExact))
+			{
+				UE_LOG(LogTemp, Error, TEXT("BenchDeltas: the rebuilt planes differ from the captured ones"));
+			}
+
+			for (int32 i = 0; i < 3; i++)
+			{
+				UE_LOG(LogTemp, Display, TEXT("%-10s %-9s %9.1f %9.1f %6.1fx %6.1f%% %8.3f"),
+				       *FString::Printf(TEXT("%dx%d"), Resolution.X, Resolution.Y), PlaneNames[i],
+				       WholeBytes[i] / NumFrames / 1024.0, DeltaBytes[i] / NumFrames / 1024.0,
+				       WholeBytes[i] / DeltaBytes[i], AllTiles[i] > 0.0 ? DirtyTiles[i] * 100.0 / AllTiles[i] : 100.0,
+				       DiffSeconds[i] * 1000.0 / NumFrames);
+			}
+			UE_LOG(LogTemp, Display, TEXT("%dx%d: decompressing and rebuilding a frame takes %.3f ms"), Resolution.X,
+			       Resolution.Y, RebuildSeconds * 1000.0 / NumFrames);
+		}
+	}
+
+	void BenchObservation()
+	{
+		const TCHAR* ResizeNames[] = {TEXT("bilinear"), TEXT("area")};
+		const TCHAR* LayoutNames[] = {TEXT("NCHW"), TEXT("NHWC")};
+		const TCHAR* PrecisionNames[] = {TEXT("f16"), TEXT("f32")};
+
+		UE_LOG(LogTemp, Display, TEXT("Observation packing benchmark (224x224 RGB tensors, ms per frame)"));
+		UE_LOG(LogTemp, Display, TEXT("%-10s %-8s %-6s %-4s %10s %10s"), TEXT("resolution"), TEXT("resize"),
+		       TEXT("layout"), TEXT("type"), TEXT("whole"), TEXT("crop"));
+		for (const FIntPoint& Resolution : BenchResolutions)
+		{
+			TArray<FColor> Color;
+			MakeColorFrame(Resolution.X, Resolution.Y, Color);
+			const int32 Iterations = Resolution.X * Resolution.Y > 1000000 ? 20 : 100;
+			TArray<uint8> Tensor;
+			for (int32 Config = 0; Config < 8; Config++)
+			{
+				FObservationSettings Settings;
+				Settings.Resize = static_cast<EObservationResize>(Config & 1);
+				Settings.Layout = static_cast<EObservationLayout>((Config >> 1) & 1);
+				Settings.Precision = static_cast<EObservationPrecision>((Config >> 2) & 1);
+				FObservationSettings Cropped = Settings;
+				Cropped.CropMin = FVector2D(0.25, 0.5);
+				Cropped.CropMax = FVector2D(0.75, 1.0);
+
+				// set up per frame, like the pipeline does
+				auto Pack = [&](const FObservationSettings& PackSettings)
+				{
+					const FObservationPacker Packer(PackSettings, Resolution.X, Resolution.Y);
+					Tensor.SetNumUninitialized(Packer.GetNumBytes(), false);
+					Packer.Pack(Color.GetData(), Tensor.GetData());
+				};
+				const double WholeMs = TimeMs(Iterations, [&]() { Pack(Settings); });
+				const double CropMs = TimeMs(Iterations, [&]() { Pack(Cropped); });
+				UE_LOG(LogTemp, Display, TEXT("%-10s %-8s %-6s %-4s %10.3f %10.3f"),
+				       *FString::Printf(TEXT("%dx%d"), Resolution.X, Resolution.Y), ResizeNames[Config & 1],
+				       LayoutNames[(Config >> 1) & 1], PrecisionNames[(Config >> 2) & 1], WholeMs, CropMs);
+			}
+
+			// every resize of a flat image is that image, which the normalization maps to a known value
+			TArray<FColor> Flat;
+			Flat.Init(FColor(200, 100, 50, 255), Resolution.X * Resolution.Y);
+			FObservationSettings Settings;
+			Settings.Precision = EObservationPrecision::Float32;
+			Settings.Layout = EObservationLayout::NHWC;
+			const FObservationPacker Packer(Settings, Resolution.X, Resolution.Y);
+			Tensor.SetNumUninitialized(Packer.GetNumBytes(), false);
+			Packer.Pack(Flat.GetData(), Tensor.GetData());
+			const float* Values = reinterpret_cast<const float*>(Tensor.GetData());
+			const double Expected[3] = {(200 / 255.0 - Settings.Mean.X) / Settings.Std.X,
+			                            (100 / 255.0 - Settings.Mean.Y) / Settings.Std.Y,
+			                            (50 / 255.0 - Settings.Mean.Z) / Settings.Std.Z};
+			double MaxError = 0.0;
+			for (int64 i = 0; i < Packer.GetNumElements(); i++)
+			{
+				MaxError = FMath::Max(MaxError, FMath::Abs(Values[i] - Expected[i % 3]));
+			}
+			if (!ensure(MaxError < 1e-3))
+			{
+				UE_LOG(LogTemp, Error, TEXT("BenchObservation: a flat image packs with an error of %f"), MaxError);
+			}
+		}
+	}
+
+	void BenchStreams()
+	{
+		FFrameCodecs Codecs;
+		Codecs.Build();
+		FSegmentationClassifier Classifier;
+		Classifier.Build(BenchClasses);
+		const FFrameCodecSettings CodecSettings;
+		const FIntPoint Resolution = BenchResolutions[1];
+
+		TArray<FColor> Color;
+		MakeColorFrame(Resolution.X, Resolution.Y, Color);
+		TArray<FColor> Marks;
+		MakeSegmentationFrame(Resolution.X, Resolution.Y, Marks);
+		TArray<uint8> ClassIds;
+		ClassIds.SetNumUninitialized(Marks.Num());
+		TArray<TArray<uint16>> ClassPixels;
+		Classifier.Classify(Marks.GetData(), nullptr, ClassIds.GetData(), Resolution.X, Resolution.Y, ClassPixels);
+		TArray<uint16> DepthMm;
+		MakeDepthFrame(Resolution.X, Resolution.Y, DepthMm);
+
+		UE_LOG(LogTemp, Display, TEXT("Capture stream benchmark (streams shrunk from one %dx%d render, ms per frame, "
+			       "LZ4 color KB)"), Resolution.X, Resolution.Y);
+		UE_LOG(LogTemp, Display, TEXT("%-10s %-10s %10s %10s %10s %10s"), TEXT("downsample"), TEXT("size"),
+		       TEXT("color"), TEXT("class ids"), TEXT("depth"), TEXT("color KB"));
+		for (int32 Downsample = 1; Downsample <= CaptureStreams::MaxDownsample; Downsample *= 2)
+		{
+			const FIntPoint Size = CaptureStreams::GetSize(Resolution.X, Resolution.Y, Downsample);
+			TArray<FColor> StreamColor;
+			StreamColor.SetNumUninitialized(Size.X * Size.Y);
+			TArray<uint8> StreamClassIds;
+			StreamClassIds.SetNumUninitialized(Size.X * Size.Y);
+			TArray<uint16> StreamDepthMm;
+			StreamDepthMm.SetNumUninitialized(Size.X * Size.Y);
+			const double ColorMs = TimeMs(20, [&]()
+			{
+				CaptureStreams::DownsampleColor(Color.GetData(), Resolution.X, Resolution.Y, Downsample,
+				                                StreamColor.GetData());
+			});
+			const double ClassIdsMs = TimeMs(20, [&]()
+			{
+				CaptureStreams::DownsampleClassIds(ClassIds.GetData(), Resolution.X, Resolution.Y, Downsample,
+				                                   StreamClassIds.GetData());
+			});
+			const double DepthMs = TimeMs(20, [&]()
+			{
+				CaptureStreams::DownsampleDepth(DepthMm.GetData(), Resolution.X, Resolution.Y, Downsample,
+				                                StreamDepthMm.GetData());
+			});
+
+			FrameWire::FPlane Plane;
+			Plane.Kind = FrameWire::EPlaneKind::Color;
+			Plane.PixelFormat = FrameWire::EPixelFormat::BGRA8;
+			Plane.Width = Size.X;
+			Plane.Height = Size.Y;
+			Plane.Data = FrameWire::ItemsData(TConstArrayView<FColor>(StreamColor));
+			TArray64<uint8> Encoded;
+			Codecs.Encode(Plane, EFrameCodec::LZ4, CodecSettings, Encoded);
+
+			UE_LOG(LogTemp, Display, TEXT("%-10d %-10s %10.3f %10.3f %10.3f %10.1f"), Downsample,
+			       *FString::Printf(TEXT("%dx%d"), Size.X, Size.Y), ColorMs, ClassIdsMs, DepthMs,
+			       Encoded.Num() / 1024.0);
+
+			// shrinking by 1 is a copy
+			if (Downsample == 1 && !ensure(FMemory::Memcmp(StreamColor.GetData(), Color.GetData(),
+			                                              Color.Num() * sizeof(FColor)) == 0))
+			{
+				UE_LOG(LogTemp, Error, TEXT("BenchStreams: a stream that isn't shrunk differs from its source"));
+			}
+		}
+	}
+
+	/**
+	 * @brief A unit sphere of Rings x Segments quads, close enough to a tree crown. Rings = 2 and Segments = 4 is an
+	 * octahedron.
+	 */
+	TSharedRef<FLabelMesh, ESPMode::ThreadSafe> MakeSphereMesh(int32 Rings, int32 Segments)
+	{
+		TSharedRef<FLabelMesh, ESPMode::ThreadSafe> Mesh = MakeShared<FLabelMesh, ESPMode::ThreadSafe>();
+		for (int32 Ring = 0; Ring <= Rings; Ring++)
+		{
+			const float Polar = PI * Ring / Rings;
+			for (int32 Segment = 0; Segment < Segments; Segment++)
+			{
+				const float Azimuth = 2.0f * PI * Segment / Segments;
+				Mesh->Positions.Add(FVector3f(FMath::Sin(Polar) * FMath::Cos(Azimuth),
+				                              FMath::Sin(Polar) * FMath::Sin(Azimuth), FMath::Cos(Polar)));
+			}
+		}
+		for (int32 Ring = 0; Ring < Rings; Ring++)
+		{
+			for (int32 Segment = 0; Segment < Segments; Segment++)
+			{
+				const uint32 A = Ring * Segments + Segment;
+				const uint32 B = Ring * Segments + (Segment + 1) % Segments;
+				Mesh->Indices.Append({A, B, A + Segments, B, B + Segments, A + Segments});
+			}
+		}
+		return Mesh;
+	}
+
+	void BenchRaster()
+	{
+		// the instances are placed in view space, X right, Y up and Z forward, so the view matrix is the identity
+		const TSharedRef<FLabelMesh, ESPMode::ThreadSafe> Crown = MakeSphereMesh(24, 48);
+		const TSharedRef<FLabelMesh, ESPMode::ThreadSafe> Block = MakeSphereMesh(2, 4);
+		FRandomStream Random(1234);
+		TArray<FLabelInstance> Instances;
+		for (int32 i = 0; i < 200; i++)
+		{
+			FLabelInstance& Instance = Instances.AddDefaulted_GetRef();
+			const bool bTree = i % 4 != 0;
+			Instance.Mesh = bTree ? Crown : Block;
+			const float Depth = Random.FRandRange(300.0f, 6000.0f);
+			const FVector Scale = bTree ? FVector(Random.FRandRange(100.0f, 300.0f)) : FVector(400.0f, 30.0f, 150.0f);
+			Instance.LocalToWorld = FScaleMatrix(Scale) * FTranslationMatrix(
+				FVector(Random.FRandRange(-Depth, Depth), Random.FRandRange(-0.5f, 0.5f) * Depth, Depth));
+			Instance.ClassId = bTree ? 2 : 1;
+			Instance.InstanceId = static_cast<uint16>(i + 1);
+		}
+
+		UE_LOG(LogTemp, Display, TEXT("Label rasterizer benchmark (%d instances, ms per frame)"), Instances.Num());
+		UE_LOG(LogTemp, Display, TEXT("%-10s %10s %10s %10s"), TEXT("size"), TEXT("triangles"), TEXT("raster"),
+		       TEXT("covered %"));
+		for (const FIntPoint& Resolution : BenchResolutions)
+		{
+			const FMatrix ViewProjection = FReversedZPerspectiveMatrix(PI / 4.0f, Resolution.X, Resolution.Y, 10.0f);
+			TArray<uint8> ClassIds;
+			ClassIds.SetNumUninitialized(Resolution.X * Resolution.Y);
+			TArray<uint16> InstanceIds;
+			InstanceIds.SetNumUninitialized(Resolution.X * Resolution.Y);
+			FLabelRasterizer Rasterizer;
+			const double RasterMs = TimeMs(20, [&]()
+			{
+				Rasterizer.Rasterize(ViewProjection, Resolution.X, Resolution.Y, Instances, ClassIds.GetData(),
+				                     InstanceIds.GetData());
+			});
+			int32 NumCovered = 0;
+			for (int32 i = 0; i < ClassIds.Num(); i++)
+			{
+				NumCovered += ClassIds[i] != 0;
+				if (ClassIds[i] != 0 && !ensure(InstanceIds[i] != 0))
+				{
+					UE_LOG(LogTemp, Error, TEXT("BenchRaster: pixel %d has a class but no instance"), i);
+					break;
+				}
+			}
+			UE_LOG(LogTemp, Display, TEXT("%-10s %10d %10.3f %10.1f"),
+			       *FString::Printf(TEXT("%dx%d"), Resolution.X, Resolution.Y), Rasterizer.GetNumBinnedTriangles(),
+			       RasterMs, 100.0 * NumCovered / ClassIds.Num());
+		}
+
+		// a closed mesh around the camera covers every pixel, whatever the clipping, tiling and fill rule
+		FLabelInstance Wall;
+		Wall.Mesh = Block;
+		Wall.LocalToWorld = FScaleMatrix(FVector(1e6)) * FTranslationMatrix(FVector(0.0, 0.0, 2e5));
+		Wall.ClassId = 1;
+		Wall.InstanceId = 1;
+		const FIntPoint Resolution = BenchResolutions[0];
+		TArray<uint8> ClassIds;
+		ClassIds.SetNumUninitialized(Resolution.X * Resolution.Y);
+		FLabelRasterizer Rasterizer;
+		Rasterizer.Rasterize(FReversedZPerspectiveMatrix(PI / 4.0f, Resolution.X, Resolution.Y, 10.0f), Resolution.X,
+		                     Resolution.Y, MakeArrayView(&Wall, 1), ClassIds.GetData(), nullptr);
+		if (!ensure(!ClassIds.Contains(0)))
+		{
+			UE_LOG(LogTemp, Error, TEXT("BenchRaster: a mesh around the camera leaves pixels uncovered"));
+		}
+	}
+
+	void BenchGrass()
+	{
+		// a 100 m lawn of dense grass, about 40 instances a square metre
+		constexpr double LawnSize = 10000.0;
+		constexpr int32 NumInstances = 400000;
+		FRandomStream Random(1234);
+		TArray<FVector> Locations;
+		Locations.SetNumUninitialized(NumInstances);
+		FGrassInstanceGrid Grid;
+		TArray<int32> Handles;
+		Handles.SetNumUninitialized(NumInstances);
+		const double BuildStart = FPlatformTime::Seconds();
+		for (int32 i = 0; i < NumInstances; i++)
+		{
+			Locations[i] = FVector(Random.FRandRange(0.0, LawnSize), Random.FRandRange(0.0, LawnSize), 0.0);
+			Handles[i] = Grid.Add(Locations[i], -5.0f, 20.0f);
+		}
+		const double BuildMs = (FPlatformTime::Seconds() - BuildStart) * 1000.0;
+
+		// the deck of a zero turn mower along a circle, one position a frame
+		TArray<FMowingDeck> Decks;
+		for (int32 Frame = 0; Frame < 600; Frame++)
+		{
+			const double Angle = 2.0 * PI * Frame / 600;
+			FMowingDeck& Deck = Decks.AddDefaulted_GetRef();
+			Deck.Center = FVector2D(LawnSize / 2) + 3000.0 * FVector2D(FMath::Cos(Angle), FMath::Sin(Angle));
+			Deck.Forward = FVector2D(-FMath::Sin(Angle), FMath::Cos(Angle));
+			Deck.HalfLength = 60.0;
+			Deck.HalfWidth = 80.0;
+			Deck.MinZ = 5.0;
+			Deck.MaxZ = 30.0;
+		}
+		TArray<int32> Found;
+		int64 NumFound = 0;
+		const double QueryMs = TimeMs(1, [&]()
+		{
+			NumFound = 0;
+			for (const FMowingDeck& Deck : Decks)
+			{
+				Found.Reset();
+				Grid.Query(Deck, Found);
+				NumFound += Found.Num();
+			}
+		}) / Decks.Num();
+		UE_LOG(LogTemp, Display, TEXT("Grass grid benchmark (%d instances in %d cells, %.1f MB)"), Grid.Num(),
+		       Grid.GetNumCells(), Grid.GetAllocatedSize() / (1024.0 * 1024.0));
+		UE_LOG(LogTemp, Display, TEXT("build %.1f ms, query %.4f ms per deck, %.1f instances per deck"), BuildMs,
+		       QueryMs, static_cast<double>(NumFound) / Decks.Num());
+
+		// the grid finds exactly what a scan of every instance finds, also after half of them are removed
+		for (int32 Pass = 0; Pass < 2; Pass++)
+		{
+			for (int32 Frame = 0; Frame < Decks.Num(); Frame += 10)
+			{
+				const FMowingDeck& Deck = Decks[Frame];
+				Found.Reset();
+				Grid.Query(Deck, Found);
+				Found.Sort();
+				TArray<int32> Expected;
+				for (int32 i = 0; i < NumInstances; i++)
+				{
+					const FVector2D Offset = FVector2D(Locations[i]) - Deck.Center;
+					const double Along = FVector2D::DotProduct(Offset, Deck.Forward);
+					const double Across = FVector2D::DotProduct(Offset, Deck.GetRight());
+					// clear of the edges, where the grid's float precision could decide either way
+					if (FMath::Abs(FMath::Abs(Along) - Deck.HalfLength) < 0.01 ||
+						FMath::Abs(FMath::Abs(Across) - Deck.HalfWidth) < 0.01)
+					{
+						Found.Remove(Handles[i]);
+						continue;
+					}
+					if (Handles[i] != INDEX_NONE && FMath::Abs(Along) <= Deck.HalfLength &&
+						FMath::Abs(Across) <= Deck.HalfWidth)
+					{
+						Expected.Add(Handles[i]);
+					}
+				}
+				if (!ensure(Found == Expected))
+				{
+					UE_LOG(LogTemp, Error, TEXT("BenchGrass: the grid found %d instances, a scan %d"), Found.Num(),
+					       Expected.Num());
+					return;
+				}
+			}
+			for (int32 i = 0; i < NumInstances; i += 2)
+			{
+				Grid.Remove(Handles[i]);
+				Handles[i] = INDEX_NONE;
+			}
+		}
+	}
+
+	void BenchCoverage()
+	{
+		// a hectare at 5 cm, mowed in stripes by a 1.2 m deck moving 10 cm a frame
+		constexpr double LawnSize = 10000.0;
+		FCoverageMap Map;
+		Map.Init(FBox2D(FVector2D(0.0), FVector2D(LawnSize)), 5.0);
+		TArray<FMowingDeck> Decks;
+		for (double StripeY = 60.0; StripeY < LawnSize; StripeY += 110.0)
+		{
+			const bool bBack = Decks.Num() % 2 != 0;
+			for (double X = 0.0; X <= LawnSize; X += 10.0)
+			{
+				FMowingDeck& Deck = Decks.AddDefaulted_GetRef();
+				Deck.Center = FVector2D(bBack ? LawnSize - X : X, StripeY + 5.0 * FMath::Sin(X / 300.0));
+				Deck.Forward = FVector2D(bBack ? -1.0 : 1.0, 0.05).GetSafeNormal();
+				Deck.HalfLength = 50.0;
+				Deck.HalfWidth = 60.0;
+			}
+		}
+		const double AddMs = TimeMs(1, [&]()
+		{
+			Map.Clear();
+			for (const FMowingDeck& Deck : Decks)
+			{
+				Map.AddDeck(Deck);
+			}
+		}) / Decks.Num();
+		double Fraction = 0.0;
+		const double FractionMs = TimeMs(100, [&]()
+		{
+			Fraction = Map.GetCoveredFraction(FBox2D(FVector2D(1234.5), FVector2D(8765.4)));
+		});
+		UE_LOG(LogTemp, Display, TEXT("Coverage map benchmark (%d x %d tiles, %.2f MB, %d decks)"), Map.GetNumTilesX(),
+		       Map.GetNumTilesY(), Map.GetAllocatedSize() / (1024.0 * 1024.0), Decks.Num());
+		UE_LOG(LogTemp, Display, TEXT("add deck %.2f us, region fraction %.1f us, covered %.1f %%, region %.1f %%"),
+		       AddMs * 1000.0, FractionMs * 1000.0, 100.0 * Map.GetCoveredFraction(), 100.0 * Fraction);
+
+		// the tile counts add up, and the whole lawn as a region is the total
+		int64 TileSum = 0;
+		for (int32 TileY = 0; TileY < Map.GetNumTilesY(); TileY++)
+		{
+			for (int32 TileX = 0; TileX < Map.GetNumTilesX(); TileX++)
+			{
+				TileSum += Map.GetTileCount(TileX, TileY);
+			}
+		}
+		const double WholeFraction = Map.GetCoveredFraction(FBox2D(FVector2D(-1.0), FVector2D(LawnSize + 1.0)));
+		if (!ensure(TileSum == Map.GetNumCovered() && FMath::IsNearlyEqual(WholeFraction, Map.GetCoveredFraction())))
+		{
+			UE_LOG(LogTemp, Error, TEXT("BenchCoverage: tiles count %lld, the map %lld"), TileSum, Map.GetNumCovered());
+			return;
+		}
+
+		// one deck marks the cells whose centres are inside it, give or take the ones on its edges
+		FMowingDeck Deck;
+		Deck.Center = FVector2D(3333.3, 4444.4);
+		Deck.Forward = FVector2D(0.6, 0.8);
+		Deck.HalfLength = 70.0;
+		Deck.HalfWidth = 90.0;
+		Map.Clear();
+		Map.AddDeck(Deck);
+		int64 NumInside = 0;
+		int64 NumOnEdges = 0;
+		for (double Y = 2.5; Y < LawnSize; Y += 5.0)
+		{
+			for (double X = 2.5; X < LawnSize; X += 5.0)
+			{
+				const FVector2D Offset = FVector2D(X, Y) - Deck.Center;
+				const double Along = FMath::Abs(FVector2D::DotProduct(Offset, Deck.Forward)) - Deck.HalfLength;
+				const double Across = FMath::Abs(FVector2D::DotProduct(Offset, Deck.GetRight())) - Deck.HalfWidth;
+				NumInside += Along < -1e-6 && Across < -1e-6;
+				NumOnEdges += FMath::Abs(Along) <= 1e-6 || FMath::Abs(Across) <= 1e-6;
+			}
+		}
+		if (!ensure(Map.GetNumCovered() >= NumInside && Map.GetNumCovered() <= NumInside + NumOnEdges))
+		{
+			UE_LOG(LogTemp, Error, TEXT("BenchCoverage: a deck marked %lld cells, %lld are inside it"),
+			       Map.GetNumCovered(), NumInside);
+			return;
+		}
+
+		// a 3 m/s run with a turn in place, mowed at 30 and at 120 ticks a second, with and without sweeping
+		auto MowRun = [&Map](int32 TicksPerSecond, bool bSweep)
+		{
+			Map.Clear();
+			FMowingDeck Previous;
+			TArray<FMowingArea> Areas;
+			for (int32 Tick = 0; Tick <= 6 * TicksPerSecond; Tick++)
+			{
+				const double Seconds = static_cast<double>(Tick) / TicksPerSecond;
+				// straight for 2 s, half a turn in 2 s, straight back
+				const double Angle = PI * FMath::Clamp(Seconds - 2.0, 0.0, 2.0) / 2.0;
+				const double Straight = 300.0 * (FMath::Min(Seconds, 2.0) - FMath::Max(Seconds - 4.0, 0.0));
+				FMowingDeck Deck;
+				Deck.Center = FVector2D(1000.0 + Straight, 1000.0);
+				Deck.Forward = FVector2D(FMath::Cos(Angle), FMath::Sin(Angle));
+				Deck.HalfLength = 50.0;
+				Deck.HalfWidth = 60.0;
+				Areas.Reset();
+				if (bSweep && Tick > 0)
+				{
+					FMowingArea::Sweep(Previous, Deck, FMath::DegreesToRadians(2.0), Areas);
+				}
+				else
+				{
+					Areas.Emplace(Deck);
+				}
+				for (const FMowingArea& Area : Areas)
+				{
+					Map.AddArea(Area);
+				}
+				Previous = Deck;
+			}
+			return Map.GetNumCovered();
+		};
+		const int64 Stepped30 = MowRun(30, false);
+		const int64 Stepped120 = MowRun(120, false);
+		const int64 Swept30 = MowRun(30, true);
+		const int64 Swept120 = MowRun(120, true);
+		UE_LOG(LogTemp, Display, TEXT("cells mowed at 30 / 120 ticks a second: stepped %lld / %lld, swept %lld / %lld"),
+		       Stepped30, Stepped120, Swept30, Swept120);
+		if (!ensure(FMath::Abs(Swept30 - Swept120) <= Swept120 / 1000))
+		{
+			UE_LOG(LogTemp, Error, TEXT("BenchCoverage: sweeping depends on the tick rate"));
+		}
+	}
+
+	FAutoConsoleCommand BenchClassifierCommand(
+		TEXT("Mower.Bench.Classifier"),
+		TEXT("Times the legacy TMap classifier against FSegmentationClassifier at 400x400 and 1920x1080"),
+		FConsoleCommandDelegate::CreateStatic(&BenchClassifier));
+
+	FAutoConsoleCommand BenchMasksCommand(
+		TEXT("Mower.Bench.Masks"),
+		TEXT("Times pixel lists against run-length masks at 400x400 and 1920x1080 and checks the masks decode exactly"),
+		FConsoleCommandDelegate::CreateStatic(&BenchMasks));
+
+	FAutoConsoleCommand BenchInstancesCommand(
+		TEXT("Mower.Bench.Instances"),
+		TEXT("Times gathering the pixel counts and bounds of instances at 400x400 and 1920x1080 and checks every "
+			"marked pixel is counted once"),
+		FConsoleCommandDelegate::CreateStatic(&BenchInstances));
+
+	FAutoConsoleCommand BenchRecorderCommand(
+		TEXT("Mower.Bench.Recorder"),
+		TEXT("Records 600 raw 400x400 frames to Saved/Recordings and reports the frame rate the disk sustains"),
+		FConsoleCommandDelegate::CreateStatic(&BenchRecorder));
+
+	FAutoConsoleCommand BenchReaderCommand(
+		TEXT("Mower.Bench.Reader"),
+		TEXT("Records 600 raw 400x400 frames, then maps them and reads them back in parallel shards"),
+		FConsoleCommandDelegate::CreateStatic(&BenchReader));
+
+	FAutoConsoleCommand BenchCodecsCommand(
+		TEXT("Mower.Bench.Codecs"),
+		TEXT("Times every plane codec on color, class id and depth planes at 400x400 and 1920x1080, in strips and "
+			"whole, and checks the lossless ones decode exactly"),
+		FConsoleCommandDelegate::CreateStatic(&BenchCodecs));
+
+	FAutoConsoleCommand BenchDeltasCommand(
+		TEXT("Mower.Bench.Deltas"),
+		TEXT("Sends 120 frames of a moving obstacle whole and as delta frames at 400x400 and 1920x1080, compares their "
+			"size and checks the delta frames are rebuilt exactly"),
+		FConsoleCommandDelegate::CreateStatic(&BenchDeltas));
+
+	FAutoConsoleCommand BenchObservationCommand(
+		TEXT("Mower.Bench.Observation"),
+		TEXT("Times packing 400x400 and 1920x1080 color images into 224x224 model tensors with every resize, layout and "
+			"precision, whole and cropped, and checks a flat image packs to its normalized color"),
+		FConsoleCommandDelegate::CreateStatic(&BenchObservation));
+
+	FAutoConsoleCommand BenchStreamsCommand(
+		TEXT("Mower.Bench.Streams"),
+		TEXT("Times shrinking a 1920x1080 frame's color, class ids and depth into streams 1 to 16 times smaller and "
+			"reports the size of their LZ4 color planes"),
+		FConsoleCommandDelegate::CreateStatic(&BenchStreams));
+
+	FAutoConsoleCommand BenchRasterCommand(
+		TEXT("Mower.Bench.Raster"),
+		TEXT("Times drawing 200 trees and walls into class and instance id maps on the CPU at 400x400 and 1920x1080 "
+			"and checks a mesh around the camera covers every pixel"),
+		FConsoleCommandDelegate::CreateStatic(&BenchRaster));
+
+	FAutoConsoleCommand BenchGrassCommand(
+		TEXT("Mower.Bench.Grass"),
+		TEXT("Times building a grid of 400000 grass instances and querying it with a mower deck, and checks it finds "
+			"what a scan of every instance finds"),
+		FConsoleCommandDelegate::CreateStatic(&BenchGrass));
+
+	FAutoConsoleCommand BenchCoverageCommand(
+		TEXT("Mower.Bench.Coverage"),
+		TEXT("Times adding mower decks to a coverage map of a hectare at 5 cm and the covered fraction of a region, "
+			"checks the tile counts and a deck's cells, and compares mowing at 30 and 120 ticks a second"),
+		FConsoleCommandDelegate::CreateStatic(&BenchCoverage));
+}
@@ -10,19 +10,60 @@
 #include "Kismet/GameplayStatics.h"
 #include "Async/ParallelFor.h"
 #include "Engine/SceneCapture2D.h"
+#include "MowerVehicleMovementComponent.h"
+#include "RecordingReader.h"
+#include "HAL/PlatformFileManager.h"
+#include "Misc/Paths.h"
+#include "CaptureProjection.h"
+#include "SegmentationClassTable.h"
+#include "TaggedActorRegistry.h"
 
 class UCameraComponent;
 
 UCaptureManager::UCaptureManager()
 {
 	PrimaryComponentTick.bCanEverTick = true;
+
+	SegmentationClasses = {
+		FSegmentationClassDefinition(133, TEXT("Wall"), FColor(255, 0, 0, 255)),
+		FSegmentationClassDefinition(250, TEXT("Tree"), FColor(0, 0, 255, 255))
+	};
 }
 
 // Called when the game starts
 void UCaptureManager::BeginPlay()
 {
 	Super::BeginPlay();
-	
+
+	Classifier.Build(ClassTable ? TConstArrayView<FSegmentationClassDefinition>(ClassTable->Classes)
+	                            : TConstArrayView<FSegmentationClassDefinition>(SegmentationClasses));
+	if (UTaggedActorRegistry* Registry = GetWorld()->GetSubsystem<UTaggedActorRegistry>())
+	{
+		Registry->SetClasses(Classifier, ClassTable && ClassTable->bStampActors);
+	}
+	if (!SensorRig && GetOwner())
+	{
+		SensorRig = GetOwner()->FindComponentByClass<UCaptureSensorRig>();
+	}
+	FrameCodecs.Build();
+	// before the pool, the pipeline only gets a decode stage when replaying
+	OpenReplay();
+	InitRenderRequestPool();
+	OpenFrameRing();
+	if (!ReplayReader)
+	{
+		OpenRecorder();
+	}
+	Scheduler.Reset(GetWorld()->GetTimeSeconds());
+	UnacknowledgedFrameIds.Reset();
+	bServerAcknowledges = false;
+	BindFrameAcknowledgements();
+
+	if (ReplayReader)
+	{
+		// replayed frames don't need the captures
+		return;
+	}
 	if (!ColorCapture.IsValid())
 	{
 		if (!ColorCapture.IsValid())
@@ -34,6 +75,726 @@ void UCaptureManager::BeginPlay()
 
 	SetupColorCaptureComponent(ColorCapture.Get());
 	SetupSegmentationCaptureComponent(ColorCapture.Get());
+	if (SegmentationSource == ESegmentationSource::CpuRaster && SegmentationCapture)
+	{
+		// only its render target's size is used
+		SegmentationCapture->GetCaptureComponent2D()->bCaptureEveryFrame = false;
+	}
+	if (bCaptureDepth)
+	{
+		SetupDepthCaptureComponent(ColorCapture.Get());
+	}
+}
+
+void UCaptureManager::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	// the render thread and the pipeline write into the pooled buffers, so they have to outlive both
+	for (FRenderRequest& RenderRequest : RenderRequestPool)
+	{
+		if (RenderRequest.State == ERenderRequestState::InFlight)
+		{
+			RenderRequest.RenderFence.Wait();
+		}
+	}
+	// frames the pipeline finished since the last tick are dropped unsent
+	Pipeline.Reset();
+	FrameRing.Reset();
+	// writes the queued chunks and the index
+	Recorder.Reset();
+	CloseReplay();
+	ReleasedRenderRequests.Empty();
+	FreeRenderRequests.Empty();
+	PendingReadbacks.Empty();
+	ProcessingFrames.Empty();
+	RenderRequestPool.Empty();
+	InFlightRenderRequests = 0;
+	ProcessingRenderRequests = 0;
+
+	Super::EndPlay(EndPlayReason);
+}
+
+/**
+ * @brief Allocates the render request pool and sizes the buffers the pipeline writes once, so processing a frame
+ * reuses them. The readbacks still allocate, ReadSurfaceData empties and resizes the images it reads into.
+ * Also starts the pipeline that processes the frames off the game thread.
+ */
+void UCaptureManager::InitRenderRequestPool()
+{
+	const int32 NumPixels = CaptureResolution.X * CaptureResolution.Y;
+	RenderRequestPool.SetNum(FMath::Max(RenderRequestPoolSize, 1));
+	for (FRenderRequest& RenderRequest : RenderRequestPool)
+	{
+		RenderRequest.Image1.SetNumUninitialized(NumPixels);
+		RenderRequest.Image2.SetNumUninitialized(NumPixels);
+		if (bCaptureDepth)
+		{
+			RenderRequest.SceneDepth.SetNumUninitialized(NumPixels);
+			RenderRequest.DepthMm.SetNumUninitialized(NumPixels);
+		}
+		RenderRequest.ClassIds.SetNumUninitialized(NumPixels);
+		if (SensorRig)
+		{
+			SensorRig->InitViews(RenderRequest.SensorViews);
+		}
+		InitStreamFrames(RenderRequest.Streams);
+		RenderRequest.State = ERenderRequestState::Free;
+	}
+	FreeRenderRequests.Reset();
+	PendingReadbacks.Reset();
+	ProcessingFrames.Reset();
+	// popped from the back, so slots are taken in pool order
+	for (int32 i = RenderRequestPool.Num() - 1; i >= 0; i--)
+	{
+		FreeRenderRequests.Add(&RenderRequestPool[i]);
+	}
+	InFlightRenderRequests = 0;
+	ProcessingRenderRequests = 0;
+	DroppedFrameCount = 0;
+
+	// the CPU stages are timed so the scheduler knows what a capture costs
+	auto TimedStage = [this](void (UCaptureManager::*Stage)(FRenderRequest&) const)
+	{
+		return [this, Stage](FRenderRequest& Frame)
+		{
+			if (Frame.bSkipped)
+			{
+				return;
+			}
+			const double Start = FPlatformTime::Seconds();
+			(this->*Stage)(Frame);
+			Frame.ProcessingSeconds += FPlatformTime::Seconds() - Start;
+		};
+	};
+	FCapturePipeline::FStages Stages;
+	if (ReplayReader)
+	{
+		Stages.Decode = TimedStage(&UCaptureManager::DecodeReplayFrame);
+	}
+	Stages.Classify = TimedStage(&UCaptureManager::ClassifyFrame);
+	Stages.Delta = TimedStage(&UCaptureManager::DiffFrame);
+	Stages.Encode = TimedStage(&UCaptureManager::EncodeImages);
+	Stages.Serialize = TimedStage(&UCaptureManager::SerializeFrame);
+	Stages.Send = [this](FRenderRequest& Frame)
+	{
+		if (Frame.bSkipped)
+		{
+			return;
+		}
+		WriteFrameRing(Frame);
+		RecordFrame(Frame);
+	};
+	Stages.Release = [this](FRenderRequest& Frame) { ReleasedRenderRequests.Enqueue(&Frame); };
+	Pipeline = MakeUnique<FCapturePipeline>(NumPipelineWorkers, MoveTemp(Stages));
+}
+
+/**
+ * @brief Sizes a pooled render request's stream frames for CaptureResolution. Stream views follow the sensor rig's.
+ */
+void UCaptureManager::InitStreamFrames(TArray<FCaptureStreamFrame>& OutStreams) const
+{
+	const int32 FirstView = 1 + (SensorRig ? SensorRig->Sensors.Num() : 0);
+	const int32 NumStreams = FMath::Clamp(MAX_uint8 + 1 - FirstView, 0, Streams.Num());
+	if (NumStreams < Streams.Num())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("InitStreamFrames: only %d of %d streams fit next to the sensor views"),
+		       NumStreams, Streams.Num());
+	}
+	OutStreams.SetNum(NumStreams);
+	for (int32 i = 0; i < NumStreams; i++)
+	{
+		const FCaptureStreamSettings& Settings = Streams[i];
+		FCaptureStreamFrame& Stream = OutStreams[i];
+		Stream.bDue = false;
+		Stream.bClassIds = Settings.bClassIds;
+		Stream.bDepth = Settings.bDepth;
+		Stream.Codec = Settings.Codec;
+		Stream.Name = Settings.Name.ToString();
+		Stream.Info.View = static_cast<uint8>(FirstView + i);
+		Stream.Info.Downsample = static_cast<uint8>(FMath::Clamp(Settings.Downsample, 1, CaptureStreams::MaxDownsample));
+		Stream.Info.RateDivisor = static_cast<uint16>(FMath::Clamp(Settings.RateDivisor, 1, MAX_uint16));
+
+		const FIntPoint Size = CaptureStreams::GetSize(CaptureResolution.X, CaptureResolution.Y, Stream.Info.Downsample);
+		const int32 NumPixels = Size.X * Size.Y;
+		Stream.Color.SetNumUninitialized(NumPixels);
+		if (Stream.bClassIds)
+		{
+			Stream.ClassIds.SetNumUninitialized(NumPixels);
+		}
+		if (Stream.bDepth && bCaptureDepth)
+		{
+			Stream.DepthMm.SetNumUninitialized(NumPixels);
+		}
+	}
+}
+
+/**
+ * @brief Snapshots the camera and the tagged actors in its frustum for the CpuRaster source, the pipeline draws them
+ * later without touching the world
+ */
+void UCaptureManager::GatherLabelInstances(USceneCaptureComponent2D* CaptureComponent, FRenderRequest& RenderRequest)
+{
+	const FCaptureProjection Projection(CaptureComponent, FIntPoint(RenderRequest.Width, RenderRequest.Height));
+	RenderRequest.LabelViewProjection = Projection.GetViewProjection();
+
+	const UTaggedActorRegistry* Registry = GetWorld()->GetSubsystem<UTaggedActorRegistry>();
+	if (!Registry)
+	{
+		return;
+	}
+	TArray<const FTaggedActor*> Visible;
+	Registry->QueryFrustum(Projection.GetFrustum(), Visible);
+	for (const FTaggedActor* Tagged : Visible)
+	{
+		const UStaticMeshComponent* MeshComponent = Tagged->MeshComponent.Get();
+		const UStaticMesh* StaticMesh = MeshComponent ? MeshComponent->GetStaticMesh() : nullptr;
+		if (!StaticMesh || !MeshComponent->IsVisible())
+		{
+			continue;
+		}
+		FLabelInstance& Instance = RenderRequest.LabelInstances.AddDefaulted_GetRef();
+		Instance.Mesh = LabelMeshCache.Get(StaticMesh, FMath::Clamp(LabelMeshLOD, 0, StaticMesh->GetNumLODs() - 1));
+		Instance.LocalToWorld = MeshComponent->GetComponentTransform().ToMatrixWithScale();
+		Instance.ClassId = Tagged->ClassId;
+		Instance.InstanceId = Tagged->InstanceId;
+	}
+}
+
+/**
+ * @brief Maps the shared memory frame ring of this instance. Frames fall back to the socket if this fails.
+ */
+void UCaptureManager::OpenFrameRing()
+{
+	if (Transport != ECaptureTransport::SharedMemory)
+	{
+		return;
+	}
+	if (WireFormat != ECaptureWireFormat::Binary)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("OpenFrameRing: the shared memory transport needs the Binary wire format"));
+		return;
+	}
+	FrameRing = MakeUnique<FSharedMemoryFrameRing>();
+	if (!FrameRing->Open(TEXT("mower_frames_") + InstanceName, SharedMemoryRingSlots,
+	                     SharedMemorySlotSizeMB * 1024 * 1024))
+	{
+		FrameRing.Reset();
+	}
+}
+
+/**
+ * @brief Starts the recording of this instance. Frames are only sent if this fails.
+ */
+void UCaptureManager::OpenRecorder()
+{
+	if (!bRecord)
+	{
+		return;
+	}
+	const FString Directory = RecordingDirectory.IsEmpty()
+		                          ? FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Recordings"))
+		                          : RecordingDirectory;
+	const FString Path = FPaths::Combine(Directory, FString::Printf(
+		                                     TEXT("%s_%s.mwrec"), *InstanceName, *FDateTime::Now().ToString()));
+	Recorder = MakeUnique<FFrameRecorder>();
+	if (!Recorder->Open(Path, InstanceName, RecordingChunkSizeMB * 1024 * 1024, RecordingMaxQueuedChunks))
+	{
+		Recorder.Reset();
+	}
+}
+
+/**
+ * @brief Pose, velocities and throttles of the vehicle that owns this component
+ */
+void UCaptureManager::GetVehicleState(FrameRecording::FVehicleState& OutState) const
+{
+	FMemory::Memzero(OutState);
+	const AActor* Owner = GetOwner();
+	if (!Owner)
+	{
+		return;
+	}
+	auto Store = [](float* Dst, const FVector& Value)
+	{
+		Dst[0] = Value.X;
+		Dst[1] = Value.Y;
+		Dst[2] = Value.Z;
+	};
+	const FRotator Rotation = Owner->GetActorRotation();
+	Store(OutState.Location, Owner->GetActorLocation());
+	Store(OutState.Rotation, FVector(Rotation.Pitch, Rotation.Yaw, Rotation.Roll));
+	Store(OutState.Velocity, Owner->GetVelocity());
+	if (const UPrimitiveComponent* Root = Cast<UPrimitiveComponent>(Owner->GetRootComponent()))
+	{
+		Store(OutState.AngularVelocity, Root->GetPhysicsAngularVelocityInDegrees());
+	}
+	if (const UMowerVehicleMovementComponent* Movement = Owner->FindComponentByClass<UMowerVehicleMovementComponent>())
+	{
+		OutState.LeftThrottle = Movement->GetLeftThrottleInput();
+		OutState.RightThrottle = Movement->GetRightThrottleInput();
+	}
+}
+
+void UCaptureManager::RecordAction(uint64 FrameId, float LeftThrottle, float RightThrottle)
+{
+	if (!Recorder)
+	{
+		return;
+	}
+	const FrameRecording::FAction Action = {LeftThrottle, RightThrottle};
+	Recorder->AppendStruct(FrameRecording::ERecordKind::Action, FrameId, GetWorld()->GetTimeSeconds(), Action);
+}
+
+/**
+ * @brief Maps ReplayRecording and indexes its frames. The manager captures as usual if this fails.
+ */
+void UCaptureManager::OpenReplay()
+{
+	if (ReplayRecording.IsEmpty())
+	{
+		return;
+	}
+	ReplayFile.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*ReplayRecording));
+	if (ReplayFile)
+	{
+		ReplayRegion.Reset(ReplayFile->MapRegion());
+	}
+	const int Result = ReplayRegion
+		                   ? mwrec_open_memory(ReplayRegion->GetMappedPtr(), ReplayRegion->GetMappedSize(),
+		                                       &ReplayReader)
+		                   : MWREC_ERROR_IO;
+	if (Result != MWREC_OK)
+	{
+		UE_LOG(LogTemp, Error, TEXT("OpenReplay: %s: %hs"), *ReplayRecording, mwrec_error_string(Result));
+		CloseReplay();
+		return;
+	}
+	UE_LOG(LogTemp, Display, TEXT("OpenReplay: replaying %llu frames of %s%s"),
+	       mwrec_count(ReplayReader, MWREC_RECORD_FRAME), *ReplayRecording,
+	       mwrec_is_complete(ReplayReader) ? TEXT("") : TEXT(", which was not closed"));
+	NextReplayFrame = 0;
+	ReplayDecoder.Reset();
+	bReplayRestart = false;
+	ReplayedFrameCount = 0;
+	bReplayFinished = false;
+	ReplayStartTime = GetWorld()->GetTimeSeconds();
+	ReplayStartSeconds = FPlatformTime::Seconds();
+	mwrec_record First;
+	ReplayFirstTimestamp = mwrec_get(ReplayReader, MWREC_RECORD_FRAME, 0, &First) == MWREC_OK ? First.timestamp : 0.0;
+}
+
+void UCaptureManager::CloseReplay()
+{
+	mwrec_close(ReplayReader);
+	ReplayReader = nullptr;
+	ReplayRegion.Reset();
+	ReplayFile.Reset();
+}
+
+/**
+ * @brief Feeds recorded frames into free render request slots and hands them straight to the pipeline, in place of
+ * the capture and readback. The pipeline's decode stage turns them into images.
+ */
+void UCaptureManager::ReplayFrames()
+{
+	const uint64 NumFrames = mwrec_count(ReplayReader, MWREC_RECORD_FRAME);
+	while (!bReplayFinished && FreeRenderRequests.Num() > 0)
+	{
+		if (NextReplayFrame == NumFrames)
+		{
+			if (bLoopReplay && NumFrames > 0)
+			{
+				NextReplayFrame = 0;
+				bReplayRestart = true;
+				ReplayStartTime = GetWorld()->GetTimeSeconds();
+				continue;
+			}
+			// once the last frame is through the pipeline, so the rate is the pipeline's
+			if (ProcessingRenderRequests == 0)
+			{
+				const double Seconds = FPlatformTime::Seconds() - ReplayStartSeconds;
+				UE_LOG(LogTemp, Display, TEXT("ReplayFrames: replayed %d frames in %.2f s, %.1f frames/s"),
+				       ReplayedFrameCount, Seconds, ReplayedFrameCount / FMath::Max(Seconds, UE_SMALL_NUMBER));
+				bReplayFinished = true;
+			}
+			break;
+		}
+
+		mwrec_record Record;
+		const int Result = mwrec_get(ReplayReader, MWREC_RECORD_FRAME, NextReplayFrame, &Record);
+		if (Result != MWREC_OK)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("ReplayFrames: record %llu: %hs, skipped"), NextReplayFrame,
+			       mwrec_error_string(Result));
+			NextReplayFrame++;
+			continue;
+		}
+		const double Elapsed = GetWorld()->GetTimeSeconds() - ReplayStartTime;
+		if (ReplaySpeed > 0.0f && Record.timestamp - ReplayFirstTimestamp > Elapsed * ReplaySpeed)
+		{
+			break;
+		}
+
+		FRenderRequest* RenderRequest = AcquireRenderRequest();
+		check(RenderRequest);
+		// the mapping outlives the pipeline, see EndPlay
+		RenderRequest->ReplayRecord = TConstArrayView<uint8>(Record.data, static_cast<int32>(Record.size));
+		RenderRequest->ReplayIndex = NextReplayFrame++;
+		RenderRequest->bReplayRestart = bReplayRestart;
+		bReplayRestart = false;
+		// there is no readback, its fence was never begun
+		SubmitOldestInFlightRenderRequest();
+	}
+}
+
+/**
+ * @brief Parses a replayed frame, rebuilds its delta planes and fills the images the other stages start from. Runs
+ * one frame at a time in submission order, since delta planes are rebuilt from the frames before them.
+ */
+void UCaptureManager::DecodeReplayFrame(FRenderRequest& Frame) const
+{
+	if (Frame.bReplayRestart)
+	{
+		ReplayDecoder.Reset();
+	}
+	if (!FrameWire::Read(Frame.ReplayRecord, ReplayFrame))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("ReplayFrames: record %llu is not a frame of this version, skipped"),
+		       Frame.ReplayIndex);
+		Frame.bSkipped = true;
+		return;
+	}
+	if (!ReplayDecoder.Decode(ReplayFrame, FrameCodecs))
+	{
+		// the frames up to the next keyframe fail the same way
+		UE_LOG(LogTemp, Warning, TEXT("ReplayFrames: frame %llu could not be decoded, skipped"),
+		       ReplayFrame.Info.FrameId);
+		Frame.bSkipped = true;
+		return;
+	}
+	FillReplayRequest(ReplayFrame, Frame);
+}
+
+/**
+ * @brief Turns a recorded frame back into the readbacks the pipeline starts from: class ids become segmentation marks,
+ * millimetre or half float depth becomes centimetres. Missing planes are left zeroed. Sensor rig views aren't replayed.
+ */
+void UCaptureManager::FillReplayRequest(const FrameWire::FFrameView& Frame, FRenderRequest& RenderRequest) const
+{
+	const int32 NumPixels = Frame.Info.Width * Frame.Info.Height;
+	RenderRequest.isPNG = true;
+	// the recorded marks are the labels, without instances
+	RenderRequest.SegmentationSource = ESegmentationSource::PostProcess;
+	RenderRequest.bInstanceSegmentation = false;
+	RenderRequest.FrameId = Frame.Info.FrameId;
+	RenderRequest.CaptureTime = Frame.Info.Timestamp;
+	RenderRequest.Width = Frame.Info.Width;
+	RenderRequest.Height = Frame.Info.Height;
+	RenderRequest.Image1.SetNumUninitialized(NumPixels, false);
+	RenderRequest.Image2.SetNumUninitialized(NumPixels, false);
+
+	FrameWire::EPixelFormat PixelFormat = FrameWire::EPixelFormat::BGRA8;
+	TConstArrayView<uint8> Pixels = GetReplayPlanePixels(Frame, FrameWire::EPlaneKind::ClassIds, PixelFormat);
+	if (Pixels.Num() == NumPixels)
+	{
+		for (int32 i = 0; i < NumPixels; i++)
+		{
+			const int32 ClassId = Pixels[i];
+			const uint8 Mark = ClassId < Classifier.GetNumClasses() ? Classifier.GetClassMark(ClassId) : 0;
+			RenderRequest.Image1[i] = FColor(Mark, 0, 0, 255);
+		}
+	}
+	else
+	{
+		Pixels = GetReplayPlanePixels(Frame, FrameWire::EPlaneKind::SegmentationMarks, PixelFormat);
+		if (Pixels.Num() == NumPixels * static_cast<int32>(sizeof(FColor)))
+		{
+			FMemory::Memcpy(RenderRequest.Image1.GetData(), Pixels.GetData(), Pixels.Num());
+		}
+		else
+		{
+			FMemory::Memzero(RenderRequest.Image1.GetData(), NumPixels * sizeof(FColor));
+		}
+	}
+
+	Pixels = GetReplayPlanePixels(Frame, FrameWire::EPlaneKind::Color, PixelFormat);
+	if (Pixels.Num() == NumPixels * static_cast<int32>(sizeof(FColor)))
+	{
+		FMemory::Memcpy(RenderRequest.Image2.GetData(), Pixels.GetData(), Pixels.Num());
+	}
+	else
+	{
+		FMemory::Memzero(RenderRequest.Image2.GetData(), NumPixels * sizeof(FColor));
+	}
+
+	Pixels = GetReplayPlanePixels(Frame, FrameWire::EPlaneKind::Depth, PixelFormat);
+	RenderRequest.bCaptureDepth = Pixels.Num() == NumPixels * static_cast<int32>(sizeof(uint16));
+	if (RenderRequest.bCaptureDepth)
+	{
+		RenderRequest.SceneDepth.SetNumUninitialized(NumPixels, false);
+		if (PixelFormat == FrameWire::EPixelFormat::R16F)
+		{
+			const FFloat16* DepthM = reinterpret_cast<const FFloat16*>(Pixels.GetData());
+			for (int32 i = 0; i < NumPixels; i++)
+			{
+				RenderRequest.SceneDepth[i].R = DepthM[i].GetFloat() * 100.0f;
+			}
+		}
+		else
+		{
+			// NoDepthMm comes back as 6553.5 cm, which packs to NoDepthMm again
+			const uint16* DepthMm = reinterpret_cast<const uint16*>(Pixels.GetData());
+			for (int32 i = 0; i < NumPixels; i++)
+			{
+				RenderRequest.SceneDepth[i].R = DepthMm[i] * 0.1f;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Pixels of the main camera's plane of Kind, planes are already decoded by ReplayDecoder. Empty if the frame
+ * has no such plane or its size doesn't match the pixel format.
+ */
+TConstArrayView<uint8> UCaptureManager::GetReplayPlanePixels(const FrameWire::FFrameView& Frame,
+                                                             FrameWire::EPlaneKind Kind,
+                                                             FrameWire::EPixelFormat& OutPixelFormat)
+{
+	const FrameWire::FPlane* Plane = Frame.Planes.FindByPredicate([Kind](const FrameWire::FPlane& Candidate)
+	{
+		return Candidate.Kind == Kind && Candidate.View == 0;
+	});
+	if (!Plane)
+	{
+		return {};
+	}
+	OutPixelFormat = Plane->PixelFormat;
+	if (Plane->Data.Num() != Plane->Width * Plane->Height * FrameWire::BytesPerPixel(Plane->PixelFormat))
+	{
+		return {};
+	}
+	return Plane->Data;
+}
+
+/**
+ * @brief Returns a free slot of the pool, applying OverflowPolicy when all slots are in use
+ * @return nullptr if the new capture should be dropped
+ */
+FRenderRequest* UCaptureManager::AcquireRenderRequest()
+{
+	if (RenderRequestPool.Num() == 0)
+	{
+		return nullptr;
+	}
+	if (FreeRenderRequests.Num() == 0)
+	{
+		switch (OverflowPolicy)
+		{
+		case ECaptureOverflowPolicy::DropNewest:
+			DroppedFrameCount++;
+			return nullptr;
+		case ECaptureOverflowPolicy::DropOldest:
+			DroppedFrameCount++;
+			// a frame the pipeline is already working on can't be taken back, so only a pending readback is dropped
+			if (PendingReadbacks.Num() == 0)
+			{
+				return nullptr;
+			}
+			DiscardOldestInFlightRenderRequest();
+			break;
+		case ECaptureOverflowPolicy::BlockCapture:
+			if (ProcessingFrames.Num() == 0)
+			{
+				SubmitOldestInFlightRenderRequest();
+			}
+			// frames are released in order, so the oldest one frees the first slot
+			ProcessingFrames[0]->ReleaseTask.Wait();
+			CollectReleasedRenderRequests();
+			break;
+		}
+	}
+
+	FRenderRequest& RenderRequest = *FreeRenderRequests.Pop(false);
+	check(RenderRequest.State == ERenderRequestState::Free);
+	RenderRequest.State = ERenderRequestState::InFlight;
+	RenderRequest.FrameId = NextFrameId++;
+	RenderRequest.CaptureTime = GetWorld()->GetTimeSeconds();
+	RenderRequest.ProcessingSeconds = 0.0;
+	RenderRequest.WireFormat = WireFormat;
+	RenderRequest.Transport = Transport;
+	RenderRequest.SegmentationOutput = SegmentationOutput;
+	RenderRequest.SegmentationSource = SegmentationSource;
+	RenderRequest.LabelInstances.Reset();
+	RenderRequest.MaskEncoding = MaskEncoding;
+	if (bInstanceSegmentation && SegmentationSource != ESegmentationSource::CpuRaster)
+	{
+		// the shipped segmentation material only writes the class mark, G and B would decode to bogus ids
+		UE_LOG(LogTemp, Error, TEXT("bInstanceSegmentation needs the CpuRaster segmentation source, turning it off"));
+		bInstanceSegmentation = false;
+	}
+	RenderRequest.bInstanceSegmentation = bInstanceSegmentation;
+	RenderRequest.bCaptureDepth = bCaptureDepth && DepthCapture != nullptr;
+	RenderRequest.DepthPlaneEncoding = DepthPlaneEncoding;
+	RenderRequest.DepthPercentile = DepthPercentile;
+	RenderRequest.PlaneCodecs = PlaneCodecs;
+	RenderRequest.PlaneDeltas = PlaneDeltas;
+	RenderRequest.Observation = Observation;
+	if (WireFormat != ECaptureWireFormat::Binary)
+	{
+		// the json format only serializes a binary frame for the recording, which keeps its planes raw
+		RenderRequest.PlaneCodecs.Color = EFrameCodec::Raw;
+		RenderRequest.PlaneCodecs.Segmentation = EFrameCodec::Raw;
+		RenderRequest.PlaneCodecs.Depth = EFrameCodec::Raw;
+	}
+	RenderRequest.bRecord = Recorder.IsValid();
+	if (RenderRequest.bRecord)
+	{
+		GetVehicleState(RenderRequest.VehicleState);
+	}
+	// the json format has always sent the recolored image
+	RenderRequest.bRecolor = bRecolorDebugImage || WireFormat == ECaptureWireFormat::JsonBase64;
+	for (FCaptureSensorView& View : RenderRequest.SensorViews)
+	{
+		View.bCaptured = false;
+	}
+	// like the sensor rig, the json format doesn't carry streams
+	const bool bBinary = WireFormat == ECaptureWireFormat::Binary;
+	RenderRequest.bFullResolution = !bBinary || RenderRequest.FrameId % FMath::Max(FullResolutionRateDivisor, 1) == 0;
+	for (FCaptureStreamFrame& Stream : RenderRequest.Streams)
+	{
+		Stream.bDue = bBinary && RenderRequest.FrameId % Stream.Info.RateDivisor == 0;
+	}
+	PendingReadbacks.Add(&RenderRequest);
+	InFlightRenderRequests++;
+	return &RenderRequest;
+}
+
+/**
+ * @brief Waits for the oldest readback to land and hands it to the pipeline
+ */
+void UCaptureManager::SubmitOldestInFlightRenderRequest()
+{
+	FRenderRequest& RenderRequest = *PendingReadbacks[0];
+	PendingReadbacks.RemoveAt(0, 1, false);
+	RenderRequest.RenderFence.Wait();
+	RenderRequest.State = ERenderRequestState::Processing;
+	InFlightRenderRequests--;
+	ProcessingFrames.Add(&RenderRequest);
+	ProcessingRenderRequests++;
+	RenderRequest.ReleaseTask = Pipeline->Submit(RenderRequest);
+}
+
+/**
+ * @brief Waits for the oldest readback to land and returns its slot to the pool without processing it
+ */
+void UCaptureManager::DiscardOldestInFlightRenderRequest()
+{
+	FRenderRequest& RenderRequest = *PendingReadbacks[0];
+	PendingReadbacks.RemoveAt(0, 1, false);
+	RenderRequest.RenderFence.Wait();
+	RenderRequest.State = ERenderRequestState::Free;
+	FreeRenderRequests.Add(&RenderRequest);
+	InFlightRenderRequests--;
+}
+
+/**
+ * @brief Sends the frames the pipeline is done with to the server and returns them to the pool. They come back in the
+ * order they were submitted.
+ */
+void UCaptureManager::CollectReleasedRenderRequests()
+{
+	FRenderRequest* RenderRequest = nullptr;
+	while (ReleasedRenderRequests.Dequeue(RenderRequest))
+	{
+		check(RenderRequest == ProcessingFrames[0]);
+		ProcessingFrames.RemoveAt(0, 1, false);
+		// the slot is still the frame's until it is freed below, so its wire data is sent without a copy
+		if (!RenderRequest->bSkipped)
+		{
+			SendImageToServer(*RenderRequest);
+			ReplayedFrameCount += RenderRequest->ReplayRecord.Num() > 0 ? 1 : 0;
+		}
+		RenderRequest->ReplayRecord = {};
+		RenderRequest->bSkipped = false;
+		RenderRequest->ReleaseTask = {};
+		RenderRequest->State = ERenderRequestState::Free;
+		FreeRenderRequests.Add(RenderRequest);
+		ProcessingRenderRequests--;
+
+		Scheduler.OnFrameProcessed(RenderRequest->ProcessingSeconds);
+		// a server that doesn't acknowledge would grow this forever
+		if (UnacknowledgedFrameIds.Num() >= MaxTrackedUnacknowledgedFrames)
+		{
+			UnacknowledgedFrameIds.RemoveAt(0, UnacknowledgedFrameIds.Num() / 2, false);
+		}
+		UnacknowledgedFrameIds.Add(RenderRequest->FrameId);
+	}
+}
+
+/**
+ * @brief Listens for "frameAck" {name, frame_id}, which the server sends once it has consumed a frame, and
+ * "requestKeyframe" {name}, which it sends when it can't rebuild a delta frame because it missed an earlier one
+ */
+void UCaptureManager::BindFrameAcknowledgements()
+{
+	if (!SIOClientComponent)
+	{
+		return;
+	}
+	TWeakObjectPtr<UCaptureManager> WeakThis(this);
+	SIOClientComponent->OnNativeEvent(TEXT("frameAck"), [WeakThis](const FString& Event,
+	                                                              const TSharedPtr<FJsonValue>& Message)
+	{
+		UCaptureManager* This = WeakThis.Get();
+		const TSharedPtr<FJsonObject>* JsonObject;
+		if (!This || !Message.IsValid() || !Message->TryGetObject(JsonObject))
+		{
+			return;
+		}
+		// every instance gets every acknowledgement
+		FString Name;
+		double FrameId;
+		if ((*JsonObject)->TryGetStringField(TEXT("name"), Name) && Name == This->InstanceName &&
+			(*JsonObject)->TryGetNumberField(TEXT("frame_id"), FrameId))
+		{
+			This->OnFrameAcknowledged(static_cast<uint64>(FrameId));
+		}
+	});
+	SIOClientComponent->OnNativeEvent(TEXT("requestKeyframe"), [WeakThis](const FString& Event,
+	                                                                     const TSharedPtr<FJsonValue>& Message)
+	{
+		UCaptureManager* This = WeakThis.Get();
+		const TSharedPtr<FJsonObject>* JsonObject;
+		FString Name;
+		if (This && Message.IsValid() && Message->TryGetObject(JsonObject) &&
+			(*JsonObject)->TryGetStringField(TEXT("name"), Name) && Name == This->InstanceName)
+		{
+			This->DeltaEncoder.RequestKeyframe();
+		}
+	});
+}
+
+void UCaptureManager::OnFrameAcknowledged(uint64 FrameId)
+{
+	bServerAcknowledges = true;
+	// acknowledging a frame acknowledges everything sent before it, so lost acknowledgements don't pile up
+	int32 NumAcknowledged = 0;
+	while (NumAcknowledged < UnacknowledgedFrameIds.Num() && UnacknowledgedFrameIds[NumAcknowledged] <= FrameId)
+	{
+		NumAcknowledged++;
+	}
+	UnacknowledgedFrameIds.RemoveAt(0, NumAcknowledged, false);
+}
+
+/**
+ * @brief Hands every readback whose fence has completed to the pipeline, oldest first
+ */
+void UCaptureManager::DrainCompletedRenderRequests()
+{
+	CollectReleasedRenderRequests();
+	while (PendingReadbacks.Num() > 0 && PendingReadbacks[0]->RenderFence.IsFenceComplete())
+	{
+		SubmitOldestInFlightRenderRequest();
+	}
 }
 
 /**
@@ -44,7 +805,7 @@ void UCaptureManager::SetupColorCaptureComponent(ASceneCapture2D* ParamCapture)
 	// scene capture component render target (stores frame that is then pulled from gpu to cpu)
 	UTextureRenderTarget2D* RenderTarget2D = NewObject<UTextureRenderTarget2D>();
 	RenderTarget2D->InitAutoFormat(256, 256); // some random format, got crashing otherwise
-	RenderTarget2D->InitCustomFormat(ModelImageProperties.width, ModelImageProperties.height, PF_B8G8R8A8, true);
+	RenderTarget2D->InitCustomFormat(CaptureResolution.X, CaptureResolution.Y, PF_B8G8R8A8, true);
 	// PF_B8G8R8A8 disables HDR which will boost storing to disk due to less image information
 	RenderTarget2D->RenderTargetFormat = RTF_RGBA8;
 	RenderTarget2D->bGPUSharedFlag = true; // demand buffer on GPU
@@ -64,7 +825,7 @@ void UCaptureManager::SetupColorCaptureComponent(ASceneCapture2D* ParamCapture)
 
 void UCaptureManager::SetupSegmentationCaptureComponent(ASceneCapture2D* ParamCapture)
 {
-	SpawnSegmentationCaptureComponent(ParamCapture);
+	SegmentationCapture = SpawnAttachedCaptureComponent(ParamCapture);
 	SetupColorCaptureComponent(SegmentationCapture);
 
 	if (PostProcessMaterial)
@@ -74,22 +835,53 @@ void UCaptureManager::SetupSegmentationCaptureComponent(ASceneCapture2D* ParamCa
 	}
 }
 
-void UCaptureManager::SpawnSegmentationCaptureComponent(ASceneCapture2D* ParamCapture)
+/**
+ * @brief Initializes a float render target that holds scene depth in centimetres
+ */
+void UCaptureManager::SetupDepthCaptureComponent(ASceneCapture2D* ParamCapture)
 {
-	ASceneCapture2D* newSegmentationCapture = GetWorld()->SpawnActor<ASceneCapture2D>(ASceneCapture2D::StaticClass());
-	// Register new CaptureComponent to game
-	newSegmentationCapture->GetCaptureComponent2D()->RegisterComponent();
-	// Attach SegmentationCaptureComponent to match ColorCaptureComponent
-	if (!IsValid(ParamCapture))
+	DepthCapture = SpawnAttachedCaptureComponent(ParamCapture);
+	if (!DepthCapture)
 	{
-		UE_LOG(LogTemp, Error, TEXT("SpawnSegmentationCaptureComponent: ParamCapture was not valid!"));
 		return;
 	}
-	newSegmentationCapture->AttachToActor(ParamCapture, FAttachmentTransformRules::SnapToTargetNotIncludingScale);
+
+	// full float, so far obstacles keep their precision until the pipeline packs them
+	UTextureRenderTarget2D* RenderTarget2D = NewObject<UTextureRenderTarget2D>();
+	RenderTarget2D->RenderTargetFormat = RTF_R32f;
+	RenderTarget2D->InitCustomFormat(CaptureResolution.X, CaptureResolution.Y, PF_R32_FLOAT, true);
+	RenderTarget2D->bGPUSharedFlag = true;
+
+	USceneCaptureComponent2D* CaptureComponent = DepthCapture->GetCaptureComponent2D();
+	CaptureComponent->TextureTarget = RenderTarget2D;
+	CaptureComponent->CaptureSource = SCS_SceneDepth;
+
+	// same placement as the color and segmentation captures, see SetupColorCaptureComponent
+	DepthCapture->AttachToActor(MySceneCap->GetOwner(), FAttachmentTransformRules::SnapToTargetNotIncludingScale);
+	CaptureComponent->SetWorldTransform(MySceneCap->GetComponentTransform());
+	CaptureComponent->FOVAngle = MySceneCap->FOVAngle;
+}
+
+/**
+ * @brief Spawns a capture actor attached to ParamCapture with the same field of view
+ * @return nullptr if ParamCapture is not valid
+ */
+ASceneCapture2D* UCaptureManager::SpawnAttachedCaptureComponent(ASceneCapture2D* ParamCapture)
+{
+	if (!IsValid(ParamCapture))
+	{
+		UE_LOG(LogTemp, Error, TEXT("SpawnAttachedCaptureComponent: ParamCapture was not valid!"));
+		return nullptr;
+	}
+	ASceneCapture2D* newCapture = GetWorld()->SpawnActor<ASceneCapture2D>(ASceneCapture2D::StaticClass());
+	// Register new CaptureComponent to game
+	newCapture->GetCaptureComponent2D()->RegisterComponent();
+	// Attach to match ColorCaptureComponent
+	newCapture->AttachToActor(ParamCapture, FAttachmentTransformRules::SnapToTargetNotIncludingScale);
 
 	// Get values from "parent" ColorCaptureComponent
-	newSegmentationCapture->GetCaptureComponent2D()->FOVAngle = ParamCapture->GetCaptureComponent2D()->FOVAngle;
-	SegmentationCapture = newSegmentationCapture;
+	newCapture->GetCaptureComponent2D()->FOVAngle = ParamCapture->GetCaptureComponent2D()->FOVAngle;
+	return newCapture;
 }
 
 /**
@@ -97,14 +889,14 @@ void UCaptureManager::SpawnSegmentationCaptureComponent(ASceneCapture2D* ParamCa
  * @param CaptureComponent 
  * @param IsSegmentation 
  */
-void UCaptureManager::CaptureColorNonBlocking(USceneCaptureComponent2D* CaptureComponent, bool IsSegmentation)
+bool UCaptureManager::CaptureColorNonBlocking(USceneCaptureComponent2D* CaptureComponent, bool IsSegmentation)
 {
 	USceneCaptureComponent2D* ColorCaptureComponent = ColorCapture->GetCaptureComponent2D();
 	USceneCaptureComponent2D* SegmentationCaptureComponent = SegmentationCapture->GetCaptureComponent2D();
 	if (!IsValid(SegmentationCaptureComponent) || !IsValid(ColorCaptureComponent))
 	{
 		UE_LOG(LogTemp, Error, TEXT("CaptureColorNonBlocking: CaptureComponent was not valid!"));
-		return;
+		return false;
 	}
 
 	FTextureRenderTargetResource* renderTargetResource1 = SegmentationCaptureComponent->TextureTarget->
@@ -116,12 +908,23 @@ void UCaptureManager::CaptureColorNonBlocking(USceneCaptureComponent2D* CaptureC
 	FTextureRenderTargetResource* renderTargetResource2 = ColorCaptureComponent->TextureTarget->
 		GameThread_GetRenderTargetResource();
 
-	FRenderRequest* renderRequest = new FRenderRequest();
+	FRenderRequest* renderRequest = AcquireRenderRequest();
+	if (!renderRequest)
+	{
+		return false;
+	}
 	renderRequest->isPNG = IsSegmentation;
 
 	int32 width = rtx1;
 	int32 height = rty1;
 	ScreenImageProperties = {width, height};
+	renderRequest->Width = width;
+	renderRequest->Height = height;
+	const bool bCpuLabels = renderRequest->SegmentationSource == ESegmentationSource::CpuRaster;
+	if (bCpuLabels)
+	{
+		GatherLabelInstances(ColorCaptureComponent, *renderRequest);
+	}
 
 	struct FReadSurfaceContext
 	{
@@ -130,9 +933,10 @@ void UCaptureManager::CaptureColorNonBlocking(USceneCaptureComponent2D* CaptureC
 		FIntRect Rect;
 		FReadSurfaceDataFlags Flags;
 	};
+	// the labels of the CpuRaster source are drawn by the pipeline, the segmentation image isn't rendered
 	FReadSurfaceContext readSurfaceContext1 = {
 		renderTargetResource1,
-		&(renderRequest->Image1),
+		bCpuLabels ? nullptr : &(renderRequest->Image1),
 		FIntRect(0, 0, width, height),
 		FReadSurfaceDataFlags(RCM_UNorm, CubeFace_MAX)
 	};
@@ -142,133 +946,428 @@ void UCaptureManager::CaptureColorNonBlocking(USceneCaptureComponent2D* CaptureC
 		FIntRect(0, 0, width, height),
 		FReadSurfaceDataFlags(RCM_UNorm, CubeFace_MAX)
 	};
+	// the rig's sensors are rendered now and read back with the images below
+	struct FSensorReadbackContext
+	{
+		FRenderTarget* SrcRenderTarget;
+		TArray<FColor>* OutPixels;
+		TArray<FLinearColor>* OutSceneDepth;
+		FIntRect Rect;
+	};
+	TArray<FSensorReadbackContext, TInlineAllocator<8>> sensorReadbackContexts;
+	// only binary frames carry the extra views, so json frames don't pay for rendering them
+	if (SensorRig && renderRequest->WireFormat == ECaptureWireFormat::Binary && SensorRig->CaptureDueSensors(renderRequest->FrameId, renderRequest->SensorViews) > 0)
+	{
+		for (FCaptureSensorView& View : renderRequest->SensorViews)
+		{
+			if (View.bCaptured)
+			{
+				sensorReadbackContexts.Add({
+					View.RenderTarget, View.bDepth ? nullptr : &View.Pixels, View.bDepth ? &View.SceneDepth : nullptr,
+					FIntRect(0, 0, View.Width, View.Height)
+				});
+				View.RenderTarget = nullptr;
+			}
+		}
+	}
+
+	// read back in the same command, so one fence covers all images of every view
+	FRenderTarget* depthRenderTarget = renderRequest->bCaptureDepth
+		                                   ? DepthCapture->GetCaptureComponent2D()->TextureTarget->
+		                                                   GameThread_GetRenderTargetResource()
+		                                   : nullptr;
+	TArray<FLinearColor>* depthOutData = &renderRequest->SceneDepth;
 	ENQUEUE_RENDER_COMMAND(SceneDrawCompletion)(
-		[readSurfaceContext1, readSurfaceContext2](FRHICommandListImmediate& RHICmdList)
+		[readSurfaceContext1, readSurfaceContext2, depthRenderTarget, depthOutData,
+			sensorReadbackContexts = MoveTemp(sensorReadbackContexts)](FRHICommandListImmediate& RHICmdList)
 		{
-			RHICmdList.ReadSurfaceData(
-				readSurfaceContext1.SrcRenderTarget->GetRenderTargetTexture(),
-				readSurfaceContext1.Rect,
-				*readSurfaceContext1.OutData,
-				readSurfaceContext1.Flags
-			);
+			if (depthRenderTarget)
+			{
+				// float targets are read back as is, the compression mode only applies to normalized formats
+				RHICmdList.ReadSurfaceData(
+					depthRenderTarget->GetRenderTargetTexture(),
+					readSurfaceContext1.Rect,
+					*depthOutData,
+					FReadSurfaceDataFlags(RCM_UNorm, CubeFace_MAX)
+				);
+			}
+			if (readSurfaceContext1.OutData)
+			{
+				RHICmdList.ReadSurfaceData(
+					readSurfaceContext1.SrcRenderTarget->GetRenderTargetTexture(),
+					readSurfaceContext1.Rect,
+					*readSurfaceContext1.OutData,
+					readSurfaceContext1.Flags
+				);
+			}
 			RHICmdList.ReadSurfaceData(
 				readSurfaceContext2.SrcRenderTarget->GetRenderTargetTexture(),
 				readSurfaceContext2.Rect,
 				*readSurfaceContext2.OutData,
 				readSurfaceContext2.Flags
 			);
+			for (const FSensorReadbackContext& Context : sensorReadbackContexts)
+			{
+				if (Context.OutSceneDepth)
+				{
+					RHICmdList.ReadSurfaceData(Context.SrcRenderTarget->GetRenderTargetTexture(), Context.Rect,
+					                           *Context.OutSceneDepth, FReadSurfaceDataFlags(RCM_UNorm, CubeFace_MAX));
+				}
+				else
+				{
+					RHICmdList.ReadSurfaceData(Context.SrcRenderTarget->GetRenderTargetTexture(), Context.Rect,
+					                           *Context.OutPixels, FReadSurfaceDataFlags(RCM_UNorm, CubeFace_MAX));
+				}
+			}
 		});
 	renderRequest->RenderFence.BeginFence(true);
+	return true;
+}
 
-	RenderRequestQueue.Enqueue(renderRequest);
+TArray<FVector> UCaptureManager::GetOutlineOfStaticMesh(UStaticMesh* StaticMesh, FTransform& ComponentToWorldTransform)
+{
+	TArray<FVector> Vertices;
+	const FMeshOutline* Outline = OutlineCache.Get(StaticMesh);
+	if (!Outline)
+	{
+		return Vertices;
+	}
+	Vertices.Reserve(Outline->Num());
+	for (int32 i = 0; i < Outline->Num(); i++)
+	{
+		Vertices.Add(ComponentToWorldTransform.TransformPosition(FVector(Outline->X[i], Outline->Y[i], Outline->Z[i])));
+	}
+	return Vertices;
+}
+
+FColor AddTransparentRed(FColor InColor)
+{
+	// Create a constant vector for the red color
+	FLinearColor RedColor(1.0f, 0.0f, 0.0f, 0.5f); // 0.5f is the alpha value for transparency
+
+	// Convert the input FColor to FLinearColor
+	FLinearColor InLinearColor = InColor.ReinterpretAsLinear();
+
+	// Blend the two colors using the alpha blend mode
+	FLinearColor OutLinearColor = FLinearColor::LerpUsingHSV(InLinearColor, RedColor, RedColor.A);
+
+	// Convert the output FLinearColor back to FColor
+	FColor OutColor = OutLinearColor.ToFColor(true); // true means to preserve the alpha value
+
+	// Return the result
+	return OutColor;
+}
+
+// Tints the square of pixels around Pixel red, clipped to the image
+static void DrawDot(TArray<FColor>& ImageData, int32 Width, int32 Height, const FVector2f& Pixel, int32 Radius)
+{
+	const int32 CenterX = FMath::FloorToInt32(Pixel.X);
+	const int32 CenterY = FMath::FloorToInt32(Pixel.Y);
+	if (CenterX + Radius < 0 || CenterX - Radius >= Width || CenterY + Radius < 0 || CenterY - Radius >= Height)
+	{
+		return;
+	}
+	for (int32 y = FMath::Max(CenterY - Radius, 0); y <= FMath::Min(CenterY + Radius, Height - 1); y++)
+	{
+		for (int32 x = FMath::Max(CenterX - Radius, 0); x <= FMath::Min(CenterX + Radius, Width - 1); x++)
+		{
+			FColor& Color = ImageData[y * Width + x];
+			Color = AddTransparentRed(Color);
+		}
+	}
+}
+
+FVector2D UCaptureManager::ProjectWorldPointToImage(FVector InWorldLocation,
+                                                    USceneCaptureComponent2D* InCaptureComponent)
+{
+	// USceneCaptureComponent2D* InCaptureComponent = ColorCaptureComponents;
+	FIntPoint InRenderTarget2DSize = FIntPoint(ScreenImageProperties.width, ScreenImageProperties.height);
+	FVector2D OutPixel;
+	ProjectWorldLocationToCapturedScreen(InCaptureComponent, InWorldLocation, InRenderTarget2DSize, OutPixel);
+	return OutPixel;
+}
+
+void UCaptureManager::ProjectWorldPointToImageAndDraw(TArray<FColor>& ImageData, FVector InWorldLocation,
+                                                      USceneCaptureComponent2D* InCaptureComponent, int32 radius = 5)
+{
+	const FIntPoint InRenderTarget2DSize = FIntPoint(ScreenImageProperties.width, ScreenImageProperties.height);
+	FVector2D OutPixel;
+	if (!ProjectWorldLocationToCapturedScreen(InCaptureComponent, InWorldLocation, InRenderTarget2DSize, OutPixel))
+	{
+		// behind the camera
+		return;
+	}
+	DrawDot(ImageData, InRenderTarget2DSize.X, InRenderTarget2DSize.Y, FVector2f(OutPixel), radius);
+}
+
+void UCaptureManager::FColorImgToB64(const TArray<FColor>& ImageData, int32 Width, int32 Height, FString& base64) const
+{
+	TArray64<uint8> DstData;
+	FImageUtils::PNGCompressImageArray(Width, Height, ImageData, DstData);
+	// Convert data to base64 string, straight from the PNG without copying it into a 32 bit array
+	base64 = FBase64::Encode(DstData.GetData(), static_cast<uint32>(DstData.Num()));
+}
+
+/**
+ * @brief Replaces the planes in which few tiles changed since the previous frame with delta planes. The pipeline runs
+ * this stage one frame at a time, in frame order.
+ */
+void UCaptureManager::DiffFrame(FRenderRequest& Frame) const
+{
+	Frame.DeltaTileCounts.Reset();
+	// the json format only serializes a binary frame for the recording
+	if (!Frame.PlaneDeltas.bEnabled || (Frame.WireFormat != ECaptureWireFormat::Binary && !Frame.bRecord))
+	{
+		return;
+	}
+
+	TArray<FrameWire::FPlane, TInlineAllocator<4>> Planes;
+	GetFramePlanes(Frame, Planes);
+	DeltaEncoder.BeginFrame(Frame.FrameId, Frame.PlaneDeltas);
+	Frame.DeltaPlanes.SetNum(Planes.Num());
+	Frame.DeltaSections.SetNum(Planes.Num());
+	Frame.DeltaTileCounts.SetNumZeroed(Planes.Num());
+	for (int32 i = 0; i < Planes.Num(); i++)
+	{
+		// a delta against JPEG pixels the server never got would drift further with every frame
+		if (FFrameCodecs::Resolve(GetPlaneCodec(Frame, Planes[i]), Planes[i].PixelFormat) ==
+			FrameWire::EPlaneEncoding::JPEG)
+		{
+			Frame.DeltaSections[i].Reset();
+			continue;
+		}
+		DeltaEncoder.EncodePlane(i, Planes[i], Frame.PlaneDeltas, Frame.DeltaPlanes[i], Frame.DeltaSections[i],
+		                         Frame.DeltaTileCounts[i]);
+	}
+}
+
+void UCaptureManager::EncodeImages(FRenderRequest& Frame) const
+{
+	Frame.ObservationSection.Reset();
+	Frame.ObservationElements = 0;
+	if (Frame.WireFormat == ECaptureWireFormat::JsonBase64)
+	{
+		// Compress image data to PNG format, the json format has one PNG per image so the two are compressed side
+		// by side instead of in strips
+		ParallelFor(2, [this, &Frame](int32 i)
+		{
+			FColorImgToB64(i == 0 ? Frame.Image1 : Frame.Image2, Frame.Width, Frame.Height,
+			               i == 0 ? Frame.Base64Image1 : Frame.Base64Image2);
+		});
+		// planes of the recorded binary frame stay raw
+		Frame.PlaneEncodings.Reset();
+	}
+	else
+	{
+		TArray<FrameWire::FPlane, TInlineAllocator<4>> Planes;
+		GetDeltaFramePlanes(Frame, Planes);
+		Frame.EncodedPlanes.SetNum(Planes.Num());
+		Frame.PlaneEncodings.SetNum(Planes.Num());
+		for (int32 i = 0; i < Planes.Num(); i++)
+		{
+			Frame.PlaneEncodings[i] = FrameCodecs.Encode(Planes[i], GetPlaneCodec(Frame, Planes[i]), Frame.PlaneCodecs,
+			                                             Frame.EncodedPlanes[i]);
+		}
+		if (Frame.Observation.bEnabled && Frame.Image2.Num() == Frame.Width * Frame.Height)
+		{
+			PackObservation(Frame);
+		}
+	}
 }
 
-TArray<FVector> UCaptureManager::GetOutlineOfStaticMesh(UStaticMesh* StaticMesh, FTransform& ComponentToWorldTransform)
+/**
+ * @brief Packs the color image, as sent, into the model input tensor of the Observation section. The packer is set
+ * up per frame, so the settings can change while playing.
+ */
+void UCaptureManager::PackObservation(FRenderRequest& Frame) const
 {
-	// Declare the map or set to store the vertex indices and counts
-	TMap<int32, int32> VertexCounts;
-
-	// Declare the arrays for the geometry data
-	TArray<FVector> Vertices;
-	TArray<int32> Triangles;
-	TArray<FVector> Normals;
-	TArray<FVector2D> UVs;
-	TArray<FProcMeshTangent> Tangents;
-
-	// Get the section from the static mesh asset
-	UKismetProceduralMeshLibrary::GetSectionFromStaticMesh(StaticMesh, 0, 0, Vertices, Triangles, Normals, UVs,
-	                                                       Tangents);
+	const FObservationSettings& Settings = Frame.Observation;
+	const FObservationPacker Packer(Settings, Frame.Width, Frame.Height);
 
-	// Convert the vertex positions to world space
-	for (int32 i = 0; i < Vertices.Num(); i++)
+	FrameWire::FObservationInfo Info;
+	FMemory::Memzero(Info);
+	Info.Width = static_cast<uint16>(Packer.GetWidth());
+	Info.Height = static_cast<uint16>(Packer.GetHeight());
+	Info.Channels = FObservationPacker::NumChannels;
+	Info.Layout = Settings.Layout == EObservationLayout::NCHW ? 0 : 1;
+	Info.Precision = Settings.Precision == EObservationPrecision::Float16 ? 0 : 1;
+	for (int32 c = 0; c < 3; c++)
 	{
-		Vertices[i] = ComponentToWorldTransform.TransformPosition(Vertices[i]);
+		Info.Mean[c] = static_cast<float>(Settings.Mean[c]);
+		Info.Std[c] = static_cast<float>(Settings.Std[c]);
 	}
-	return Vertices;
+
+	Frame.ObservationSection.SetNumUninitialized(sizeof(Info) + Packer.GetNumBytes(), false);
+	FMemory::Memcpy(Frame.ObservationSection.GetData(), &Info, sizeof(Info));
+	Packer.Pack(Frame.Image2.GetData(), Frame.ObservationSection.GetData() + sizeof(Info));
+	Frame.ObservationElements = static_cast<int32>(Packer.GetNumElements());
 }
 
-FColor AddTransparentRed(FColor InColor)
+/**
+ * @brief The raw planes a binary frame carries, in wire order
+ */
+void UCaptureManager::GetFramePlanes(const FRenderRequest& Frame,
+                                     TArray<FrameWire::FPlane, TInlineAllocator<4>>& OutPlanes) const
 {
-	// Create a constant vector for the red color
-	FLinearColor RedColor(1.0f, 0.0f, 0.0f, 0.5f); // 0.5f is the alpha value for transparency
+	auto ImagePlane = [&Frame](FrameWire::EPlaneKind Kind, const TArray<FColor>& Image)
+	{
+		FrameWire::FPlane Plane;
+		Plane.Kind = Kind;
+		Plane.PixelFormat = FrameWire::EPixelFormat::BGRA8;
+		Plane.Width = Frame.Width;
+		Plane.Height = Frame.Height;
+		Plane.Data = TConstArrayView<uint8>(reinterpret_cast<const uint8*>(Image.GetData()), Image.Num() * sizeof(FColor));
+		return Plane;
+	};
 
-	// Convert the input FColor to FLinearColor
-	FLinearColor InLinearColor = InColor.ReinterpretAsLinear();
+	OutPlanes.Reset();
+	if (Frame.bFullResolution)
+	{
+		if (Frame.SegmentationOutput == ESegmentationOutput::ClassIds)
+		{
+			FrameWire::FPlane& Plane = OutPlanes.AddDefaulted_GetRef();
+			Plane.Kind = FrameWire::EPlaneKind::ClassIds;
+			Plane.PixelFormat = FrameWire::EPixelFormat::R8;
+			Plane.Width = Frame.Width;
+			Plane.Height = Frame.Height;
+			Plane.Data = Frame.ClassIds;
+		}
+		else
+		{
+			OutPlanes.Add(ImagePlane(FrameWire::EPlaneKind::SegmentationMarks, Frame.Image1));
+		}
+		if (Frame.bInstanceSegmentation)
+		{
+			FrameWire::FPlane& Plane = OutPlanes.AddDefaulted_GetRef();
+			Plane.Kind = FrameWire::EPlaneKind::InstanceIds;
+			Plane.PixelFormat = FrameWire::EPixelFormat::R16;
+			Plane.Width = Frame.Width;
+			Plane.Height = Frame.Height;
+			Plane.Data = FrameWire::ItemsData(TConstArrayView<uint16>(Frame.InstanceIds));
+		}
+		OutPlanes.Add(ImagePlane(FrameWire::EPlaneKind::Color, Frame.Image2));
 
-	// Blend the two colors using the alpha blend mode
-	FLinearColor OutLinearColor = FLinearColor::LerpUsingHSV(InLinearColor, RedColor, RedColor.A);
+		if (Frame.bCaptureDepth && Frame.DepthPlaneEncoding != EDepthPlaneEncoding::None)
+		{
+			const bool bHalf = Frame.DepthPlaneEncoding == EDepthPlaneEncoding::HalfFloat;
+			FrameWire::FPlane& Plane = OutPlanes.AddDefaulted_GetRef();
+			Plane.Kind = FrameWire::EPlaneKind::Depth;
+			Plane.PixelFormat = bHalf ? FrameWire::EPixelFormat::R16F : FrameWire::EPixelFormat::R16;
+			Plane.Width = Frame.Width;
+			Plane.Height = Frame.Height;
+			Plane.Data = bHalf
+				             ? TConstArrayView<uint8>(reinterpret_cast<const uint8*>(Frame.DepthHalf.GetData()),
+				                                      Frame.DepthHalf.Num() * sizeof(FFloat16))
+				             : TConstArrayView<uint8>(reinterpret_cast<const uint8*>(Frame.DepthMm.GetData()),
+				                                      Frame.DepthMm.Num() * sizeof(uint16));
+		}
+	}
 
-	// Convert the output FLinearColor back to FColor
-	FColor OutColor = OutLinearColor.ToFColor(true); // true means to preserve the alpha value
+	for (const FCaptureSensorView& View : Frame.SensorViews)
+	{
+		if (!View.bCaptured)
+		{
+			continue;
+		}
+		FrameWire::FPlane& Plane = OutPlanes.AddDefaulted_GetRef();
+		Plane.Kind = View.bDepth ? FrameWire::EPlaneKind::Depth : FrameWire::EPlaneKind::Color;
+		Plane.PixelFormat = View.bDepth ? FrameWire::EPixelFormat::R16 : FrameWire::EPixelFormat::BGRA8;
+		Plane.View = View.Info.View;
+		Plane.Width = View.Width;
+		Plane.Height = View.Height;
+		Plane.Data = View.bDepth
+			             ? TConstArrayView<uint8>(reinterpret_cast<const uint8*>(View.DepthMm.GetData()),
+			                                      View.DepthMm.Num() * sizeof(uint16))
+			             : TConstArrayView<uint8>(reinterpret_cast<const uint8*>(View.Pixels.GetData()),
+			                                      View.Pixels.Num() * sizeof(FColor));
+	}
 
-	// Return the result
-	return OutColor;
+	for (const FCaptureStreamFrame& Stream : Frame.Streams)
+	{
+		if (!Stream.bDue)
+		{
+			continue;
+		}
+		auto StreamPlane = [&](FrameWire::EPlaneKind Kind, FrameWire::EPixelFormat PixelFormat,
+		                       TConstArrayView<uint8> Data)
+		{
+			FrameWire::FPlane& Plane = OutPlanes.AddDefaulted_GetRef();
+			Plane.Kind = Kind;
+			Plane.PixelFormat = PixelFormat;
+			Plane.View = Stream.Info.View;
+			Plane.Width = Stream.Width;
+			Plane.Height = Stream.Height;
+			Plane.Data = Data;
+		};
+		StreamPlane(FrameWire::EPlaneKind::Color, FrameWire::EPixelFormat::BGRA8,
+		            FrameWire::ItemsData(TConstArrayView<FColor>(Stream.Color)));
+		if (Stream.ClassIds.Num() > 0)
+		{
+			StreamPlane(FrameWire::EPlaneKind::ClassIds, FrameWire::EPixelFormat::R8, Stream.ClassIds);
+		}
+		if (Stream.DepthMm.Num() > 0)
+		{
+			StreamPlane(FrameWire::EPlaneKind::Depth, FrameWire::EPixelFormat::R16,
+			            FrameWire::ItemsData(TConstArrayView<uint16>(Stream.DepthMm)));
+		}
+	}
 }
 
-FVector2D UCaptureManager::ProjectWorldPointToImage(FVector InWorldLocation,
-                                                    USceneCaptureComponent2D* InCaptureComponent)
+/**
+ * @brief The codec of a plane: a stream's own codec for its color plane, otherwise the codec of the plane's kind
+ */
+EFrameCodec UCaptureManager::GetPlaneCodec(const FRenderRequest& Frame, const FrameWire::FPlane& Plane)
 {
-	// USceneCaptureComponent2D* InCaptureComponent = ColorCaptureComponents;
-	FIntPoint InRenderTarget2DSize = FIntPoint(ScreenImageProperties.width, ScreenImageProperties.height);
-	FVector2D OutPixel;
-	ProjectWorldLocationToCapturedScreen(InCaptureComponent, InWorldLocation, InRenderTarget2DSize, OutPixel);
-	return OutPixel;
+	if (Plane.Kind == FrameWire::EPlaneKind::Color && Plane.View > 0)
+	{
+		const FCaptureStreamFrame* Stream = Frame.Streams.FindByPredicate(
+			[&Plane](const FCaptureStreamFrame& Candidate)
+			{
+				return Candidate.bDue && Candidate.Info.View == Plane.View;
+			});
+		if (Stream)
+		{
+			return Stream->Codec;
+		}
+	}
+	return Frame.PlaneCodecs.ForPlane(Plane.Kind);
 }
 
-void UCaptureManager::ProjectWorldPointToImageAndDraw(TArray<FColor>& ImageData, FVector InWorldLocation,
-                                                      USceneCaptureComponent2D* InCaptureComponent, int32 radius = 5)
+/**
+ * @brief GetFramePlanes with the planes DiffFrame turned into deltas replaced by their delta planes
+ */
+void UCaptureManager::GetDeltaFramePlanes(const FRenderRequest& Frame,
+                                          TArray<FrameWire::FPlane, TInlineAllocator<4>>& OutPlanes) const
 {
-	FVector2D OutPixel;
-	ProjectWorldPointToImage(InWorldLocation, InCaptureComponent);
-
-	FVector CaptureLocation = InCaptureComponent->GetComponentLocation();
-	FVector CaptureForward = InCaptureComponent->GetForwardVector();
-	float NearClipPlane = InCaptureComponent->CustomNearClippingPlane;
-	FVector LensCenter = CaptureLocation + CaptureForward * NearClipPlane;
-	// Subtract the LensCenter from the InWorldLocation to get the InWorldLocation in the coordinate system of the LensCenter.
-	FVector InWorldLocationInLensCenterSpace = InWorldLocation - LensCenter;
-
-	// Draw OutPixel onto image as a red dot
-	int32 x = OutPixel.X;
-	int32 y = OutPixel.Y;
-	int32 width = ScreenImageProperties.width;
-	int32 height = ScreenImageProperties.height;
-	for (int32 _i = -radius; _i <= radius; _i++)
-	{
-		for (int32 j = -radius; j <= radius; j++)
-		{
-			if (x + _i >= 0 && x + _i < width && y + j >= 0 && y + j < height)
-			// TODO: If it's not in the bounds it's not being captured. Check this beforehand and exit.
-			{
-				FColor color = ImageData[(y + j) * width + (x + _i)];
-				ImageData[(y + j) * width + (x + _i)] = AddTransparentRed(color);
-			}
+	GetFramePlanes(Frame, OutPlanes);
+	for (int32 i = 0; i < Frame.DeltaTileCounts.Num() && i < OutPlanes.Num(); i++)
+	{
+		if (Frame.DeltaTileCounts[i] > 0)
+		{
+			OutPlanes[i].Data = Frame.DeltaPlanes[i];
 		}
 	}
 }
 
-void UCaptureManager::FColorImgToB64(TArray<FColor>& ImageData, FString& base64) const
+void UCaptureManager::SerializeFrame(FRenderRequest& Frame) const
 {
-	TArray64<uint8> DstData;
-	FImageUtils::PNGCompressImageArray(ScreenImageProperties.width, ScreenImageProperties.height, ImageData,
-	                                   DstData);
-	// Convert data to base64 string
-	DstData.Shrink(); // Shrink the source array to remove any extra slack
-	uint8* SrcPtr = DstData.GetData(); // Get a pointer to the raw data of the source array
-	int32 SrcCount = DstData.Num(); // Get the number of elements in the source array
-	TArray<uint8> NDstData(SrcPtr, SrcCount);
-	base64 = FBase64::Encode(NDstData);
+	if (Frame.WireFormat == ECaptureWireFormat::JsonBase64)
+	{
+		SerializeFrameJson(Frame);
+		if (Frame.bRecord)
+		{
+			SerializeFrameBinary(Frame);
+		}
+	}
+	else
+	{
+		SerializeFrameBinary(Frame);
+	}
 }
 
-void UCaptureManager::SendImageToServer(TArray<FColor>& ImageData1, TArray<FColor>& ImageData2) const
+void UCaptureManager::SerializeFrameJson(FRenderRequest& Frame) const
 {
-	// Compress image data to PNG format
-	FString base64_1;
-	FColorImgToB64(ImageData1, base64_1);
-	FString base64_2;
-	FColorImgToB64(ImageData2, base64_2);
-
-	// Create json object and emit to socket
+	// Create json object
 	auto JsonObject = USIOJConvert::MakeJsonObject();
 	auto AddPostfixtoname = [](const FString& name, const FString postfix) -> FString
 	{
@@ -276,16 +1375,38 @@ void UCaptureManager::SendImageToServer(TArray<FColor>& ImageData1, TArray<FColo
 	};
 	JsonObject->SetStringField(TEXT("name1"), AddPostfixtoname(InstanceName, FString("_1")));
 	JsonObject->SetStringField(TEXT("name2"), AddPostfixtoname(InstanceName, FString("_2")));
-	JsonObject->SetStringField(TEXT("image1"), base64_1);
-	JsonObject->SetStringField(TEXT("image2"), base64_2);
+	JsonObject->SetStringField(TEXT("image1"), Frame.Base64Image1);
+	JsonObject->SetStringField(TEXT("image2"), Frame.Base64Image2);
+	JsonObject->SetNumberField(TEXT("frame_id"), Frame.FrameId);
+
+	if (Frame.bCaptureDepth)
+	{
+		JsonObject->SetObjectField(TEXT("depth"), DepthToJson(Frame));
+	}
+	if (Frame.bInstanceSegmentation)
+	{
+		JsonObject->SetArrayField(TEXT("instances"), InstancesToJson(Frame));
+	}
+	if (Frame.MaskEncoding == ESegmentationMaskEncoding::RunLength)
+	{
+		// spans are decoded against the image size
+		JsonObject->SetNumberField(TEXT("width"), Frame.Width);
+		JsonObject->SetNumberField(TEXT("height"), Frame.Height);
+		JsonObject->SetObjectField(TEXT("masks"), MasksToJson(Frame));
+		Frame.Json = JsonObject;
+		return;
+	}
 
-	// send TMap<FString, TArray<float>> MapTagToPixelData to server by creating a new flaot array and adding the size of each array and then the array itself
+	// send the pixel data of every class to server by creating a new flaot array and adding the size of each array and then the array itself
 	TArray<float> locPixelLocationAndDistanceArray;
-	for (auto& Elem : MapTagToPixelData)
+	for (int32 ClassId = 1; ClassId < Frame.ClassPixelData.Num(); ClassId++)
 	{
-		FString tag = Elem.Key;
-		TArray<float> PixelData = Elem.Value;
-		locPixelLocationAndDistanceArray.Add(MapTagToPixelData[tag].Num());
+		const TArray<uint16>& PixelData = Frame.ClassPixelData[ClassId];
+		if (PixelData.Num() == 0)
+		{
+			continue;
+		}
+		locPixelLocationAndDistanceArray.Add(PixelData.Num());
 		locPixelLocationAndDistanceArray.Append(PixelData);
 	}
 	// convert to makeshareable jsonvaluenumber array
@@ -295,118 +1416,476 @@ void UCaptureManager::SendImageToServer(TArray<FColor>& ImageData1, TArray<FColo
 		arr2.Add(MakeShareable(new FJsonValueNumber(elem2)));
 	}
 	JsonObject->SetArrayField(TEXT("arr2"), arr2);
-	
-	// do above but use fjsonvalue and tshared pointer
-	// TArray<TSharedPtr<FJsonValue>> arr;
-	// for (auto& elem : MapTagToPixelData)
-	// {
-	// 	FString tag = elem.Key;
-	// 	TArray<float> PixelData = elem.Value;
-	// 	TArray<TSharedPtr<FJsonValue>> arr2;
-	// 	for (auto& elem2 : PixelData)
-	// 	{
-	// 		arr2.Add(MakeShareable(new FJsonValueNumber(elem2)));
-	// 	}
-	// 	arr.Add(MakeShareable(new FJsonValueObject(MakeShareable(new FJsonObject()))));
-	// 	arr.Last()->AsObject()->SetArrayField(TEXT("arr"), arr2);
-	// 	arr.Last()->AsObject()->SetStringField(TEXT("tag"), tag);		
-	// }
-	// JsonObject->SetArrayField(TEXT("arr"), arr); 
-	
-	SIOClientComponent->EmitNative(TEXT("imageJson"), JsonObject);
+	Frame.Json = JsonObject;
 }
 
-void UCaptureManager::DoImageSegmentation(TArray<FColor>& ImageData, USceneCaptureComponent2D* InCaptureComponent)
+/**
+ * @brief Tag -> {"spans": [y, x, length, ...], "regions": [{"bounds": [minx, miny, maxx, maxy], "area", "centroid"}]},
+ * regions[0] is the whole mask and the rest are its connected components
+ */
+TSharedPtr<FJsonObject> UCaptureManager::MasksToJson(const FRenderRequest& Frame) const
+{
+	auto Masks = USIOJConvert::MakeJsonObject();
+	for (int32 ClassId = 1; ClassId < Frame.ClassMasks.Num(); ClassId++)
+	{
+		const FClassMask& Mask = Frame.ClassMasks[ClassId];
+		if (Mask.Spans.Num() == 0)
+		{
+			continue;
+		}
+		TArray<TSharedPtr<FJsonValue>> Spans;
+		Spans.Reserve(Mask.Spans.Num() * 3);
+		for (const FMaskSpan& Span : Mask.Spans)
+		{
+			Spans.Add(MakeShared<FJsonValueNumber>(Span.Y));
+			Spans.Add(MakeShared<FJsonValueNumber>(Span.X));
+			Spans.Add(MakeShared<FJsonValueNumber>(Span.Length));
+		}
+		TArray<TSharedPtr<FJsonValue>> Regions;
+		for (const FMaskRegion& Region : Mask.Regions)
+		{
+			auto RegionObject = USIOJConvert::MakeJsonObject();
+			RegionObject->SetArrayField(TEXT("bounds"), {
+				                            MakeShared<FJsonValueNumber>(Region.MinX),
+				                            MakeShared<FJsonValueNumber>(Region.MinY),
+				                            MakeShared<FJsonValueNumber>(Region.MaxX),
+				                            MakeShared<FJsonValueNumber>(Region.MaxY)
+			                            });
+			RegionObject->SetNumberField(TEXT("area"), Region.Area);
+			RegionObject->SetArrayField(TEXT("centroid"), {
+				                            MakeShared<FJsonValueNumber>(Region.CentroidX),
+				                            MakeShared<FJsonValueNumber>(Region.CentroidY)
+			                            });
+			Regions.Add(MakeShared<FJsonValueObject>(RegionObject));
+		}
+		auto MaskObject = USIOJConvert::MakeJsonObject();
+		MaskObject->SetArrayField(TEXT("spans"), Spans);
+		MaskObject->SetArrayField(TEXT("regions"), Regions);
+		Masks->SetObjectField(Classifier.GetClassTag(ClassId), MaskObject);
+	}
+	return Masks;
+}
+
+/**
+ * @brief Tag -> {"pixels", "min_mm", "mean_mm", "percentile", "percentile_mm", "nearest": [x, y]}
+ */
+TSharedPtr<FJsonObject> UCaptureManager::DepthToJson(const FRenderRequest& Frame) const
+{
+	auto Depth = USIOJConvert::MakeJsonObject();
+	for (int32 ClassId = 1; ClassId < Frame.ClassDepth.Num(); ClassId++)
+	{
+		const FClassDepthStats& Stats = Frame.ClassDepth[ClassId];
+		if (Stats.NumPixels == 0)
+		{
+			continue;
+		}
+		auto StatsObject = USIOJConvert::MakeJsonObject();
+		StatsObject->SetNumberField(TEXT("pixels"), Stats.NumPixels);
+		StatsObject->SetNumberField(TEXT("min_mm"), Stats.MinMm);
+		StatsObject->SetNumberField(TEXT("mean_mm"), Stats.MeanMm);
+		StatsObject->SetNumberField(TEXT("percentile"), Stats.Percentile);
+		StatsObject->SetNumberField(TEXT("percentile_mm"), Stats.PercentileMm);
+		StatsObject->SetArrayField(TEXT("nearest"), {
+			                           MakeShared<FJsonValueNumber>(Stats.NearestX),
+			                           MakeShared<FJsonValueNumber>(Stats.NearestY)
+		                           });
+		Depth->SetObjectField(Classifier.GetClassTag(ClassId), StatsObject);
+	}
+	return Depth;
+}
+
+/**
+ * @brief [{"id", "class", "pixels", "bounds": [minx, miny, maxx, maxy]}] sorted by id
+ */
+TArray<TSharedPtr<FJsonValue>> UCaptureManager::InstancesToJson(const FRenderRequest& Frame)
 {
-	// Get actors
-	TArray<AActor*> FoundActors;
-	TSet<FString> MyStrings = {"Tree", "Wall"};
-	for (auto& Str : MyStrings)
+	TArray<TSharedPtr<FJsonValue>> Instances;
+	Instances.Reserve(Frame.Instances.Num());
+	for (const FInstanceStats& Stats : Frame.Instances)
 	{
-		TArray<AActor*> TempFoundActors;
-		UGameplayStatics::GetAllActorsWithTag(GetWorld(), FName(*Str), TempFoundActors);
-		FoundActors.Append(TempFoundActors);
+		auto InstanceObject = USIOJConvert::MakeJsonObject();
+		InstanceObject->SetNumberField(TEXT("id"), Stats.InstanceId);
+		InstanceObject->SetNumberField(TEXT("class"), Stats.ClassId);
+		InstanceObject->SetNumberField(TEXT("pixels"), Stats.NumPixels);
+		InstanceObject->SetArrayField(TEXT("bounds"), {
+			                              MakeShared<FJsonValueNumber>(Stats.MinX),
+			                              MakeShared<FJsonValueNumber>(Stats.MinY),
+			                              MakeShared<FJsonValueNumber>(Stats.MaxX),
+			                              MakeShared<FJsonValueNumber>(Stats.MaxY)
+		                              });
+		Instances.Add(MakeShared<FJsonValueObject>(InstanceObject));
 	}
+	return Instances;
+}
+
+void UCaptureManager::SerializeFrameBinary(FRenderRequest& Frame) const
+{
+	FrameWire::FFrameInfo Info;
+	Info.FrameId = Frame.FrameId;
+	Info.Timestamp = Frame.CaptureTime;
+	Info.InstanceName = InstanceName;
+	Info.Width = Frame.Width;
+	Info.Height = Frame.Height;
 
-	ParallelFor(FoundActors.Num(), [&](int32 i) -> void
+	TArray<FrameWire::FPlane, TInlineAllocator<4>> Planes;
+	GetDeltaFramePlanes(Frame, Planes);
+	for (int32 i = 0; i < Frame.PlaneEncodings.Num() && i < Planes.Num(); i++)
 	{
-		const AStaticMeshActor* StaticMeshActor = Cast<AStaticMeshActor>(FoundActors[i]);
-		if (!StaticMeshActor)
+		if (Frame.PlaneEncodings[i] != FrameWire::EPlaneEncoding::Raw)
 		{
-			return;
+			Planes[i].Encoding = Frame.PlaneEncodings[i];
+			Planes[i].Data = TConstArrayView<uint8>(Frame.EncodedPlanes[i].GetData(), Frame.EncodedPlanes[i].Num());
 		}
-		const UStaticMeshComponent* StaticMeshComponent = StaticMeshActor->GetStaticMeshComponent();
-		if (!StaticMeshComponent)
+	}
+
+	TArray<FrameWire::FSection, TInlineAllocator<8>> Sections;
+	auto AddSection = [this, &Sections](int32 ClassId, FrameWire::ESectionKind Kind, int32 Count,
+	                                    TConstArrayView<uint8> Data)
+	{
+		FrameWire::FSection& Section = Sections.AddDefaulted_GetRef();
+		Section.Tag = Classifier.GetClassTag(ClassId);
+		Section.ClassId = static_cast<uint8>(ClassId);
+		Section.Kind = Kind;
+		Section.Count = Count;
+		Section.Data = Data;
+	};
+	if (Frame.MaskEncoding == ESegmentationMaskEncoding::RunLength)
+	{
+		for (int32 ClassId = 1; ClassId < Frame.ClassMasks.Num(); ClassId++)
 		{
-			return;
+			const FClassMask& Mask = Frame.ClassMasks[ClassId];
+			if (Mask.Spans.Num() > 0)
+			{
+				AddSection(ClassId, FrameWire::ESectionKind::Spans, Mask.Spans.Num(),
+				           FrameWire::ItemsData<FMaskSpan>(Mask.Spans));
+				AddSection(ClassId, FrameWire::ESectionKind::Regions, Mask.Regions.Num(),
+				           FrameWire::ItemsData<FMaskRegion>(Mask.Regions));
+			}
 		}
-		UStaticMesh* StaticMesh = StaticMeshComponent->GetStaticMesh();
-		if (!StaticMesh)
+	}
+	else
+	{
+		for (int32 ClassId = 1; ClassId < Frame.ClassPixelData.Num(); ClassId++)
 		{
-			return;
+			const TArray<uint16>& Points = Frame.ClassPixelData[ClassId];
+			if (Points.Num() > 0)
+			{
+				AddSection(ClassId, FrameWire::ESectionKind::Points, Points.Num() / 2, FrameWire::PointsData(Points));
+			}
+		}
+	}
+	for (int32 ClassId = 1; Frame.bCaptureDepth && ClassId < Frame.ClassDepth.Num(); ClassId++)
+	{
+		if (Frame.ClassDepth[ClassId].NumPixels > 0)
+		{
+			AddSection(ClassId, FrameWire::ESectionKind::DepthStats, 1,
+			           FrameWire::ItemsData(MakeArrayView(&Frame.ClassDepth[ClassId], 1)));
 		}
+	}
 
-		FTransform ComponentToWorldTransform = StaticMeshComponent->GetComponentTransform();
-		TArray<FVector> Vertices = GetOutlineOfStaticMesh(StaticMesh, ComponentToWorldTransform);
+	if (Frame.bInstanceSegmentation && Frame.bFullResolution)
+	{
+		FrameWire::FSection& Section = Sections.AddDefaulted_GetRef();
+		Section.Tag = TEXT("instances");
+		Section.Kind = FrameWire::ESectionKind::Instances;
+		Section.Count = Frame.Instances.Num();
+		Section.Data = FrameWire::ItemsData<FInstanceStats>(Frame.Instances);
+	}
 
-		for (int vi = 0; vi < Vertices.Num(); vi++)
+	for (const FCaptureSensorView& View : Frame.SensorViews)
+	{
+		if (View.bCaptured)
 		{
-			const FVector InWorldLocation = Vertices[vi];
-			ProjectWorldPointToImageAndDraw(ImageData, InWorldLocation, InCaptureComponent, 1);
+			FrameWire::FSection& Section = Sections.AddDefaulted_GetRef();
+			Section.Tag = View.Name;
+			Section.Kind = FrameWire::ESectionKind::View;
+			Section.Count = 1;
+			Section.Data = FrameWire::ItemsData(MakeArrayView(&View.Info, 1));
 		}
-	});
+	}
+	for (const FCaptureStreamFrame& Stream : Frame.Streams)
+	{
+		if (Stream.bDue)
+		{
+			FrameWire::FSection& Section = Sections.AddDefaulted_GetRef();
+			Section.Tag = Stream.Name;
+			Section.Kind = FrameWire::ESectionKind::Stream;
+			Section.Count = 1;
+			Section.Data = FrameWire::ItemsData(MakeArrayView(&Stream.Info, 1));
+		}
+	}
+
+	for (int32 i = 0; i < Frame.DeltaTileCounts.Num(); i++)
+	{
+		if (Frame.DeltaSections[i].Num() > 0)
+		{
+			FrameWire::FSection& Section = Sections.AddDefaulted_GetRef();
+			Section.Kind = FrameWire::ESectionKind::Delta;
+			Section.Count = Frame.DeltaTileCounts[i];
+			Section.Data = Frame.DeltaSections[i];
+		}
+	}
+
+	if (Frame.ObservationSection.Num() > 0)
+	{
+		FrameWire::FSection& Section = Sections.AddDefaulted_GetRef();
+		Section.Kind = FrameWire::ESectionKind::Observation;
+		Section.Count = Frame.ObservationElements;
+		Section.Data = Frame.ObservationSection;
+	}
+
+	FrameWire::Write(Info, Planes, Sections, Frame.WireData);
+}
+
+/**
+ * @brief Copies the binary frame into the shared memory ring when that is the transport, for the game thread to
+ * announce with "frameReady"
+ */
+void UCaptureManager::WriteFrameRing(FRenderRequest& Frame) const
+{
+	Frame.RingSlot = INDEX_NONE;
+	if (Frame.WireFormat == ECaptureWireFormat::Binary && Frame.Transport == ECaptureTransport::SharedMemory &&
+		FrameRing && !FrameRing->Write(Frame.WireData, Frame.RingSlot, Frame.RingSequence))
+	{
+		Frame.RingSlot = INDEX_NONE;
+	}
+}
+
+void UCaptureManager::SendImageToServer(FRenderRequest& Frame) const
+{
+	if (Frame.WireFormat == ECaptureWireFormat::JsonBase64)
+	{
+		SIOClientComponent->EmitNative(TEXT("imageJson"), Frame.Json);
+		Frame.Json.Reset();
+		Frame.Base64Image1.Empty();
+		Frame.Base64Image2.Empty();
+	}
+	else if (Frame.RingSlot != INDEX_NONE)
+	{
+		auto JsonObject = USIOJConvert::MakeJsonObject();
+		JsonObject->SetStringField(TEXT("name"), InstanceName);
+		JsonObject->SetStringField(TEXT("ring"), FrameRing->GetName());
+		JsonObject->SetNumberField(TEXT("slot"), Frame.RingSlot);
+		JsonObject->SetNumberField(TEXT("sequence"), Frame.RingSequence);
+		JsonObject->SetNumberField(TEXT("size"), Frame.WireData.Num());
+		SIOClientComponent->EmitNative(TEXT("frameReady"), JsonObject);
+	}
+	else
+	{
+		// WireData keeps its allocation for the next frame in this slot
+		SIOClientComponent->EmitNative(TEXT("imageFrame"), Frame.WireData);
+	}
+}
+
+/**
+ * @brief Appends the binary frame and the vehicle state it was captured with to the recording
+ */
+void UCaptureManager::RecordFrame(const FRenderRequest& Frame) const
+{
+	if (!Frame.bRecord || !Recorder)
+	{
+		return;
+	}
+	if (!Recorder->Append(FrameRecording::ERecordKind::Frame, Frame.FrameId, Frame.CaptureTime, Frame.WireData))
+	{
+		// the next frames are deltas against the dropped one, the recording can't be decoded until a keyframe
+		DeltaEncoder.RequestKeyframe();
+	}
+	Recorder->AppendStruct(FrameRecording::ERecordKind::VehicleState, Frame.FrameId, Frame.CaptureTime,
+	                       Frame.VehicleState);
+}
+
+void UCaptureManager::DoImageSegmentation(TArray<FColor>& ImageData, USceneCaptureComponent2D* InCaptureComponent)
+{
+	const FIntPoint ImageSize(ScreenImageProperties.width, ScreenImageProperties.height);
+	if (ImageData.Num() < ImageSize.X * ImageSize.Y)
+	{
+		return;
+	}
+
+	// one view-projection for the whole frame
+	const FCaptureProjection Projection(InCaptureComponent, ImageSize);
+	const UTaggedActorRegistry* Registry = GetWorld()->GetSubsystem<UTaggedActorRegistry>();
+	if (!Registry)
+	{
+		return;
+	}
+	TArray<const FTaggedActor*> Visible;
+	Registry->QueryFrustum(Projection.GetFrustum(), Visible);
+
+	TArray<FVector2f> Pixels;
+	for (const FTaggedActor* Tagged : Visible)
+	{
+		const UStaticMeshComponent* StaticMeshComponent = Tagged->MeshComponent.Get();
+		if (!StaticMeshComponent)
+		{
+			continue;
+		}
+		const FMeshOutline* Outline = OutlineCache.Get(StaticMeshComponent->GetStaticMesh());
+		if (!Outline)
+		{
+			continue;
+		}
+		Projection.ProjectPoints(StaticMeshComponent->GetComponentTransform().ToMatrixWithScale(),
+		                         Outline->X.GetData(), Outline->Y.GetData(), Outline->Z.GetData(), Outline->Num(),
+		                         Pixels);
+	}
+
+	// serial, nearby dots overlap
+	for (const FVector2f& Pixel : Pixels)
+	{
+		DrawDot(ImageData, ImageSize.X, ImageSize.Y, Pixel, 1);
+	}
+}
+
+/**
+ * @brief The classify stage: classes and depth of the main camera, then the streams shrunk from them
+ */
+void UCaptureManager::ClassifyFrame(FRenderRequest& Frame) const
+{
+	ColorImageObjects(Frame);
+	DownsampleStreams(Frame);
 }
 
-void UCaptureManager::ColorImageObjects(TArray<FColor>& ImageData1, TArray<FColor>& ImageData2)
+void UCaptureManager::DownsampleStreams(FRenderRequest& Frame) const
 {
-	USceneCaptureComponent2D* CaptureComponent = ColorCapture->GetCaptureComponent2D();
-	// clear map tag to pixel data
-	MapTagToPixelData.Empty();
-	for (int i = 0; i < ImageData1.Num(); i++)
+	const int32 NumPixels = Frame.Width * Frame.Height;
+	for (FCaptureStreamFrame& Stream : Frame.Streams)
 	{
-		// log pixel
-		// UE_LOG(LogTemp, Warning, TEXT("Pixel: %s"), *ImageData1[i].ToString());
-		FColor& color1 = ImageData1[i];
-		FColor& color2 = ImageData2[i];
-		if (const auto val = MapOfMarks.Find(color1.R) != nullptr)
+		if (!Stream.bDue)
+		{
+			continue;
+		}
+		if (Frame.Image2.Num() != NumPixels)
 		{
-			auto tag = MapOfMarks[color1.R].Key;
-			int32 x = i % ScreenImageProperties.width;
-			int32 y = i / ScreenImageProperties.width;
-			
-			// MapTagToPixelLocationAndDistance.FindOrAdd(tag).Add(TPair<FVector2d, float>(FVector2d(i % ScreenImageProperties.width, i / ScreenImageProperties.width), color2.R));
-			// PixelLocationAndDistanceArray.Add(i % ScreenImageProperties.width);
-			// PixelLocationAndDistanceArray.Add(i / ScreenImageProperties.width);
-			// PixelLocationAndDistanceArray.Add(color2.R); // placeholder still get real distance
-			// MapTagToPixelLocationAndDistanceSize.FindOrAdd(tag)++;
-			MapTagToPixelData.FindOrAdd(tag).Add(x);
-			MapTagToPixelData.FindOrAdd(tag).Add(y);
-			ImageData2[i] = MapOfMarks[color1.R].Value;
-			// log color1.r
-			// UE_LOG(LogTemp, Warning, TEXT("Color1.R: %d"), color1.R);
+			Stream.bDue = false;
+			continue;
+		}
+		const int32 Downsample = Stream.Info.Downsample;
+		const FIntPoint Size = CaptureStreams::GetSize(Frame.Width, Frame.Height, Downsample);
+		Stream.Width = Size.X;
+		Stream.Height = Size.Y;
+		Stream.Color.SetNumUninitialized(Size.X * Size.Y, false);
+		CaptureStreams::DownsampleColor(Frame.Image2.GetData(), Frame.Width, Frame.Height, Downsample,
+		                                Stream.Color.GetData());
 
-			// distance
-			
-			// FVector WorldPosition;
-			// FVector WorldDirection;
-			// UGameplayStatics::DeprojectSceneCaptureToWorld(ColorCapture.Get(), FVector2d(x, y), WorldPosition,
-			//                                                WorldDirection);
-			// UE_LOG(LogTemp, Warning, TEXT("WorldPosition: %s"), *WorldPosition.ToString());
-			// UE_LOG(LogTemp, Warning, TEXT("WorldDirection: %s"), *WorldDirection.ToString());
-			// draw debug point
-			// DrawDebugPoint(GetWorld(), WorldPosition, 5, FColor::Red, false, 0.1f);
+		// the planes left empty aren't sent
+		Stream.ClassIds.Reset();
+		if (Stream.bClassIds && Frame.SegmentationOutput == ESegmentationOutput::ClassIds && Frame.ClassIds.Num() ==
+			NumPixels)
+		{
+			Stream.ClassIds.SetNumUninitialized(Size.X * Size.Y, false);
+			CaptureStreams::DownsampleClassIds(Frame.ClassIds.GetData(), Frame.Width, Frame.Height, Downsample,
+			                                   Stream.ClassIds.GetData());
+		}
+		Stream.DepthMm.Reset();
+		if (Stream.bDepth && Frame.bCaptureDepth && Frame.DepthMm.Num() == NumPixels)
+		{
+			Stream.DepthMm.SetNumUninitialized(Size.X * Size.Y, false);
+			CaptureStreams::DownsampleDepth(Frame.DepthMm.GetData(), Frame.Width, Frame.Height, Downsample,
+			                                Stream.DepthMm.GetData());
 		}
 	}
 }
 
-void UCaptureManager::ProcessImageData(TArray<FColor>& ImageData1, TArray<FColor>& ImageData2)
+/**
+ * @brief The CpuRaster source: draws the instances gathered at capture time into the class and instance id planes and
+ * writes their marks into Image1, so the classify stage reads them like a segmentation readback
+ */
+void UCaptureManager::RasterizeLabels(FRenderRequest& Frame) const
+{
+	const int32 NumPixels = Frame.Width * Frame.Height;
+	Frame.ClassIds.SetNumUninitialized(NumPixels, false);
+	Frame.InstanceIds.SetNumUninitialized(NumPixels, false);
+	Frame.LabelRasterizer.Rasterize(Frame.LabelViewProjection, Frame.Width, Frame.Height, Frame.LabelInstances,
+	                                Frame.ClassIds.GetData(), Frame.InstanceIds.GetData());
+	// the meshes may be released on the game thread now
+	Frame.LabelInstances.Reset();
+
+	Frame.Image1.SetNumUninitialized(NumPixels, false);
+	for (int32 i = 0; i < NumPixels; i++)
+	{
+		const uint8 ClassId = Frame.ClassIds[i];
+		const uint8 Mark = ClassId < Classifier.GetNumClasses() ? Classifier.GetClassMark(ClassId) : 0;
+		Frame.Image1[i] = FColor(Mark, 0, 0, 255);
+	}
+	if (Frame.Image2.Num() != NumPixels)
+	{
+		// without a renderer (-nullrhi) nothing is read back, the labels are sent with a black color image
+		Frame.Image2.SetNumZeroed(NumPixels, false);
+	}
+}
+
+void UCaptureManager::ColorImageObjects(FRenderRequest& Frame) const
 {
-	// Segmentation
-	// DoImageSegmentation(ImageData, InCaptureComponent);
+	if (Frame.SegmentationSource == ESegmentationSource::CpuRaster)
+	{
+		RasterizeLabels(Frame);
+	}
 
-	ColorImageObjects(ImageData1, ImageData2);
+	for (FCaptureSensorView& View : Frame.SensorViews)
+	{
+		if (!View.bCaptured || !View.bDepth)
+		{
+			continue;
+		}
+		if (View.SceneDepth.Num() != View.Width * View.Height)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("ColorImageObjects: %s readback has %d pixels, expected %d"), *View.Name,
+			       View.SceneDepth.Num(), View.Width * View.Height);
+			View.bCaptured = false;
+			continue;
+		}
+		View.DepthMm.SetNumUninitialized(View.SceneDepth.Num(), false);
+		FSegmentationClassifier::PackDepth(View.SceneDepth.GetData(), View.Width, View.Height, View.DepthMm.GetData());
+	}
+
+	// ReadSurfaceData sizes the images from the render target, which may differ from the pooled size
+	Frame.ClassIds.SetNumUninitialized(Frame.Image1.Num(), false);
+	// classes come from the R channel of the segmentation image
+	FColor* Recolor = Frame.bRecolor ? Frame.Image2.GetData() : nullptr;
+	if (Frame.MaskEncoding == ESegmentationMaskEncoding::RunLength)
+	{
+		Classifier.ClassifyMasks(Frame.Image1.GetData(), Recolor, Frame.ClassIds.GetData(), Frame.Width, Frame.Height,
+		                         Frame.ClassMasks);
+	}
+	else
+	{
+		Classifier.Classify(Frame.Image1.GetData(), Recolor, Frame.ClassIds.GetData(), Frame.Width, Frame.Height,
+		                    Frame.ClassPixelData);
+	}
+	if (Frame.bInstanceSegmentation)
+	{
+		// the rasterizer of the CpuRaster source already wrote the ids
+		const bool bRasterized = Frame.SegmentationSource == ESegmentationSource::CpuRaster;
+		Frame.InstanceIds.SetNumUninitialized(Frame.ClassIds.Num(), false);
+		FSegmentationClassifier::GatherInstances(bRasterized ? nullptr : Frame.Image1.GetData(),
+		                                         Frame.ClassIds.GetData(), Frame.InstanceIds.GetData(), Frame.Width,
+		                                         Frame.Height, Frame.Instances);
+	}
 
-	SendImageToServer(ImageData1, ImageData2);
+	if (!Frame.bCaptureDepth)
+	{
+		return;
+	}
+	if (Frame.SceneDepth.Num() != Frame.ClassIds.Num())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("ColorImageObjects: depth readback has %d pixels, expected %d"),
+		       Frame.SceneDepth.Num(), Frame.ClassIds.Num());
+		Frame.bCaptureDepth = false;
+		return;
+	}
+	Frame.DepthMm.SetNumUninitialized(Frame.SceneDepth.Num(), false);
+	Classifier.ClassifyDepth(Frame.SceneDepth.GetData(), Frame.ClassIds.GetData(), Frame.Width, Frame.Height,
+	                         Frame.DepthPercentile, Frame.DepthMm.GetData(), Frame.ClassDepth);
+	if (Frame.DepthPlaneEncoding == EDepthPlaneEncoding::HalfFloat)
+	{
+		Frame.DepthHalf.SetNumUninitialized(Frame.SceneDepth.Num(), false);
+		for (int32 i = 0; i < Frame.SceneDepth.Num(); i++)
+		{
+			Frame.DepthHalf[i] = FFloat16(Frame.SceneDepth[i].R * 0.01f);
+		}
+	}
 }
 
 bool UCaptureManager::ProjectWorldLocationToCapturedScreen(USceneCaptureComponent2D* InCaptureComponent,
@@ -416,40 +1895,14 @@ bool UCaptureManager::ProjectWorldLocationToCapturedScreen(USceneCaptureComponen
 {
 	// Render Target's Rectangle
 	verify(InRenderTarget2DSize.GetMin() > 0);
-	const FIntRect renderTargetRect(0, 0, InRenderTarget2DSize.X, InRenderTarget2DSize.Y);
-
-	// Initialise Viewinfo for projection matrix from [InCaptureComponent]
-	FMinimalViewInfo minimalViewInfo;
-	InCaptureComponent->GetCameraView(0.f, minimalViewInfo);
 
-	// Fetch [captureComponent]'s [CustomProjectionMatrix]
-	TOptional<FMatrix> customProjectionMatrix;
-	if (InCaptureComponent->bUseCustomProjectionMatrix)
-	{
-		customProjectionMatrix = InCaptureComponent->CustomProjectionMatrix;
-	}
-
-	// Calculate [cameraViewProjectionMatrix]
-	FMatrix captureViewMatrix, captureProjectionMatrix, captureViewProjectionMatrix;
-	UGameplayStatics::CalculateViewProjectionMatricesFromMinimalView(minimalViewInfo, customProjectionMatrix,
-	                                                                 captureViewMatrix, captureProjectionMatrix,
-	                                                                 captureViewProjectionMatrix);
-
-	bool result = FSceneView::ProjectWorldToScreen(InWorldLocation, renderTargetRect,
-	                                               captureViewProjectionMatrix, OutPixel);
-
-	// UE_LOG(LogTemp, Warning,
-	//        TEXT(
-	// 	       "ON [%s] CAPTURED SCREEN: WORLD LOCATION [%s] HAS LOCAL PIXEL COORDINATES: (X) %lf [over %d] OR (Y) %lf [over %d]"
-	//        ),
-	//        *InCaptureComponent->GetName(), *InWorldLocation.ToString(),
-	//        OutPixel.X, InRenderTarget2DSize.X,
-	//        OutPixel.Y, InRenderTarget2DSize.Y);
-	return result;
+	// Projecting many points, build an FCaptureProjection once and use it for all of them
+	const FCaptureProjection Projection(InCaptureComponent, InRenderTarget2DSize);
+	return Projection.Project(InWorldLocation, OutPixel);
 }
 
 /**
- * @brief Captures frame every frameMod frame
+ * @brief Captures a frame whenever the scheduler says one is due
  * @param DeltaTime 
  * @param TickType 
  * @param ThisTickFunction
@@ -463,25 +1916,30 @@ void UCaptureManager::TickComponent(float DeltaTime, ELevelTick TickType, FActor
 	// UE_LOG(LogTemp, Warning, TEXT("SegmentationCapture: %s"), *SegmentationCapture->GetActorLocation().ToString());
 	// UE_LOG(LogTemp, Warning, TEXT("myscenecap catpure component: %s"), *MySceneCap->GetComponentLocation().ToString());
 
-	// capture frame every frameMod frame
-	if (frameCount++ % frameMod == 0)
+	// process every readback that has landed first, so their slots are free for this tick's capture
+	DrainCompletedRenderRequests();
+
+	FCaptureLoad Load;
+	Load.PendingFrames = InFlightRenderRequests + ProcessingRenderRequests;
+	Load.MaxPendingFrames = RenderRequestPool.Num();
+	Load.NumWorkers = Pipeline ? Pipeline->GetNumWorkers() : 1;
+	Load.UnacknowledgedFrames = bServerAcknowledges ? UnacknowledgedFrameIds.Num() : INDEX_NONE;
+	if (ReplayReader)
 	{
-		// Capture render target data (adds render request to queue)
-		CaptureColorNonBlocking(SegmentationCapture->GetCaptureComponent2D(), true);
-		frameCount = 1;
+		ReplayFrames();
 	}
-	if (!RenderRequestQueue.IsEmpty())
+	else if (Scheduler.Tick(Schedule, GetWorld()->GetTimeSeconds(), DeltaTime, Load))
 	{
-		FRenderRequest* nextRenderRequest = nullptr;
-		RenderRequestQueue.Peek(nextRenderRequest);
-		if (nextRenderRequest)
+		// Capture render target data (takes a slot from the render request ring)
+		const double Start = FPlatformTime::Seconds();
+		if (CaptureColorNonBlocking(SegmentationCapture->GetCaptureComponent2D(), true))
 		{
-			if (nextRenderRequest->RenderFence.IsFenceComplete())
-			{
-				ProcessImageData(nextRenderRequest->Image1, nextRenderRequest->Image2);
-				RenderRequestQueue.Pop();
-				delete nextRenderRequest;
-			}
+			Scheduler.OnCaptureTaken(FPlatformTime::Seconds() - Start);
 		}
 	}
+	CaptureRateHz = Scheduler.GetRateHz();
+	AchievedCaptureRateHz = Scheduler.GetAchievedRateHz();
+	SkippedCaptureCount = Scheduler.GetSkippedCount();
+	UnacknowledgedFrameCount = Load.UnacknowledgedFrames;
+	DroppedRecordCount = Recorder ? static_cast<int32>(Recorder->GetNumDroppedRecords()) : 0;
 }
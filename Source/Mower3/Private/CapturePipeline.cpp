@@ -0,0 +1,106 @@
+#include "CapturePipeline.h"
+
+FCapturePipeline::FCapturePipeline(int32 NumWorkers, FStages InStages)
+	: Stages(MoveTemp(InStages))
+	, DecodePipe(TEXT("CaptureDecodePipe"))
+	, DeltaPipe(TEXT("CaptureDeltaPipe"))
+	, SendPipe(TEXT("CaptureSendPipe"))
+{
+	NumWorkers = FMath::Max(NumWorkers, 1);
+	for (int32 i = 0; i < NumWorkers; i++)
+	{
+		WorkerPipes.Add(MakeUnique<UE::Tasks::FPipe>(TEXT("CaptureWorkerPipe")));
+	}
+}
+
+FCapturePipeline::~FCapturePipeline()
+{
+	Flush();
+}
+
+UE::Tasks::FTask FCapturePipeline::Submit(FRenderRequest& Frame)
+{
+	FRenderRequest* FramePtr = &Frame;
+	UE::Tasks::FPipe& WorkerPipe = *WorkerPipes[NextWorker];
+	NextWorker = (NextWorker + 1) % WorkerPipes.Num();
+
+	auto ClassifyBody = [this, FramePtr]()
+	{
+		Stages.Classify(*FramePtr);
+	};
+	UE::Tasks::FTask ClassifyTask;
+	if (Stages.Decode)
+	{
+		// decodes are chained like deltas, a decoder may rebuild a frame from the one before it
+		auto DecodeBody = [this, FramePtr]()
+		{
+			Stages.Decode(*FramePtr);
+		};
+		if (LastDecodeTask.IsValid())
+		{
+			LastDecodeTask = DecodePipe.Launch(TEXT("CaptureDecode"), MoveTemp(DecodeBody),
+			                                   UE::Tasks::Prerequisites(LastDecodeTask));
+		}
+		else
+		{
+			LastDecodeTask = DecodePipe.Launch(TEXT("CaptureDecode"), MoveTemp(DecodeBody));
+		}
+		ClassifyTask = WorkerPipe.Launch(TEXT("CaptureClassify"), MoveTemp(ClassifyBody),
+		                                 UE::Tasks::Prerequisites(LastDecodeTask));
+	}
+	else
+	{
+		ClassifyTask = WorkerPipe.Launch(TEXT("CaptureClassify"), MoveTemp(ClassifyBody));
+	}
+	// a frame is diffed against the one submitted before it, so deltas are chained like sends, but the slow encode
+	// after them still runs in parallel
+	auto DeltaBody = [this, FramePtr]()
+	{
+		Stages.Delta(*FramePtr);
+	};
+	if (LastDeltaTask.IsValid())
+	{
+		LastDeltaTask = DeltaPipe.Launch(TEXT("CaptureDelta"), MoveTemp(DeltaBody),
+		                                 UE::Tasks::Prerequisites(ClassifyTask, LastDeltaTask));
+	}
+	else
+	{
+		LastDeltaTask = DeltaPipe.Launch(TEXT("CaptureDelta"), MoveTemp(DeltaBody),
+		                                 UE::Tasks::Prerequisites(ClassifyTask));
+	}
+	const UE::Tasks::FTask EncodeTask = WorkerPipe.Launch(TEXT("CaptureEncode"), [this, FramePtr]()
+	{
+		Stages.Encode(*FramePtr);
+	}, UE::Tasks::Prerequisites(LastDeltaTask));
+	const UE::Tasks::FTask SerializeTask = WorkerPipe.Launch(TEXT("CaptureSerialize"), [this, FramePtr]()
+	{
+		Stages.Serialize(*FramePtr);
+	}, UE::Tasks::Prerequisites(EncodeTask));
+
+	// chaining on the previous send keeps frames in submission order even when a later frame encodes faster
+	auto SendBody = [this, FramePtr]()
+	{
+		Stages.Send(*FramePtr);
+		Stages.Release(*FramePtr);
+	};
+	if (LastSendTask.IsValid())
+	{
+		LastSendTask = SendPipe.Launch(TEXT("CaptureSend"), MoveTemp(SendBody),
+		                               UE::Tasks::Prerequisites(SerializeTask, LastSendTask));
+	}
+	else
+	{
+		LastSendTask = SendPipe.Launch(TEXT("CaptureSend"), MoveTemp(SendBody),
+		                               UE::Tasks::Prerequisites(SerializeTask));
+	}
+	return LastSendTask;
+}
+
+void FCapturePipeline::Flush()
+{
+	// every send depends on the one before it, so the last send completing means the pipeline is empty
+	if (LastSendTask.IsValid())
+	{
+		LastSendTask.Wait();
+	}
+}
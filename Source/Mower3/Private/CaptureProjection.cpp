@@ -0,0 +1,98 @@
+#include "CaptureProjection.h"
+#include "Components/SceneCaptureComponent2D.h"
+#include "Kismet/GameplayStatics.h"
+#include "SceneView.h"
+
+#if PLATFORM_ENABLE_VECTORINTRINSICS && PLATFORM_CPU_X86_FAMILY
+#include <emmintrin.h>
+#define MOWER_PROJECTION_SSE2 1
+#else
+#define MOWER_PROJECTION_SSE2 0
+#endif
+
+FCaptureProjection::FCaptureProjection(USceneCaptureComponent2D* CaptureComponent, FIntPoint ImageSize)
+	: ViewRect(0, 0, ImageSize.X, ImageSize.Y)
+{
+	FMinimalViewInfo ViewInfo;
+	CaptureComponent->GetCameraView(0.0f, ViewInfo);
+	TOptional<FMatrix> CustomProjection;
+	if (CaptureComponent->bUseCustomProjectionMatrix)
+	{
+		CustomProjection = CaptureComponent->CustomProjectionMatrix;
+	}
+	FMatrix View;
+	FMatrix Projection;
+	UGameplayStatics::CalculateViewProjectionMatricesFromMinimalView(ViewInfo, CustomProjection, View, Projection,
+	                                                                 ViewProjection);
+	GetViewFrustumBounds(Frustum, ViewProjection, false);
+}
+
+bool FCaptureProjection::Project(const FVector& WorldLocation, FVector2D& OutPixel) const
+{
+	return FSceneView::ProjectWorldToScreen(WorldLocation, ViewRect, ViewProjection, OutPixel);
+}
+
+bool FCaptureProjection::IsVisible(const FBoxSphereBounds& WorldBounds) const
+{
+	return Frustum.IntersectBox(WorldBounds.Origin, WorldBounds.BoxExtent);
+}
+
+void FCaptureProjection::ProjectPoints(const FMatrix& LocalToWorld, const float* X, const float* Y, const float* Z,
+                                       int32 Num, TArray<FVector2f>& OutPixels) const
+{
+	// local to clip space in one matrix, UE matrices multiply row vectors from the left
+	const FMatrix44f M(LocalToWorld * ViewProjection);
+	const float Width = ViewRect.Width();
+	const float Height = ViewRect.Height();
+	const float MinX = ViewRect.Min.X;
+	const float MinY = ViewRect.Min.Y;
+
+	int32 i = 0;
+#if MOWER_PROJECTION_SSE2
+	const __m128 Half = _mm_set1_ps(0.5f);
+	const __m128 Zero = _mm_setzero_ps();
+	for (; i + 4 <= Num; i += 4)
+	{
+		const __m128 PX = _mm_loadu_ps(X + i);
+		const __m128 PY = _mm_loadu_ps(Y + i);
+		const __m128 PZ = _mm_loadu_ps(Z + i);
+		auto Row = [&](int32 Column)
+		{
+			__m128 Result = _mm_add_ps(_mm_mul_ps(PX, _mm_set1_ps(M.M[0][Column])),
+			                           _mm_mul_ps(PY, _mm_set1_ps(M.M[1][Column])));
+			Result = _mm_add_ps(Result, _mm_mul_ps(PZ, _mm_set1_ps(M.M[2][Column])));
+			return _mm_add_ps(Result, _mm_set1_ps(M.M[3][Column]));
+		};
+		const __m128 ClipW = Row(3);
+		const int32 InFront = _mm_movemask_ps(_mm_cmpgt_ps(ClipW, Zero));
+		if (InFront == 0)
+		{
+			continue;
+		}
+		const __m128 Rhw = _mm_div_ps(_mm_set1_ps(1.0f), ClipW);
+		const __m128 NormalizedX = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(Row(0), Rhw), Half), Half);
+		const __m128 NormalizedY = _mm_sub_ps(Half, _mm_mul_ps(_mm_mul_ps(Row(1), Rhw), Half));
+		float PixelX[4];
+		float PixelY[4];
+		_mm_storeu_ps(PixelX, _mm_add_ps(_mm_mul_ps(NormalizedX, _mm_set1_ps(Width)), _mm_set1_ps(MinX)));
+		_mm_storeu_ps(PixelY, _mm_add_ps(_mm_mul_ps(NormalizedY, _mm_set1_ps(Height)), _mm_set1_ps(MinY)));
+		for (int32 Lane = 0; Lane < 4; ++Lane)
+		{
+			if (InFront & (1 << Lane))
+			{
+				OutPixels.Emplace(PixelX[Lane], PixelY[Lane]);
+			}
+		}
+	}
+#endif
+	for (; i < Num; ++i)
+	{
+		const FVector4f Clip = M.TransformFVector4(FVector4f(X[i], Y[i], Z[i], 1.0f));
+		if (Clip.W > 0.0f)
+		{
+			const float Rhw = 1.0f / Clip.W;
+			OutPixels.Emplace((Clip.X * Rhw * 0.5f + 0.5f) * Width + MinX,
+			                  (0.5f - Clip.Y * Rhw * 0.5f) * Height + MinY);
+		}
+	}
+}
@@ -0,0 +1,127 @@
+#include "CaptureScheduler.h"
+
+namespace
+{
+	constexpr double AdaptIntervalSeconds = 0.25;
+	constexpr float DecreaseFactor = 0.7f;
+	// fraction of MaxRateHz the rate climbs back per second
+	constexpr float IncreasePerSecond = 0.25f;
+	// keep the workers below saturation, a full pipeline only adds latency
+	constexpr double WorkerUtilization = 0.8;
+	constexpr double SmoothingAlpha = 0.2;
+
+	template <typename T>
+	T Smooth(T Average, T Sample)
+	{
+		return Average <= 0 ? Sample : FMath::Lerp(Average, Sample, static_cast<T>(SmoothingAlpha));
+	}
+}
+
+void FCaptureScheduler::Reset(double Now)
+{
+	RateHz = 0.0f;
+	AchievedRateHz = 0.0f;
+	SkippedCount = 0;
+	NextCaptureTime = Now;
+	FramesSinceCapture = 0;
+	LastAdaptTime = Now;
+	WindowStart = Now;
+	WindowCaptures = 0;
+	SmoothedFps = 0.0f;
+	SmoothedWorkerMs = 0.0;
+	SmoothedGameThreadMs = 0.0;
+}
+
+bool FCaptureScheduler::Tick(const FCaptureScheduleSettings& Settings, double Now, float DeltaTime,
+                             const FCaptureLoad& Load)
+{
+	if (DeltaTime > 0.0f)
+	{
+		SmoothedFps = Smooth(SmoothedFps, 1.0f / DeltaTime);
+	}
+
+	const float MinRate = FMath::Max(FMath::Min(Settings.MinRateHz, Settings.MaxRateHz), 0.1f);
+	const float MaxRate = FMath::Max(Settings.MaxRateHz, MinRate);
+	if (!Settings.bAdaptive || RateHz <= 0.0f)
+	{
+		RateHz = MaxRate;
+	}
+	else if (Now - LastAdaptTime >= AdaptIntervalSeconds)
+	{
+		Adapt(Settings, Now, Load, MinRate, MaxRate);
+	}
+	RateHz = FMath::Clamp(RateHz, MinRate, MaxRate);
+
+	if (Now - WindowStart >= 1.0)
+	{
+		AchievedRateHz = static_cast<float>(WindowCaptures / (Now - WindowStart));
+		WindowStart = Now;
+		WindowCaptures = 0;
+	}
+
+	if (Settings.Trigger == ECaptureTrigger::FrameCount)
+	{
+		int32 Interval = FMath::Max(Settings.FramesPerCapture, 1);
+		if (Settings.bAdaptive && SmoothedFps > 0.0f)
+		{
+			Interval = FMath::Max(Interval, FMath::CeilToInt(SmoothedFps / RateHz));
+		}
+		return ++FramesSinceCapture >= Interval;
+	}
+
+	if (Now < NextCaptureTime)
+	{
+		return false;
+	}
+	// a tick slower than the capture period loses the periods in between, the cadence itself stays put
+	const double Period = 1.0 / RateHz;
+	const int64 Missed = FMath::FloorToInt64((Now - NextCaptureTime) / Period);
+	SkippedCount += static_cast<int32>(Missed);
+	NextCaptureTime += Period * (Missed + 1);
+	return true;
+}
+
+void FCaptureScheduler::OnCaptureTaken(double GameThreadSeconds)
+{
+	FramesSinceCapture = 0;
+	WindowCaptures++;
+	SmoothedGameThreadMs = Smooth(SmoothedGameThreadMs, GameThreadSeconds * 1000.0);
+}
+
+void FCaptureScheduler::OnFrameProcessed(double WorkerSeconds)
+{
+	SmoothedWorkerMs = Smooth(SmoothedWorkerMs, WorkerSeconds * 1000.0);
+}
+
+void FCaptureScheduler::Adapt(const FCaptureScheduleSettings& Settings, double Now, const FCaptureLoad& Load,
+                              float MinRate, float MaxRate)
+{
+	const double Elapsed = Now - LastAdaptTime;
+	LastAdaptTime = Now;
+
+	const bool bSlotsFull = Load.PendingFrames >= Load.MaxPendingFrames;
+	const bool bServerBehind = Settings.MaxUnacknowledgedFrames > 0 && Load.UnacknowledgedFrames > Settings.
+		MaxUnacknowledgedFrames;
+	if (bSlotsFull || bServerBehind)
+	{
+		RateHz *= DecreaseFactor;
+	}
+	else if (Load.PendingFrames * 2 <= Load.MaxPendingFrames)
+	{
+		RateHz += static_cast<float>(MaxRate * IncreasePerSecond * Elapsed);
+	}
+
+	float Ceiling = MaxRate;
+	if (SmoothedWorkerMs > 0.0)
+	{
+		Ceiling = FMath::Min(Ceiling, static_cast<float>(WorkerUtilization * Load.NumWorkers * 1000.0 /
+			                     SmoothedWorkerMs));
+	}
+	// CpuBudgetMs per rendered frame at SmoothedFps frames per second pays for this many captures per second
+	const double CaptureMs = SmoothedWorkerMs + SmoothedGameThreadMs;
+	if (Settings.CpuBudgetMs > 0.0f && CaptureMs > 0.0 && SmoothedFps > 0.0f)
+	{
+		Ceiling = FMath::Min(Ceiling, static_cast<float>(Settings.CpuBudgetMs * SmoothedFps / CaptureMs));
+	}
+	RateHz = FMath::Clamp(FMath::Min(RateHz, Ceiling), MinRate, MaxRate);
+}
@@ -0,0 +1,136 @@
+#include "CaptureSensorRig.h"
+#include "Components/SceneCaptureComponent2D.h"
+#include "Engine/TextureRenderTarget2D.h"
+#include "Materials/MaterialInterface.h"
+
+UCaptureSensorRig::UCaptureSensorRig()
+{
+	PrimaryComponentTick.bCanEverTick = false;
+}
+
+void UCaptureSensorRig::BeginPlay()
+{
+	Super::BeginPlay();
+
+	CaptureComponents.Reset(Sensors.Num());
+	for (const FCaptureSensorSettings& Sensor : Sensors)
+	{
+		CaptureComponents.Add(CreateCaptureComponent(Sensor));
+	}
+}
+
+void UCaptureSensorRig::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	for (USceneCaptureComponent2D* CaptureComponent : CaptureComponents)
+	{
+		if (IsValid(CaptureComponent))
+		{
+			CaptureComponent->DestroyComponent();
+		}
+	}
+	CaptureComponents.Reset();
+
+	Super::EndPlay(EndPlayReason);
+}
+
+/**
+ * @brief Creates a capture component attached to the rig that only renders when CaptureDueSensors asks it to
+ */
+USceneCaptureComponent2D* UCaptureSensorRig::CreateCaptureComponent(const FCaptureSensorSettings& Sensor)
+{
+	const bool bDepth = Sensor.CaptureSource == SCS_SceneDepth;
+	UTextureRenderTarget2D* RenderTarget2D = NewObject<UTextureRenderTarget2D>(this);
+	if (bDepth)
+	{
+		// same format as the capture manager's depth target
+		RenderTarget2D->RenderTargetFormat = RTF_R32f;
+		RenderTarget2D->InitCustomFormat(Sensor.Width, Sensor.Height, PF_R32_FLOAT, true);
+	}
+	else
+	{
+		RenderTarget2D->RenderTargetFormat = RTF_RGBA8;
+		RenderTarget2D->InitCustomFormat(Sensor.Width, Sensor.Height, PF_B8G8R8A8, true);
+		RenderTarget2D->TargetGamma = 1.2f;
+	}
+	RenderTarget2D->bGPUSharedFlag = true;
+
+	USceneCaptureComponent2D* CaptureComponent = NewObject<USceneCaptureComponent2D>(
+		GetOwner(), MakeUniqueObjectName(GetOwner(), USceneCaptureComponent2D::StaticClass(), Sensor.Name));
+	CaptureComponent->SetupAttachment(this);
+	CaptureComponent->SetRelativeTransform(Sensor.RelativeTransform);
+	CaptureComponent->TextureTarget = RenderTarget2D;
+	CaptureComponent->CaptureSource = Sensor.CaptureSource;
+	CaptureComponent->FOVAngle = Sensor.FOVAngle;
+	// rendered on demand, a sensor at a rate divisor of 4 costs a quarter of one that renders every frame
+	CaptureComponent->bCaptureEveryFrame = false;
+	CaptureComponent->bCaptureOnMovement = false;
+	if (Sensor.PostProcessMaterial)
+	{
+		CaptureComponent->AddOrUpdateBlendable(Sensor.PostProcessMaterial);
+	}
+	CaptureComponent->RegisterComponent();
+	return CaptureComponent;
+}
+
+void UCaptureSensorRig::InitViews(TArray<FCaptureSensorView>& OutViews) const
+{
+	OutViews.SetNum(Sensors.Num());
+	for (int32 i = 0; i < Sensors.Num(); i++)
+	{
+		const FCaptureSensorSettings& Sensor = Sensors[i];
+		FCaptureSensorView& View = OutViews[i];
+		View.bCaptured = false;
+		View.bDepth = Sensor.CaptureSource == SCS_SceneDepth;
+		View.Name = Sensor.Name.ToString();
+		const int32 NumPixels = Sensor.Width * Sensor.Height;
+		if (View.bDepth)
+		{
+			View.SceneDepth.SetNumUninitialized(NumPixels);
+			View.DepthMm.SetNumUninitialized(NumPixels);
+		}
+		else
+		{
+			View.Pixels.SetNumUninitialized(NumPixels);
+		}
+	}
+}
+
+int32 UCaptureSensorRig::CaptureDueSensors(uint64 CaptureIndex, TArray<FCaptureSensorView>& InOutViews)
+{
+	check(InOutViews.Num() == Sensors.Num());
+	int32 NumCaptured = 0;
+	for (int32 i = 0; i < Sensors.Num(); i++)
+	{
+		const FCaptureSensorSettings& Sensor = Sensors[i];
+		FCaptureSensorView& View = InOutViews[i];
+		USceneCaptureComponent2D* CaptureComponent = CaptureComponents.IsValidIndex(i) ? CaptureComponents[i] : nullptr;
+		View.bCaptured = IsValid(CaptureComponent) && IsValid(CaptureComponent->TextureTarget) && CaptureIndex %
+			FMath::Max(Sensor.RateDivisor, 1) == 0;
+		if (!View.bCaptured)
+		{
+			continue;
+		}
+
+		// queues the scene render on the render thread, the readback queued after it sees the finished image
+		CaptureComponent->CaptureScene();
+		View.RenderTarget = CaptureComponent->TextureTarget->GameThread_GetRenderTargetResource();
+		View.Width = CaptureComponent->TextureTarget->SizeX;
+		View.Height = CaptureComponent->TextureTarget->SizeY;
+
+		const FVector Location = CaptureComponent->GetRelativeLocation();
+		const FRotator Rotation = CaptureComponent->GetRelativeRotation();
+		FrameWire::FViewInfo& Info = View.Info;
+		Info.View = static_cast<uint8>(i + 1);
+		Info.CaptureSource = static_cast<uint8>(Sensor.CaptureSource.GetValue());
+		Info.RateDivisor = static_cast<uint16>(FMath::Clamp(Sensor.RateDivisor, 1, MAX_uint16));
+		Info.FOVDegrees = CaptureComponent->FOVAngle;
+		Info.Location[0] = Location.X;
+		Info.Location[1] = Location.Y;
+		Info.Location[2] = Location.Z;
+		Info.Rotation[0] = Rotation.Pitch;
+		Info.Rotation[1] = Rotation.Yaw;
+		Info.Rotation[2] = Rotation.Roll;
+		NumCaptured++;
+	}
+	return NumCaptured;
+}
@@ -0,0 +1,135 @@
+#include "CaptureStreams.h"
+#include "Async/ParallelFor.h"
+
+#if PLATFORM_ENABLE_VECTORINTRINSICS && PLATFORM_CPU_X86_FAMILY
+#include <emmintrin.h>
+#define MOWER_STREAMS_SSE2 1
+#else
+#define MOWER_STREAMS_SSE2 0
+#endif
+
+namespace
+{
+	// output rows per task, enough work to be worth scheduling
+	constexpr int32 RowsPerTask = 8;
+
+	// source pixels a block covers along one axis, cut short at the edge
+	int32 GetBlockSize(int32 Size, int32 Block, int32 Downsample)
+	{
+		return FMath::Min(Downsample, Size - Block * Downsample);
+	}
+
+	template <typename FunctionType>
+	void ForEachOutputRows(int32 OutHeight, FunctionType&& Function)
+	{
+		const int32 NumTasks = FMath::DivideAndRoundUp(OutHeight, RowsPerTask);
+		ParallelFor(NumTasks, [&](int32 Task)
+		{
+			Function(Task * RowsPerTask, FMath::Min(OutHeight, (Task + 1) * RowsPerTask));
+		}, NumTasks == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
+	}
+}
+
+FIntPoint CaptureStreams::GetSize(int32 Width, int32 Height, int32 Downsample)
+{
+	const int32 Factor = FMath::Clamp(Downsample, 1, MaxDownsample);
+	return FIntPoint(FMath::DivideAndRoundUp(Width, Factor), FMath::DivideAndRoundUp(Height, Factor));
+}
+
+void CaptureStreams::DownsampleColor(const FColor* Source, int32 Width, int32 Height, int32 Downsample, FColor* Out)
+{
+	const int32 Factor = FMath::Clamp(Downsample, 1, MaxDownsample);
+	const FIntPoint Size = GetSize(Width, Height, Factor);
+	const int32 RowBytes = Width * 4;
+	ForEachOutputRows(Size.Y, [&](int32 FirstY, int32 EndY)
+	{
+		// per source byte, the sum over the rows of the block row. MaxDownsample rows of 255 add up to 4080 and a
+		// whole block to 65280, so uint16 holds both.
+		TArray<uint16> Sums;
+		Sums.SetNumUninitialized(RowBytes);
+		for (int32 Y = FirstY; Y < EndY; ++Y)
+		{
+			const int32 NumRows = GetBlockSize(Height, Y, Factor);
+			FMemory::Memzero(Sums.GetData(), RowBytes * sizeof(uint16));
+			for (int32 Row = 0; Row < NumRows; ++Row)
+			{
+				const uint8* Pixels = reinterpret_cast<const uint8*>(Source + static_cast<int64>(Y * Factor + Row) *
+					Width);
+				uint16* RowSums = Sums.GetData();
+				int32 i = 0;
+#if MOWER_STREAMS_SSE2
+				const __m128i Zero = _mm_setzero_si128();
+				for (; i + 16 <= RowBytes; i += 16)
+				{
+					const __m128i Bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Pixels + i));
+					__m128i* Lo = reinterpret_cast<__m128i*>(RowSums + i);
+					__m128i* Hi = reinterpret_cast<__m128i*>(RowSums + i + 8);
+					_mm_storeu_si128(Lo, _mm_add_epi16(_mm_loadu_si128(Lo), _mm_unpacklo_epi8(Bytes, Zero)));
+					_mm_storeu_si128(Hi, _mm_add_epi16(_mm_loadu_si128(Hi), _mm_unpackhi_epi8(Bytes, Zero)));
+				}
+#endif
+				for (; i < RowBytes; ++i)
+				{
+					RowSums[i] += Pixels[i];
+				}
+			}
+
+			uint8* OutRow = reinterpret_cast<uint8*>(Out + static_cast<int64>(Y) * Size.X);
+			for (int32 X = 0; X < Size.X; ++X)
+			{
+				const int32 NumColumns = GetBlockSize(Width, X, Factor);
+				const uint32 Count = NumRows * NumColumns;
+				uint32 Channels[4] = {};
+				const uint16* BlockSums = Sums.GetData() + X * Factor * 4;
+				for (int32 Column = 0; Column < NumColumns; ++Column)
+				{
+					for (int32 c = 0; c < 4; ++c)
+					{
+						Channels[c] += BlockSums[Column * 4 + c];
+					}
+				}
+				for (int32 c = 0; c < 4; ++c)
+				{
+					OutRow[X * 4 + c] = static_cast<uint8>((Channels[c] + Count / 2) / Count);
+				}
+			}
+		}
+	});
+}
+
+void CaptureStreams::DownsampleClassIds(const uint8* Source, int32 Width, int32 Height, int32 Downsample, uint8* Out)
+{
+	const int32 Factor = FMath::Clamp(Downsample, 1, MaxDownsample);
+	const FIntPoint Size = GetSize(Width, Height, Factor);
+	for (int32 Y = 0; Y < Size.Y; ++Y)
+	{
+		const uint8* Row = Source + static_cast<int64>(Y * Factor + GetBlockSize(Height, Y, Factor) / 2) * Width;
+		for (int32 X = 0; X < Size.X; ++X)
+		{
+			Out[static_cast<int64>(Y) * Size.X + X] = Row[X * Factor + GetBlockSize(Width, X, Factor) / 2];
+		}
+	}
+}
+
+void CaptureStreams::DownsampleDepth(const uint16* Source, int32 Width, int32 Height, int32 Downsample, uint16* Out)
+{
+	const int32 Factor = FMath::Clamp(Downsample, 1, MaxDownsample);
+	const FIntPoint Size = GetSize(Width, Height, Factor);
+	ForEachOutputRows(Size.Y, [&](int32 FirstY, int32 EndY)
+	{
+		for (int32 Y = FirstY; Y < EndY; ++Y)
+		{
+			uint16* OutRow = Out + static_cast<int64>(Y) * Size.X;
+			FMemory::Memset(OutRow, 0xff, Size.X * sizeof(uint16));
+			for (int32 Row = 0; Row < GetBlockSize(Height, Y, Factor); ++Row)
+			{
+				const uint16* Depth = Source + static_cast<int64>(Y * Factor + Row) * Width;
+				for (int32 x = 0; x < Width; ++x)
+				{
+					uint16& Nearest = OutRow[x / Factor];
+					Nearest = FMath::Min(Nearest, Depth[x]);
+				}
+			}
+		}
+	});
+}
@@ -0,0 +1,252 @@
+#include "CoverageMap.h"
+#include "Engine/World.h"
+#include "GrassMowingSubsystem.h"
+
+bool FCoverageMap::Init(const FBox2D& Area, double InCellSize)
+{
+	Words.Empty();
+	TileCounts.Empty();
+	NumCellsX = NumCellsY = NumTilesX = NumTilesY = 0;
+	NumCovered = 0;
+	if (!Area.bIsValid || InCellSize <= 0.0)
+	{
+		return false;
+	}
+	const FVector2D Size = Area.GetSize();
+	const double SideX = FMath::Max(1.0, FMath::CeilToDouble(Size.X / InCellSize));
+	const double SideY = FMath::Max(1.0, FMath::CeilToDouble(Size.Y / InCellSize));
+	// counted in whole tiles, which is what is allocated. Checked before the casts, since this also keeps both sides
+	// far below MAX_int32 however thin the area is.
+	const double TilesX = FMath::CeilToDouble(SideX / TileSize);
+	const double TilesY = FMath::CeilToDouble(SideY / TileSize);
+	if (TilesX * TilesY * TileSize * TileSize > MaxCells)
+	{
+		UE_LOG(LogTemp, Error, TEXT("FCoverageMap: %.0f x %.0f cells of %.1f cm are too many"), SideX, SideY,
+		       InCellSize);
+		return false;
+	}
+	Origin = Area.Min;
+	CellSize = InCellSize;
+	NumCellsX = static_cast<int32>(SideX);
+	NumCellsY = static_cast<int32>(SideY);
+	NumTilesX = FMath::DivideAndRoundUp(NumCellsX, TileSize);
+	NumTilesY = FMath::DivideAndRoundUp(NumCellsY, TileSize);
+	Words.SetNumZeroed(NumTilesX * NumTilesY * TileSize);
+	TileCounts.SetNumZeroed(NumTilesX * NumTilesY);
+	return true;
+}
+
+void FCoverageMap::Clear()
+{
+	FMemory::Memzero(Words.GetData(), Words.Num() * Words.GetTypeSize());
+	FMemory::Memzero(TileCounts.GetData(), TileCounts.Num() * TileCounts.GetTypeSize());
+	NumCovered = 0;
+}
+
+void FCoverageMap::AddDeck(const FMowingDeck& Deck)
+{
+	FVector2D Corners[4];
+	Deck.GetCorners(Corners);
+	AddConvex(Corners, 4);
+}
+
+void FCoverageMap::AddConvex(const FVector2D* Vertices, int32 NumVertices)
+{
+	if (!IsInitialized() || NumVertices < 3)
+	{
+		return;
+	}
+	// in cells from the map's origin, so a cell's centre is at its index plus a half
+	TArray<FVector2D, TInlineAllocator<16>> Local;
+	double MinY = TNumericLimits<double>::Max();
+	double MaxY = TNumericLimits<double>::Lowest();
+	for (int32 i = 0; i < NumVertices; ++i)
+	{
+		const FVector2D& Vertex = Local.Add_GetRef((Vertices[i] - Origin) / CellSize);
+		MinY = FMath::Min(MinY, Vertex.Y);
+		MaxY = FMath::Max(MaxY, Vertex.Y);
+	}
+	const int32 Y0 = static_cast<int32>(FMath::Clamp(FMath::CeilToDouble(MinY - 0.5), 0.0, NumCellsY * 1.0));
+	const int32 Y1 = static_cast<int32>(FMath::Clamp(FMath::FloorToDouble(MaxY - 0.5), -1.0, NumCellsY - 1.0));
+	for (int32 Y = Y0; Y <= Y1; ++Y)
+	{
+		// the polygon is convex, so its edges crossing the row bound one span
+		const double CenterY = Y + 0.5;
+		double MinX = TNumericLimits<double>::Max();
+		double MaxX = TNumericLimits<double>::Lowest();
+		for (int32 i = 0; i < NumVertices; ++i)
+		{
+			const FVector2D& A = Local[i];
+			const FVector2D& B = Local[(i + 1) % NumVertices];
+			if ((A.Y < CenterY && B.Y < CenterY) || (A.Y > CenterY && B.Y > CenterY))
+			{
+				continue;
+			}
+			if (A.Y == B.Y)
+			{
+				MinX = FMath::Min3(MinX, A.X, B.X);
+				MaxX = FMath::Max3(MaxX, A.X, B.X);
+				continue;
+			}
+			const double X = A.X + (CenterY - A.Y) * (B.X - A.X) / (B.Y - A.Y);
+			MinX = FMath::Min(MinX, X);
+			MaxX = FMath::Max(MaxX, X);
+		}
+		const double X0 = FMath::Max(FMath::CeilToDouble(MinX - 0.5), 0.0);
+		const double X1 = FMath::Min(FMath::FloorToDouble(MaxX - 0.5), NumCellsX - 1.0);
+		if (X0 <= X1)
+		{
+			AddSpan(Y, static_cast<int32>(X0), static_cast<int32>(X1));
+		}
+	}
+}
+
+uint64 FCoverageMap::GetSpanMask(int32 TileX, int32 X0, int32 X1) const
+{
+	const int32 First = FMath::Max(X0 - TileX * TileSize, 0);
+	const int32 Last = FMath::Min(X1 - TileX * TileSize, TileSize - 1);
+	return (~0ull >> (TileSize - 1 - (Last - First))) << First;
+}
+
+void FCoverageMap::AddSpan(int32 Y, int32 X0, int32 X1)
+{
+	// a word of the row at a time, counting the bits that weren't set yet
+	const int32 TileRow = (Y / TileSize) * NumTilesX;
+	for (int32 TileX = X0 / TileSize; TileX <= X1 / TileSize; ++TileX)
+	{
+		const uint64 Mask = GetSpanMask(TileX, X0, X1);
+		uint64& Word = Words[GetWordIndex(TileX, Y)];
+		const int32 Added = static_cast<int32>(FPlatformMath::CountBits(Mask & ~Word));
+		Word |= Mask;
+		TileCounts[TileRow + TileX] += static_cast<uint16>(Added);
+		NumCovered += Added;
+	}
+}
+
+int64 FCoverageMap::CountSpan(int32 Y, int32 X0, int32 X1) const
+{
+	int64 Count = 0;
+	for (int32 TileX = X0 / TileSize; TileX <= X1 / TileSize; ++TileX)
+	{
+		Count += FPlatformMath::CountBits(GetSpanMask(TileX, X0, X1) & Words[GetWordIndex(TileX, Y)]);
+	}
+	return Count;
+}
+
+bool FCoverageMap::IsCovered(const FVector2D& Location) const
+{
+	const FVector2D Cell = (Location - Origin) / CellSize;
+	const int32 X = FMath::FloorToInt32(Cell.X);
+	const int32 Y = FMath::FloorToInt32(Cell.Y);
+	if (X < 0 || Y < 0 || X >= NumCellsX || Y >= NumCellsY)
+	{
+		return false;
+	}
+	return (Words[GetWordIndex(X / TileSize, Y)] >> (X % TileSize) & 1) != 0;
+}
+
+double FCoverageMap::GetCoveredFraction() const
+{
+	return IsInitialized() ? static_cast<double>(NumCovered) / GetNumCells() : 0.0;
+}
+
+double FCoverageMap::GetCoveredFraction(const FBox2D& Region) const
+{
+	if (!IsInitialized() || !Region.bIsValid)
+	{
+		return 0.0;
+	}
+	const FVector2D Min = (Region.Min - Origin) / CellSize;
+	const FVector2D Max = (Region.Max - Origin) / CellSize;
+	const int32 X0 = static_cast<int32>(FMath::Clamp(FMath::CeilToDouble(Min.X - 0.5), 0.0, NumCellsX * 1.0));
+	const int32 Y0 = static_cast<int32>(FMath::Clamp(FMath::CeilToDouble(Min.Y - 0.5), 0.0, NumCellsY * 1.0));
+	const int32 X1 = static_cast<int32>(FMath::Clamp(FMath::FloorToDouble(Max.X - 0.5), -1.0, NumCellsX - 1.0));
+	const int32 Y1 = static_cast<int32>(FMath::Clamp(FMath::FloorToDouble(Max.Y - 0.5), -1.0, NumCellsY - 1.0));
+	if (X0 > X1 || Y0 > Y1)
+	{
+		return 0.0;
+	}
+
+	// whole tiles by their counts, the edges of the region word by word
+	int64 Count = 0;
+	for (int32 TileY = Y0 / TileSize; TileY <= Y1 / TileSize; ++TileY)
+	{
+		const int32 RowStart = FMath::Max(Y0, TileY * TileSize);
+		const int32 RowEnd = FMath::Min(Y1, TileY * TileSize + TileSize - 1);
+		const bool bWholeRows = RowStart == TileY * TileSize && RowEnd == TileY * TileSize + TileSize - 1;
+		for (int32 TileX = X0 / TileSize; TileX <= X1 / TileSize; ++TileX)
+		{
+			const int32 ColumnStart = FMath::Max(X0, TileX * TileSize);
+			const int32 ColumnEnd = FMath::Min(X1, TileX * TileSize + TileSize - 1);
+			if (bWholeRows && ColumnStart == TileX * TileSize && ColumnEnd == TileX * TileSize + TileSize - 1)
+			{
+				Count += TileCounts[TileY * NumTilesX + TileX];
+				continue;
+			}
+			for (int32 Y = RowStart; Y <= RowEnd; ++Y)
+			{
+				Count += CountSpan(Y, ColumnStart, ColumnEnd);
+			}
+		}
+	}
+	return static_cast<double>(Count) / (static_cast<int64>(X1 - X0 + 1) * (Y1 - Y0 + 1));
+}
+
+UCoverageMapComponent::UCoverageMapComponent()
+{
+	PrimaryComponentTick.bCanEverTick = false;
+}
+
+void UCoverageMapComponent::AddDeck(const FMowingDeck& Deck)
+{
+	if (Map.IsInitialized() || InitMap())
+	{
+		Map.AddDeck(Deck);
+	}
+}
+
+void UCoverageMapComponent::AddArea(const FMowingArea& MowedArea)
+{
+	if (Map.IsInitialized() || InitMap())
+	{
+		Map.AddArea(MowedArea);
+	}
+}
+
+float UCoverageMapComponent::GetCoveredFraction() const
+{
+	return static_cast<float>(Map.GetCoveredFraction());
+}
+
+float UCoverageMapComponent::GetRegionCoveredFraction(FVector2D Min, FVector2D Max) const
+{
+	return static_cast<float>(Map.GetCoveredFraction(FBox2D(Min, Max)));
+}
+
+void UCoverageMapComponent::ClearCoverage()
+{
+	Map.Clear();
+}
+
+bool UCoverageMapComponent::InitMap()
+{
+	if (bInitFailed)
+	{
+		return false;
+	}
+	FBox2D MapArea = Area;
+	const UGrassMowingSubsystem* Mowing = GetWorld() ? GetWorld()->GetSubsystem<UGrassMowingSubsystem>() : nullptr;
+	if (!MapArea.bIsValid && Mowing)
+	{
+		MapArea = Mowing->GetGrassBounds();
+	}
+	if (!Map.Init(MapArea, CellSize))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("UCoverageMapComponent: no area to map, set Area or index some grass"));
+		bInitFailed = true;
+		return false;
+	}
+	UE_LOG(LogTemp, Log, TEXT("UCoverageMapComponent: %d x %d tiles of %.1f cm cells, %.1f MB"), Map.GetNumTilesX(),
+	       Map.GetNumTilesY(), CellSize, Map.GetAllocatedSize() / (1024.0 * 1024.0));
+	return true;
+}
@@ -0,0 +1,667 @@
+#include "FrameCodec.h"
+#include "Async/ParallelFor.h"
+#include "IImageWrapper.h"
+#include "IImageWrapperModule.h"
+
+namespace
+{
+	/**
+	 * LZ4 block format, https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md. FCompression's LZ4 is the slow
+	 * high compression variant, this is the greedy single hash table compressor the format was made for.
+	 */
+	namespace Lz4
+	{
+		constexpr int32 MinMatch = 4;
+		// the last 5 bytes are always literals and no match starts in the last 12
+		constexpr int64 LastLiterals = 5;
+		constexpr int64 MatchStartLimit = 12;
+		constexpr int64 MaxOffset = 65535;
+		constexpr int32 HashBits = 12;
+		// after this many misses in a row the search skips ahead faster, so incompressible data is cheap
+		constexpr int32 SkipTrigger = 6;
+
+		uint32 Read32(const uint8* Data)
+		{
+			uint32 Value;
+			FMemory::Memcpy(&Value, Data, sizeof(Value));
+			return Value;
+		}
+
+		uint32 Hash(uint32 Sequence)
+		{
+			return (Sequence * 2654435761u) >> (32 - HashBits);
+		}
+
+		uint8* WriteLength(uint8* Out, int64 Length)
+		{
+			for (; Length >= 255; Length -= 255)
+			{
+				*Out++ = 255;
+			}
+			*Out++ = static_cast<uint8>(Length);
+			return Out;
+		}
+
+		uint8* WriteSequence(uint8* Out, const uint8* Literals, int64 NumLiterals, int64 Offset, int64 MatchLength)
+		{
+			uint8* Token = Out++;
+			*Token = static_cast<uint8>(FMath::Min<int64>(NumLiterals, 15) << 4);
+			if (NumLiterals >= 15)
+			{
+				Out = WriteLength(Out, NumLiterals - 15);
+			}
+			FMemory::Memcpy(Out, Literals, NumLiterals);
+			Out += NumLiterals;
+			if (MatchLength == 0)
+			{
+				return Out;
+			}
+			*Out++ = static_cast<uint8>(Offset);
+			*Out++ = static_cast<uint8>(Offset >> 8);
+			MatchLength -= MinMatch;
+			*Token |= static_cast<uint8>(FMath::Min<int64>(MatchLength, 15));
+			if (MatchLength >= 15)
+			{
+				Out = WriteLength(Out, MatchLength - 15);
+			}
+			return Out;
+		}
+
+		void Compress(const uint8* Src, int64 Size, TArray64<uint8>& Out)
+		{
+			Out.SetNumUninitialized(Size + Size / 255 + 16, false);
+			uint8* Dst = Out.GetData();
+			int32 Table[1 << HashBits];
+			FMemory::Memset(Table, 0xFF, sizeof(Table));
+
+			int64 Anchor = 0;
+			int64 Pos = 0;
+			int64 Misses = 0;
+			while (Pos + MatchStartLimit < Size)
+			{
+				const uint32 Sequence = Read32(Src + Pos);
+				int32& Slot = Table[Hash(Sequence)];
+				const int64 Candidate = Slot;
+				Slot = static_cast<int32>(Pos);
+				if (Candidate < 0 || Pos - Candidate > MaxOffset || Read32(Src + Candidate) != Sequence)
+				{
+					Pos += 1 + (Misses++ >> SkipTrigger);
+					continue;
+				}
+				Misses = 0;
+
+				int64 Start = Pos;
+				int64 MatchStart = Candidate;
+				while (Start > Anchor && MatchStart > 0 && Src[Start - 1] == Src[MatchStart - 1])
+				{
+					Start--;
+					MatchStart--;
+				}
+				int64 End = Pos + MinMatch;
+				const int64 EndLimit = Size - LastLiterals;
+				while (End < EndLimit && Src[End] == Src[MatchStart + (End - Start)])
+				{
+					End++;
+				}
+
+				Dst = WriteSequence(Dst, Src + Anchor, Start - Anchor, Start - MatchStart, End - Start);
+				Pos = End;
+				Anchor = End;
+			}
+			Dst = WriteSequence(Dst, Src + Anchor, Size - Anchor, 0, 0);
+			Out.SetNum(Dst - Out.GetData(), false);
+		}
+
+		bool ReadLength(const uint8*& In, const uint8* InEnd, int64& Length)
+		{
+			uint8 Byte;
+			do
+			{
+				if (In == InEnd)
+				{
+					return false;
+				}
+				Byte = *In++;
+				Length += Byte;
+			}
+			while (Byte == 255);
+			return true;
+		}
+
+		bool Decompress(const uint8* In, int64 InSize, uint8* Dst, int64 DstSize)
+		{
+			const uint8* InEnd = In + InSize;
+			int64 Pos = 0;
+			while (In < InEnd)
+			{
+				const uint8 Token = *In++;
+				int64 NumLiterals = Token >> 4;
+				if (NumLiterals == 15 && !ReadLength(In, InEnd, NumLiterals))
+				{
+					return false;
+				}
+				if (NumLiterals > InEnd - In || NumLiterals > DstSize - Pos)
+				{
+					return false;
+				}
+				FMemory::Memcpy(Dst + Pos, In, NumLiterals);
+				In += NumLiterals;
+				Pos += NumLiterals;
+				if (In == InEnd)
+				{
+					// the last sequence has no match
+					break;
+				}
+
+				if (InEnd - In < 2)
+				{
+					return false;
+				}
+				const int64 Offset = In[0] | In[1] << 8;
+				In += 2;
+				int64 MatchLength = Token & 15;
+				if (MatchLength == 15 && !ReadLength(In, InEnd, MatchLength))
+				{
+					return false;
+				}
+				MatchLength += MinMatch;
+				if (Offset == 0 || Offset > Pos || MatchLength > DstSize - Pos)
+				{
+					return false;
+				}
+				// matches may overlap their own output, e.g. offset 1 repeats a byte
+				const uint8* Match = Dst + Pos - Offset;
+				if (Offset >= MatchLength)
+				{
+					FMemory::Memcpy(Dst + Pos, Match, MatchLength);
+				}
+				else
+				{
+					for (int64 i = 0; i < MatchLength; i++)
+					{
+						Dst[Pos + i] = Match[i];
+					}
+				}
+				Pos += MatchLength;
+			}
+			return Pos == DstSize;
+		}
+	}
+
+	/** LZ4 of the strip with the bytes of each pixel grouped by channel, which puts e.g. the slowly changing high
+	 * bytes of depth next to each other */
+	class FLz4Codec : public IFrameCodec
+	{
+	public:
+		virtual FrameWire::EPlaneEncoding GetEncoding() const override { return FrameWire::EPlaneEncoding::LZ4; }
+
+		virtual bool Encode(const uint8* Pixels, const FFrameStrip& Strip, int32 Quality,
+		                    TArray64<uint8>& Out) const override
+		{
+			const int32 BytesPerPixel = FrameWire::BytesPerPixel(Strip.PixelFormat);
+			const int64 NumBytes = Strip.GetNumBytes();
+			if (BytesPerPixel == 1)
+			{
+				Lz4::Compress(Pixels, NumBytes, Out);
+				return true;
+			}
+			TArray64<uint8> Grouped;
+			Grouped.SetNumUninitialized(NumBytes);
+			const int64 NumPixels = NumBytes / BytesPerPixel;
+			for (int32 Channel = 0; Channel < BytesPerPixel; Channel++)
+			{
+				uint8* Dst = Grouped.GetData() + Channel * NumPixels;
+				for (int64 i = 0; i < NumPixels; i++)
+				{
+					Dst[i] = Pixels[i * BytesPerPixel + Channel];
+				}
+			}
+			Lz4::Compress(Grouped.GetData(), NumBytes, Out);
+			return true;
+		}
+
+		virtual bool Decode(TConstArrayView<uint8> Data, const FFrameStrip& Strip, uint8* OutPixels) const override
+		{
+			const int32 BytesPerPixel = FrameWire::BytesPerPixel(Strip.PixelFormat);
+			const int64 NumBytes = Strip.GetNumBytes();
+			if (BytesPerPixel == 1)
+			{
+				return Lz4::Decompress(Data.GetData(), Data.Num(), OutPixels, NumBytes);
+			}
+			TArray64<uint8> Grouped;
+			Grouped.SetNumUninitialized(NumBytes);
+			if (!Lz4::Decompress(Data.GetData(), Data.Num(), Grouped.GetData(), NumBytes))
+			{
+				return false;
+			}
+			const int64 NumPixels = NumBytes / BytesPerPixel;
+			for (int32 Channel = 0; Channel < BytesPerPixel; Channel++)
+			{
+				const uint8* Src = Grouped.GetData() + Channel * NumPixels;
+				for (int64 i = 0; i < NumPixels; i++)
+				{
+					OutPixels[i * BytesPerPixel + Channel] = Src[i];
+				}
+			}
+			return true;
+		}
+	};
+
+	/**
+	 * The Quite OK Image format, https://qoiformat.org/qoi-specification.pdf, of BGRA8 pixels in memory order, so the
+	 * image's R channel holds B. Encodes several times faster than PNG at a similar size for rendered color.
+	 */
+	class FQoiCodec : public IFrameCodec
+	{
+	public:
+		virtual FrameWire::EPlaneEncoding GetEncoding() const override { return FrameWire::EPlaneEncoding::QOI; }
+
+		virtual bool Encode(const uint8* Pixels, const FFrameStrip& Strip, int32 Quality,
+		                    TArray64<uint8>& Out) const override
+		{
+			if (Strip.PixelFormat != FrameWire::EPixelFormat::BGRA8)
+			{
+				return false;
+			}
+			const int64 NumPixels = static_cast<int64>(Strip.Width) * Strip.NumRows;
+			// worst case every pixel is an OpRGBA
+			Out.SetNumUninitialized(HeaderSize + NumPixels * 5 + sizeof(EndMarker), false);
+			uint8* Dst = WriteHeader(Out.GetData(), Strip);
+
+			FPixel Index[64] = {};
+			FPixel Previous = {0, 0, 0, 255};
+			int32 Run = 0;
+			for (int64 i = 0; i < NumPixels; i++)
+			{
+				FPixel Pixel;
+				FMemory::Memcpy(&Pixel, Pixels + i * 4, 4);
+				if (Pixel == Previous)
+				{
+					if (++Run == 62 || i == NumPixels - 1)
+					{
+						*Dst++ = OpRun | (Run - 1);
+						Run = 0;
+					}
+					continue;
+				}
+				if (Run > 0)
+				{
+					*Dst++ = OpRun | (Run - 1);
+					Run = 0;
+				}
+
+				const int32 Hash = Pixel.Hash();
+				if (Index[Hash] == Pixel)
+				{
+					*Dst++ = OpIndex | Hash;
+				}
+				else
+				{
+					Index[Hash] = Pixel;
+					if (Pixel.V[3] == Previous.V[3])
+					{
+						const int8 Dr = static_cast<int8>(Pixel.V[0] - Previous.V[0]);
+						const int8 Dg = static_cast<int8>(Pixel.V[1] - Previous.V[1]);
+						const int8 Db = static_cast<int8>(Pixel.V[2] - Previous.V[2]);
+						const int8 DrDg = static_cast<int8>(Dr - Dg);
+						const int8 DbDg = static_cast<int8>(Db - Dg);
+						if (Dr >= -2 && Dr <= 1 && Dg >= -2 && Dg <= 1 && Db >= -2 && Db <= 1)
+						{
+							*Dst++ = OpDiff | (Dr + 2) << 4 | (Dg + 2) << 2 | (Db + 2);
+						}
+						else if (Dg >= -32 && Dg <= 31 && DrDg >= -8 && DrDg <= 7 && DbDg >= -8 && DbDg <= 7)
+						{
+							*Dst++ = OpLuma | (Dg + 32);
+							*Dst++ = (DrDg + 8) << 4 | (DbDg + 8);
+						}
+						else
+						{
+							*Dst++ = OpRGB;
+							FMemory::Memcpy(Dst, Pixel.V, 3);
+							Dst += 3;
+						}
+					}
+					else
+					{
+						*Dst++ = OpRGBA;
+						FMemory::Memcpy(Dst, Pixel.V, 4);
+						Dst += 4;
+					}
+				}
+				Previous = Pixel;
+			}
+			FMemory::Memcpy(Dst, EndMarker, sizeof(EndMarker));
+			Dst += sizeof(EndMarker);
+			Out.SetNum(Dst - Out.GetData(), false);
+			return true;
+		}
+
+		virtual bool Decode(TConstArrayView<uint8> Data, const FFrameStrip& Strip, uint8* OutPixels) const override
+		{
+			uint8 Expected[HeaderSize];
+			WriteHeader(Expected, Strip);
+			if (Strip.PixelFormat != FrameWire::EPixelFormat::BGRA8 ||
+				Data.Num() < static_cast<int32>(HeaderSize + sizeof(EndMarker)) ||
+				FMemory::Memcmp(Data.GetData(), Expected, HeaderSize) != 0)
+			{
+				return false;
+			}
+			const uint8* In = Data.GetData() + HeaderSize;
+			const uint8* InEnd = Data.GetData() + Data.Num() - sizeof(EndMarker);
+			const int64 NumPixels = static_cast<int64>(Strip.Width) * Strip.NumRows;
+
+			FPixel Index[64] = {};
+			FPixel Pixel = {0, 0, 0, 255};
+			int32 Run = 0;
+			for (int64 i = 0; i < NumPixels; i++)
+			{
+				if (Run > 0)
+				{
+					Run--;
+				}
+				else
+				{
+					if (In >= InEnd)
+					{
+						return false;
+					}
+					const uint8 Op = *In++;
+					if (Op == OpRGB || Op == OpRGBA)
+					{
+						const int32 NumChannels = Op == OpRGB ? 3 : 4;
+						if (InEnd - In < NumChannels)
+						{
+							return false;
+						}
+						FMemory::Memcpy(Pixel.V, In, NumChannels);
+						In += NumChannels;
+					}
+					else if ((Op & OpMask) == OpIndex)
+					{
+						Pixel = Index[Op];
+					}
+					else if ((Op & OpMask) == OpDiff)
+					{
+						Pixel.V[0] += (Op >> 4 & 3) - 2;
+						Pixel.V[1] += (Op >> 2 & 3) - 2;
+						Pixel.V[2] += (Op & 3) - 2;
+					}
+					else if ((Op & OpMask) == OpLuma)
+					{
+						if (In == InEnd)
+						{
+							return false;
+						}
+						const uint8 Second = *In++;
+						const int32 Dg = (Op & 0x3F) - 32;
+						Pixel.V[0] += Dg - 8 + (Second >> 4);
+						Pixel.V[1] += Dg;
+						Pixel.V[2] += Dg - 8 + (Second & 0x0F);
+					}
+					else
+					{
+						Run = Op & 0x3F;
+					}
+					Index[Pixel.Hash()] = Pixel;
+				}
+				FMemory::Memcpy(OutPixels + i * 4, Pixel.V, 4);
+			}
+			return true;
+		}
+
+	private:
+		struct FPixel
+		{
+			uint8 V[4];
+
+			bool operator==(const FPixel& Other) const { return FMemory::Memcmp(V, Other.V, 4) == 0; }
+			int32 Hash() const { return (V[0] * 3 + V[1] * 5 + V[2] * 7 + V[3] * 11) % 64; }
+		};
+
+		static constexpr int32 HeaderSize = 14;
+		static constexpr uint8 EndMarker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+		static constexpr uint8 OpIndex = 0x00;
+		static constexpr uint8 OpDiff = 0x40;
+		static constexpr uint8 OpLuma = 0x80;
+		static constexpr uint8 OpRun = 0xC0;
+		static constexpr uint8 OpRGB = 0xFE;
+		static constexpr uint8 OpRGBA = 0xFF;
+		static constexpr uint8 OpMask = 0xC0;
+
+		// magic, big endian width and height, 4 channels, sRGB
+		static uint8* WriteHeader(uint8* Dst, const FFrameStrip& Strip)
+		{
+			const uint8 Header[HeaderSize] = {
+				'q', 'o', 'i', 'f',
+				static_cast<uint8>(Strip.Width >> 24), static_cast<uint8>(Strip.Width >> 16),
+				static_cast<uint8>(Strip.Width >> 8), static_cast<uint8>(Strip.Width),
+				static_cast<uint8>(Strip.NumRows >> 24), static_cast<uint8>(Strip.NumRows >> 16),
+				static_cast<uint8>(Strip.NumRows >> 8), static_cast<uint8>(Strip.NumRows),
+				4, 0
+			};
+			FMemory::Memcpy(Dst, Header, HeaderSize);
+			return Dst + HeaderSize;
+		}
+	};
+
+	/** PNG and JPEG through the engine's image wrappers, one wrapper per strip */
+	class FImageWrapperCodec : public IFrameCodec
+	{
+	public:
+		FImageWrapperCodec(IImageWrapperModule& InModule, FrameWire::EPlaneEncoding InEncoding)
+			: Module(InModule), Encoding(InEncoding)
+		{
+		}
+
+		virtual FrameWire::EPlaneEncoding GetEncoding() const override { return Encoding; }
+
+		virtual bool Encode(const uint8* Pixels, const FFrameStrip& Strip, int32 Quality,
+		                    TArray64<uint8>& Out) const override
+		{
+			const bool bJpeg = Encoding == FrameWire::EPlaneEncoding::JPEG;
+			if (bJpeg && Strip.PixelFormat != FrameWire::EPixelFormat::BGRA8)
+			{
+				return false;
+			}
+			const TSharedPtr<IImageWrapper> ImageWrapper = Module.CreateImageWrapper(
+				bJpeg ? EImageFormat::JPEG : EImageFormat::PNG);
+			if (!ImageWrapper.IsValid() || !ImageWrapper->SetRaw(Pixels, Strip.GetNumBytes(), Strip.Width,
+			                                                     Strip.NumRows, GetRGBFormat(Strip),
+			                                                     GetBitDepth(Strip)))
+			{
+				return false;
+			}
+			Out = ImageWrapper->GetCompressed(bJpeg ? Quality : 0);
+			return Out.Num() > 0;
+		}
+
+		virtual bool Decode(TConstArrayView<uint8> Data, const FFrameStrip& Strip, uint8* OutPixels) const override
+		{
+			const TSharedPtr<IImageWrapper> ImageWrapper = Module.CreateImageWrapper(
+				Encoding == FrameWire::EPlaneEncoding::JPEG ? EImageFormat::JPEG : EImageFormat::PNG);
+			TArray64<uint8> Pixels;
+			if (!ImageWrapper.IsValid() || !ImageWrapper->SetCompressed(Data.GetData(), Data.Num()) ||
+				ImageWrapper->GetWidth() != Strip.Width || ImageWrapper->GetHeight() != Strip.NumRows ||
+				!ImageWrapper->GetRaw(GetRGBFormat(Strip), GetBitDepth(Strip), Pixels) ||
+				Pixels.Num() != Strip.GetNumBytes())
+			{
+				return false;
+			}
+			FMemory::Memcpy(OutPixels, Pixels.GetData(), Pixels.Num());
+			return true;
+		}
+
+	private:
+		// 16 bit planes are 16 bit grayscale, half floats included, which keeps their bits intact
+		static ERGBFormat GetRGBFormat(const FFrameStrip& Strip)
+		{
+			return Strip.PixelFormat == FrameWire::EPixelFormat::BGRA8 ? ERGBFormat::BGRA : ERGBFormat::Gray;
+		}
+
+		static int32 GetBitDepth(const FFrameStrip& Strip)
+		{
+			return FrameWire::BytesPerPixel(Strip.PixelFormat) == 2 ? 16 : 8;
+		}
+
+		IImageWrapperModule& Module;
+		FrameWire::EPlaneEncoding Encoding;
+	};
+}
+
+void FFrameCodecs::Build()
+{
+	IImageWrapperModule& ImageWrapperModule =
+		FModuleManager::LoadModuleChecked<IImageWrapperModule>(FName("ImageWrapper"));
+	Codecs.Reset();
+	Codecs.SetNum(static_cast<int32>(FrameWire::EPlaneEncoding::JPEG) + 1);
+	Codecs[static_cast<int32>(FrameWire::EPlaneEncoding::PNG)] =
+		MakeUnique<FImageWrapperCodec>(ImageWrapperModule, FrameWire::EPlaneEncoding::PNG);
+	Codecs[static_cast<int32>(FrameWire::EPlaneEncoding::LZ4)] = MakeUnique<FLz4Codec>();
+	Codecs[static_cast<int32>(FrameWire::EPlaneEncoding::QOI)] = MakeUnique<FQoiCodec>();
+	Codecs[static_cast<int32>(FrameWire::EPlaneEncoding::JPEG)] =
+		MakeUnique<FImageWrapperCodec>(ImageWrapperModule, FrameWire::EPlaneEncoding::JPEG);
+}
+
+const IFrameCodec* FFrameCodecs::Find(FrameWire::EPlaneEncoding Encoding) const
+{
+	const int32 Index = static_cast<int32>(Encoding);
+	return Codecs.IsValidIndex(Index) ? Codecs[Index].Get() : nullptr;
+}
+
+FrameWire::EPlaneEncoding FFrameCodecs::Resolve(EFrameCodec Codec, FrameWire::EPixelFormat PixelFormat)
+{
+	const bool bColor = PixelFormat == FrameWire::EPixelFormat::BGRA8;
+	switch (Codec)
+	{
+	case EFrameCodec::LZ4:
+		return FrameWire::EPlaneEncoding::LZ4;
+	case EFrameCodec::QOI:
+		return bColor ? FrameWire::EPlaneEncoding::QOI : FrameWire::EPlaneEncoding::LZ4;
+	case EFrameCodec::PNG:
+		return FrameWire::EPlaneEncoding::PNG;
+	case EFrameCodec::JPEG:
+		return bColor ? FrameWire::EPlaneEncoding::JPEG : FrameWire::EPlaneEncoding::PNG;
+	default:
+		return FrameWire::EPlaneEncoding::Raw;
+	}
+}
+
+FrameWire::EPlaneEncoding FFrameCodecs::Encode(const FrameWire::FPlane& Plane, EFrameCodec Codec,
+                                               const FFrameCodecSettings& Settings, TArray64<uint8>& Out) const
+{
+	Out.Reset();
+	const FrameWire::EPlaneEncoding Encoding = Resolve(Codec, Plane.PixelFormat);
+	const IFrameCodec* FrameCodec = Find(Encoding);
+	const int64 RowBytes = static_cast<int64>(Plane.Width) * FrameWire::BytesPerPixel(Plane.PixelFormat);
+	if (!FrameCodec || Plane.Height <= 0 || Plane.Data.Num() != RowBytes * Plane.Height)
+	{
+		return FrameWire::EPlaneEncoding::Raw;
+	}
+
+	const int32 RowsPerStrip = Settings.RowsPerStrip > 0
+		                           ? FMath::Min(Settings.RowsPerStrip, Plane.Height)
+		                           : Plane.Height;
+	const int32 NumStrips = FMath::DivideAndRoundUp(Plane.Height, RowsPerStrip);
+	TArray<TArray64<uint8>, TInlineAllocator<32>> Strips;
+	Strips.SetNum(NumStrips);
+	TAtomic<bool> bFailed{false};
+	ParallelFor(NumStrips, [&](int32 i)
+	{
+		const int32 FirstRow = i * RowsPerStrip;
+		FFrameStrip Strip;
+		Strip.PixelFormat = Plane.PixelFormat;
+		Strip.Width = Plane.Width;
+		Strip.NumRows = FMath::Min(RowsPerStrip, Plane.Height - FirstRow);
+		if (!FrameCodec->Encode(Plane.Data.GetData() + FirstRow * RowBytes, Strip, Settings.JpegQuality, Strips[i]) ||
+			Strips[i].Num() > MAX_uint32)
+		{
+			bFailed = true;
+		}
+	}, NumStrips == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
+	if (bFailed)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Could not compress a %dx%d frame plane, sending it raw"), Plane.Width,
+		       Plane.Height);
+		return FrameWire::EPlaneEncoding::Raw;
+	}
+
+	int64 Size = sizeof(FrameWire::FStripHeader) + NumStrips * sizeof(uint32);
+	for (const TArray64<uint8>& Strip : Strips)
+	{
+		Size += Strip.Num();
+	}
+	Out.SetNumUninitialized(Size);
+	uint8* Dst = Out.GetData();
+	FrameWire::FStripHeader Header;
+	Header.NumStrips = static_cast<uint16>(NumStrips);
+	Header.RowsPerStrip = static_cast<uint16>(RowsPerStrip);
+	FMemory::Memcpy(Dst, &Header, sizeof(Header));
+	Dst += sizeof(Header);
+	for (const TArray64<uint8>& Strip : Strips)
+	{
+		const uint32 StripSize = static_cast<uint32>(Strip.Num());
+		FMemory::Memcpy(Dst, &StripSize, sizeof(StripSize));
+		Dst += sizeof(StripSize);
+	}
+	for (const TArray64<uint8>& Strip : Strips)
+	{
+		FMemory::Memcpy(Dst, Strip.GetData(), Strip.Num());
+		Dst += Strip.Num();
+	}
+	return Encoding;
+}
+
+bool FFrameCodecs::Decode(const FrameWire::FPlane& Plane, TArray64<uint8>& OutPixels) const
+{
+	const IFrameCodec* FrameCodec = Find(Plane.Encoding);
+	FrameWire::FStripHeader Header;
+	if (!FrameCodec || Plane.Height <= 0 || Plane.Data.Num() < static_cast<int32>(sizeof(Header)))
+	{
+		return false;
+	}
+	FMemory::Memcpy(&Header, Plane.Data.GetData(), sizeof(Header));
+	if (Header.RowsPerStrip == 0 || FMath::DivideAndRoundUp<int32>(Plane.Height, Header.RowsPerStrip) !=
+		Header.NumStrips)
+	{
+		return false;
+	}
+
+	// where each strip starts, the end of the last one at the end
+	TArray<int64, TInlineAllocator<33>> Offsets;
+	int64 Offset = sizeof(Header) + Header.NumStrips * sizeof(uint32);
+	if (Offset > Plane.Data.Num())
+	{
+		return false;
+	}
+	for (int32 i = 0; i < Header.NumStrips; i++)
+	{
+		uint32 StripSize;
+		FMemory::Memcpy(&StripSize, Plane.Data.GetData() + sizeof(Header) + i * sizeof(uint32), sizeof(StripSize));
+		Offsets.Add(Offset);
+		Offset += StripSize;
+	}
+	Offsets.Add(Offset);
+	if (Offset > Plane.Data.Num())
+	{
+		return false;
+	}
+
+	const int64 RowBytes = static_cast<int64>(Plane.Width) * FrameWire::BytesPerPixel(Plane.PixelFormat);
+	OutPixels.SetNumUninitialized(RowBytes * Plane.Height);
+	TAtomic<bool> bFailed{false};
+	ParallelFor(Header.NumStrips, [&](int32 i)
+	{
+		const int32 FirstRow = i * Header.RowsPerStrip;
+		FFrameStrip Strip;
+		Strip.PixelFormat = Plane.PixelFormat;
+		Strip.Width = Plane.Width;
+		Strip.NumRows = FMath::Min<int32>(Header.RowsPerStrip, Plane.Height - FirstRow);
+		const TConstArrayView<uint8> Data(Plane.Data.GetData() + Offsets[i],
+		                                  static_cast<int32>(Offsets[i + 1] - Offsets[i]));
+		if (!FrameCodec->Decode(Data, Strip, OutPixels.GetData() + FirstRow * RowBytes))
+		{
+			bFailed = true;
+		}
+	}, Header.NumStrips == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
+	return !bFailed;
+}
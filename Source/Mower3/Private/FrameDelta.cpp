@@ -0,0 +1,320 @@
+#include "FrameDelta.h"
+#include "FrameCodec.h"
+#include "Async/ParallelFor.h"
+
+#if PLATFORM_ENABLE_VECTORINTRINSICS && PLATFORM_CPU_X86_FAMILY
+#include <emmintrin.h>
+#define MOWER_DELTA_SSE2 1
+#else
+#define MOWER_DELTA_SSE2 0
+#endif
+
+namespace
+{
+	// the tiles of a plane, the last column and row of tiles are cut short by the plane's edge
+	struct FTileGrid
+	{
+		int32 TileSize;
+		int32 Width;
+		int32 Height;
+		int32 BytesPerPixel;
+		int32 TilesX;
+		int32 TilesY;
+
+		FTileGrid(const FrameWire::FPlane& Plane, int32 InTileSize)
+			: TileSize(InTileSize)
+			, Width(Plane.Width)
+			, Height(Plane.Height)
+			, BytesPerPixel(FrameWire::BytesPerPixel(Plane.PixelFormat))
+			, TilesX(FMath::DivideAndRoundUp(Plane.Width, InTileSize))
+			, TilesY(FMath::DivideAndRoundUp(Plane.Height, InTileSize))
+		{
+		}
+
+		int32 Num() const { return TilesX * TilesY; }
+		int64 GetRowBytes() const { return static_cast<int64>(Width) * BytesPerPixel; }
+		int64 GetNumBytes() const { return GetRowBytes() * Height; }
+		int32 GetNumRows(int32 TileY) const { return FMath::Min(TileSize, Height - TileY * TileSize); }
+
+		int64 GetRowSpanBytes(int32 TileX) const
+		{
+			return static_cast<int64>(FMath::Min(TileSize, Width - TileX * TileSize)) * BytesPerPixel;
+		}
+
+		// offset of the first byte of the tile's Row-th row
+		int64 GetOffset(int32 TileX, int32 TileY, int32 Row) const
+		{
+			return (static_cast<int64>(TileY) * TileSize + Row) * GetRowBytes() + static_cast<int64>(TileX) * TileSize *
+				BytesPerPixel;
+		}
+	};
+
+	bool BytesEqual(const uint8* A, const uint8* B, int64 NumBytes)
+	{
+		int64 i = 0;
+#if MOWER_DELTA_SSE2
+		// a 16 pixel row of a color tile is 64 bytes, or'ing the differences first leaves one branch per row
+		for (; i + 64 <= NumBytes; i += 64)
+		{
+			const __m128i Diff0 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(A + i)),
+			                                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(B + i)));
+			const __m128i Diff1 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(A + i + 16)),
+			                                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(B + i + 16)));
+			const __m128i Diff2 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(A + i + 32)),
+			                                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(B + i + 32)));
+			const __m128i Diff3 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(A + i + 48)),
+			                                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(B + i + 48)));
+			const __m128i Diff = _mm_or_si128(_mm_or_si128(Diff0, Diff1), _mm_or_si128(Diff2, Diff3));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(Diff, _mm_setzero_si128())) != 0xFFFF)
+			{
+				return false;
+			}
+		}
+		for (; i + 16 <= NumBytes; i += 16)
+		{
+			const __m128i Equal = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(A + i)),
+			                                     _mm_loadu_si128(reinterpret_cast<const __m128i*>(B + i)));
+			if (_mm_movemask_epi8(Equal) != 0xFFFF)
+			{
+				return false;
+			}
+		}
+#endif
+		return FMemory::Memcmp(A + i, B + i, NumBytes - i) == 0;
+	}
+
+	const FrameWire::FSection* FindDeltaSection(const FrameWire::FFrameView& Frame, int32 PlaneIndex,
+	                                            FrameWire::FDeltaInfo& OutInfo)
+	{
+		for (const FrameWire::FSection& Section : Frame.Sections)
+		{
+			if (Section.Kind == FrameWire::ESectionKind::Delta && Section.Data.Num() >= static_cast<int32>(sizeof(
+				OutInfo)))
+			{
+				FMemory::Memcpy(&OutInfo, Section.Data.GetData(), sizeof(OutInfo));
+				if (OutInfo.Plane == PlaneIndex)
+				{
+					return &Section;
+				}
+			}
+		}
+		return nullptr;
+	}
+}
+
+bool FFrameDeltaEncoder::BeginFrame(uint64 InFrameId, const FFrameDeltaSettings& Settings)
+{
+	FrameId = InFrameId;
+	bKeyframe = bKeyframeRequested.Exchange(false) || ++FramesSinceKeyframe >= Settings.KeyframeInterval;
+	if (bKeyframe)
+	{
+		FramesSinceKeyframe = 0;
+		References.Reset();
+	}
+	return bKeyframe;
+}
+
+bool FFrameDeltaEncoder::EncodePlane(int32 PlaneIndex, const FrameWire::FPlane& Plane,
+                                     const FFrameDeltaSettings& Settings, TArray<uint8>& OutPixels,
+                                     TArray<uint8>& OutSection, int32& OutNumTiles)
+{
+	const FTileGrid Grid(Plane, FMath::Clamp(Settings.TileSize, 4, 256));
+	FrameWire::FDeltaInfo Info;
+	FMemory::Memzero(Info);
+	Info.Plane = static_cast<uint8>(PlaneIndex);
+	Info.TileSize = static_cast<uint16>(Grid.TileSize);
+	OutNumTiles = 0;
+
+	FReference* Reference = References.FindByPredicate([&Plane](const FReference& Candidate)
+	{
+		return Candidate.Kind == Plane.Kind && Candidate.View == Plane.View;
+	});
+	const bool bDelta = !bKeyframe && Reference && Reference->PixelFormat == Plane.PixelFormat && Reference->Width ==
+		Plane.Width && Reference->Height == Plane.Height && Plane.Data.Num() == Grid.GetNumBytes();
+	if (!bDelta)
+	{
+		if (!Reference)
+		{
+			Reference = &References.AddDefaulted_GetRef();
+		}
+		Reference->Kind = Plane.Kind;
+		Reference->View = Plane.View;
+		Reference->PixelFormat = Plane.PixelFormat;
+		Reference->Width = Plane.Width;
+		Reference->Height = Plane.Height;
+		Reference->FrameId = FrameId;
+		Reference->Pixels.Reset();
+		Reference->Pixels.Append(Plane.Data.GetData(), Plane.Data.Num());
+		Info.Keyframe = 1;
+		OutSection.SetNumUninitialized(sizeof(Info), false);
+		FMemory::Memcpy(OutSection.GetData(), &Info, sizeof(Info));
+		return false;
+	}
+
+	// one byte per tile, bits of the same bitmap byte would be written from different tasks
+	TArray<uint8, TInlineAllocator<1024>> DirtyTiles;
+	DirtyTiles.SetNumUninitialized(Grid.Num());
+	OutPixels.SetNumUninitialized(Plane.Data.Num(), false);
+	const uint8* New = Plane.Data.GetData();
+	uint8* Old = Reference->Pixels.GetData();
+	uint8* Delta = OutPixels.GetData();
+	ParallelFor(Grid.TilesY, [&](int32 TileY)
+	{
+		const int32 NumRows = Grid.GetNumRows(TileY);
+		for (int32 TileX = 0; TileX < Grid.TilesX; TileX++)
+		{
+			const int64 SpanBytes = Grid.GetRowSpanBytes(TileX);
+			bool bDirty = false;
+			for (int32 Row = 0; Row < NumRows && !bDirty; Row++)
+			{
+				const int64 Offset = Grid.GetOffset(TileX, TileY, Row);
+				bDirty = !BytesEqual(New + Offset, Old + Offset, SpanBytes);
+			}
+			DirtyTiles[TileY * Grid.TilesX + TileX] = bDirty;
+			for (int32 Row = 0; Row < NumRows; Row++)
+			{
+				const int64 Offset = Grid.GetOffset(TileX, TileY, Row);
+				if (bDirty)
+				{
+					FMemory::Memcpy(Delta + Offset, New + Offset, SpanBytes);
+					FMemory::Memcpy(Old + Offset, New + Offset, SpanBytes);
+				}
+				else
+				{
+					FMemory::Memzero(Delta + Offset, SpanBytes);
+				}
+			}
+		}
+	}, Grid.TilesY == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
+
+	for (const uint8 bDirty : DirtyTiles)
+	{
+		Info.NumDirtyTiles += bDirty;
+	}
+	// the reference now holds the new plane either way
+	const uint64 ReferenceFrameId = Reference->FrameId;
+	Reference->FrameId = FrameId;
+	if (Info.NumDirtyTiles > Settings.MaxDirtyFraction * Grid.Num())
+	{
+		Info.NumDirtyTiles = 0;
+		Info.Keyframe = 1;
+		OutSection.SetNumUninitialized(sizeof(Info), false);
+		FMemory::Memcpy(OutSection.GetData(), &Info, sizeof(Info));
+		return false;
+	}
+
+	Info.ReferenceFrameId = ReferenceFrameId;
+	const int32 BitmapBytes = FMath::DivideAndRoundUp(Grid.Num(), 8);
+	OutSection.SetNumUninitialized(sizeof(Info) + BitmapBytes, false);
+	FMemory::Memcpy(OutSection.GetData(), &Info, sizeof(Info));
+	uint8* Bitmap = OutSection.GetData() + sizeof(Info);
+	FMemory::Memzero(Bitmap, BitmapBytes);
+	for (int32 i = 0; i < Grid.Num(); i++)
+	{
+		Bitmap[i / 8] |= DirtyTiles[i] << (i % 8);
+	}
+	OutNumTiles = Grid.Num();
+	return true;
+}
+
+bool FFrameDeltaDecoder::Decode(FrameWire::FFrameView& Frame, const FFrameCodecs& Codecs)
+{
+	Untracked.SetNum(Frame.Planes.Num());
+	for (int32 i = 0; i < Frame.Planes.Num(); i++)
+	{
+		FrameWire::FPlane& Plane = Frame.Planes[i];
+		const int64 NumBytes = static_cast<int64>(Plane.Width) * Plane.Height * FrameWire::BytesPerPixel(
+			Plane.PixelFormat);
+		const bool bRaw = Plane.Encoding == FrameWire::EPlaneEncoding::Raw;
+		FrameWire::FDeltaInfo Info;
+		const FrameWire::FSection* Section = FindDeltaSection(Frame, i, Info);
+		FReference* Reference = References.FindByPredicate([&Plane](const FReference& Candidate)
+		{
+			return Candidate.Kind == Plane.Kind && Candidate.View == Plane.View;
+		});
+
+		TConstArrayView<uint8> Pixels = Plane.Data;
+		if (!Section)
+		{
+			if (!bRaw)
+			{
+				if (!Codecs.Decode(Plane, Untracked[i]))
+				{
+					return false;
+				}
+				Pixels = TConstArrayView<uint8>(Untracked[i].GetData(), static_cast<int32>(Untracked[i].Num()));
+			}
+		}
+		else if (Info.Keyframe)
+		{
+			if (!Reference)
+			{
+				Reference = &References.AddDefaulted_GetRef();
+				Reference->Kind = Plane.Kind;
+				Reference->View = Plane.View;
+			}
+			Reference->FrameId = Frame.Info.FrameId;
+			if (bRaw)
+			{
+				Reference->Pixels.Reset();
+				Reference->Pixels.Append(Plane.Data.GetData(), Plane.Data.Num());
+			}
+			else if (!Codecs.Decode(Plane, Reference->Pixels))
+			{
+				Reference->Pixels.Reset();
+				return false;
+			}
+			Pixels = TConstArrayView<uint8>(Reference->Pixels.GetData(), static_cast<int32>(Reference->Pixels.Num()));
+		}
+		else
+		{
+			if (!Reference || Reference->FrameId != Info.ReferenceFrameId || Reference->Pixels.Num() != NumBytes)
+			{
+				return false;
+			}
+			TConstArrayView<uint8> Delta = Plane.Data;
+			if (!bRaw)
+			{
+				if (!Codecs.Decode(Plane, DeltaPixels))
+				{
+					return false;
+				}
+				Delta = TConstArrayView<uint8>(DeltaPixels.GetData(), static_cast<int32>(DeltaPixels.Num()));
+			}
+			const FTileGrid Tiles(Plane, FMath::Max<int32>(Info.TileSize, 1));
+			if (Delta.Num() != Tiles.GetNumBytes() || Section->Count != static_cast<uint32>(Tiles.Num()) ||
+				Section->Data.Num() < static_cast<int32>(sizeof(Info)) + FMath::DivideAndRoundUp(Tiles.Num(), 8))
+			{
+				return false;
+			}
+
+			const uint8* Bitmap = Section->Data.GetData() + sizeof(Info);
+			uint8* Dst = Reference->Pixels.GetData();
+			ParallelFor(Tiles.TilesY, [&](int32 TileY)
+			{
+				for (int32 TileX = 0; TileX < Tiles.TilesX; TileX++)
+				{
+					const int32 Tile = TileY * Tiles.TilesX + TileX;
+					if (Bitmap[Tile / 8] & (1 << (Tile % 8)))
+					{
+						for (int32 Row = 0; Row < Tiles.GetNumRows(TileY); Row++)
+						{
+							const int64 Offset = Tiles.GetOffset(TileX, TileY, Row);
+							FMemory::Memcpy(Dst + Offset, Delta.GetData() + Offset, Tiles.GetRowSpanBytes(TileX));
+						}
+					}
+				}
+			}, Tiles.TilesY == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
+			Reference->FrameId = Frame.Info.FrameId;
+			Pixels = TConstArrayView<uint8>(Reference->Pixels.GetData(), static_cast<int32>(Reference->Pixels.Num()));
+		}
+
+		if (Pixels.Num() != NumBytes)
+		{
+			return false;
+		}
+		Plane.Encoding = FrameWire::EPlaneEncoding::Raw;
+		Plane.Data = Pixels;
+	}
+	return true;
+}
@@ -0,0 +1,327 @@
+#include "FrameRecorder.h"
+#include "HAL/PlatformFileManager.h"
+#include "HAL/RunnableThread.h"
+#include "Misc/Paths.h"
+
+using namespace FrameRecording;
+
+FFrameRecorder::~FFrameRecorder()
+{
+	Close();
+}
+
+bool FFrameRecorder::Open(const FString& InPath, const FString& InstanceName, int32 InChunkSize,
+                          int32 MaxQueuedChunks)
+{
+	Close();
+	check(InChunkSize > 0 && MaxQueuedChunks > 0);
+
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	PlatformFile.CreateDirectoryTree(*FPaths::GetPath(InPath));
+	File = PlatformFile.OpenWrite(*InPath);
+	if (!File)
+	{
+		UE_LOG(LogTemp, Error, TEXT("FFrameRecorder: could not create %s"), *InPath);
+		return false;
+	}
+
+	Path = InPath;
+	ChunkSize = Align(static_cast<int64>(InChunkSize), 64 * 1024);
+	NextChunkIndex = 0;
+	Index.Reset();
+	bWarnedTooBig = false;
+	NumRecords = 0;
+	NumDroppedRecords = 0;
+	BytesWritten = 0;
+	bStopping = false;
+
+	// every buffer is allocated up front, so appending never allocates
+	Chunks.Reset();
+	FreeChunks.Reset();
+	for (int32 i = 0; i < MaxQueuedChunks + 1; i++)
+	{
+		FChunk& Chunk = *Chunks.Add_GetRef(MakeUnique<FChunk>());
+		Chunk.Data.SetNumUninitialized(ChunkSize);
+		FreeChunks.Add(&Chunk);
+	}
+	CurrentChunk = nullptr;
+
+	FFileHeader Header;
+	FMemory::Memzero(Header);
+	FMemory::Memcpy(Header.Magic, FileMagic, sizeof(FileMagic));
+	Header.Version = Version;
+	Header.HeaderSize = sizeof(FFileHeader);
+	Header.ChunkSize = static_cast<uint32>(ChunkSize);
+	Header.StartTime = static_cast<double>((FDateTime::UtcNow() - FDateTime(1970, 1, 1)).GetTotalSeconds());
+	const FTCHARToUTF8 Utf8(*InstanceName);
+	FMemory::Memcpy(Header.InstanceName, Utf8.Get(), FMath::Min<int32>(Utf8.Length(), MaxInstanceNameLength));
+	File->Write(reinterpret_cast<const uint8*>(&Header), sizeof(Header));
+	BytesWritten += sizeof(Header);
+
+	WakeWriter = FPlatformProcess::GetSynchEventFromPool(false);
+	Thread = FRunnableThread::Create(this, TEXT("FrameRecorder"), 0, TPri_BelowNormal);
+	if (!Thread)
+	{
+		UE_LOG(LogTemp, Error, TEXT("FFrameRecorder: could not start the writer thread"));
+		FPlatformProcess::ReturnSynchEventToPool(WakeWriter);
+		WakeWriter = nullptr;
+		delete File;
+		File = nullptr;
+		return false;
+	}
+	return true;
+}
+
+void FFrameRecorder::Close()
+{
+	if (!Thread)
+	{
+		return;
+	}
+
+	{
+		// under the lock, so no record gets into the index after the last chunk is sealed
+		FScopeLock Lock(&AppendLock);
+		if (CurrentChunk)
+		{
+			SealChunk(CurrentChunk);
+			CurrentChunk = nullptr;
+		}
+		bStopping = true;
+	}
+	WakeWriter->Trigger();
+	// the writer drains the queue before it returns
+	Thread->WaitForCompletion();
+	delete Thread;
+	Thread = nullptr;
+	FPlatformProcess::ReturnSynchEventToPool(WakeWriter);
+	WakeWriter = nullptr;
+
+	FFooter Footer;
+	FMemory::Memzero(Footer);
+	Footer.IndexOffset = static_cast<uint64>(File->Tell());
+	Footer.NumEntries = Index.Num();
+	Footer.NumChunks = NextChunkIndex;
+	FMemory::Memcpy(Footer.Magic, FooterMagic, sizeof(FooterMagic));
+	Footer.Version = Version;
+	File->Write(reinterpret_cast<const uint8*>(Index.GetData()), Index.Num() * sizeof(FIndexEntry));
+	File->Write(reinterpret_cast<const uint8*>(&Footer), sizeof(Footer));
+	File->Flush();
+	delete File;
+	File = nullptr;
+
+	UE_LOG(LogTemp, Display, TEXT("FFrameRecorder: wrote %lld records (%lld dropped), %.1f MB to %s"),
+	       NumRecords.Load(), NumDroppedRecords.Load(), BytesWritten.Load() / (1024.0 * 1024.0), *Path);
+	Chunks.Reset();
+	FreeChunks.Reset();
+	Index.Empty();
+}
+
+bool FFrameRecorder::Append(ERecordKind Kind, uint64 FrameId, double Timestamp, TConstArrayView<uint8> Payload)
+{
+	const int64 RecordSize = Align(static_cast<int64>(sizeof(FRecordHeader)) + Payload.Num(), RecordAlignment);
+
+	FRecordBuffers Buffers;
+	int64 Offset;
+	{
+		FScopeLock Lock(&AppendLock);
+		if (!Thread || bStopping)
+		{
+			return false;
+		}
+
+		if (RecordSize > ChunkSize - static_cast<int64>(sizeof(FChunkHeader)))
+		{
+			// bigger than a chunk, give it a run of chunks of its own so every chunk still starts on a ChunkSize
+			// boundary. The run is made of pooled buffers, so it waits for the disk like any other chunk.
+			const int64 RunUsed = static_cast<int64>(sizeof(FChunkHeader)) + RecordSize;
+			const int64 NumChunks = FMath::DivideAndRoundUp(RunUsed, ChunkSize);
+			if (NumChunks > FreeChunks.Num())
+			{
+				if (NumChunks > Chunks.Num() && !bWarnedTooBig)
+				{
+					UE_LOG(LogTemp, Warning, TEXT("FFrameRecorder: records of %lld bytes need %lld chunks but there are "
+						       "only %d, they are dropped. Use bigger chunks or queue more."), RecordSize, NumChunks,
+					       Chunks.Num());
+					bWarnedTooBig = true;
+				}
+				NumDroppedRecords++;
+				return false;
+			}
+			if (CurrentChunk)
+			{
+				SealChunk(CurrentChunk);
+				CurrentChunk = nullptr;
+			}
+			for (int64 i = 0; i < NumChunks; i++)
+			{
+				FChunk* Chunk = AcquireChunk();
+				Chunk->NumChunks = i == 0 ? static_cast<uint32>(NumChunks) : 0;
+				Chunk->Used = FMath::Min(RunUsed - i * ChunkSize, ChunkSize);
+				Chunk->RunUsed = RunUsed;
+				Buffers.Add(Chunk);
+			}
+			Offset = sizeof(FChunkHeader);
+		}
+		else
+		{
+			if (CurrentChunk && CurrentChunk->Used + RecordSize > CurrentChunk->Data.Num())
+			{
+				SealChunk(CurrentChunk);
+				CurrentChunk = nullptr;
+			}
+			if (!CurrentChunk)
+			{
+				CurrentChunk = AcquireChunk();
+				if (!CurrentChunk)
+				{
+					NumDroppedRecords++;
+					return false;
+				}
+			}
+			Offset = CurrentChunk->Used;
+			CurrentChunk->Used += RecordSize;
+			Buffers.Add(CurrentChunk);
+		}
+
+		AddIndexEntry(*Buffers[0], Offset, Kind, FrameId, Timestamp, static_cast<uint32>(Payload.Num()));
+		for (FChunk* Chunk : Buffers)
+		{
+			Chunk->PendingCopies++;
+		}
+		if (Buffers.Num() > 1)
+		{
+			// the run is complete, the writer takes it as soon as the copy is done
+			for (FChunk* Chunk : Buffers)
+			{
+				SealChunk(Chunk);
+			}
+		}
+	}
+
+	CopyRecord(Buffers, Offset, Kind, FrameId, Timestamp, Payload);
+	return true;
+}
+
+FFrameRecorder::FChunk* FFrameRecorder::AcquireChunk()
+{
+	if (FreeChunks.Num() == 0)
+	{
+		return nullptr;
+	}
+	FChunk* Chunk = FreeChunks.Pop(false);
+	Chunk->Index = NextChunkIndex++;
+	Chunk->NumChunks = 1;
+	Chunk->Used = sizeof(FChunkHeader);
+	return Chunk;
+}
+
+void FFrameRecorder::AddIndexEntry(const FChunk& Chunk, int64 Offset, ERecordKind Kind, uint64 FrameId,
+                                   double Timestamp, uint32 Size)
+{
+	FIndexEntry& Entry = Index.AddZeroed_GetRef();
+	Entry.Offset = sizeof(FFileHeader) + static_cast<uint64>(Chunk.Index) * ChunkSize + Offset;
+	Entry.FrameId = FrameId;
+	Entry.Timestamp = Timestamp;
+	Entry.Size = Size;
+	Entry.Kind = static_cast<uint8>(Kind);
+	NumRecords++;
+}
+
+void FFrameRecorder::CopyRecord(const FRecordBuffers& Buffers, int64 Offset, ERecordKind Kind, uint64 FrameId,
+                                double Timestamp, TConstArrayView<uint8> Payload) const
+{
+	FRecordHeader Header;
+	FMemory::Memzero(Header);
+	Header.Kind = static_cast<uint8>(Kind);
+	Header.Size = static_cast<uint32>(Payload.Num());
+	Header.FrameId = FrameId;
+	Header.Timestamp = Timestamp;
+
+	// split where one buffer of a run ends and the next begins, null Src writes zeros
+	auto Copy = [&Buffers, &Offset, this](const uint8* Src, int64 Size)
+	{
+		while (Size > 0)
+		{
+			FChunk& Chunk = *Buffers[Offset / ChunkSize];
+			const int64 Start = Offset % ChunkSize;
+			const int64 Bytes = FMath::Min(Size, ChunkSize - Start);
+			if (Src)
+			{
+				FMemory::Memcpy(Chunk.Data.GetData() + Start, Src, Bytes);
+				Src += Bytes;
+			}
+			else
+			{
+				FMemory::Memzero(Chunk.Data.GetData() + Start, Bytes);
+			}
+			Offset += Bytes;
+			Size -= Bytes;
+		}
+	};
+	Copy(reinterpret_cast<const uint8*>(&Header), sizeof(Header));
+	Copy(Payload.GetData(), Payload.Num());
+	const int64 RecordSize = Align(static_cast<int64>(sizeof(FRecordHeader)) + Payload.Num(), RecordAlignment);
+	// zero the alignment padding so identical recordings produce identical bytes
+	Copy(nullptr, RecordSize - sizeof(Header) - Payload.Num());
+
+	for (FChunk* Chunk : Buffers)
+	{
+		Chunk->PendingCopies--;
+	}
+}
+
+void FFrameRecorder::SealChunk(FChunk* Chunk)
+{
+	if (Chunk->NumChunks == 1)
+	{
+		Chunk->RunUsed = Chunk->Used;
+	}
+	FullChunks.Enqueue(Chunk);
+	WakeWriter->Trigger();
+}
+
+uint32 FFrameRecorder::Run()
+{
+	for (;;)
+	{
+		FChunk* Chunk = nullptr;
+		while (FullChunks.Dequeue(Chunk))
+		{
+			// records are copied in after their room is reserved, a copy or two may still be running
+			while (Chunk->PendingCopies.Load() > 0)
+			{
+				FPlatformProcess::Sleep(0.0f);
+			}
+			if (Chunk->NumChunks > 0)
+			{
+				FChunkHeader Header;
+				FMemory::Memcpy(Header.Magic, ChunkMagic, sizeof(ChunkMagic));
+				Header.Index = Chunk->Index;
+				Header.NumChunks = Chunk->NumChunks;
+				Header.UsedBytes = static_cast<uint32>(Chunk->RunUsed);
+				FMemory::Memcpy(Chunk->Data.GetData(), &Header, sizeof(Header));
+			}
+			FMemory::Memzero(Chunk->Data.GetData() + Chunk->Used, Chunk->Data.Num() - Chunk->Used);
+
+			// chunks are queued in index order under the append lock, so the file only ever grows at its end
+			if (!File->Write(Chunk->Data.GetData(), Chunk->Data.Num()))
+			{
+				UE_LOG(LogTemp, Error, TEXT("FFrameRecorder: write to %s failed"), *Path);
+			}
+			BytesWritten += Chunk->Data.Num();
+			FScopeLock Lock(&AppendLock);
+			FreeChunks.Add(Chunk);
+		}
+		if (bStopping)
+		{
+			// Close sealed the last chunk before setting bStopping, so the queue is empty for good
+			if (FullChunks.IsEmpty())
+			{
+				return 0;
+			}
+			continue;
+		}
+		WakeWriter->Wait();
+	}
+}
@@ -0,0 +1,166 @@
+#include "FrameWireFormat.h"
+
+namespace FrameWire
+{
+	namespace
+	{
+		template <int32 N>
+		void CopyName(ANSICHAR (&Dst)[N], const FString& Src)
+		{
+			FMemory::Memzero(Dst, N);
+			const FTCHARToUTF8 Utf8(*Src);
+			FMemory::Memcpy(Dst, Utf8.Get(), FMath::Min<int32>(Utf8.Length(), N));
+		}
+
+		template <int32 N>
+		FString ReadName(const ANSICHAR (&Src)[N])
+		{
+			int32 Length = 0;
+			while (Length < N && Src[Length] != 0)
+			{
+				Length++;
+			}
+			const FUTF8ToTCHAR Converted(Src, Length);
+			return FString(Converted.Length(), Converted.Get());
+		}
+	}
+
+	void Write(const FFrameInfo& Info, TConstArrayView<FPlane> Planes, TConstArrayView<FSection> Sections,
+	           TArray<uint8>& Out)
+	{
+		check(Planes.Num() <= MAX_uint8 && Sections.Num() <= MAX_uint16);
+		const int64 TablesSize = sizeof(FHeader) + Planes.Num() * sizeof(FPlaneEntry) + Sections.Num() *
+			sizeof(FSectionEntry);
+
+		// lay out the payloads first so the whole frame is allocated once
+		TArray<FPlaneEntry, TInlineAllocator<4>> PlaneEntries;
+		int64 Size = TablesSize;
+		for (const FPlane& Plane : Planes)
+		{
+			FPlaneEntry& Entry = PlaneEntries.AddZeroed_GetRef();
+			Entry.Offset = static_cast<uint32>(Size);
+			Entry.Size = static_cast<uint32>(Plane.Data.Num());
+			Entry.Width = static_cast<uint16>(Plane.Width);
+			Entry.Height = static_cast<uint16>(Plane.Height);
+			Entry.Kind = static_cast<uint8>(Plane.Kind);
+			Entry.PixelFormat = static_cast<uint8>(Plane.PixelFormat);
+			Entry.Encoding = static_cast<uint8>(Plane.Encoding);
+			Entry.View = Plane.View;
+			Size += Plane.Data.Num();
+		}
+		TArray<FSectionEntry, TInlineAllocator<8>> SectionEntries;
+		for (const FSection& Section : Sections)
+		{
+			Size = Align(Size, 4);
+			FSectionEntry& Entry = SectionEntries.AddZeroed_GetRef();
+			CopyName(Entry.Tag, Section.Tag);
+			Entry.ClassId = Section.ClassId;
+			Entry.Kind = static_cast<uint8>(Section.Kind);
+			Entry.Offset = static_cast<uint32>(Size);
+			Entry.Size = static_cast<uint32>(Section.Data.Num());
+			Entry.Count = Section.Count;
+			Size += Section.Data.Num();
+		}
+		check(Size <= MAX_int32);
+		Out.SetNumUninitialized(static_cast<int32>(Size), false);
+		uint8* Dst = Out.GetData();
+
+		FHeader Header;
+		FMemory::Memzero(Header);
+		FMemory::Memcpy(Header.Magic, Magic, sizeof(Magic));
+		Header.Version = Version;
+		Header.HeaderSize = sizeof(FHeader);
+		Header.FrameId = Info.FrameId;
+		Header.Timestamp = Info.Timestamp;
+		Header.Width = static_cast<uint16>(Info.Width);
+		Header.Height = static_cast<uint16>(Info.Height);
+		Header.NumPlanes = static_cast<uint8>(Planes.Num());
+		Header.NumSections = static_cast<uint16>(Sections.Num());
+		CopyName(Header.InstanceName, Info.InstanceName);
+		FMemory::Memcpy(Dst, &Header, sizeof(Header));
+
+		uint8* Table = Dst + sizeof(FHeader);
+		FMemory::Memcpy(Table, PlaneEntries.GetData(), PlaneEntries.Num() * sizeof(FPlaneEntry));
+		Table += PlaneEntries.Num() * sizeof(FPlaneEntry);
+		FMemory::Memcpy(Table, SectionEntries.GetData(), SectionEntries.Num() * sizeof(FSectionEntry));
+
+		for (int32 i = 0; i < Planes.Num(); i++)
+		{
+			FMemory::Memcpy(Dst + PlaneEntries[i].Offset, Planes[i].Data.GetData(), Planes[i].Data.Num());
+		}
+		int64 PreviousEnd = PlaneEntries.Num() > 0
+			                    ? PlaneEntries.Last().Offset + PlaneEntries.Last().Size
+			                    : TablesSize;
+		for (int32 i = 0; i < Sections.Num(); i++)
+		{
+			// zero the alignment padding so identical frames produce identical bytes
+			FMemory::Memzero(Dst + PreviousEnd, SectionEntries[i].Offset - PreviousEnd);
+			FMemory::Memcpy(Dst + SectionEntries[i].Offset, Sections[i].Data.GetData(), Sections[i].Data.Num());
+			PreviousEnd = SectionEntries[i].Offset + Sections[i].Data.Num();
+		}
+	}
+
+	bool Read(TConstArrayView<uint8> Data, FFrameView& Out)
+	{
+		if (Data.Num() < static_cast<int32>(sizeof(FHeader)))
+		{
+			return false;
+		}
+		FHeader Header;
+		FMemory::Memcpy(&Header, Data.GetData(), sizeof(FHeader));
+		if (FMemory::Memcmp(Header.Magic, Magic, sizeof(Magic)) != 0 || Header.Version != Version)
+		{
+			return false;
+		}
+		const int64 TablesSize = Header.HeaderSize + Header.NumPlanes * sizeof(FPlaneEntry) + Header.NumSections *
+			sizeof(FSectionEntry);
+		if (Header.HeaderSize < sizeof(FHeader) || Data.Num() < TablesSize)
+		{
+			return false;
+		}
+
+		Out.Info.FrameId = Header.FrameId;
+		Out.Info.Timestamp = Header.Timestamp;
+		Out.Info.InstanceName = ReadName(Header.InstanceName);
+		Out.Info.Width = Header.Width;
+		Out.Info.Height = Header.Height;
+
+		const uint8* Table = Data.GetData() + Header.HeaderSize;
+		Out.Planes.Reset(Header.NumPlanes);
+		for (int32 i = 0; i < Header.NumPlanes; i++, Table += sizeof(FPlaneEntry))
+		{
+			FPlaneEntry Entry;
+			FMemory::Memcpy(&Entry, Table, sizeof(Entry));
+			if (static_cast<int64>(Entry.Offset) + Entry.Size > Data.Num())
+			{
+				return false;
+			}
+			FPlane& Plane = Out.Planes.AddDefaulted_GetRef();
+			Plane.Kind = static_cast<EPlaneKind>(Entry.Kind);
+			Plane.PixelFormat = static_cast<EPixelFormat>(Entry.PixelFormat);
+			Plane.Encoding = static_cast<EPlaneEncoding>(Entry.Encoding);
+			Plane.View = Entry.View;
+			Plane.Width = Entry.Width;
+			Plane.Height = Entry.Height;
+			Plane.Data = Data.Slice(Entry.Offset, Entry.Size);
+		}
+
+		Out.Sections.Reset(Header.NumSections);
+		for (int32 i = 0; i < Header.NumSections; i++, Table += sizeof(FSectionEntry))
+		{
+			FSectionEntry Entry;
+			FMemory::Memcpy(&Entry, Table, sizeof(Entry));
+			if (Entry.Offset % 4 != 0 || static_cast<int64>(Entry.Offset) + Entry.Size > Data.Num())
+			{
+				return false;
+			}
+			FSection& Section = Out.Sections.AddDefaulted_GetRef();
+			Section.Tag = ReadName(Entry.Tag);
+			Section.ClassId = Entry.ClassId;
+			Section.Kind = static_cast<ESectionKind>(Entry.Kind);
+			Section.Count = Entry.Count;
+			Section.Data = Data.Slice(Entry.Offset, Entry.Size);
+		}
+		return true;
+	}
+}
@@ -0,0 +1,250 @@
+#include "GrassInstanceGrid.h"
+#include "Algo/Sort.h"
+
+#if PLATFORM_ENABLE_VECTORINTRINSICS && PLATFORM_CPU_X86_FAMILY
+#include <emmintrin.h>
+#define MOWER_GRASS_SSE2 1
+#else
+#define MOWER_GRASS_SSE2 0
+#endif
+
+void FMowingDeck::GetCorners(FVector2D (&OutCorners)[4]) const
+{
+	const FVector2D Length = Forward * HalfLength;
+	const FVector2D Width = GetRight() * HalfWidth;
+	OutCorners[0] = Center + Length - Width;
+	OutCorners[1] = Center + Length + Width;
+	OutCorners[2] = Center - Length + Width;
+	OutCorners[3] = Center - Length - Width;
+}
+
+FBox2D FMowingDeck::GetBounds() const
+{
+	FVector2D Corners[4];
+	GetCorners(Corners);
+	return FBox2D(Corners, 4);
+}
+
+FMowingArea::FMowingArea(const FMowingDeck& Deck)
+	: MinZ(Deck.MinZ)
+	, MaxZ(Deck.MaxZ)
+{
+	FVector2D Corners[4];
+	Deck.GetCorners(Corners);
+	Vertices.Append(Corners, 4);
+}
+
+void FMowingArea::Sweep(const FMowingDeck& From, const FMowingDeck& To, double MaxStepAngle,
+                        TArray<FMowingArea>& OutAreas)
+{
+	const double FromAngle = FMath::Atan2(From.Forward.Y, From.Forward.X);
+	const double TurnAngle = FMath::FindDeltaAngleRadians(FromAngle, FMath::Atan2(To.Forward.Y, To.Forward.X));
+	const int32 NumSteps = FMath::Clamp(FMath::CeilToInt32(FMath::Abs(TurnAngle) / FMath::Max(MaxStepAngle, 0.01)),
+	                                    1, 64);
+	FMowingDeck Previous = From;
+	for (int32 Step = 1; Step <= NumSteps; ++Step)
+	{
+		FMowingDeck Next = To;
+		if (Step < NumSteps)
+		{
+			const double Alpha = static_cast<double>(Step) / NumSteps;
+			double Sin, Cos;
+			FMath::SinCos(&Sin, &Cos, FromAngle + TurnAngle * Alpha);
+			Next.Center = FMath::Lerp(From.Center, To.Center, Alpha);
+			Next.Forward = FVector2D(Cos, Sin);
+		}
+
+		// the convex hull of both poses' corners, by the monotone chain
+		FVector2D PreviousCorners[4];
+		FVector2D NextCorners[4];
+		Previous.GetCorners(PreviousCorners);
+		Next.GetCorners(NextCorners);
+		FVector2D Points[8];
+		for (int32 Corner = 0; Corner < 4; ++Corner)
+		{
+			Points[Corner] = PreviousCorners[Corner];
+			Points[Corner + 4] = NextCorners[Corner];
+		}
+		Algo::Sort(Points, [](const FVector2D& A, const FVector2D& B)
+		{
+			return A.X < B.X || (A.X == B.X && A.Y < B.Y);
+		});
+		FVector2D Hull[2 * UE_ARRAY_COUNT(Points)];
+		int32 NumHull = 0;
+		auto AddToHull = [&Hull, &NumHull](const FVector2D& Point, int32 MinHull)
+		{
+			while (NumHull >= MinHull && FVector2D::CrossProduct(Hull[NumHull - 1] - Hull[NumHull - 2],
+			                                                     Point - Hull[NumHull - 2]) <= 0.0)
+			{
+				--NumHull;
+			}
+			Hull[NumHull++] = Point;
+		};
+		for (const FVector2D& Point : Points)
+		{
+			AddToHull(Point, 2);
+		}
+		const int32 LowerSize = NumHull + 1;
+		for (int32 i = UE_ARRAY_COUNT(Points) - 2; i >= 0; --i)
+		{
+			AddToHull(Points[i], LowerSize);
+		}
+
+		FMowingArea& Area = OutAreas.AddDefaulted_GetRef();
+		// the last point is the first again
+		Area.Vertices.Append(Hull, NumHull - 1);
+		Area.MinZ = FMath::Min(Previous.MinZ, Next.MinZ);
+		Area.MaxZ = FMath::Max(Previous.MaxZ, Next.MaxZ);
+		Previous = Next;
+	}
+}
+
+FBox2D FMowingArea::GetBounds() const
+{
+	return Vertices.Num() > 0 ? FBox2D(Vertices.GetData(), Vertices.Num()) : FBox2D(ForceInit);
+}
+
+FIntPoint FGrassInstanceGrid::GetCell(double X, double Y)
+{
+	// far outside any level, but keeps the cell coordinates in range
+	constexpr double MaxCoordinate = 1 << 24;
+	return FIntPoint(FMath::FloorToInt32(FMath::Clamp(X / CellSize, -MaxCoordinate, MaxCoordinate)),
+	                 FMath::FloorToInt32(FMath::Clamp(Y / CellSize, -MaxCoordinate, MaxCoordinate)));
+}
+
+int32 FGrassInstanceGrid::Add(const FVector& Location, float MinZ, float MaxZ)
+{
+	const FIntPoint Key = GetCell(Location.X, Location.Y);
+	FCell& Cell = Cells.FindOrAdd(Key);
+	const int32 Handle = Entries.Add({Key, Cell.Handles.Num()});
+	Cell.X.Add(static_cast<float>(Location.X - Key.X * CellSize));
+	Cell.Y.Add(static_cast<float>(Location.Y - Key.Y * CellSize));
+	Cell.MinZ.Add(MinZ);
+	Cell.MaxZ.Add(MaxZ);
+	Cell.Handles.Add(Handle);
+	return Handle;
+}
+
+void FGrassInstanceGrid::Remove(int32 Handle)
+{
+	const FEntry Entry = Entries[Handle];
+	Entries.RemoveAt(Handle);
+	FCell& Cell = Cells.FindChecked(Entry.Cell);
+	const int32 Index = Entry.IndexInCell;
+	const int32 Last = Cell.Handles.Num() - 1;
+	if (Index != Last)
+	{
+		// the last instance of the cell takes the removed one's place
+		Entries[Cell.Handles[Last]].IndexInCell = Index;
+	}
+	Cell.X.RemoveAtSwap(Index, 1, false);
+	Cell.Y.RemoveAtSwap(Index, 1, false);
+	Cell.MinZ.RemoveAtSwap(Index, 1, false);
+	Cell.MaxZ.RemoveAtSwap(Index, 1, false);
+	Cell.Handles.RemoveAtSwap(Index, 1, false);
+	if (Cell.Handles.Num() == 0)
+	{
+		Cells.Remove(Entry.Cell);
+	}
+}
+
+void FGrassInstanceGrid::Reset()
+{
+	Entries.Empty();
+	Cells.Empty();
+}
+
+void FGrassInstanceGrid::Query(const FMowingArea& Area, TArray<int32>& OutHandles) const
+{
+	if (Area.Vertices.Num() < 3)
+	{
+		return;
+	}
+	check(Area.Vertices.Num() <= FMowingArea::MaxVertices);
+	const FBox2D Bounds = Area.GetBounds();
+	const FIntPoint MinCell = GetCell(Bounds.Min.X, Bounds.Min.Y);
+	const FIntPoint MaxCell = GetCell(Bounds.Max.X, Bounds.Max.Y);
+	for (int32 CellY = MinCell.Y; CellY <= MaxCell.Y; ++CellY)
+	{
+		for (int32 CellX = MinCell.X; CellX <= MaxCell.X; ++CellX)
+		{
+			const FIntPoint Key(CellX, CellY);
+			if (const FCell* Cell = Cells.Find(Key))
+			{
+				QueryCell(*Cell, Key, Area, OutHandles);
+			}
+		}
+	}
+}
+
+void FGrassInstanceGrid::QueryCell(const FCell& Cell, FIntPoint CellKey, const FMowingArea& Area,
+                                   TArray<int32>& OutHandles)
+{
+	// the edges as half planes in the cell's frame, inside where NormalX * X + NormalY * Y <= Offset
+	const FVector2D CellOrigin(CellKey.X * CellSize, CellKey.Y * CellSize);
+	const int32 NumEdges = Area.Vertices.Num();
+	float NormalX[FMowingArea::MaxVertices];
+	float NormalY[FMowingArea::MaxVertices];
+	float Offset[FMowingArea::MaxVertices];
+	for (int32 Edge = 0; Edge < NumEdges; ++Edge)
+	{
+		const FVector2D A = Area.Vertices[Edge] - CellOrigin;
+		const FVector2D B = Area.Vertices[(Edge + 1) % NumEdges] - CellOrigin;
+		// outward, the polygon being counter clockwise
+		const FVector2D Normal(B.Y - A.Y, A.X - B.X);
+		NormalX[Edge] = static_cast<float>(Normal.X);
+		NormalY[Edge] = static_cast<float>(Normal.Y);
+		Offset[Edge] = static_cast<float>(FVector2D::DotProduct(Normal, A));
+	}
+	const float AreaMinZ = static_cast<float>(Area.MinZ);
+	const float AreaMaxZ = static_cast<float>(Area.MaxZ);
+	const int32 Num = Cell.Handles.Num();
+
+	int32 i = 0;
+#if MOWER_GRASS_SSE2
+	for (; i + 4 <= Num; i += 4)
+	{
+		const __m128 X = _mm_loadu_ps(Cell.X.GetData() + i);
+		const __m128 Y = _mm_loadu_ps(Cell.Y.GetData() + i);
+		__m128 Inside = _mm_cmpge_ps(_mm_loadu_ps(Cell.MaxZ.GetData() + i), _mm_set1_ps(AreaMinZ));
+		Inside = _mm_and_ps(Inside, _mm_cmple_ps(_mm_loadu_ps(Cell.MinZ.GetData() + i), _mm_set1_ps(AreaMaxZ)));
+		for (int32 Edge = 0; Edge < NumEdges; ++Edge)
+		{
+			const __m128 Distance = _mm_add_ps(_mm_mul_ps(X, _mm_set1_ps(NormalX[Edge])),
+			                                   _mm_mul_ps(Y, _mm_set1_ps(NormalY[Edge])));
+			Inside = _mm_and_ps(Inside, _mm_cmple_ps(Distance, _mm_set1_ps(Offset[Edge])));
+		}
+		int32 Mask = _mm_movemask_ps(Inside);
+		while (Mask != 0)
+		{
+			const int32 Lane = FMath::CountTrailingZeros(static_cast<uint32>(Mask));
+			OutHandles.Add(Cell.Handles[i + Lane]);
+			Mask &= Mask - 1;
+		}
+	}
+#endif
+	for (; i < Num; ++i)
+	{
+		bool bInside = Cell.MaxZ[i] >= AreaMinZ && Cell.MinZ[i] <= AreaMaxZ;
+		for (int32 Edge = 0; Edge < NumEdges && bInside; ++Edge)
+		{
+			bInside = Cell.X[i] * NormalX[Edge] + Cell.Y[i] * NormalY[Edge] <= Offset[Edge];
+		}
+		if (bInside)
+		{
+			OutHandles.Add(Cell.Handles[i]);
+		}
+	}
+}
+
+SIZE_T FGrassInstanceGrid::GetAllocatedSize() const
+{
+	SIZE_T Size = Entries.GetAllocatedSize() + Cells.GetAllocatedSize();
+	for (const TPair<FIntPoint, FCell>& Pair : Cells)
+	{
+		const FCell& Cell = Pair.Value;
+		Size += Cell.X.GetAllocatedSize() + Cell.Y.GetAllocatedSize() + Cell.MinZ.GetAllocatedSize() +
+			Cell.MaxZ.GetAllocatedSize() + Cell.Handles.GetAllocatedSize();
+	}
+	return Size;
+}
@@ -0,0 +1,420 @@
+#include "GrassMowingSubsystem.h"
+#include "Engine/Level.h"
+#include "Engine/StaticMesh.h"
+#include "Engine/World.h"
+#include "Components/HierarchicalInstancedStaticMeshComponent.h"
+#include "FoliageInstancedStaticMeshComponent.h"
+#include "InstancedFoliageActor.h"
+#include "Stats/Stats.h"
+
+DECLARE_STATS_GROUP(TEXT("GrassMowing"), STATGROUP_GrassMowing, STATCAT_Advanced);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Instances"), STAT_GrassMowing_Instances, STATGROUP_GrassMowing);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Grid cells"), STAT_GrassMowing_Cells, STATGROUP_GrassMowing);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Mowed"), STAT_GrassMowing_Mowed, STATGROUP_GrassMowing);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Remove batches"), STAT_GrassMowing_RemoveBatches, STATGROUP_GrassMowing);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Stubble"), STAT_GrassMowing_Stubble, STATGROUP_GrassMowing);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Stubble components"), STAT_GrassMowing_StubbleComponents, STATGROUP_GrassMowing);
+DECLARE_MEMORY_STAT(TEXT("Memory"), STAT_GrassMowing_Memory, STATGROUP_GrassMowing);
+DECLARE_CYCLE_STAT(TEXT("Build"), STAT_GrassMowing_Build, STATGROUP_GrassMowing);
+DECLARE_CYCLE_STAT(TEXT("Query"), STAT_GrassMowing_Query, STATGROUP_GrassMowing);
+DECLARE_CYCLE_STAT(TEXT("Remove"), STAT_GrassMowing_Remove, STATGROUP_GrassMowing);
+DECLARE_CYCLE_STAT(TEXT("Add stubble"), STAT_GrassMowing_Stubble_Add, STATGROUP_GrassMowing);
+
+void UGrassMowingSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	LevelAddedHandle = FWorldDelegates::LevelAddedToWorld.AddUObject(this, &UGrassMowingSubsystem::OnLevelAdded);
+	LevelRemovedHandle = FWorldDelegates::LevelRemovedFromWorld.AddUObject(this,
+	                                                                       &UGrassMowingSubsystem::OnLevelRemoved);
+}
+
+void UGrassMowingSubsystem::Deinitialize()
+{
+	FWorldDelegates::LevelAddedToWorld.Remove(LevelAddedHandle);
+	FWorldDelegates::LevelRemovedFromWorld.Remove(LevelRemovedHandle);
+
+	Grid.Reset();
+	Components.Empty();
+	RefOfHandle.Empty();
+	QueuedComponents.Empty();
+	StubbleActor = nullptr;
+	StubbleComponents.Empty();
+	StubbleOfChunk.Empty();
+	QueuedStubble.Empty();
+	bStubbleQueued = false;
+	bBuilt = false;
+	UpdateStats();
+	Super::Deinitialize();
+}
+
+void UGrassMowingSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	FlushRemovals();
+	FlushStubble();
+	if (bStatsDirty)
+	{
+		UpdateStats();
+	}
+}
+
+TStatId UGrassMowingSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UGrassMowingSubsystem, STATGROUP_Tickables);
+}
+
+void UGrassMowingSubsystem::Build(const FGrassMowingSettings& InSettings)
+{
+	SCOPE_CYCLE_COUNTER(STAT_GrassMowing_Build);
+	const double StartSeconds = FPlatformTime::Seconds();
+	Settings = InSettings;
+	Grid.Reset();
+	Components.Empty();
+	RefOfHandle.Reset();
+	QueuedComponents.Reset();
+	GrassBounds.Init();
+	bBuilt = true;
+	for (const ULevel* Level : GetWorld()->GetLevels())
+	{
+		AddLevel(Level);
+	}
+	bStatsDirty = true;
+	UE_LOG(LogTemp, Log, TEXT("UGrassMowingSubsystem: %d grass instances of %d components in %d cells in %.1f ms"),
+	       Grid.Num(), Components.Num(), Grid.GetNumCells(), (FPlatformTime::Seconds() - StartSeconds) * 1000.0);
+}
+
+void UGrassMowingSubsystem::Query(const FMowingArea& Area, TArray<int32>& OutHandles) const
+{
+	SCOPE_CYCLE_COUNTER(STAT_GrassMowing_Query);
+	Grid.Query(Area, OutHandles);
+}
+
+UFoliageInstancedStaticMeshComponent* UGrassMowingSubsystem::GetInstance(int32 Handle, int32& OutInstanceIndex) const
+{
+	if (!RefOfHandle.IsValidIndex(Handle) || RefOfHandle[Handle].Component == INDEX_NONE)
+	{
+		return nullptr;
+	}
+	const FGrassRef& Ref = RefOfHandle[Handle];
+	OutInstanceIndex = Ref.Instance;
+	return Components[Ref.Component].Component.Get();
+}
+
+bool UGrassMowingSubsystem::QueueRemoval(int32 Handle, FTransform* OutTransform)
+{
+	if (!RefOfHandle.IsValidIndex(Handle) || RefOfHandle[Handle].Component == INDEX_NONE || RefOfHandle[Handle].bQueued)
+	{
+		return false;
+	}
+	FGrassRef& Ref = RefOfHandle[Handle];
+	FGrassComponent& Grass = Components[Ref.Component];
+	const UFoliageInstancedStaticMeshComponent* Component = Grass.Component.Get();
+	if (!Component)
+	{
+		return false;
+	}
+	if (OutTransform)
+	{
+		Component->GetInstanceTransform(Ref.Instance, *OutTransform, true);
+	}
+	if (Grass.Queued.Num() == 0)
+	{
+		QueuedComponents.Add(Ref.Component);
+	}
+	Grass.Queued.Add(Handle);
+	Ref.bQueued = true;
+	return true;
+}
+
+void UGrassMowingSubsystem::FlushRemovals()
+{
+	if (QueuedComponents.Num() == 0)
+	{
+		return;
+	}
+	SCOPE_CYCLE_COUNTER(STAT_GrassMowing_Remove);
+	TArray<int32, TInlineAllocator<16>> Stale;
+	TArray<int32> Instances;
+	for (const int32 ComponentIndex : QueuedComponents)
+	{
+		FGrassComponent& Grass = Components[ComponentIndex];
+		UFoliageInstancedStaticMeshComponent* Component = Grass.Component.Get();
+		if (!Component)
+		{
+			Stale.Add(ComponentIndex);
+			continue;
+		}
+		Instances.Reset();
+		for (const int32 Handle : Grass.Queued)
+		{
+			Instances.Add(RefOfHandle[Handle].Instance);
+		}
+		Grass.Queued.Reset();
+
+		// last first, as the component removes them, each by swapping its last instance into its place
+		Instances.Sort(TGreater<int32>());
+		Component->RemoveInstances(Instances);
+		for (const int32 Instance : Instances)
+		{
+			ForgetInstance(ComponentIndex, Instance);
+		}
+		Component->BuildTreeIfOutdated(true, false);
+		Stats.NumMowed += Instances.Num();
+		++Stats.NumRemoveBatches;
+
+		// something else changed the component, index it again rather than mow the wrong instances
+		if (Component->GetInstanceCount() != Grass.Handles.Num())
+		{
+			UE_LOG(LogTemp, Warning, TEXT("UGrassMowingSubsystem: %s changed outside of mowing, indexing it again"),
+			       *Component->GetName());
+			Stale.Add(ComponentIndex);
+		}
+	}
+	QueuedComponents.Reset();
+	for (const int32 ComponentIndex : Stale)
+	{
+		UFoliageInstancedStaticMeshComponent* Component = Components[ComponentIndex].Component.Get();
+		RemoveComponent(ComponentIndex);
+		AddComponent(Component);
+	}
+	bStatsDirty = true;
+}
+
+void UGrassMowingSubsystem::AddStubble(UStaticMesh* Mesh, const FTransform& Transform)
+{
+	if (!Mesh)
+	{
+		return;
+	}
+	const FVector Location = Transform.GetLocation();
+	const double ChunkSize = FMath::Max(Settings.StubbleChunkSize, 100.0f);
+	const FIntPoint Chunk(FMath::FloorToInt32(Location.X / ChunkSize), FMath::FloorToInt32(Location.Y / ChunkSize));
+	const int32 Index = FindOrAddStubbleComponent(Mesh, Chunk);
+	if (Index != INDEX_NONE)
+	{
+		QueuedStubble[Index].Add(Transform);
+		bStubbleQueued = true;
+	}
+}
+
+void UGrassMowingSubsystem::FlushStubble()
+{
+	if (!bStubbleQueued)
+	{
+		return;
+	}
+	SCOPE_CYCLE_COUNTER(STAT_GrassMowing_Stubble_Add);
+	for (int32 Index = 0; Index < StubbleComponents.Num(); ++Index)
+	{
+		TArray<FTransform>& Transforms = QueuedStubble[Index];
+		UHierarchicalInstancedStaticMeshComponent* Component = StubbleComponents[Index];
+		if (Transforms.Num() == 0 || !IsValid(Component))
+		{
+			Transforms.Reset();
+			continue;
+		}
+		Component->AddInstances(Transforms, false, true);
+		Component->BuildTreeIfOutdated(true, false);
+		Stats.NumStubble += Transforms.Num();
+		Transforms.Reset();
+	}
+	bStubbleQueued = false;
+	bStatsDirty = true;
+}
+
+FGrassMowingStats UGrassMowingSubsystem::GetStats() const
+{
+	return Stats;
+}
+
+void UGrassMowingSubsystem::OnLevelAdded(ULevel* Level, UWorld* InWorld)
+{
+	if (!Level || InWorld != GetWorld() || !bBuilt)
+	{
+		return;
+	}
+	SCOPE_CYCLE_COUNTER(STAT_GrassMowing_Build);
+	AddLevel(Level);
+	bStatsDirty = true;
+}
+
+void UGrassMowingSubsystem::OnLevelRemoved(ULevel* Level, UWorld* InWorld)
+{
+	// a null level means every level of the world is going away
+	if (!Level || InWorld != GetWorld())
+	{
+		return;
+	}
+	TArray<int32, TInlineAllocator<16>> Removed;
+	for (auto It = Components.CreateConstIterator(); It; ++It)
+	{
+		const UFoliageInstancedStaticMeshComponent* Component = It->Component.Get();
+		if (!Component || Component->GetComponentLevel() == Level)
+		{
+			Removed.Add(It.GetIndex());
+		}
+	}
+	for (const int32 Index : Removed)
+	{
+		RemoveComponent(Index);
+	}
+}
+
+void UGrassMowingSubsystem::AddLevel(const ULevel* Level)
+{
+	if (!Level)
+	{
+		return;
+	}
+	for (AActor* Actor : Level->Actors)
+	{
+		// only the level's foliage, not the components of other actors that reuse the foliage class
+		if (!IsValid(Actor) || !Actor->IsA<AInstancedFoliageActor>())
+		{
+			continue;
+		}
+		TInlineComponentArray<UFoliageInstancedStaticMeshComponent*> FoliageComponents(Actor);
+		for (UFoliageInstancedStaticMeshComponent* Component : FoliageComponents)
+		{
+			AddComponent(Component);
+		}
+	}
+}
+
+void UGrassMowingSubsystem::AddComponent(UFoliageInstancedStaticMeshComponent* Component)
+{
+	const UStaticMesh* Mesh = Component ? Component->GetStaticMesh() : nullptr;
+	if (!Mesh)
+	{
+		return;
+	}
+	const FBox MeshBox = Mesh->GetBoundingBox();
+	if (MeshBox.GetSize().Z > Settings.MaxGrassHeight)
+	{
+		return;
+	}
+
+	const int32 Index = Components.Add(FGrassComponent());
+	FGrassComponent& Grass = Components[Index];
+	Grass.Component = Component;
+	const int32 NumInstances = Component->GetInstanceCount();
+	Grass.Handles.SetNumUninitialized(NumInstances);
+	for (int32 Instance = 0; Instance < NumInstances; ++Instance)
+	{
+		FTransform Transform;
+		Component->GetInstanceTransform(Instance, Transform, true);
+		const FBox Box = MeshBox.TransformBy(Transform);
+		const int32 Handle = Grid.Add(Transform.GetLocation(), static_cast<float>(Box.Min.Z),
+		                              static_cast<float>(Box.Max.Z));
+		if (Handle >= RefOfHandle.Num())
+		{
+			RefOfHandle.SetNum(Handle + 1);
+		}
+		RefOfHandle[Handle] = {Index, Instance};
+		Grass.Handles[Instance] = Handle;
+		GrassBounds += FVector2D(Box.Min);
+		GrassBounds += FVector2D(Box.Max);
+	}
+
+	// mowing rebuilds the tree once a frame, asynchronously, instead of on every change
+	Component->bAutoRebuildTreeOnInstanceChanges = false;
+	if (Settings.bDisableCollision && Component->GetCollisionEnabled() != ECollisionEnabled::NoCollision)
+	{
+		Component->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	}
+}
+
+void UGrassMowingSubsystem::RemoveComponent(int32 Index)
+{
+	for (const int32 Handle : Components[Index].Handles)
+	{
+		Grid.Remove(Handle);
+		RefOfHandle[Handle] = FGrassRef();
+	}
+	Components.RemoveAt(Index);
+	QueuedComponents.Remove(Index);
+	bStatsDirty = true;
+}
+
+void UGrassMowingSubsystem::ForgetInstance(int32 ComponentIndex, int32 InstanceIndex)
+{
+	TArray<int32>& Handles = Components[ComponentIndex].Handles;
+	const int32 Handle = Handles[InstanceIndex];
+	Grid.Remove(Handle);
+	RefOfHandle[Handle] = FGrassRef();
+
+	const int32 Last = Handles.Num() - 1;
+	if (InstanceIndex != Last)
+	{
+		Handles[InstanceIndex] = Handles[Last];
+		RefOfHandle[Handles[InstanceIndex]].Instance = InstanceIndex;
+	}
+	Handles.Pop(false);
+}
+
+int32 UGrassMowingSubsystem::FindOrAddStubbleComponent(UStaticMesh* Mesh, FIntPoint Chunk)
+{
+	const TPair<TObjectKey<UStaticMesh>, FIntPoint> Key(Mesh, Chunk);
+	if (const int32* Index = StubbleOfChunk.Find(Key))
+	{
+		return *Index;
+	}
+
+	if (!StubbleActor)
+	{
+		FActorSpawnParameters SpawnParameters;
+		SpawnParameters.ObjectFlags |= RF_Transient;
+		StubbleActor = GetWorld()->SpawnActor<AActor>(SpawnParameters);
+		if (!StubbleActor)
+		{
+			return INDEX_NONE;
+		}
+		USceneComponent* Root = NewObject<USceneComponent>(StubbleActor, TEXT("Root"));
+		StubbleActor->SetRootComponent(Root);
+		Root->RegisterComponent();
+	}
+	UHierarchicalInstancedStaticMeshComponent* Component =
+		NewObject<UHierarchicalInstancedStaticMeshComponent>(StubbleActor);
+	Component->SetStaticMesh(Mesh);
+	Component->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	Component->bAutoRebuildTreeOnInstanceChanges = false;
+	Component->SetupAttachment(StubbleActor->GetRootComponent());
+	Component->RegisterComponent();
+	StubbleActor->AddInstanceComponent(Component);
+
+	const int32 Index = StubbleComponents.Add(Component);
+	QueuedStubble.AddDefaulted();
+	StubbleOfChunk.Add(Key, Index);
+	bStatsDirty = true;
+	return Index;
+}
+
+void UGrassMowingSubsystem::UpdateStats()
+{
+	int64 AllocatedBytes = Grid.GetAllocatedSize() + Components.GetAllocatedSize() + RefOfHandle.GetAllocatedSize() +
+		StubbleComponents.GetAllocatedSize() + StubbleOfChunk.GetAllocatedSize() + QueuedStubble.GetAllocatedSize();
+	for (const FGrassComponent& Grass : Components)
+	{
+		AllocatedBytes += Grass.Handles.GetAllocatedSize();
+	}
+	for (const TArray<FTransform>& Transforms : QueuedStubble)
+	{
+		AllocatedBytes += Transforms.GetAllocatedSize();
+	}
+	Stats.NumInstances = Grid.Num();
+	Stats.NumComponents = Components.Num();
+	Stats.NumCells = Grid.GetNumCells();
+	Stats.NumStubbleComponents = StubbleComponents.Num();
+	Stats.AllocatedBytes = AllocatedBytes;
+	bStatsDirty = false;
+
+	SET_DWORD_STAT(STAT_GrassMowing_Instances, Stats.NumInstances);
+	SET_DWORD_STAT(STAT_GrassMowing_Cells, Stats.NumCells);
+	SET_DWORD_STAT(STAT_GrassMowing_Mowed, Stats.NumMowed);
+	SET_DWORD_STAT(STAT_GrassMowing_RemoveBatches, Stats.NumRemoveBatches);
+	SET_DWORD_STAT(STAT_GrassMowing_Stubble, Stats.NumStubble);
+	SET_DWORD_STAT(STAT_GrassMowing_StubbleComponents, Stats.NumStubbleComponents);
+	SET_MEMORY_STAT(STAT_GrassMowing_Memory, Stats.AllocatedBytes);
+}
@@ -0,0 +1,351 @@
+#include "LabelRasterizer.h"
+#include "Async/ParallelFor.h"
+#include "Async/TaskGraphInterfaces.h"
+
+namespace
+{
+	// near, left, right, bottom and top. Reversed Z puts the near plane at z = w.
+	constexpr int32 NumClipPlanes = 5;
+	// a triangle clipped by every plane has at most this many vertices
+	constexpr int32 MaxClippedVertices = 3 + NumClipPlanes;
+
+	// signed distance to a clip plane, inside when not negative
+	float GetPlaneDistance(const FVector4f& V, int32 Plane)
+	{
+		switch (Plane)
+		{
+		case 0: return V.W - V.Z;
+		case 1: return V.W + V.X;
+		case 2: return V.W - V.X;
+		case 3: return V.W + V.Y;
+		default: return V.W - V.Y;
+		}
+	}
+
+	// bit i is set when the vertex is outside plane i
+	uint8 GetOutcode(const FVector4f& V)
+	{
+		uint8 Outcode = 0;
+		for (int32 Plane = 0; Plane < NumClipPlanes; ++Plane)
+		{
+			Outcode |= GetPlaneDistance(V, Plane) < 0.0f ? 1 << Plane : 0;
+		}
+		return Outcode;
+	}
+}
+
+void FLabelRasterizer::Rasterize(const FMatrix& ViewProjection, int32 InWidth, int32 InHeight,
+                                 TConstArrayView<FLabelInstance> Instances, uint8* OutClassIds,
+                                 uint16* OutInstanceIds)
+{
+	Width = FMath::Clamp(InWidth, 0, MaxSize);
+	Height = FMath::Clamp(InHeight, 0, MaxSize);
+	NumTilesX = FMath::DivideAndRoundUp(Width, TileSize);
+	NumTilesY = FMath::DivideAndRoundUp(Height, TileSize);
+	const int32 NumTiles = NumTilesX * NumTilesY;
+	if (NumTiles == 0)
+	{
+		return;
+	}
+
+	// split the instances into ranges of about the same number of triangles, one per setup task
+	int64 TotalTriangles = 0;
+	for (const FLabelInstance& Instance : Instances)
+	{
+		TotalTriangles += Instance.Mesh ? Instance.Mesh->GetNumTriangles() : 0;
+	}
+	NumTasks = FMath::Clamp(FTaskGraphInterface::Get().GetNumWorkerThreads() + 1, 1, FMath::Max(Instances.Num(), 1));
+	TaskInstances.SetNum(NumTasks + 1, false);
+	TaskInstances[0] = 0;
+	int64 Triangles = 0;
+	int32 Task = 1;
+	for (int32 i = 0; i < Instances.Num() && Task < NumTasks; ++i)
+	{
+		Triangles += Instances[i].Mesh ? Instances[i].Mesh->GetNumTriangles() : 0;
+		if (Triangles * NumTasks >= TotalTriangles * Task)
+		{
+			TaskInstances[Task++] = i + 1;
+		}
+	}
+	for (; Task <= NumTasks; ++Task)
+	{
+		TaskInstances[Task] = Instances.Num();
+	}
+
+	TaskTriangles.SetNum(NumTasks, false);
+	TaskClip.SetNum(NumTasks, false);
+	TaskOutcodes.SetNum(NumTasks, false);
+	Bins.SetNum(NumTasks * NumTiles, false);
+	for (TArray<int32>& Bin : Bins)
+	{
+		Bin.Reset();
+	}
+
+	ParallelFor(NumTasks, [&](int32 SetupTask)
+	{
+		SetupInstances(SetupTask, ViewProjection, Instances);
+	}, NumTasks == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
+
+	NumBinnedTriangles = 0;
+	for (const TArray<FTriangle>& SetUp : TaskTriangles)
+	{
+		NumBinnedTriangles += SetUp.Num();
+	}
+
+	ParallelFor(NumTiles, [&](int32 Tile)
+	{
+		RasterizeTile(Tile, OutClassIds, OutInstanceIds);
+	}, NumTiles == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
+}
+
+void FLabelRasterizer::SetupInstances(int32 Task, const FMatrix& ViewProjection,
+                                      TConstArrayView<FLabelInstance> Instances)
+{
+	TaskTriangles[Task].Reset();
+	TArray<FVector4f>& Clip = TaskClip[Task];
+	TArray<uint8>& Outcodes = TaskOutcodes[Task];
+	for (int32 i = TaskInstances[Task]; i < TaskInstances[Task + 1]; ++i)
+	{
+		const FLabelInstance& Instance = Instances[i];
+		if (!Instance.Mesh || Instance.ClassId == 0)
+		{
+			continue;
+		}
+		const FLabelMesh& Mesh = *Instance.Mesh;
+
+		// local to clip space in one matrix, UE matrices multiply row vectors from the left
+		const FMatrix44f LocalToClip(Instance.LocalToWorld * ViewProjection);
+		Clip.SetNumUninitialized(Mesh.Positions.Num(), false);
+		Outcodes.SetNumUninitialized(Mesh.Positions.Num(), false);
+		for (int32 v = 0; v < Mesh.Positions.Num(); ++v)
+		{
+			Clip[v] = LocalToClip.TransformFVector4(FVector4f(Mesh.Positions[v], 1.0f));
+			Outcodes[v] = GetOutcode(Clip[v]);
+		}
+
+		for (int32 t = 0; t + 2 < Mesh.Indices.Num(); t += 3)
+		{
+			const uint32 I0 = Mesh.Indices[t];
+			const uint32 I1 = Mesh.Indices[t + 1];
+			const uint32 I2 = Mesh.Indices[t + 2];
+			if (I0 >= static_cast<uint32>(Clip.Num()) || I1 >= static_cast<uint32>(Clip.Num()) ||
+				I2 >= static_cast<uint32>(Clip.Num()))
+			{
+				continue;
+			}
+			if (Outcodes[I0] & Outcodes[I1] & Outcodes[I2])
+			{
+				// all three outside the same plane
+				continue;
+			}
+			if ((Outcodes[I0] | Outcodes[I1] | Outcodes[I2]) == 0)
+			{
+				AddTriangle(Task, Clip[I0], Clip[I1], Clip[I2], Instance);
+				continue;
+			}
+			const FVector4f Triangle[3] = {Clip[I0], Clip[I1], Clip[I2]};
+			AddPolygon(Task, Triangle, 3, Instance);
+		}
+	}
+}
+
+void FLabelRasterizer::AddPolygon(int32 Task, const FVector4f* Clip, int32 NumVertices, const FLabelInstance& Instance)
+{
+	// Sutherland-Hodgman against every plane, ping-ponging between two buffers
+	FVector4f Buffers[2][MaxClippedVertices];
+	FMemory::Memcpy(Buffers[0], Clip, NumVertices * sizeof(FVector4f));
+	int32 Current = 0;
+	for (int32 Plane = 0; Plane < NumClipPlanes && NumVertices >= 3; ++Plane)
+	{
+		const FVector4f* In = Buffers[Current];
+		FVector4f* Out = Buffers[Current ^ 1];
+		int32 NumOut = 0;
+		for (int32 v = 0; v < NumVertices; ++v)
+		{
+			const FVector4f& A = In[v];
+			const FVector4f& B = In[(v + 1) % NumVertices];
+			const float DistanceA = GetPlaneDistance(A, Plane);
+			const float DistanceB = GetPlaneDistance(B, Plane);
+			if (DistanceA >= 0.0f)
+			{
+				Out[NumOut++] = A;
+			}
+			if ((DistanceA >= 0.0f) != (DistanceB >= 0.0f))
+			{
+				// from the inside vertex, so the neighbour sharing the edge gets the very same point
+				const bool bAInside = DistanceA >= 0.0f;
+				const FVector4f& Inside = bAInside ? A : B;
+				const FVector4f& Outside = bAInside ? B : A;
+				const float DistanceInside = bAInside ? DistanceA : DistanceB;
+				const float DistanceOutside = bAInside ? DistanceB : DistanceA;
+				const float Alpha = DistanceInside / (DistanceInside - DistanceOutside);
+				Out[NumOut++] = Inside + (Outside - Inside) * Alpha;
+			}
+		}
+		NumVertices = NumOut;
+		Current ^= 1;
+	}
+
+	// a fan, the clipped polygon is convex
+	for (int32 v = 1; v + 1 < NumVertices; ++v)
+	{
+		AddTriangle(Task, Buffers[Current][0], Buffers[Current][v], Buffers[Current][v + 1], Instance);
+	}
+}
+
+void FLabelRasterizer::AddTriangle(int32 Task, const FVector4f& A, const FVector4f& B, const FVector4f& C,
+                                   const FLabelInstance& Instance)
+{
+	constexpr float SubPixels = 1 << SubPixelBits;
+	FTriangle Triangle;
+	const FVector4f* Vertices[3] = {&A, &B, &C};
+	for (int32 v = 0; v < 3; ++v)
+	{
+		const FVector4f& V = *Vertices[v];
+		const float Rhw = V.W > 0.0f ? 1.0f / V.W : 0.0f;
+		// clipping keeps vertices in the viewport, the clamps only catch rounding
+		const float ScreenX = FMath::Clamp((V.X * Rhw * 0.5f + 0.5f) * Width, 0.0f, static_cast<float>(Width));
+		const float ScreenY = FMath::Clamp((0.5f - V.Y * Rhw * 0.5f) * Height, 0.0f, static_cast<float>(Height));
+		Triangle.X[v] = FMath::RoundToInt32(ScreenX * SubPixels);
+		Triangle.Y[v] = FMath::RoundToInt32(ScreenY * SubPixels);
+		Triangle.Z[v] = V.Z * Rhw;
+	}
+
+	const int64 Area = static_cast<int64>(Triangle.X[1] - Triangle.X[0]) * (Triangle.Y[2] - Triangle.Y[0]) -
+		static_cast<int64>(Triangle.X[2] - Triangle.X[0]) * (Triangle.Y[1] - Triangle.Y[0]);
+	if (Area == 0)
+	{
+		return;
+	}
+	if (Area < 0)
+	{
+		Swap(Triangle.X[1], Triangle.X[2]);
+		Swap(Triangle.Y[1], Triangle.Y[2]);
+		Swap(Triangle.Z[1], Triangle.Z[2]);
+	}
+
+	// pixels whose centres lie in the fixed point bounds
+	constexpr int32 HalfPixel = 1 << (SubPixelBits - 1);
+	const int32 MinX = FMath::Min3(Triangle.X[0], Triangle.X[1], Triangle.X[2]);
+	const int32 MinY = FMath::Min3(Triangle.Y[0], Triangle.Y[1], Triangle.Y[2]);
+	const int32 MaxX = FMath::Max3(Triangle.X[0], Triangle.X[1], Triangle.X[2]);
+	const int32 MaxY = FMath::Max3(Triangle.Y[0], Triangle.Y[1], Triangle.Y[2]);
+	Triangle.MinX = FMath::Max((MinX - HalfPixel + (1 << SubPixelBits) - 1) >> SubPixelBits, 0);
+	Triangle.MinY = FMath::Max((MinY - HalfPixel + (1 << SubPixelBits) - 1) >> SubPixelBits, 0);
+	Triangle.MaxX = FMath::Min((MaxX - HalfPixel) >> SubPixelBits, Width - 1);
+	Triangle.MaxY = FMath::Min((MaxY - HalfPixel) >> SubPixelBits, Height - 1);
+	if (Triangle.MinX > Triangle.MaxX || Triangle.MinY > Triangle.MaxY)
+	{
+		// too small to cover a pixel centre
+		return;
+	}
+	Triangle.ClassId = Instance.ClassId;
+	Triangle.InstanceId = Instance.InstanceId;
+
+	TArray<FTriangle>& Triangles = TaskTriangles[Task];
+	const int32 Index = Triangles.Add(Triangle);
+	const int32 NumTiles = NumTilesX * NumTilesY;
+	for (int32 TileY = Triangle.MinY / TileSize; TileY <= Triangle.MaxY / TileSize; ++TileY)
+	{
+		for (int32 TileX = Triangle.MinX / TileSize; TileX <= Triangle.MaxX / TileSize; ++TileX)
+		{
+			Bins[Task * NumTiles + TileY * NumTilesX + TileX].Add(Index);
+		}
+	}
+}
+
+void FLabelRasterizer::RasterizeTile(int32 Tile, uint8* OutClassIds, uint16* OutInstanceIds) const
+{
+	const int32 TileMinX = (Tile % NumTilesX) * TileSize;
+	const int32 TileMinY = (Tile / NumTilesX) * TileSize;
+	const int32 TileMaxX = FMath::Min(TileMinX + TileSize, Width) - 1;
+	const int32 TileMaxY = FMath::Min(TileMinY + TileSize, Height) - 1;
+
+	// the tile is only ever written by this task
+	float Depth[TileSize * TileSize];
+	for (int32 Y = TileMinY; Y <= TileMaxY; ++Y)
+	{
+		FMemory::Memzero(OutClassIds + static_cast<int64>(Y) * Width + TileMinX, TileMaxX - TileMinX + 1);
+		if (OutInstanceIds)
+		{
+			FMemory::Memzero(OutInstanceIds + static_cast<int64>(Y) * Width + TileMinX,
+			                 (TileMaxX - TileMinX + 1) * sizeof(uint16));
+		}
+	}
+	for (float& Value : Depth)
+	{
+		Value = -MAX_flt;
+	}
+
+	constexpr int64 Step = 1 << SubPixelBits;
+	constexpr int32 HalfPixel = 1 << (SubPixelBits - 1);
+	const int32 NumTiles = NumTilesX * NumTilesY;
+	for (int32 Task = 0; Task < NumTasks; ++Task)
+	{
+		const TArray<FTriangle>& Triangles = TaskTriangles[Task];
+		for (const int32 Index : Bins[Task * NumTiles + Tile])
+		{
+			const FTriangle& Triangle = Triangles[Index];
+			const int32 MinX = FMath::Max(Triangle.MinX, TileMinX);
+			const int32 MinY = FMath::Max(Triangle.MinY, TileMinY);
+			const int32 MaxX = FMath::Min(Triangle.MaxX, TileMaxX);
+			const int32 MaxY = FMath::Min(Triangle.MaxY, TileMaxY);
+
+			// Edge i runs between the two other vertices and is positive on the inside. A pixel centre exactly on
+			// an edge belongs to the triangle only for top-left edges, so a shared edge is drawn exactly once.
+			int64 StepX[3];
+			int64 StepY[3];
+			int64 RowStart[3];
+			const int64 StartX = static_cast<int64>(MinX) * Step + HalfPixel;
+			const int64 StartY = static_cast<int64>(MinY) * Step + HalfPixel;
+			for (int32 Edge = 0; Edge < 3; ++Edge)
+			{
+				const int32 From = (Edge + 1) % 3;
+				const int32 To = (Edge + 2) % 3;
+				const int64 DeltaX = Triangle.X[To] - Triangle.X[From];
+				const int64 DeltaY = Triangle.Y[To] - Triangle.Y[From];
+				const bool bTopLeft = DeltaY < 0 || (DeltaY == 0 && DeltaX > 0);
+				StepX[Edge] = -DeltaY * Step;
+				StepY[Edge] = DeltaX * Step;
+				RowStart[Edge] = DeltaX * (StartY - Triangle.Y[From]) - DeltaY * (StartX - Triangle.X[From]) -
+					(bTopLeft ? 0 : 1);
+			}
+			// the edge values are the barycentric weights of the opposite vertices scaled by the area
+			const int64 Area = static_cast<int64>(Triangle.X[1] - Triangle.X[0]) * (Triangle.Y[2] - Triangle.Y[0]) -
+				static_cast<int64>(Triangle.X[2] - Triangle.X[0]) * (Triangle.Y[1] - Triangle.Y[0]);
+			const float InvArea = 1.0f / static_cast<float>(Area);
+
+			for (int32 Y = MinY; Y <= MaxY; ++Y)
+			{
+				int64 E0 = RowStart[0];
+				int64 E1 = RowStart[1];
+				int64 E2 = RowStart[2];
+				const int64 PixelRow = static_cast<int64>(Y) * Width;
+				float* DepthRow = Depth + (Y - TileMinY) * TileSize - TileMinX;
+				for (int32 X = MinX; X <= MaxX; ++X)
+				{
+					if ((E0 | E1 | E2) >= 0)
+					{
+						const float Z = (static_cast<float>(E0) * Triangle.Z[0] + static_cast<float>(E1) *
+							Triangle.Z[1] + static_cast<float>(E2) * Triangle.Z[2]) * InvArea;
+						if (Z > DepthRow[X])
+						{
+							DepthRow[X] = Z;
+							OutClassIds[PixelRow + X] = Triangle.ClassId;
+							if (OutInstanceIds)
+							{
+								OutInstanceIds[PixelRow + X] = Triangle.InstanceId;
+							}
+						}
+					}
+					E0 += StepX[0];
+					E1 += StepX[1];
+					E2 += StepX[2];
+				}
+				RowStart[0] += StepY[0];
+				RowStart[1] += StepY[1];
+				RowStart[2] += StepY[2];
+			}
+		}
+	}
+}
@@ -0,0 +1,152 @@
+#include "MeshOutlineCache.h"
+#include "Engine/StaticMesh.h"
+#include "StaticMeshResources.h"
+
+namespace
+{
+	// every direction with components in {-1, 0, 1} except zero, the axes, edges and corners of a cube
+	constexpr int32 NumDirections = 26;
+
+	// cooked meshes only keep their vertices on the CPU when asked to
+	bool HasCpuVertices(const UStaticMesh* StaticMesh, int32 LODIndex)
+	{
+		const FStaticMeshRenderData* RenderData = StaticMesh->GetRenderData();
+		bool bHasVertices = RenderData && RenderData->LODResources.IsValidIndex(LODIndex) &&
+			RenderData->LODResources[LODIndex].VertexBuffers.PositionVertexBuffer.GetNumVertices() > 0;
+#if !WITH_EDITOR
+		bHasVertices = bHasVertices && StaticMesh->bAllowCPUAccess;
+#endif
+		return bHasVertices;
+	}
+
+	TStaticArray<FVector3f, NumDirections> GetDirections()
+	{
+		TStaticArray<FVector3f, NumDirections> Directions;
+		int32 Index = 0;
+		for (int32 DirX = -1; DirX <= 1; ++DirX)
+		{
+			for (int32 DirY = -1; DirY <= 1; ++DirY)
+			{
+				for (int32 DirZ = -1; DirZ <= 1; ++DirZ)
+				{
+					if (DirX != 0 || DirY != 0 || DirZ != 0)
+					{
+						Directions[Index++] = FVector3f(DirX, DirY, DirZ);
+					}
+				}
+			}
+		}
+		return Directions;
+	}
+}
+
+void FMeshOutline::Add(const FVector3f& Point)
+{
+	for (int32 i = 0; i < X.Num(); ++i)
+	{
+		if (X[i] == Point.X && Y[i] == Point.Y && Z[i] == Point.Z)
+		{
+			return;
+		}
+	}
+	X.Add(Point.X);
+	Y.Add(Point.Y);
+	Z.Add(Point.Z);
+}
+
+void FMeshOutline::Build(const UStaticMesh* StaticMesh)
+{
+	X.Reset();
+	Y.Reset();
+	Z.Reset();
+
+	if (!HasCpuVertices(StaticMesh, 0))
+	{
+		const FBox Box = StaticMesh->GetBoundingBox();
+		FVector Corners[8];
+		Box.GetVertices(Corners);
+		for (const FVector& Corner : Corners)
+		{
+			Add(FVector3f(Corner));
+		}
+		return;
+	}
+
+	// one pass over every vertex of LOD 0, all sections share its position buffer
+	const FPositionVertexBuffer& Positions =
+		StaticMesh->GetRenderData()->LODResources[0].VertexBuffers.PositionVertexBuffer;
+	const TStaticArray<FVector3f, NumDirections> Directions = GetDirections();
+	TStaticArray<float, NumDirections> Furthest;
+	TStaticArray<uint32, NumDirections> FurthestVertex;
+	for (int32 d = 0; d < NumDirections; ++d)
+	{
+		Furthest[d] = -MAX_flt;
+		FurthestVertex[d] = 0;
+	}
+	for (uint32 v = 0; v < Positions.GetNumVertices(); ++v)
+	{
+		const FVector3f& Position = Positions.VertexPosition(v);
+		for (int32 d = 0; d < NumDirections; ++d)
+		{
+			const float Distance = Position | Directions[d];
+			if (Distance > Furthest[d])
+			{
+				Furthest[d] = Distance;
+				FurthestVertex[d] = v;
+			}
+		}
+	}
+	for (int32 d = 0; d < NumDirections; ++d)
+	{
+		Add(Positions.VertexPosition(FurthestVertex[d]));
+	}
+}
+
+const FMeshOutline* FMeshOutlineCache::Get(const UStaticMesh* StaticMesh)
+{
+	if (!StaticMesh)
+	{
+		return nullptr;
+	}
+	if (const FMeshOutline* Outline = Outlines.Find(StaticMesh))
+	{
+		return Outline;
+	}
+	FMeshOutline& Outline = Outlines.Add(StaticMesh);
+	Outline.Build(StaticMesh);
+	return &Outline;
+}
+
+TSharedPtr<const FLabelMesh, ESPMode::ThreadSafe> FLabelMeshCache::Get(const UStaticMesh* StaticMesh, int32 LODIndex)
+{
+	if (!StaticMesh)
+	{
+		return nullptr;
+	}
+	const TPair<TObjectKey<UStaticMesh>, int32> Key(StaticMesh, LODIndex);
+	if (const TSharedPtr<const FLabelMesh, ESPMode::ThreadSafe>* Found = Meshes.Find(Key))
+	{
+		return *Found;
+	}
+
+	TSharedPtr<const FLabelMesh, ESPMode::ThreadSafe>& Mesh = Meshes.Add(Key);
+	if (!HasCpuVertices(StaticMesh, LODIndex))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("FLabelMeshCache: %s has no CPU readable vertices in LOD %d, enable Allow CPU "
+			       "Access on it"), *StaticMesh->GetName(), LODIndex);
+		return Mesh;
+	}
+
+	// every section, they share the LOD's vertex and index buffers
+	const FStaticMeshLODResources& LOD = StaticMesh->GetRenderData()->LODResources[LODIndex];
+	const FPositionVertexBuffer& Positions = LOD.VertexBuffers.PositionVertexBuffer;
+	TSharedRef<FLabelMesh, ESPMode::ThreadSafe> Built = MakeShared<FLabelMesh, ESPMode::ThreadSafe>();
+	Built->Positions.SetNumUninitialized(Positions.GetNumVertices());
+	for (uint32 v = 0; v < Positions.GetNumVertices(); ++v)
+	{
+		Built->Positions[v] = Positions.VertexPosition(v);
+	}
+	LOD.IndexBuffer.GetCopy(Built->Indices);
+	Mesh = Built;
+	return Mesh;
+}
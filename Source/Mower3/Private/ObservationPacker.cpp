@@ -0,0 +1,211 @@
+#include "ObservationPacker.h"
+#include "Async/ParallelFor.h"
+
+#if PLATFORM_ENABLE_VECTORINTRINSICS && PLATFORM_CPU_X86_FAMILY
+#include <emmintrin.h>
+#define MOWER_OBSERVATION_SSE2 1
+#else
+#define MOWER_OBSERVATION_SSE2 0
+#endif
+
+namespace
+{
+	// output rows per task, enough work to be worth scheduling
+	constexpr int32 RowsPerTask = 8;
+}
+
+void FObservationPacker::FTaps::Build(EObservationResize Resize, int32 SourceSize, double CropBegin, double CropEnd,
+                                      int32 OutSize)
+{
+	// the crop in source pixels, at least one pixel wide
+	const double Begin = FMath::Clamp(CropBegin * SourceSize, 0.0, SourceSize - 1.0);
+	const double End = FMath::Clamp(CropEnd * SourceSize, Begin + 1.0, static_cast<double>(SourceSize));
+	const double Step = (End - Begin) / OutSize;
+
+	MaxTaps = Resize == EObservationResize::Bilinear ? 2 : FMath::CeilToInt(Step) + 1;
+	First.SetNumUninitialized(OutSize);
+	Num.SetNumUninitialized(OutSize);
+	Weights.SetNumZeroed(OutSize * MaxTaps);
+
+	for (int32 i = 0; i < OutSize; ++i)
+	{
+		float* W = &Weights[i * MaxTaps];
+		if (Resize == EObservationResize::Bilinear)
+		{
+			const double Center = FMath::Clamp(Begin + (i + 0.5) * Step - 0.5, 0.0, SourceSize - 1.0);
+			First[i] = FMath::Min(FMath::FloorToInt(Center), FMath::Max(SourceSize - 2, 0));
+			const float Frac = static_cast<float>(Center - First[i]);
+			Num[i] = First[i] + 1 < SourceSize ? 2 : 1;
+			W[0] = Num[i] == 2 ? 1.0f - Frac : 1.0f;
+			W[1] = Num[i] == 2 ? Frac : 0.0f;
+		}
+		else
+		{
+			// the pixels under [Low, High), each weighted by how much of it is covered
+			const double Low = Begin + i * Step;
+			const double High = FMath::Min(Low + Step, End);
+			First[i] = FMath::FloorToInt(Low);
+			Num[i] = FMath::Clamp(FMath::CeilToInt(High), First[i] + 1, SourceSize) - First[i];
+			for (int32 Tap = 0; Tap < Num[i]; ++Tap)
+			{
+				const double Pixel = First[i] + Tap;
+				const double Covered = FMath::Min(Pixel + 1.0, High) - FMath::Max(Pixel, Low);
+				W[Tap] = static_cast<float>(FMath::Max(Covered, 0.0) / Step);
+			}
+		}
+	}
+}
+
+FObservationPacker::FObservationPacker(const FObservationSettings& Settings, int32 InSourceWidth,
+                                       int32 InSourceHeight)
+	: Width(FMath::Clamp(Settings.Width, 1, MaxSize))
+	, Height(FMath::Clamp(Settings.Height, 1, MaxSize))
+	, SourceWidth(InSourceWidth)
+	, Layout(Settings.Layout)
+	, Precision(Settings.Precision)
+{
+	Columns.Build(Settings.Resize, InSourceWidth, Settings.CropMin.X, Settings.CropMax.X, Width);
+	Rows.Build(Settings.Resize, InSourceHeight, Settings.CropMin.Y, Settings.CropMax.Y, Height);
+
+	FirstColumn = Columns.First[0];
+	int32 EndColumn = FirstColumn;
+	for (int32 X = 0; X < Width; ++X)
+	{
+		EndColumn = FMath::Max(EndColumn, Columns.First[X] + Columns.Num[X]);
+	}
+	NumColumns = EndColumn - FirstColumn;
+
+	// (value / 255 - Mean) / Std per channel, B G R A
+	const FVector::FReal Mean[4] = {Settings.Mean.Z, Settings.Mean.Y, Settings.Mean.X, 0.0};
+	const FVector::FReal Std[4] = {Settings.Std.Z, Settings.Std.Y, Settings.Std.X, 1.0};
+	for (int32 c = 0; c < 4; ++c)
+	{
+		const double SafeStd = FMath::Max(FMath::Abs(Std[c]), 1e-6);
+		Scale[c] = static_cast<float>(1.0 / (255.0 * SafeStd));
+		Bias[c] = static_cast<float>(-Mean[c] / SafeStd);
+	}
+}
+
+void FObservationPacker::Pack(const FColor* Source, uint8* Out) const
+{
+	const int32 NumTasks = FMath::DivideAndRoundUp(Height, RowsPerTask);
+	ParallelFor(NumTasks, [&](int32 Task)
+	{
+		// the weighted sum of the source rows of one output row, 4 floats per source column
+		TArray<float> RowSums;
+		RowSums.SetNumUninitialized(NumColumns * 4);
+		TArray<float> Rgb;
+		Rgb.SetNumUninitialized(Width * NumChannels);
+
+		const int32 EndY = FMath::Min(Height, (Task + 1) * RowsPerTask);
+		for (int32 Y = Task * RowsPerTask; Y < EndY; ++Y)
+		{
+			FMemory::Memzero(RowSums.GetData(), RowSums.Num() * sizeof(float));
+			for (int32 Tap = 0; Tap < Rows.Num[Y]; ++Tap)
+			{
+				const float Weight = Rows.Weights[Y * Rows.MaxTaps + Tap];
+				const uint8* Pixels = reinterpret_cast<const uint8*>(
+					Source + static_cast<int64>(Rows.First[Y] + Tap) * SourceWidth + FirstColumn);
+				float* Sums = RowSums.GetData();
+				int32 X = 0;
+#if MOWER_OBSERVATION_SSE2
+				const __m128 W = _mm_set1_ps(Weight);
+				const __m128i Zero = _mm_setzero_si128();
+				for (; X + 4 <= NumColumns; X += 4)
+				{
+					const __m128i Bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Pixels + X * 4));
+					const __m128i Lo = _mm_unpacklo_epi8(Bytes, Zero);
+					const __m128i Hi = _mm_unpackhi_epi8(Bytes, Zero);
+					const __m128 P0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(Lo, Zero));
+					const __m128 P1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(Lo, Zero));
+					const __m128 P2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(Hi, Zero));
+					const __m128 P3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(Hi, Zero));
+					float* S = Sums + X * 4;
+					_mm_storeu_ps(S, _mm_add_ps(_mm_loadu_ps(S), _mm_mul_ps(P0, W)));
+					_mm_storeu_ps(S + 4, _mm_add_ps(_mm_loadu_ps(S + 4), _mm_mul_ps(P1, W)));
+					_mm_storeu_ps(S + 8, _mm_add_ps(_mm_loadu_ps(S + 8), _mm_mul_ps(P2, W)));
+					_mm_storeu_ps(S + 12, _mm_add_ps(_mm_loadu_ps(S + 12), _mm_mul_ps(P3, W)));
+				}
+#endif
+				for (int32 i = X * 4; i < NumColumns * 4; ++i)
+				{
+					Sums[i] += Pixels[i] * Weight;
+				}
+			}
+
+			for (int32 X = 0; X < Width; ++X)
+			{
+				const float* W = &Columns.Weights[X * Columns.MaxTaps];
+				const float* Sums = RowSums.GetData() + (Columns.First[X] - FirstColumn) * 4;
+				float Value[4];
+#if MOWER_OBSERVATION_SSE2
+				__m128 Acc = _mm_setzero_ps();
+				for (int32 Tap = 0; Tap < Columns.Num[X]; ++Tap)
+				{
+					Acc = _mm_add_ps(Acc, _mm_mul_ps(_mm_loadu_ps(Sums + Tap * 4), _mm_set1_ps(W[Tap])));
+				}
+				_mm_storeu_ps(Value, _mm_add_ps(_mm_mul_ps(Acc, _mm_loadu_ps(Scale)), _mm_loadu_ps(Bias)));
+#else
+				for (int32 c = 0; c < 4; ++c)
+				{
+					float Acc = 0.0f;
+					for (int32 Tap = 0; Tap < Columns.Num[X]; ++Tap)
+					{
+						Acc += Sums[Tap * 4 + c] * W[Tap];
+					}
+					Value[c] = Acc * Scale[c] + Bias[c];
+				}
+#endif
+				Rgb[X * 3 + 0] = Value[2];
+				Rgb[X * 3 + 1] = Value[1];
+				Rgb[X * 3 + 2] = Value[0];
+			}
+
+			WriteRow(Rgb.GetData(), Y, Out);
+		}
+	}, NumTasks == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
+}
+
+void FObservationPacker::WriteRow(const float* Rgb, int32 Y, uint8* Out) const
+{
+	const int64 PlaneSize = static_cast<int64>(Width) * Height;
+	const int64 RowOffset = static_cast<int64>(Y) * Width;
+	if (Precision == EObservationPrecision::Float32)
+	{
+		float* Tensor = reinterpret_cast<float*>(Out);
+		if (Layout == EObservationLayout::NHWC)
+		{
+			FMemory::Memcpy(Tensor + RowOffset * NumChannels, Rgb, Width * NumChannels * sizeof(float));
+			return;
+		}
+		for (int32 c = 0; c < NumChannels; ++c)
+		{
+			float* Plane = Tensor + c * PlaneSize + RowOffset;
+			for (int32 X = 0; X < Width; ++X)
+			{
+				Plane[X] = Rgb[X * NumChannels + c];
+			}
+		}
+		return;
+	}
+
+	// SSE2 has no half conversions, FFloat16 rounds one value at a time
+	FFloat16* Tensor = reinterpret_cast<FFloat16*>(Out);
+	if (Layout == EObservationLayout::NHWC)
+	{
+		FFloat16* Row = Tensor + RowOffset * NumChannels;
+		for (int32 i = 0; i < Width * NumChannels; ++i)
+		{
+			Row[i] = FFloat16(Rgb[i]);
+		}
+		return;
+	}
+	for (int32 c = 0; c < NumChannels; ++c)
+	{
+		FFloat16* Plane = Tensor + c * PlaneSize + RowOffset;
+		for (int32 X = 0; X < Width; ++X)
+		{
+			Plane[X] = FFloat16(Rgb[X * NumChannels + c]);
+		}
+	}
+}
@@ -0,0 +1,649 @@
+#include "RecordingReader.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <vector>
+
+// only the standalone library maps files itself, the game module maps them with IPlatformFile
+#if defined(MWREC_SHARED_LIBRARY)
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#else
+#include "FrameRecorder.h"
+#include "FrameWireFormat.h"
+#endif
+
+// Copies of the FrameRecording and FrameWire layouts, which can't be included here without the engine. The game module
+// build checks them against the originals below.
+namespace MwrecLayout
+{
+	constexpr char FileMagic[4] = {'M', 'W', 'R', 'C'};
+	constexpr char ChunkMagic[4] = {'M', 'W', 'C', 'K'};
+	constexpr char FooterMagic[4] = {'M', 'W', 'I', 'X'};
+	constexpr uint16_t Version = 1;
+	constexpr uint64_t RecordAlignment = 8;
+
+	constexpr char FrameMagic[4] = {'M', 'W', 'F', 'R'};
+	constexpr uint16_t FrameVersion = 8;
+
+#pragma pack(push, 1)
+	struct FileHeader
+	{
+		char Magic[4];
+		uint16_t Version;
+		uint16_t HeaderSize;
+		uint32_t ChunkSize;
+		uint32_t Reserved;
+		double StartTime;
+		char InstanceName[32];
+		uint8_t Padding[8];
+	};
+
+	struct ChunkHeader
+	{
+		char Magic[4];
+		uint32_t Index;
+		uint32_t NumChunks;
+		uint32_t UsedBytes;
+	};
+
+	struct RecordHeader
+	{
+		uint8_t Kind;
+		uint8_t Reserved[3];
+		uint32_t Size;
+		uint64_t FrameId;
+		double Timestamp;
+	};
+
+	struct Footer
+	{
+		uint64_t IndexOffset;
+		uint64_t NumEntries;
+		uint64_t NumChunks;
+		char Magic[4];
+		uint16_t Version;
+		uint16_t Reserved;
+	};
+
+	struct FrameHeader
+	{
+		char Magic[4];
+		uint16_t Version;
+		uint16_t HeaderSize;
+		uint64_t FrameId;
+		double Timestamp;
+		uint16_t Width;
+		uint16_t Height;
+		uint16_t NumSections;
+		uint8_t NumPlanes;
+		uint8_t Reserved;
+		char InstanceName[32];
+	};
+
+	struct PlaneEntry
+	{
+		uint32_t Offset;
+		uint32_t Size;
+		uint16_t Width;
+		uint16_t Height;
+		uint8_t Kind;
+		uint8_t PixelFormat;
+		uint8_t Encoding;
+		uint8_t View;
+	};
+
+	struct SectionEntry
+	{
+		char Tag[18];
+		uint8_t ClassId;
+		uint8_t Kind;
+		uint32_t Offset;
+		uint32_t Size;
+		uint32_t Count;
+	};
+#pragma pack(pop)
+
+	static_assert(sizeof(FileHeader) == 64 && sizeof(ChunkHeader) == 16 && sizeof(RecordHeader) == 24 &&
+	              sizeof(Footer) == 32 && sizeof(mwrec_index_entry) == 32, "FrameRecording layout");
+	static_assert(sizeof(FrameHeader) == 64 && sizeof(PlaneEntry) == 16 && sizeof(SectionEntry) == 32,
+	              "FrameWire layout");
+
+#if !defined(MWREC_SHARED_LIBRARY)
+	template <typename A, typename B>
+	constexpr bool SameMagic(const A (&Left)[4], const B (&Right)[4])
+	{
+		return uint8_t(Left[0]) == uint8_t(Right[0]) && uint8_t(Left[1]) == uint8_t(Right[1]) &&
+		       uint8_t(Left[2]) == uint8_t(Right[2]) && uint8_t(Left[3]) == uint8_t(Right[3]);
+	}
+
+	static_assert(Version == FrameRecording::Version && RecordAlignment == FrameRecording::RecordAlignment,
+	              "MwrecLayout is out of date with FrameRecording");
+	static_assert(SameMagic(FileMagic, FrameRecording::FileMagic) && SameMagic(ChunkMagic, FrameRecording::ChunkMagic) &&
+	              SameMagic(FooterMagic, FrameRecording::FooterMagic), "MwrecLayout is out of date with FrameRecording");
+	static_assert(sizeof(FileHeader) == sizeof(FrameRecording::FFileHeader) &&
+	              sizeof(ChunkHeader) == sizeof(FrameRecording::FChunkHeader) &&
+	              sizeof(RecordHeader) == sizeof(FrameRecording::FRecordHeader) &&
+	              sizeof(Footer) == sizeof(FrameRecording::FFooter) &&
+	              sizeof(mwrec_index_entry) == sizeof(FrameRecording::FIndexEntry),
+	              "MwrecLayout is out of date with FrameRecording");
+	static_assert(MWREC_RECORD_FRAME == uint8(FrameRecording::ERecordKind::Frame) &&
+	              MWREC_RECORD_VEHICLE_STATE == uint8(FrameRecording::ERecordKind::VehicleState) &&
+	              MWREC_RECORD_ACTION == uint8(FrameRecording::ERecordKind::Action),
+	              "the record kinds are out of date with FrameRecording::ERecordKind");
+
+	static_assert(FrameVersion == FrameWire::Version && SameMagic(FrameMagic, FrameWire::Magic),
+	              "MwrecLayout is out of date with FrameWire");
+	static_assert(sizeof(FrameHeader) == sizeof(FrameWire::FHeader) &&
+	              sizeof(PlaneEntry) == sizeof(FrameWire::FPlaneEntry) &&
+	              sizeof(SectionEntry) == sizeof(FrameWire::FSectionEntry) &&
+	              sizeof(FrameHeader::InstanceName) == FrameWire::MaxInstanceNameLength &&
+	              sizeof(SectionEntry::Tag) == FrameWire::MaxTagLength, "MwrecLayout is out of date with FrameWire");
+	static_assert(offsetof(FrameHeader, NumPlanes) == offsetof(FrameWire::FHeader, NumPlanes) &&
+	              offsetof(PlaneEntry, Kind) == offsetof(FrameWire::FPlaneEntry, Kind) &&
+	              offsetof(SectionEntry, Offset) == offsetof(FrameWire::FSectionEntry, Offset),
+	              "MwrecLayout is out of date with FrameWire");
+#endif
+
+	template <typename T>
+	bool ReadStruct(const uint8_t* Data, uint64_t Size, uint64_t Offset, T& Out)
+	{
+		if (Offset > Size || Size - Offset < sizeof(T))
+		{
+			return false;
+		}
+		std::memcpy(&Out, Data + Offset, sizeof(T));
+		return true;
+	}
+
+	template <size_t N>
+	void CopyName(const char (&Name)[N], char* Out)
+	{
+		const char* End = static_cast<const char*>(std::memchr(Name, 0, N));
+		const size_t Length = End ? static_cast<size_t>(End - Name) : N;
+		std::memcpy(Out, Name, Length);
+		Out[Length] = 0;
+	}
+
+	bool ReadFrameHeader(const uint8_t* Frame, uint64_t Size, FrameHeader& Out)
+	{
+		if (!Frame || !ReadStruct(Frame, Size, 0, Out) || std::memcmp(Out.Magic, FrameMagic, 4) != 0 ||
+			Out.Version != FrameVersion || Out.HeaderSize < sizeof(FrameHeader))
+		{
+			return false;
+		}
+		const uint64_t TablesSize = Out.HeaderSize + Out.NumPlanes * sizeof(PlaneEntry) + Out.NumSections *
+			sizeof(SectionEntry);
+		return Size >= TablesSize;
+	}
+}
+
+struct mwrec_reader
+{
+	const uint8_t* Data = nullptr;
+	uint64_t Size = 0;
+	// unmapped by mwrec_close
+	bool bOwnsMapping = false;
+	bool bComplete = false;
+	double StartTime = 0.0;
+	char InstanceName[33] = {};
+	// per record kind, in timestamp order
+	std::vector<mwrec_index_entry> Entries[MWREC_NUM_RECORD_KINDS];
+	// lets mwrec_find_frame binary search
+	bool bFrameIdsSorted[MWREC_NUM_RECORD_KINDS] = {};
+};
+
+namespace
+{
+	using namespace MwrecLayout;
+
+	void AddEntry(mwrec_reader& Reader, const mwrec_index_entry& Entry)
+	{
+		if (Entry.kind < MWREC_NUM_RECORD_KINDS)
+		{
+			Reader.Entries[Entry.kind].push_back(Entry);
+		}
+	}
+
+	bool ReadIndex(mwrec_reader& Reader, uint64_t HeaderSize)
+	{
+		Footer Tail;
+		if (Reader.Size < HeaderSize + sizeof(Footer) || !ReadStruct(Reader.Data, Reader.Size,
+		                                                             Reader.Size - sizeof(Footer), Tail))
+		{
+			return false;
+		}
+		if (std::memcmp(Tail.Magic, FooterMagic, 4) != 0 || Tail.Version != Version || Tail.IndexOffset < HeaderSize ||
+			Tail.NumEntries > (Reader.Size - Tail.IndexOffset) / sizeof(mwrec_index_entry) ||
+			Tail.IndexOffset + Tail.NumEntries * sizeof(mwrec_index_entry) + sizeof(Footer) != Reader.Size)
+		{
+			return false;
+		}
+		for (uint64_t i = 0; i < Tail.NumEntries; i++)
+		{
+			mwrec_index_entry Entry;
+			std::memcpy(&Entry, Reader.Data + Tail.IndexOffset + i * sizeof(Entry), sizeof(Entry));
+			if (Entry.offset > Tail.IndexOffset ||
+				Entry.offset + sizeof(RecordHeader) + Entry.size > Tail.IndexOffset)
+			{
+				return false;
+			}
+			AddEntry(Reader, Entry);
+		}
+		return true;
+	}
+
+	// a recording that was never closed has no index, walk its chunks up to the last complete one
+	void ScanChunks(mwrec_reader& Reader, uint64_t HeaderSize, uint64_t ChunkSize)
+	{
+		for (uint64_t Offset = HeaderSize; ChunkSize > 0 && Offset + ChunkSize <= Reader.Size;)
+		{
+			ChunkHeader Chunk;
+			if (!ReadStruct(Reader.Data, Reader.Size, Offset, Chunk) || std::memcmp(Chunk.Magic, ChunkMagic, 4) != 0 ||
+				Chunk.NumChunks == 0 || Chunk.NumChunks > (Reader.Size - Offset) / ChunkSize ||
+				Chunk.UsedBytes > Chunk.NumChunks * ChunkSize)
+			{
+				break;
+			}
+			const uint64_t ChunkEnd = Offset + Chunk.NumChunks * ChunkSize;
+			const uint64_t UsedEnd = Offset + Chunk.UsedBytes;
+			RecordHeader Record;
+			for (uint64_t RecordOffset = Offset + sizeof(ChunkHeader); RecordOffset + sizeof(RecordHeader) <= UsedEnd;)
+			{
+				if (!ReadStruct(Reader.Data, Reader.Size, RecordOffset, Record))
+				{
+					break;
+				}
+				const uint64_t RecordEnd = RecordOffset + sizeof(RecordHeader) + Record.Size;
+				if (RecordEnd > UsedEnd)
+				{
+					break;
+				}
+				mwrec_index_entry Entry = {};
+				Entry.offset = RecordOffset;
+				Entry.frame_id = Record.FrameId;
+				Entry.timestamp = Record.Timestamp;
+				Entry.size = Record.Size;
+				Entry.kind = Record.Kind;
+				AddEntry(Reader, Entry);
+				RecordOffset = (RecordEnd + RecordAlignment - 1) / RecordAlignment * RecordAlignment;
+			}
+			Offset = ChunkEnd;
+		}
+	}
+
+	int BuildIndex(mwrec_reader& Reader)
+	{
+		FileHeader Header;
+		if (!ReadStruct(Reader.Data, Reader.Size, 0, Header) || std::memcmp(Header.Magic, FileMagic, 4) != 0 ||
+			Header.Version != Version || Header.HeaderSize < sizeof(FileHeader))
+		{
+			return MWREC_ERROR_FORMAT;
+		}
+		Reader.StartTime = Header.StartTime;
+		CopyName(Header.InstanceName, Reader.InstanceName);
+
+		Reader.bComplete = ReadIndex(Reader, Header.HeaderSize);
+		if (!Reader.bComplete)
+		{
+			for (std::vector<mwrec_index_entry>& Entries : Reader.Entries)
+			{
+				Entries.clear();
+			}
+			ScanChunks(Reader, Header.HeaderSize, Header.ChunkSize);
+		}
+
+		auto ByTimestamp = [](const mwrec_index_entry& A, const mwrec_index_entry& B)
+		{
+			return A.timestamp < B.timestamp;
+		};
+		auto ByFrameId = [](const mwrec_index_entry& A, const mwrec_index_entry& B)
+		{
+			return A.frame_id < B.frame_id;
+		};
+		for (int Kind = 0; Kind < MWREC_NUM_RECORD_KINDS; Kind++)
+		{
+			std::vector<mwrec_index_entry>& Entries = Reader.Entries[Kind];
+			// records are appended in capture order, so this is usually a no-op
+			if (!std::is_sorted(Entries.begin(), Entries.end(), ByTimestamp))
+			{
+				std::stable_sort(Entries.begin(), Entries.end(), ByTimestamp);
+			}
+			Reader.bFrameIdsSorted[Kind] = std::is_sorted(Entries.begin(), Entries.end(), ByFrameId);
+		}
+		return MWREC_OK;
+	}
+
+	bool IsValidKind(int Kind)
+	{
+		return Kind >= 0 && Kind < MWREC_NUM_RECORD_KINDS;
+	}
+
+	void Unmap(mwrec_reader* Reader)
+	{
+#if defined(MWREC_SHARED_LIBRARY)
+		if (Reader->bOwnsMapping && Reader->Data)
+		{
+#if defined(_WIN32)
+			UnmapViewOfFile(Reader->Data);
+#else
+			munmap(const_cast<uint8_t*>(Reader->Data), Reader->Size);
+#endif
+		}
+#endif
+		Reader->Data = nullptr;
+	}
+}
+
+extern "C" {
+
+MWREC_API int mwrec_open(const char* path, mwrec_reader** out_reader)
+{
+	*out_reader = nullptr;
+#if defined(MWREC_SHARED_LIBRARY)
+	mwrec_reader* Reader = new(std::nothrow) mwrec_reader();
+	if (!Reader)
+	{
+		return MWREC_ERROR_IO;
+	}
+#if defined(_WIN32)
+	HANDLE File = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+	                          FILE_ATTRIBUTE_NORMAL, nullptr);
+	LARGE_INTEGER FileSize;
+	if (File != INVALID_HANDLE_VALUE && GetFileSizeEx(File, &FileSize) && FileSize.QuadPart > 0)
+	{
+		if (HANDLE Mapping = CreateFileMappingA(File, nullptr, PAGE_READONLY, 0, 0, nullptr))
+		{
+			Reader->Data = static_cast<const uint8_t*>(MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0));
+			Reader->Size = static_cast<uint64_t>(FileSize.QuadPart);
+			// the view keeps the mapping alive
+			CloseHandle(Mapping);
+		}
+	}
+	if (File != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(File);
+	}
+#else
+	const int File = open(path, O_RDONLY);
+	struct stat Stat;
+	if (File >= 0 && fstat(File, &Stat) == 0 && Stat.st_size > 0)
+	{
+		void* Mapped = mmap(nullptr, static_cast<size_t>(Stat.st_size), PROT_READ, MAP_SHARED, File, 0);
+		if (Mapped != MAP_FAILED)
+		{
+			Reader->Data = static_cast<const uint8_t*>(Mapped);
+			Reader->Size = static_cast<uint64_t>(Stat.st_size);
+		}
+	}
+	if (File >= 0)
+	{
+		close(File);
+	}
+#endif
+	if (!Reader->Data)
+	{
+		delete Reader;
+		return MWREC_ERROR_IO;
+	}
+	Reader->bOwnsMapping = true;
+	const int Result = BuildIndex(*Reader);
+	if (Result != MWREC_OK)
+	{
+		mwrec_close(Reader);
+		return Result;
+	}
+	*out_reader = Reader;
+	return MWREC_OK;
+#else
+	(void)path;
+	// the game module maps files with IPlatformFile and uses mwrec_open_memory
+	return MWREC_ERROR_IO;
+#endif
+}
+
+MWREC_API int mwrec_open_memory(const void* data, uint64_t size, mwrec_reader** out_reader)
+{
+	*out_reader = nullptr;
+	if (!data)
+	{
+		return MWREC_ERROR_IO;
+	}
+	mwrec_reader* Reader = new(std::nothrow) mwrec_reader();
+	if (!Reader)
+	{
+		return MWREC_ERROR_IO;
+	}
+	Reader->Data = static_cast<const uint8_t*>(data);
+	Reader->Size = size;
+	const int Result = BuildIndex(*Reader);
+	if (Result != MWREC_OK)
+	{
+		mwrec_close(Reader);
+		return Result;
+	}
+	*out_reader = Reader;
+	return MWREC_OK;
+}
+
+MWREC_API void mwrec_close(mwrec_reader* reader)
+{
+	if (reader)
+	{
+		Unmap(reader);
+		delete reader;
+	}
+}
+
+MWREC_API int mwrec_is_complete(const mwrec_reader* reader)
+{
+	return reader->bComplete ? 1 : 0;
+}
+
+MWREC_API double mwrec_start_time(const mwrec_reader* reader)
+{
+	return reader->StartTime;
+}
+
+MWREC_API const char* mwrec_instance_name(const mwrec_reader* reader)
+{
+	return reader->InstanceName;
+}
+
+MWREC_API uint64_t mwrec_count(const mwrec_reader* reader, int kind)
+{
+	return IsValidKind(kind) ? reader->Entries[kind].size() : 0;
+}
+
+MWREC_API const mwrec_index_entry* mwrec_entries(const mwrec_reader* reader, int kind)
+{
+	return IsValidKind(kind) ? reader->Entries[kind].data() : nullptr;
+}
+
+MWREC_API int mwrec_get(const mwrec_reader* reader, int kind, uint64_t index, mwrec_record* out_record)
+{
+	if (!IsValidKind(kind) || index >= reader->Entries[kind].size())
+	{
+		return MWREC_ERROR_RANGE;
+	}
+	const mwrec_index_entry& Entry = reader->Entries[kind][index];
+	out_record->frame_id = Entry.frame_id;
+	out_record->timestamp = Entry.timestamp;
+	out_record->data = reader->Data + Entry.offset + sizeof(MwrecLayout::RecordHeader);
+	out_record->size = Entry.size;
+	return MWREC_OK;
+}
+
+MWREC_API void mwrec_time_range(const mwrec_reader* reader, int kind, double begin, double end, uint64_t* out_first,
+                                uint64_t* out_count)
+{
+	*out_first = 0;
+	*out_count = 0;
+	if (!IsValidKind(kind) || !(begin < end))
+	{
+		return;
+	}
+	const std::vector<mwrec_index_entry>& Entries = reader->Entries[kind];
+	auto Before = [](const mwrec_index_entry& Entry, double Time) { return Entry.timestamp < Time; };
+	const auto First = std::lower_bound(Entries.begin(), Entries.end(), begin, Before);
+	const auto Last = std::lower_bound(First, Entries.end(), end, Before);
+	*out_first = static_cast<uint64_t>(First - Entries.begin());
+	*out_count = static_cast<uint64_t>(Last - First);
+}
+
+MWREC_API int mwrec_find_frame(const mwrec_reader* reader, int kind, uint64_t frame_id, uint64_t* out_index)
+{
+	if (!IsValidKind(kind))
+	{
+		return MWREC_ERROR_RANGE;
+	}
+	const std::vector<mwrec_index_entry>& Entries = reader->Entries[kind];
+	auto Found = Entries.end();
+	if (reader->bFrameIdsSorted[kind])
+	{
+		Found = std::lower_bound(Entries.begin(), Entries.end(), frame_id,
+		                         [](const mwrec_index_entry& Entry, uint64_t Id) { return Entry.frame_id < Id; });
+	}
+	else
+	{
+		Found = std::find_if(Entries.begin(), Entries.end(),
+		                     [frame_id](const mwrec_index_entry& Entry) { return Entry.frame_id == frame_id; });
+	}
+	if (Found == Entries.end() || Found->frame_id != frame_id)
+	{
+		return MWREC_ERROR_RANGE;
+	}
+	*out_index = static_cast<uint64_t>(Found - Entries.begin());
+	return MWREC_OK;
+}
+
+MWREC_API void mwrec_shard(uint64_t count, uint32_t shard, uint32_t num_shards, uint64_t* out_first,
+                           uint64_t* out_count)
+{
+	if (num_shards == 0 || shard >= num_shards)
+	{
+		*out_first = 0;
+		*out_count = 0;
+		return;
+	}
+	const uint64_t Base = count / num_shards;
+	const uint64_t Remainder = count % num_shards;
+	*out_first = shard * Base + std::min<uint64_t>(shard, Remainder);
+	*out_count = Base + (shard < Remainder ? 1 : 0);
+}
+
+MWREC_API int mwrec_read_frame(const uint8_t* frame, uint64_t size, mwrec_frame_info* out_info)
+{
+	MwrecLayout::FrameHeader Header;
+	if (!MwrecLayout::ReadFrameHeader(frame, size, Header))
+	{
+		return MWREC_ERROR_FORMAT;
+	}
+	out_info->frame_id = Header.FrameId;
+	out_info->timestamp = Header.Timestamp;
+	out_info->width = Header.Width;
+	out_info->height = Header.Height;
+	out_info->num_planes = Header.NumPlanes;
+	out_info->num_sections = Header.NumSections;
+	MwrecLayout::CopyName(Header.InstanceName, out_info->instance_name);
+	return MWREC_OK;
+}
+
+MWREC_API int mwrec_frame_plane(const uint8_t* frame, uint64_t size, uint32_t index, mwrec_plane* out_plane)
+{
+	MwrecLayout::FrameHeader Header;
+	if (!MwrecLayout::ReadFrameHeader(frame, size, Header))
+	{
+		return MWREC_ERROR_FORMAT;
+	}
+	if (index >= Header.NumPlanes)
+	{
+		return MWREC_ERROR_RANGE;
+	}
+	MwrecLayout::PlaneEntry Entry;
+	std::memcpy(&Entry, frame + Header.HeaderSize + index * sizeof(Entry), sizeof(Entry));
+	if (static_cast<uint64_t>(Entry.Offset) + Entry.Size > size)
+	{
+		return MWREC_ERROR_FORMAT;
+	}
+	out_plane->data = frame + Entry.Offset;
+	out_plane->size = Entry.Size;
+	out_plane->width = Entry.Width;
+	out_plane->height = Entry.Height;
+	out_plane->kind = Entry.Kind;
+	out_plane->pixel_format = Entry.PixelFormat;
+	out_plane->encoding = Entry.Encoding;
+	out_plane->view = Entry.View;
+	return MWREC_OK;
+}
+
+MWREC_API int mwrec_find_plane(const uint8_t* frame, uint64_t size, uint8_t kind, uint8_t view,
+                               mwrec_plane* out_plane)
+{
+	mwrec_frame_info Info;
+	int Result = mwrec_read_frame(frame, size, &Info);
+	for (uint32_t i = 0; Result == MWREC_OK && i < Info.num_planes; i++)
+	{
+		Result = mwrec_frame_plane(frame, size, i, out_plane);
+		if (Result == MWREC_OK && out_plane->kind == kind && out_plane->view == view)
+		{
+			return MWREC_OK;
+		}
+	}
+	return Result == MWREC_OK ? MWREC_ERROR_RANGE : Result;
+}
+
+MWREC_API int mwrec_frame_section(const uint8_t* frame, uint64_t size, uint32_t index, mwrec_section* out_section)
+{
+	MwrecLayout::FrameHeader Header;
+	if (!MwrecLayout::ReadFrameHeader(frame, size, Header))
+	{
+		return MWREC_ERROR_FORMAT;
+	}
+	if (index >= Header.NumSections)
+	{
+		return MWREC_ERROR_RANGE;
+	}
+	MwrecLayout::SectionEntry Entry;
+	std::memcpy(&Entry, frame + Header.HeaderSize + Header.NumPlanes * sizeof(MwrecLayout::PlaneEntry) + index *
+	            sizeof(Entry), sizeof(Entry));
+	if (Entry.Offset % 4 != 0 || static_cast<uint64_t>(Entry.Offset) + Entry.Size > size)
+	{
+		return MWREC_ERROR_FORMAT;
+	}
+	out_section->data = frame + Entry.Offset;
+	out_section->size = Entry.Size;
+	out_section->count = Entry.Count;
+	out_section->class_id = Entry.ClassId;
+	out_section->kind = Entry.Kind;
+	MwrecLayout::CopyName(Entry.Tag, out_section->tag);
+	return MWREC_OK;
+}
+
+MWREC_API const char* mwrec_error_string(int error)
+{
+	switch (error)
+	{
+	case MWREC_OK:
+		return "ok";
+	case MWREC_ERROR_IO:
+		return "could not open or map the file";
+	case MWREC_ERROR_FORMAT:
+		return "not a recording or frame of a known version";
+	case MWREC_ERROR_RANGE:
+		return "no such record";
+	default:
+		return "unknown error";
+	}
+}
+
+}
@@ -0,0 +1,776 @@
+#include "SegmentationClassifier.h"
+#include "Async/ParallelFor.h"
+
+#if PLATFORM_ENABLE_VECTORINTRINSICS && PLATFORM_CPU_X86_FAMILY
+#include <emmintrin.h>
+#define MOWER_CLASSIFIER_SSE2 1
+#else
+#define MOWER_CLASSIFIER_SSE2 0
+#endif
+
+namespace
+{
+	// rows handed to one ParallelFor task, small enough to balance well at 400x400
+	constexpr int32 RowsPerChunk = 16;
+	// above this many classes the per class compares cost more than the scalar table lookup
+	constexpr int32 MaxVectorClasses = 8;
+
+	// depth stats need a histogram per class and chunk, so they use fewer, bigger chunks
+	constexpr int32 DepthRowsPerChunk = 64;
+	constexpr int32 NumDepthBins = (MAX_uint16 + 1) / FSegmentationClassifier::DepthHistogramBinMm;
+
+	struct FDepthSums
+	{
+		uint64 Sum = 0;
+		uint32 Count = 0;
+		uint16 Min = MAX_uint16;
+		int32 MinIndex = -1;
+		// offset of the class's histogram in its chunk's Histograms, set with the first pixel
+		int32 Histogram = INDEX_NONE;
+	};
+
+	struct FDepthChunk
+	{
+		// by class id
+		TArray<FDepthSums> Sums;
+		// NumDepthBins for every class seen in the chunk, a chunk sees a few of them
+		TArray<uint32> Histograms;
+	};
+
+	// kept by a thread between frames, so the depth stats of a frame allocate nothing once its classes have been seen
+	struct FDepthScratch
+	{
+		TArray<FDepthChunk> Chunks;
+		// the merged histogram of one class
+		TArray<uint32> Histogram;
+
+		void Reset(int32 NumChunks, int32 NumClasses)
+		{
+			if (Chunks.Num() < NumChunks)
+			{
+				Chunks.SetNum(NumChunks);
+			}
+			for (int32 Chunk = 0; Chunk < NumChunks; Chunk++)
+			{
+				Chunks[Chunk].Sums.Reset();
+				Chunks[Chunk].Sums.SetNum(NumClasses);
+				Chunks[Chunk].Histograms.Reset();
+			}
+			Histogram.SetNumUninitialized(NumDepthBins, false);
+		}
+	};
+
+	// round half up and saturate, the vector path below does the same steps in the same order
+	uint16 DepthToMm(float DepthCm)
+	{
+		float Mm = DepthCm * 10.0f + 0.5f;
+		Mm = Mm > 0.0f ? Mm : 0.0f;
+		Mm = Mm < 65535.0f ? Mm : 65535.0f;
+		return static_cast<uint16>(Mm);
+	}
+
+	void PackDepthRow(const FLinearColor* SceneDepth, uint16* OutDepthMm, int32 Width)
+	{
+		int32 x = 0;
+#if MOWER_CLASSIFIER_SSE2
+		const __m128 Scale = _mm_set1_ps(10.0f);
+		const __m128 Half = _mm_set1_ps(0.5f);
+		const __m128 Zero = _mm_setzero_ps();
+		const __m128 Max = _mm_set1_ps(65535.0f);
+		const __m128i Bias32 = _mm_set1_epi32(32768);
+		const __m128i Bias16 = _mm_set1_epi16(-32768);
+		for (; x + 4 <= Width; x += 4)
+		{
+			__m128 P0 = _mm_loadu_ps(&SceneDepth[x].R);
+			__m128 P1 = _mm_loadu_ps(&SceneDepth[x + 1].R);
+			__m128 P2 = _mm_loadu_ps(&SceneDepth[x + 2].R);
+			__m128 P3 = _mm_loadu_ps(&SceneDepth[x + 3].R);
+			// P0 ends up holding the R of all 4 pixels
+			_MM_TRANSPOSE4_PS(P0, P1, P2, P3);
+			// max returns its second operand for NaN, so NaN becomes 0 like the scalar path
+			__m128 Mm = _mm_add_ps(_mm_mul_ps(P0, Scale), Half);
+			Mm = _mm_min_ps(_mm_max_ps(Mm, Zero), Max);
+			// SSE2 has no unsigned 32 -> 16 pack, so shift into signed range and back
+			const __m128i Mm32 = _mm_sub_epi32(_mm_cvttps_epi32(Mm), Bias32);
+			const __m128i Mm16 = _mm_add_epi16(_mm_packs_epi32(Mm32, Mm32), Bias16);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(OutDepthMm + x), Mm16);
+		}
+#endif
+		for (; x < Width; x++)
+		{
+			OutDepthMm[x] = DepthToMm(SceneDepth[x].R);
+		}
+	}
+
+	struct FRun
+	{
+		uint16 Y;
+		uint16 X;
+		uint16 Length;
+		uint8 ClassId;
+	};
+
+	// runs of one row chunk, labeled within the chunk
+	struct FChunkRuns
+	{
+		TArray<FRun> Runs;
+		// union-find parents, chunk local until the chunks are merged
+		TArray<int32> Parent;
+		// index of the first run of every row, plus the end
+		int32 RowStart[RowsPerChunk + 1];
+	};
+
+	struct FRegionSums
+	{
+		int32 MinX = MAX_int32;
+		int32 MinY = MAX_int32;
+		int32 MaxX = -1;
+		int32 MaxY = -1;
+		int64 Area = 0;
+		int64 SumX = 0;
+		int64 SumY = 0;
+
+		void Add(const FRun& Run)
+		{
+			MinX = FMath::Min<int32>(MinX, Run.X);
+			MinY = FMath::Min<int32>(MinY, Run.Y);
+			MaxX = FMath::Max<int32>(MaxX, Run.X + Run.Length - 1);
+			MaxY = FMath::Max<int32>(MaxY, Run.Y);
+			Area += Run.Length;
+			SumX += static_cast<int64>(Run.Length) * Run.X + static_cast<int64>(Run.Length) * (Run.Length - 1) / 2;
+			SumY += static_cast<int64>(Run.Length) * Run.Y;
+		}
+
+		FMaskRegion ToRegion() const
+		{
+			FMaskRegion Region;
+			Region.MinX = static_cast<uint16>(MinX);
+			Region.MinY = static_cast<uint16>(MinY);
+			Region.MaxX = static_cast<uint16>(MaxX);
+			Region.MaxY = static_cast<uint16>(MaxY);
+			Region.Area = static_cast<uint32>(Area);
+			Region.CentroidX = static_cast<float>(static_cast<double>(SumX) / Area);
+			Region.CentroidY = static_cast<float>(static_cast<double>(SumY) / Area);
+			return Region;
+		}
+	};
+
+	int32 FindRoot(TArray<int32>& Parent, int32 Run)
+	{
+		while (Parent[Run] != Run)
+		{
+			// path halving
+			Parent[Run] = Parent[Parent[Run]];
+			Run = Parent[Run];
+		}
+		return Run;
+	}
+
+	// the smaller index wins, so a component's root is always its first run in row major order
+	void Union(TArray<int32>& Parent, int32 A, int32 B)
+	{
+		A = FindRoot(Parent, A);
+		B = FindRoot(Parent, B);
+		if (A != B)
+		{
+			Parent[FMath::Max(A, B)] = FMath::Min(A, B);
+		}
+	}
+
+	/**
+	 * @brief Unions the runs of two adjacent rows that have the same class and share a column
+	 * @param AboveBase, BelowBase index of Above[0] and Below[0] in Parent
+	 */
+	void LinkRows(const FRun* Above, int32 NumAbove, int32 AboveBase, const FRun* Below, int32 NumBelow,
+	              int32 BelowBase, TArray<int32>& Parent)
+	{
+		int32 a = 0;
+		int32 b = 0;
+		while (a < NumAbove && b < NumBelow)
+		{
+			const int32 AboveEnd = Above[a].X + Above[a].Length;
+			const int32 BelowEnd = Below[b].X + Below[b].Length;
+			if (Above[a].ClassId == Below[b].ClassId && Above[a].X < BelowEnd && Below[b].X < AboveEnd)
+			{
+				Union(Parent, AboveBase + a, BelowBase + b);
+			}
+			if (AboveEnd < BelowEnd)
+			{
+				a++;
+			}
+			else
+			{
+				b++;
+			}
+		}
+	}
+
+	void ExtractRuns(const uint8* RowIds, int32 Width, int32 y, TArray<FRun>& OutRuns)
+	{
+		int32 x = 0;
+		while (x < Width)
+		{
+#if MOWER_CLASSIFIER_SSE2
+			if (x + 16 <= Width && _mm_movemask_epi8(_mm_cmpeq_epi8(
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(RowIds + x)), _mm_setzero_si128())) == 0xFFFF)
+			{
+				x += 16;
+				continue;
+			}
+#endif
+			const uint8 ClassId = RowIds[x];
+			if (ClassId == FSegmentationClassifier::BackgroundClass)
+			{
+				x++;
+				continue;
+			}
+			int32 End = x + 1;
+			while (End < Width && RowIds[End] == ClassId)
+			{
+				End++;
+			}
+			OutRuns.Add({static_cast<uint16>(y), static_cast<uint16>(x), static_cast<uint16>(End - x), ClassId});
+			x = End;
+		}
+	}
+}
+
+void FSegmentationClassifier::Build(TConstArrayView<FSegmentationClassDefinition> Classes)
+{
+	check(Classes.Num() < 256);
+
+	FMemory::Memzero(ClassTable, sizeof(ClassTable));
+	ClassTags.Reset();
+	ClassColors.Reset();
+	ClassMarks.Reset();
+
+	ClassTags.Add(TEXT("Background"));
+	ClassColors.Add(FColor::Black);
+	ClassMarks.Add(0);
+	for (const FSegmentationClassDefinition& Class : Classes)
+	{
+		if (Class.Mark <= 0 || Class.Mark > 255 || ClassTable[Class.Mark] != BackgroundClass)
+		{
+			UE_LOG(LogTemp, Error, TEXT("FSegmentationClassifier: skipping class %s, mark %d is invalid or taken"),
+			       *Class.Tag.ToString(), Class.Mark);
+			continue;
+		}
+		ClassTable[Class.Mark] = static_cast<uint8>(ClassTags.Num());
+		ClassTags.Add(Class.Tag.ToString());
+		ClassColors.Add(Class.DebugColor);
+		ClassMarks.Add(static_cast<uint8>(Class.Mark));
+	}
+}
+
+template <bool bRecolor>
+void FSegmentationClassifier::ClassifyRows(const FColor* Marks, FColor* Recolor, uint8* OutClassIds,
+                                           int32 NumPixels, int32* OutCounts) const
+{
+	int32 i = 0;
+#if MOWER_CLASSIFIER_SSE2
+	const int32 NumMarked = ClassMarks.Num() - 1;
+	if (NumMarked <= MaxVectorClasses)
+	{
+		__m128i MarkK[MaxVectorClasses];
+		__m128i IdK[MaxVectorClasses];
+		__m128i ColorK[MaxVectorClasses];
+		for (int32 k = 0; k < NumMarked; k++)
+		{
+			MarkK[k] = _mm_set1_epi32(ClassMarks[k + 1]);
+			IdK[k] = _mm_set1_epi32(k + 1);
+			ColorK[k] = _mm_set1_epi32(static_cast<int32>(ClassColors[k + 1].DWColor()));
+		}
+		const __m128i ByteMask = _mm_set1_epi32(0xFF);
+
+		// 4 pixels per iteration, FColor is BGRA in memory so R is bits 16..23 of each lane
+		for (; i + 4 <= NumPixels; i += 4)
+		{
+			const __m128i Px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Marks + i));
+			const __m128i R = _mm_and_si128(_mm_srli_epi32(Px, 16), ByteMask);
+			__m128i Out = bRecolor ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(Recolor + i)) : Px;
+			__m128i Ids = _mm_setzero_si128();
+			for (int32 k = 0; k < NumMarked; k++)
+			{
+				const __m128i Match = _mm_cmpeq_epi32(R, MarkK[k]);
+				const int32 MatchBits = _mm_movemask_ps(_mm_castsi128_ps(Match));
+				if (MatchBits == 0)
+				{
+					continue;
+				}
+				OutCounts[k + 1] += FMath::CountBits(MatchBits);
+				Ids = _mm_or_si128(Ids, _mm_and_si128(Match, IdK[k]));
+				if (bRecolor)
+				{
+					Out = _mm_or_si128(_mm_andnot_si128(Match, Out), _mm_and_si128(Match, ColorK[k]));
+				}
+			}
+			if (bRecolor)
+			{
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(Recolor + i), Out);
+			}
+			// ids are < 256, so saturating packs keep them exact: 4x32 -> 4x16 -> 4x8
+			const __m128i Ids16 = _mm_packs_epi32(Ids, Ids);
+			const __m128i Ids8 = _mm_packus_epi16(Ids16, Ids16);
+			const int32 PackedIds = _mm_cvtsi128_si32(Ids8);
+			FMemory::Memcpy(OutClassIds + i, &PackedIds, 4);
+		}
+	}
+#endif
+
+	for (; i < NumPixels; i++)
+	{
+		const uint8 ClassId = ClassTable[Marks[i].R];
+		OutClassIds[i] = ClassId;
+		if (ClassId != BackgroundClass)
+		{
+			if (bRecolor)
+			{
+				Recolor[i] = ClassColors[ClassId];
+			}
+			OutCounts[ClassId]++;
+		}
+	}
+}
+
+void FSegmentationClassifier::ClassifyChunk(const FColor* Marks, FColor* Recolor, uint8* OutClassIds, int32 Width,
+                                            int32 FirstRow, int32 NumRows, int32* OutCounts) const
+{
+	const int32 Offset = FirstRow * Width;
+	if (Recolor)
+	{
+		ClassifyRows<true>(Marks + Offset, Recolor + Offset, OutClassIds + Offset, NumRows * Width, OutCounts);
+	}
+	else
+	{
+		ClassifyRows<false>(Marks + Offset, nullptr, OutClassIds + Offset, NumRows * Width, OutCounts);
+	}
+}
+
+void FSegmentationClassifier::Classify(const FColor* Marks, FColor* Recolor, uint8* OutClassIds, int32 Width,
+                                       int32 Height, TArray<TArray<uint16>>& OutClassPixels) const
+{
+	check(Width <= MAX_uint16 && Height <= MAX_uint16);
+	const int32 NumClasses = GetNumClasses();
+	const int32 NumChunks = FMath::DivideAndRoundUp(Height, RowsPerChunk);
+
+	// pass 1: classify and count per chunk
+	TArray<int32> ChunkCounts;
+	ChunkCounts.SetNumZeroed(NumChunks * NumClasses);
+	ParallelFor(NumChunks, [&](int32 Chunk)
+	{
+		const int32 FirstRow = Chunk * RowsPerChunk;
+		ClassifyChunk(Marks, Recolor, OutClassIds, Width, FirstRow, FMath::Min(RowsPerChunk, Height - FirstRow),
+		              &ChunkCounts[Chunk * NumClasses]);
+	});
+
+	// prefix sum per class turns the counts into each chunk's write cursor
+	OutClassPixels.SetNum(NumClasses);
+	for (int32 ClassId = 1; ClassId < NumClasses; ClassId++)
+	{
+		int32 Total = 0;
+		for (int32 Chunk = 0; Chunk < NumChunks; Chunk++)
+		{
+			const int32 Count = ChunkCounts[Chunk * NumClasses + ClassId];
+			ChunkCounts[Chunk * NumClasses + ClassId] = Total;
+			Total += Count;
+		}
+		OutClassPixels[ClassId].SetNumUninitialized(Total * 2, false);
+	}
+	OutClassPixels[BackgroundClass].Reset();
+
+	// pass 2: scatter x,y into the per class arrays
+	ParallelFor(NumChunks, [&](int32 Chunk)
+	{
+		int32* Cursors = &ChunkCounts[Chunk * NumClasses];
+		const int32 FirstRow = Chunk * RowsPerChunk;
+		const int32 LastRow = FMath::Min(FirstRow + RowsPerChunk, Height);
+		for (int32 y = FirstRow; y < LastRow; y++)
+		{
+			const uint8* RowIds = OutClassIds + y * Width;
+			auto Emit = [&](int32 x)
+			{
+				const uint8 ClassId = RowIds[x];
+				if (ClassId != BackgroundClass)
+				{
+					uint16* Out = &OutClassPixels[ClassId][Cursors[ClassId]++ * 2];
+					Out[0] = static_cast<uint16>(x);
+					Out[1] = static_cast<uint16>(y);
+				}
+			};
+			int32 x = 0;
+#if MOWER_CLASSIFIER_SSE2
+			// skip runs of 16 background pixels with one compare
+			for (; x + 16 <= Width; x += 16)
+			{
+				const __m128i Ids = _mm_loadu_si128(reinterpret_cast<const __m128i*>(RowIds + x));
+				if (_mm_movemask_epi8(_mm_cmpeq_epi8(Ids, _mm_setzero_si128())) == 0xFFFF)
+				{
+					continue;
+				}
+				for (int32 xi = x; xi < x + 16; xi++)
+				{
+					Emit(xi);
+				}
+			}
+#endif
+			for (; x < Width; x++)
+			{
+				Emit(x);
+			}
+		}
+	});
+}
+
+void FSegmentationClassifier::ClassifyMasks(const FColor* Marks, FColor* Recolor, uint8* OutClassIds, int32 Width,
+                                            int32 Height, TArray<FClassMask>& OutClassMasks) const
+{
+	check(Width <= MAX_uint16 && Height <= MAX_uint16);
+	const int32 NumClasses = GetNumClasses();
+	const int32 NumChunks = FMath::DivideAndRoundUp(Height, RowsPerChunk);
+
+	// pass 1: classify a chunk, extract its runs and label them within the chunk
+	TArray<FChunkRuns> Chunks;
+	Chunks.SetNum(NumChunks);
+	ParallelFor(NumChunks, [&](int32 Chunk)
+	{
+		const int32 FirstRow = Chunk * RowsPerChunk;
+		const int32 NumRows = FMath::Min(RowsPerChunk, Height - FirstRow);
+		TArray<int32, TInlineAllocator<16>> Counts;
+		Counts.SetNumZeroed(NumClasses);
+		ClassifyChunk(Marks, Recolor, OutClassIds, Width, FirstRow, NumRows, Counts.GetData());
+
+		FChunkRuns& Runs = Chunks[Chunk];
+		for (int32 Row = 0; Row < NumRows; Row++)
+		{
+			Runs.RowStart[Row] = Runs.Runs.Num();
+			ExtractRuns(OutClassIds + (FirstRow + Row) * Width, Width, FirstRow + Row, Runs.Runs);
+		}
+		Runs.RowStart[NumRows] = Runs.Runs.Num();
+
+		Runs.Parent.SetNumUninitialized(Runs.Runs.Num());
+		for (int32 i = 0; i < Runs.Parent.Num(); i++)
+		{
+			Runs.Parent[i] = i;
+		}
+		for (int32 Row = 1; Row < NumRows; Row++)
+		{
+			const int32 Above = Runs.RowStart[Row - 1];
+			const int32 Below = Runs.RowStart[Row];
+			LinkRows(Runs.Runs.GetData() + Above, Below - Above, Above, Runs.Runs.GetData() + Below,
+			         Runs.RowStart[Row + 1] - Below, Below, Runs.Parent);
+		}
+	});
+
+	// pass 2: move the labels into one union-find and link the rows at the chunk borders
+	TArray<int32> ChunkBase;
+	ChunkBase.SetNumUninitialized(NumChunks);
+	int32 NumRuns = 0;
+	for (int32 Chunk = 0; Chunk < NumChunks; Chunk++)
+	{
+		ChunkBase[Chunk] = NumRuns;
+		NumRuns += Chunks[Chunk].Runs.Num();
+	}
+	TArray<int32> Parent;
+	Parent.SetNumUninitialized(NumRuns);
+	for (int32 Chunk = 0; Chunk < NumChunks; Chunk++)
+	{
+		const TArray<int32>& LocalParent = Chunks[Chunk].Parent;
+		for (int32 i = 0; i < LocalParent.Num(); i++)
+		{
+			Parent[ChunkBase[Chunk] + i] = ChunkBase[Chunk] + LocalParent[i];
+		}
+	}
+	for (int32 Chunk = 1; Chunk < NumChunks; Chunk++)
+	{
+		const FChunkRuns& Above = Chunks[Chunk - 1];
+		const FChunkRuns& Below = Chunks[Chunk];
+		const int32 AboveFirst = Above.RowStart[RowsPerChunk - 1];
+		LinkRows(Above.Runs.GetData() + AboveFirst, Above.Runs.Num() - AboveFirst, ChunkBase[Chunk - 1] + AboveFirst,
+		         Below.Runs.GetData(), Below.RowStart[1], ChunkBase[Chunk], Parent);
+	}
+
+	// pass 3: walk the runs in row major order, a run that is its own root starts a new component
+	TArray<TArray<FRegionSums>> Sums;
+	Sums.SetNum(NumClasses);
+	OutClassMasks.SetNum(NumClasses);
+	for (FClassMask& Mask : OutClassMasks)
+	{
+		Mask.Spans.Reset();
+		Mask.Regions.Reset();
+	}
+	TArray<int32> ComponentOf;
+	ComponentOf.SetNumUninitialized(NumRuns);
+	for (int32 Chunk = 0; Chunk < NumChunks; Chunk++)
+	{
+		const TArray<FRun>& Runs = Chunks[Chunk].Runs;
+		for (int32 i = 0; i < Runs.Num(); i++)
+		{
+			const FRun& Run = Runs[i];
+			const int32 Index = ChunkBase[Chunk] + i;
+			const int32 Root = FindRoot(Parent, Index);
+			TArray<FRegionSums>& ClassSums = Sums[Run.ClassId];
+			if (ClassSums.Num() == 0)
+			{
+				ClassSums.AddDefaulted();
+			}
+			if (Root == Index)
+			{
+				ComponentOf[Index] = ClassSums.AddDefaulted();
+			}
+			else
+			{
+				ComponentOf[Index] = ComponentOf[Root];
+			}
+			ClassSums[0].Add(Run);
+			ClassSums[ComponentOf[Index]].Add(Run);
+			OutClassMasks[Run.ClassId].Spans.Add({Run.Y, Run.X, Run.Length});
+		}
+	}
+	for (int32 ClassId = 1; ClassId < NumClasses; ClassId++)
+	{
+		for (const FRegionSums& RegionSums : Sums[ClassId])
+		{
+			OutClassMasks[ClassId].Regions.Add(RegionSums.ToRegion());
+		}
+	}
+}
+
+bool FSegmentationClassifier::DecodeSpans(TConstArrayView<FMaskSpan> Spans, uint8 ClassId, uint8* OutClassIds,
+                                          int32 Width, int32 Height)
+{
+	for (const FMaskSpan& Span : Spans)
+	{
+		if (Span.Y >= Height || Span.X + Span.Length > Width)
+		{
+			return false;
+		}
+		FMemory::Memset(OutClassIds + Span.Y * Width + Span.X, ClassId, Span.Length);
+	}
+	return true;
+}
+
+void FSegmentationClassifier::PackDepth(const FLinearColor* SceneDepth, int32 Width, int32 Height,
+                                        uint16* OutDepthMm)
+{
+	ParallelFor(FMath::DivideAndRoundUp(Height, DepthRowsPerChunk), [&](int32 Chunk)
+	{
+		const int32 FirstRow = Chunk * DepthRowsPerChunk;
+		const int32 LastRow = FMath::Min(FirstRow + DepthRowsPerChunk, Height);
+		for (int32 y = FirstRow; y < LastRow; y++)
+		{
+			PackDepthRow(SceneDepth + y * Width, OutDepthMm + y * Width, Width);
+		}
+	});
+}
+
+void FSegmentationClassifier::ClassifyDepth(const FLinearColor* SceneDepth, const uint8* ClassIds, int32 Width,
+                                            int32 Height, int32 Percentile, uint16* OutDepthMm,
+                                            TArray<FClassDepthStats>& OutClassDepth) const
+{
+	check(Width <= MAX_uint16 && Height <= MAX_uint16);
+	const int32 NumClasses = GetNumClasses();
+	const int32 NumChunks = FMath::DivideAndRoundUp(Height, DepthRowsPerChunk);
+
+	// a thread waiting for the ParallelFor below may pick up another frame's stats, that one gets its own scratch
+	thread_local FDepthScratch ThreadScratch;
+	thread_local bool bThreadScratchInUse = false;
+	FDepthScratch LocalScratch;
+	FDepthScratch& Scratch = bThreadScratchInUse ? LocalScratch : ThreadScratch;
+	TGuardValue<bool> ScratchGuard(bThreadScratchInUse, true);
+	Scratch.Reset(NumChunks, NumClasses);
+	TArray<FDepthChunk>& Chunks = Scratch.Chunks;
+	ParallelFor(NumChunks, [&](int32 Chunk)
+	{
+		FDepthSums* Sums = Chunks[Chunk].Sums.GetData();
+		TArray<uint32>& Histograms = Chunks[Chunk].Histograms;
+		const int32 FirstRow = Chunk * DepthRowsPerChunk;
+		const int32 LastRow = FMath::Min(FirstRow + DepthRowsPerChunk, Height);
+		for (int32 y = FirstRow; y < LastRow; y++)
+		{
+			const uint8* RowIds = ClassIds + y * Width;
+			uint16* RowMm = OutDepthMm + y * Width;
+			PackDepthRow(SceneDepth + y * Width, RowMm, Width);
+
+			int32 x = 0;
+			while (x < Width)
+			{
+#if MOWER_CLASSIFIER_SSE2
+				if (x + 16 <= Width && _mm_movemask_epi8(_mm_cmpeq_epi8(
+					_mm_loadu_si128(reinterpret_cast<const __m128i*>(RowIds + x)), _mm_setzero_si128())) == 0xFFFF)
+				{
+					x += 16;
+					continue;
+				}
+#endif
+				const uint8 ClassId = RowIds[x];
+				const uint16 Mm = RowMm[x];
+				if (ClassId != BackgroundClass && Mm != NoDepthMm)
+				{
+					FDepthSums& ClassSums = Sums[ClassId];
+					if (ClassSums.Count++ == 0)
+					{
+						ClassSums.Histogram = Histograms.AddZeroed(NumDepthBins);
+					}
+					ClassSums.Sum += Mm;
+					if (Mm < ClassSums.Min)
+					{
+						ClassSums.Min = Mm;
+						ClassSums.MinIndex = y * Width + x;
+					}
+					Histograms[ClassSums.Histogram + Mm / DepthHistogramBinMm]++;
+				}
+				x++;
+			}
+		}
+	});
+
+	OutClassDepth.SetNumZeroed(NumClasses);
+	TArray<uint32>& Histogram = Scratch.Histogram;
+	for (int32 ClassId = 1; ClassId < NumClasses; ClassId++)
+	{
+		// chunks are in row order, so the first minimum found is the first in row major order too
+		FDepthSums Total;
+		for (int32 Chunk = 0; Chunk < NumChunks; Chunk++)
+		{
+			const FDepthSums& Sums = Chunks[Chunk].Sums[ClassId];
+			Total.Sum += Sums.Sum;
+			Total.Count += Sums.Count;
+			if (Sums.Count > 0 && Sums.Min < Total.Min)
+			{
+				Total.Min = Sums.Min;
+				Total.MinIndex = Sums.MinIndex;
+			}
+		}
+
+		FClassDepthStats& Stats = OutClassDepth[ClassId];
+		FMemory::Memzero(Stats);
+		Stats.Percentile = static_cast<uint8>(FMath::Clamp(Percentile, 0, 100));
+		if (Total.Count == 0)
+		{
+			continue;
+		}
+		// only the chunks the class is in have a histogram
+		FMemory::Memzero(Histogram.GetData(), NumDepthBins * sizeof(uint32));
+		for (int32 Chunk = 0; Chunk < NumChunks; Chunk++)
+		{
+			const FDepthSums& Sums = Chunks[Chunk].Sums[ClassId];
+			if (Sums.Count == 0)
+			{
+				continue;
+			}
+			const uint32* ChunkHistogram = &Chunks[Chunk].Histograms[Sums.Histogram];
+			for (int32 Bin = 0; Bin < NumDepthBins; Bin++)
+			{
+				Histogram[Bin] += ChunkHistogram[Bin];
+			}
+		}
+		Stats.NumPixels = Total.Count;
+		Stats.MinMm = Total.Min;
+		Stats.MeanMm = static_cast<uint16>((Total.Sum + Total.Count / 2) / Total.Count);
+		Stats.NearestX = static_cast<uint16>(Total.MinIndex % Width);
+		Stats.NearestY = static_cast<uint16>(Total.MinIndex / Width);
+
+		const uint64 Rank = FMath::Max<uint64>(1, (static_cast<uint64>(Total.Count) * Stats.Percentile + 99) / 100);
+		uint64 Seen = 0;
+		int32 Bin = 0;
+		for (; Bin < NumDepthBins - 1; Bin++)
+		{
+			Seen += Histogram[Bin];
+			if (Seen >= Rank)
+			{
+				break;
+			}
+		}
+		const int32 BinCenter = Bin * DepthHistogramBinMm + DepthHistogramBinMm / 2;
+		Stats.PercentileMm = static_cast<uint16>(FMath::Clamp<int32>(BinCenter, Total.Min, NoDepthMm - 1));
+	}
+}
+
+void FSegmentationClassifier::GatherInstances(const FColor* Marks, const uint8* ClassIds, uint16* InstanceIds,
+                                              int32 Width, int32 Height, TArray<FInstanceStats>& OutInstances)
+{
+	check(Width <= MAX_uint16 && Height <= MAX_uint16);
+	const int32 NumChunks = FMath::DivideAndRoundUp(Height, DepthRowsPerChunk);
+
+	// a frame sees a few dozen actors, so every chunk keeps a short list instead of a table of all 65536 ids
+	TArray<TArray<FInstanceStats>> ChunkInstances;
+	ChunkInstances.SetNum(NumChunks);
+	ParallelFor(NumChunks, [&](int32 Chunk)
+	{
+		TArray<FInstanceStats>& Instances = ChunkInstances[Chunk];
+		TMap<uint16, int32> SlotOfInstance;
+		const int32 FirstRow = Chunk * DepthRowsPerChunk;
+		const int32 LastRow = FMath::Min(FirstRow + DepthRowsPerChunk, Height);
+		for (int32 y = FirstRow; y < LastRow; y++)
+		{
+			const uint8* RowIds = ClassIds + y * Width;
+			uint16* RowInstances = InstanceIds + y * Width;
+			if (Marks)
+			{
+				const FColor* RowMarks = Marks + y * Width;
+				for (int32 x = 0; x < Width; x++)
+				{
+					const uint16 Decoded = static_cast<uint16>(RowMarks[x].G << 8 | RowMarks[x].B);
+					RowInstances[x] = RowIds[x] != BackgroundClass ? Decoded : 0;
+				}
+			}
+
+			int32 x = 0;
+			while (x < Width)
+			{
+				const uint16 InstanceId = RowIds[x] != BackgroundClass ? RowInstances[x] : 0;
+				const int32 Start = x;
+				if (InstanceId == 0)
+				{
+					RowInstances[x++] = 0;
+					continue;
+				}
+				while (x < Width && RowInstances[x] == InstanceId && RowIds[x] != BackgroundClass)
+				{
+					x++;
+				}
+
+				int32& Slot = SlotOfInstance.FindOrAdd(InstanceId, INDEX_NONE);
+				if (Slot == INDEX_NONE)
+				{
+					Slot = Instances.Num();
+					FInstanceStats& Added = Instances.AddZeroed_GetRef();
+					Added.InstanceId = InstanceId;
+					Added.ClassId = RowIds[Start];
+					Added.MinX = MAX_uint16;
+					Added.MinY = static_cast<uint16>(y);
+				}
+				FInstanceStats& Stats = Instances[Slot];
+				Stats.MinX = FMath::Min(Stats.MinX, static_cast<uint16>(Start));
+				Stats.MaxX = FMath::Max(Stats.MaxX, static_cast<uint16>(x - 1));
+				Stats.MaxY = static_cast<uint16>(y);
+				Stats.NumPixels += static_cast<uint32>(x - Start);
+			}
+		}
+	}, NumChunks == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
+
+	// chunks are in row order, so the first chunk an instance appears in has its first pixel and MinY
+	OutInstances.Reset();
+	TMap<uint16, int32> SlotOfInstance;
+	for (const TArray<FInstanceStats>& Instances : ChunkInstances)
+	{
+		for (const FInstanceStats& Chunk : Instances)
+		{
+			int32& Slot = SlotOfInstance.FindOrAdd(Chunk.InstanceId, INDEX_NONE);
+			if (Slot == INDEX_NONE)
+			{
+				Slot = OutInstances.Add(Chunk);
+				continue;
+			}
+			FInstanceStats& Stats = OutInstances[Slot];
+			Stats.MinX = FMath::Min(Stats.MinX, Chunk.MinX);
+			Stats.MaxX = FMath::Max(Stats.MaxX, Chunk.MaxX);
+			Stats.MaxY = FMath::Max(Stats.MaxY, Chunk.MaxY);
+			Stats.NumPixels += Chunk.NumPixels;
+		}
+	}
+	OutInstances.Sort([](const FInstanceStats& A, const FInstanceStats& B)
+	{
+		return A.InstanceId < B.InstanceId;
+	});
+}
@@ -0,0 +1,84 @@
+#include "SharedMemoryFrameRing.h"
+
+namespace
+{
+	constexpr uint8 RingMagic[4] = {'M', 'W', 'S', 'R'};
+}
+
+FSharedMemoryFrameRing::~FSharedMemoryFrameRing()
+{
+	Close();
+}
+
+bool FSharedMemoryFrameRing::Open(const FString& InName, int32 InNumSlots, int32 InSlotSize)
+{
+	Close();
+	check(InNumSlots > 0 && InSlotSize > 0);
+
+	// keep payloads 64 byte aligned
+	const int32 AlignedSlotSize = Align(InSlotSize, 64);
+	const SIZE_T Size = sizeof(FRingHeader) + static_cast<SIZE_T>(InNumSlots) * (sizeof(FSlotHeader) +
+		AlignedSlotSize);
+	Region = FPlatformMemory::MapNamedSharedMemoryRegion(InName, true,
+	                                                     FPlatformMemory::ESharedMemoryAccess::Read |
+	                                                     FPlatformMemory::ESharedMemoryAccess::Write, Size);
+	if (!Region)
+	{
+		UE_LOG(LogTemp, Error, TEXT("FSharedMemoryFrameRing: could not map shared memory region %s"), *InName);
+		return false;
+	}
+
+	Name = InName;
+	NumSlots = InNumSlots;
+	SlotSize = AlignedSlotSize;
+	LastSequence = 0;
+
+	Header = static_cast<FRingHeader*>(Region->GetAddress());
+	FMemory::Memzero(Region->GetAddress(), Size);
+	Header->Version = Version;
+	Header->NumSlots = NumSlots;
+	Header->SlotSize = SlotSize;
+	// the magic goes in last, readers treat a ring without it as not ready
+	FPlatformMisc::MemoryBarrier();
+	FMemory::Memcpy(Header->Magic, RingMagic, sizeof(RingMagic));
+	return true;
+}
+
+void FSharedMemoryFrameRing::Close()
+{
+	if (Region)
+	{
+		FPlatformMemory::UnmapNamedSharedMemoryRegion(Region);
+	}
+	Region = nullptr;
+	Header = nullptr;
+}
+
+FSharedMemoryFrameRing::FSlotHeader* FSharedMemoryFrameRing::GetSlot(int32 Slot) const
+{
+	uint8* Base = static_cast<uint8*>(Region->GetAddress()) + sizeof(FRingHeader);
+	return reinterpret_cast<FSlotHeader*>(Base + static_cast<SIZE_T>(Slot) * (sizeof(FSlotHeader) + SlotSize));
+}
+
+bool FSharedMemoryFrameRing::Write(TConstArrayView<uint8> Frame, int32& OutSlot, uint64& OutSequence)
+{
+	if (!Region || Frame.Num() > SlotSize)
+	{
+		return false;
+	}
+
+	const uint64 Sequence = ++LastSequence;
+	const int32 Slot = static_cast<int32>(Sequence % NumSlots);
+	FSlotHeader* SlotHeader = GetSlot(Slot);
+
+	// interlocked stores are full barriers, so the payload can't be reordered around them
+	FPlatformAtomics::InterlockedExchange(&SlotHeader->Sequence, 0);
+	FMemory::Memcpy(reinterpret_cast<uint8*>(SlotHeader) + sizeof(FSlotHeader), Frame.GetData(), Frame.Num());
+	SlotHeader->Size = Frame.Num();
+	FPlatformAtomics::InterlockedExchange(&SlotHeader->Sequence, static_cast<int64>(Sequence));
+	FPlatformAtomics::InterlockedExchange(&Header->LastSequence, static_cast<int64>(Sequence));
+
+	OutSlot = Slot;
+	OutSequence = Sequence;
+	return true;
+}
@@ -0,0 +1,490 @@
+#include "TaggedActorRegistry.h"
+#include "Components/PrimitiveComponent.h"
+#include "Components/StaticMeshComponent.h"
+#include "ConvexVolume.h"
+#include "Engine/Level.h"
+#include "Engine/World.h"
+#include "EngineUtils.h"
+#include "SegmentationClassifier.h"
+#include "SegmentationClassTable.h"
+#include "Stats/Stats.h"
+
+DECLARE_STATS_GROUP(TEXT("TaggedActors"), STATGROUP_TaggedActors, STATCAT_Advanced);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Actors"), STAT_TaggedActors_Actors, STATGROUP_TaggedActors);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Grid cells"), STAT_TaggedActors_Cells, STATGROUP_TaggedActors);
+DECLARE_MEMORY_STAT(TEXT("Memory"), STAT_TaggedActors_Memory, STATGROUP_TaggedActors);
+DECLARE_CYCLE_STAT(TEXT("Update"), STAT_TaggedActors_Update, STATGROUP_TaggedActors);
+DECLARE_CYCLE_STAT(TEXT("Query"), STAT_TaggedActors_Query, STATGROUP_TaggedActors);
+
+void UTaggedActorRegistry::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	UWorld* World = GetWorld();
+	ActorSpawnedHandle = World->AddOnActorSpawnedHandler(
+		FOnActorSpawned::FDelegate::CreateUObject(this, &UTaggedActorRegistry::OnActorSpawned));
+	ActorDestroyedHandle = World->AddOnActorDestroyedHandler(
+		FOnActorDestroyed::FDelegate::CreateUObject(this, &UTaggedActorRegistry::OnActorDestroyed));
+	LevelAddedHandle = FWorldDelegates::LevelAddedToWorld.AddUObject(this, &UTaggedActorRegistry::OnLevelAdded);
+	LevelRemovedHandle = FWorldDelegates::LevelRemovedFromWorld.AddUObject(this,
+	                                                                       &UTaggedActorRegistry::OnLevelRemoved);
+}
+
+void UTaggedActorRegistry::Deinitialize()
+{
+	UWorld* World = GetWorld();
+	World->RemoveOnActorSpawnedHandler(ActorSpawnedHandle);
+	World->RemoveOnActorDestroyededHandler(ActorDestroyedHandle);
+	FWorldDelegates::LevelAddedToWorld.Remove(LevelAddedHandle);
+	FWorldDelegates::LevelRemovedFromWorld.Remove(LevelRemovedHandle);
+
+	Entries.Empty();
+	EntryOfActor.Empty();
+	EntriesOfTag.Empty();
+	Cells.Empty();
+	MovableEntries.Empty();
+	UpdateStats();
+	Super::Deinitialize();
+}
+
+void UTaggedActorRegistry::SetClasses(const FSegmentationClassifier& Classifier, bool bInStampActors)
+{
+	ClassIds.Reset();
+	ClassMarks.Reset();
+	for (int32 ClassId = 0; ClassId < Classifier.GetNumClasses(); ++ClassId)
+	{
+		ClassMarks.Add(Classifier.GetClassMark(ClassId));
+		if (ClassId != FSegmentationClassifier::BackgroundClass)
+		{
+			ClassIds.Add(FName(*Classifier.GetClassTag(ClassId)), static_cast<uint8>(ClassId));
+		}
+	}
+	bStampActors = bInStampActors;
+
+	const double StartSeconds = FPlatformTime::Seconds();
+	Entries.Empty();
+	EntryOfActor.Empty();
+	EntriesOfTag.Empty();
+	Cells.Empty();
+	MovableEntries.Empty();
+	for (TActorIterator<AActor> It(GetWorld()); It; ++It)
+	{
+		FTaggedActor Entry;
+		if (Describe(*It, Entry))
+		{
+			Add(MoveTemp(Entry));
+		}
+	}
+	AddUpdateTime(StartSeconds);
+	UE_LOG(LogTemp, Log, TEXT("UTaggedActorRegistry: %d tagged actors in %d cells"), Entries.Num(), Cells.Num());
+}
+
+void UTaggedActorRegistry::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	if (MovableEntries.Num() > 0)
+	{
+		SCOPE_CYCLE_COUNTER(STAT_TaggedActors_Update);
+		const double StartSeconds = FPlatformTime::Seconds();
+		TArray<int32, TInlineAllocator<16>> Stale;
+		for (const int32 Index : MovableEntries)
+		{
+			FTaggedActor& Entry = Entries[Index];
+			AActor* Actor = Entry.Actor.Get();
+			if (!Actor)
+			{
+				Stale.Add(Index);
+				continue;
+			}
+			const FBoxSphereBounds Bounds = Entry.MeshComponent.IsValid()
+				                                ? Entry.MeshComponent->Bounds
+				                                : FBoxSphereBounds(Actor->GetComponentsBoundingBox(true));
+			if (Bounds.Origin.Equals(Entry.Bounds.Origin) && Bounds.BoxExtent.Equals(Entry.Bounds.BoxExtent))
+			{
+				continue;
+			}
+			RemoveFromGrid(Index);
+			Entry.Bounds = Bounds;
+			InsertIntoGrid(Index);
+			++Stats.NumUpdates;
+		}
+		for (const int32 Index : Stale)
+		{
+			Remove(Index);
+		}
+		AddUpdateTime(StartSeconds);
+	}
+
+	if (bStatsDirty)
+	{
+		UpdateStats();
+	}
+}
+
+TStatId UTaggedActorRegistry::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UTaggedActorRegistry, STATGROUP_Tickables);
+}
+
+void UTaggedActorRegistry::RefreshActor(AActor* Actor)
+{
+	if (!Actor)
+	{
+		return;
+	}
+	SCOPE_CYCLE_COUNTER(STAT_TaggedActors_Update);
+	const double StartSeconds = FPlatformTime::Seconds();
+	if (const int32* Index = EntryOfActor.Find(Actor))
+	{
+		Remove(*Index);
+	}
+	FTaggedActor Entry;
+	if (Describe(Actor, Entry))
+	{
+		Add(MoveTemp(Entry));
+	}
+	AddUpdateTime(StartSeconds);
+}
+
+const FTaggedActor* UTaggedActorRegistry::Find(const AActor* Actor) const
+{
+	const int32* Index = EntryOfActor.Find(Actor);
+	return Index ? &Entries[*Index] : nullptr;
+}
+
+template <typename FunctionType>
+void UTaggedActorRegistry::ForEachCandidate(FIntPoint MinCell, FIntPoint MaxCell, FunctionType&& Function) const
+{
+	Visited.Init(false, Entries.GetMaxIndex());
+	auto VisitCell = [&](const FCell& Cell)
+	{
+		for (const int32 Index : Cell.Entries)
+		{
+			if (!Visited[Index])
+			{
+				Visited[Index] = true;
+				Function(Index);
+			}
+		}
+	};
+
+	// a range wider than the occupied grid walks the occupied cells instead
+	const int64 NumRangeCells = static_cast<int64>(MaxCell.X - MinCell.X + 1) * (MaxCell.Y - MinCell.Y + 1);
+	if (NumRangeCells > Cells.Num())
+	{
+		for (const TPair<FIntPoint, FCell>& Pair : Cells)
+		{
+			if (Pair.Key.X >= MinCell.X && Pair.Key.X <= MaxCell.X && Pair.Key.Y >= MinCell.Y &&
+				Pair.Key.Y <= MaxCell.Y)
+			{
+				VisitCell(Pair.Value);
+			}
+		}
+		return;
+	}
+	for (int32 CellY = MinCell.Y; CellY <= MaxCell.Y; ++CellY)
+	{
+		for (int32 CellX = MinCell.X; CellX <= MaxCell.X; ++CellX)
+		{
+			if (const FCell* Cell = Cells.Find(FIntPoint(CellX, CellY)))
+			{
+				VisitCell(*Cell);
+			}
+		}
+	}
+}
+
+void UTaggedActorRegistry::GetActorsWithTag(FName Tag, TArray<const FTaggedActor*>& OutActors) const
+{
+	if (const TArray<int32>* Indices = EntriesOfTag.Find(Tag))
+	{
+		OutActors.Reserve(OutActors.Num() + Indices->Num());
+		for (const int32 Index : *Indices)
+		{
+			OutActors.Add(&Entries[Index]);
+		}
+	}
+}
+
+void UTaggedActorRegistry::QueryFrustum(const FConvexVolume& Frustum, TArray<const FTaggedActor*>& OutActors) const
+{
+	SCOPE_CYCLE_COUNTER(STAT_TaggedActors_Query);
+	Visited.Init(false, Entries.GetMaxIndex());
+	for (const TPair<FIntPoint, FCell>& Pair : Cells)
+	{
+		// whole cells outside the frustum are skipped without looking at their actors
+		const FCell& Cell = Pair.Value;
+		const FVector CellMin(Pair.Key.X * CellSize, Pair.Key.Y * CellSize, Cell.MinZ);
+		const FVector CellMax(CellMin.X + CellSize, CellMin.Y + CellSize, Cell.MaxZ);
+		if (!Frustum.IntersectBox((CellMin + CellMax) * 0.5, (CellMax - CellMin) * 0.5))
+		{
+			continue;
+		}
+		for (const int32 Index : Cell.Entries)
+		{
+			if (Visited[Index])
+			{
+				continue;
+			}
+			Visited[Index] = true;
+			const FTaggedActor& Entry = Entries[Index];
+			if (Frustum.IntersectBox(Entry.Bounds.Origin, Entry.Bounds.BoxExtent))
+			{
+				OutActors.Add(&Entry);
+			}
+		}
+	}
+}
+
+void UTaggedActorRegistry::QueryRadius(const FVector& Center, double Radius,
+                                       TArray<const FTaggedActor*>& OutActors) const
+{
+	SCOPE_CYCLE_COUNTER(STAT_TaggedActors_Query);
+	const FIntPoint MinCell = GetCell(Center.X - Radius, Center.Y - Radius);
+	const FIntPoint MaxCell = GetCell(Center.X + Radius, Center.Y + Radius);
+	const double RadiusSquared = FMath::Square(Radius);
+	ForEachCandidate(MinCell, MaxCell, [&](int32 Index)
+	{
+		const FTaggedActor& Entry = Entries[Index];
+		if (FMath::SphereAABBIntersection(Center, RadiusSquared, Entry.Bounds.GetBox()))
+		{
+			OutActors.Add(&Entry);
+		}
+	});
+}
+
+FTaggedActorRegistryStats UTaggedActorRegistry::GetStats() const
+{
+	return Stats;
+}
+
+void UTaggedActorRegistry::AddActor(AActor* Actor)
+{
+	FTaggedActor Entry;
+	if (Actor && !EntryOfActor.Contains(Actor) && Describe(Actor, Entry))
+	{
+		Add(MoveTemp(Entry));
+	}
+}
+
+void UTaggedActorRegistry::OnActorSpawned(AActor* Actor)
+{
+	if (ClassIds.Num() > 0)
+	{
+		SCOPE_CYCLE_COUNTER(STAT_TaggedActors_Update);
+		const double StartSeconds = FPlatformTime::Seconds();
+		AddActor(Actor);
+		AddUpdateTime(StartSeconds);
+	}
+}
+
+void UTaggedActorRegistry::OnActorDestroyed(AActor* Actor)
+{
+	if (const int32* Index = EntryOfActor.Find(Actor))
+	{
+		SCOPE_CYCLE_COUNTER(STAT_TaggedActors_Update);
+		const double StartSeconds = FPlatformTime::Seconds();
+		Remove(*Index);
+		AddUpdateTime(StartSeconds);
+	}
+}
+
+void UTaggedActorRegistry::OnLevelAdded(ULevel* Level, UWorld* InWorld)
+{
+	// actors of streamed in levels are loaded, not spawned
+	if (!Level || InWorld != GetWorld() || ClassIds.Num() == 0)
+	{
+		return;
+	}
+	SCOPE_CYCLE_COUNTER(STAT_TaggedActors_Update);
+	const double StartSeconds = FPlatformTime::Seconds();
+	for (AActor* Actor : Level->Actors)
+	{
+		AddActor(Actor);
+	}
+	AddUpdateTime(StartSeconds);
+}
+
+void UTaggedActorRegistry::OnLevelRemoved(ULevel* Level, UWorld* InWorld)
+{
+	// a null level means every level of the world is going away
+	if (!Level || InWorld != GetWorld())
+	{
+		return;
+	}
+	SCOPE_CYCLE_COUNTER(STAT_TaggedActors_Update);
+	const double StartSeconds = FPlatformTime::Seconds();
+	for (AActor* Actor : Level->Actors)
+	{
+		if (const int32* Index = Actor ? EntryOfActor.Find(Actor) : nullptr)
+		{
+			Remove(*Index);
+		}
+	}
+	AddUpdateTime(StartSeconds);
+}
+
+bool UTaggedActorRegistry::Describe(AActor* Actor, FTaggedActor& OutEntry) const
+{
+	if (!IsValid(Actor))
+	{
+		return false;
+	}
+	const uint8* ClassId = nullptr;
+	for (const FName& Tag : Actor->Tags)
+	{
+		ClassId = ClassIds.Find(Tag);
+		if (ClassId)
+		{
+			OutEntry.Tag = Tag;
+			break;
+		}
+	}
+	if (!ClassId)
+	{
+		return false;
+	}
+
+	OutEntry.Actor = Actor;
+	OutEntry.ClassId = *ClassId;
+	UStaticMeshComponent* MeshComponent = Actor->FindComponentByClass<UStaticMeshComponent>();
+	OutEntry.MeshComponent = MeshComponent;
+	OutEntry.Mesh = MeshComponent ? MeshComponent->GetStaticMesh() : nullptr;
+	OutEntry.Bounds = MeshComponent ? MeshComponent->Bounds : FBoxSphereBounds(Actor->GetComponentsBoundingBox(true));
+	OutEntry.bMovable = Actor->IsRootComponentMovable();
+	return true;
+}
+
+void UTaggedActorRegistry::Add(FTaggedActor&& Entry)
+{
+	const FName Tag = Entry.Tag;
+	const bool bMovable = Entry.bMovable;
+	const TWeakObjectPtr<const AActor> Actor = Entry.Actor;
+	const int32 Index = Entries.Add(MoveTemp(Entry));
+	// the sparse array reuses the slot of the last removed entry, so an actor refreshed keeps its id
+	Entries[Index].InstanceId = Index < MAX_uint16 ? static_cast<uint16>(Index + 1) : 0;
+	if (bStampActors)
+	{
+		StampActor(Entries[Index]);
+	}
+	EntryOfActor.Add(Actor, Index);
+	EntriesOfTag.FindOrAdd(Tag).Add(Index);
+	if (bMovable)
+	{
+		MovableEntries.Add(Index);
+	}
+	InsertIntoGrid(Index);
+	++Stats.NumUpdates;
+}
+
+void UTaggedActorRegistry::StampActor(const FTaggedActor& Entry) const
+{
+	AActor* Actor = Entry.Actor.Get();
+	if (!Actor)
+	{
+		return;
+	}
+	TInlineComponentArray<UPrimitiveComponent*> Components(Actor);
+	for (UPrimitiveComponent* Component : Components)
+	{
+		Component->SetRenderCustomDepth(true);
+		Component->SetCustomDepthStencilValue(ClassMarks[Entry.ClassId]);
+		Component->SetCustomPrimitiveDataFloat(USegmentationClassTable::InstanceIdDataIndex, Entry.InstanceId);
+	}
+}
+
+void UTaggedActorRegistry::Remove(int32 Index)
+{
+	RemoveFromGrid(Index);
+	const FTaggedActor& Entry = Entries[Index];
+	EntryOfActor.Remove(Entry.Actor);
+	if (TArray<int32>* Indices = EntriesOfTag.Find(Entry.Tag))
+	{
+		Indices->RemoveSwap(Index);
+		if (Indices->Num() == 0)
+		{
+			EntriesOfTag.Remove(Entry.Tag);
+		}
+	}
+	MovableEntries.Remove(Index);
+	Entries.RemoveAt(Index);
+	++Stats.NumUpdates;
+}
+
+FIntPoint UTaggedActorRegistry::GetCell(double X, double Y)
+{
+	// far outside any level, but keeps the cell coordinates in range
+	constexpr double MaxCoordinate = 1 << 20;
+	return FIntPoint(FMath::FloorToInt32(FMath::Clamp(X / CellSize, -MaxCoordinate, MaxCoordinate)),
+	                 FMath::FloorToInt32(FMath::Clamp(Y / CellSize, -MaxCoordinate, MaxCoordinate)));
+}
+
+void UTaggedActorRegistry::InsertIntoGrid(int32 Index)
+{
+	FTaggedActor& Entry = Entries[Index];
+	const FBox Box = Entry.Bounds.GetBox();
+	Entry.MinCell = GetCell(Box.Min.X, Box.Min.Y);
+	Entry.MaxCell = GetCell(Box.Max.X, Box.Max.Y);
+	for (int32 CellY = Entry.MinCell.Y; CellY <= Entry.MaxCell.Y; ++CellY)
+	{
+		for (int32 CellX = Entry.MinCell.X; CellX <= Entry.MaxCell.X; ++CellX)
+		{
+			FCell& Cell = Cells.FindOrAdd(FIntPoint(CellX, CellY));
+			Cell.Entries.Add(Index);
+			Cell.MinZ = FMath::Min(Cell.MinZ, Box.Min.Z);
+			Cell.MaxZ = FMath::Max(Cell.MaxZ, Box.Max.Z);
+		}
+	}
+	bStatsDirty = true;
+}
+
+void UTaggedActorRegistry::RemoveFromGrid(int32 Index)
+{
+	const FTaggedActor& Entry = Entries[Index];
+	for (int32 CellY = Entry.MinCell.Y; CellY <= Entry.MaxCell.Y; ++CellY)
+	{
+		for (int32 CellX = Entry.MinCell.X; CellX <= Entry.MaxCell.X; ++CellX)
+		{
+			const FIntPoint Key(CellX, CellY);
+			if (FCell* Cell = Cells.Find(Key))
+			{
+				Cell->Entries.RemoveSwap(Index);
+				if (Cell->Entries.Num() == 0)
+				{
+					Cells.Remove(Key);
+				}
+			}
+		}
+	}
+	bStatsDirty = true;
+}
+
+void UTaggedActorRegistry::AddUpdateTime(double StartSeconds)
+{
+	Stats.UpdateMilliseconds += static_cast<float>((FPlatformTime::Seconds() - StartSeconds) * 1000.0);
+	bStatsDirty = true;
+}
+
+void UTaggedActorRegistry::UpdateStats()
+{
+	int64 AllocatedBytes = Entries.GetAllocatedSize() + EntryOfActor.GetAllocatedSize() +
+		EntriesOfTag.GetAllocatedSize() + Cells.GetAllocatedSize() + MovableEntries.GetAllocatedSize() +
+		Visited.GetAllocatedSize();
+	for (const TPair<FIntPoint, FCell>& Pair : Cells)
+	{
+		AllocatedBytes += Pair.Value.Entries.GetAllocatedSize();
+	}
+	for (const TPair<FName, TArray<int32>>& Pair : EntriesOfTag)
+	{
+		AllocatedBytes += Pair.Value.GetAllocatedSize();
+	}
+	Stats.NumActors = Entries.Num();
+	Stats.NumCells = Cells.Num();
+	Stats.AllocatedBytes = AllocatedBytes;
+	bStatsDirty = false;
+
+	SET_DWORD_STAT(STAT_TaggedActors_Actors, Stats.NumActors);
+	SET_DWORD_STAT(STAT_TaggedActors_Cells, Stats.NumCells);
+	SET_MEMORY_STAT(STAT_TaggedActors_Memory, Stats.AllocatedBytes);
+}
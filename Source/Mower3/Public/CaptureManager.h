@@ -4,9 +4,113 @@
 
 #include "CoreMinimal.h"
 #include "Components/ActorComponent.h"
+#include "Async/MappedFileHandle.h"
+#include "Dom/JsonObject.h"
+#include "Math/Float16.h"
+#include "CapturePipeline.h"
+#include "CaptureScheduler.h"
+#include "CaptureSensorRig.h"
+#include "CaptureStreams.h"
+#include "FrameCodec.h"
+#include "FrameDelta.h"
+#include "FrameRecorder.h"
+#include "FrameWireFormat.h"
+#include "LabelRasterizer.h"
+#include "MeshOutlineCache.h"
+#include "ObservationPacker.h"
+#include "SegmentationClassifier.h"
+#include "SharedMemoryFrameRing.h"
 #include "CaptureManager.generated.h"
 
 class ASceneCapture2D;
+class USegmentationClassTable;
+struct mwrec_reader;
+
+/** What to do when every render request slot is already in use */
+UENUM(BlueprintType)
+enum class ECaptureOverflowPolicy : uint8
+{
+	// Wait for the oldest pending readback, throw it away and reuse its slot for the new capture. When every slot is
+	// already owned by the pipeline the new capture is dropped instead.
+	DropOldest,
+	// Skip the new capture and keep the pending readbacks
+	DropNewest,
+	// Wait until the oldest frame has been released by the pipeline before taking the new capture
+	BlockCapture
+};
+
+/** How frames are packed for the server */
+UENUM(BlueprintType)
+enum class ECaptureWireFormat : uint8
+{
+	// "imageJson" event: base64 PNG images and a json number per pixel coordinate
+	JsonBase64,
+	// "imageFrame" event: one FrameWire binary attachment, see FrameWireFormat.h
+	Binary
+};
+
+/** How binary frames get to the server */
+UENUM(BlueprintType)
+enum class ECaptureTransport : uint8
+{
+	// the whole frame is sent as a socket.io binary attachment
+	SocketIO,
+	// the frame is written to a shared memory ring named after InstanceName and only a small "frameReady"
+	// notification goes over the socket. Needs the server on the same host and the Binary wire format.
+	SharedMemory
+};
+
+/** How the pixels of each tag are described next to the images */
+UENUM(BlueprintType)
+enum class ESegmentationMaskEncoding : uint8
+{
+	// x,y of every pixel
+	PixelList,
+	// row-wise runs plus bounding box, area, centroid and connected components
+	RunLength
+};
+
+/** How the depth plane of a binary frame is packed */
+UENUM(BlueprintType)
+enum class EDepthPlaneEncoding : uint8
+{
+	// only the per tag depth stats are sent
+	None,
+	// uint16 millimetres, saturating at 65.5 m
+	Millimeters,
+	// half float metres
+	HalfFloat
+};
+
+/** What the segmentation plane of a binary frame holds */
+UENUM(BlueprintType)
+enum class ESegmentationOutput : uint8
+{
+	// one 8 bit class id per pixel, see SegmentationClasses
+	ClassIds,
+	// the RGBA segmentation readback, with class marks in R
+	Marks
+};
+
+/** Where the class of every pixel comes from */
+UENUM(BlueprintType)
+enum class ESegmentationSource : uint8
+{
+	// the segmentation capture, with PostProcessMaterial writing class marks into R
+	PostProcess,
+	// the triangles of the tagged actors drawn on the CPU, exact masks that need no segmentation render. See
+	// FLabelRasterizer.
+	CpuRaster
+};
+
+enum class ERenderRequestState : uint8
+{
+	Free,
+	// readback queued on the render thread
+	InFlight,
+	// owned by the processing pipeline until it is released
+	Processing
+};
 
 USTRUCT()
 struct FRenderRequest {
@@ -14,11 +118,126 @@ struct FRenderRequest {
 
 	TArray<FColor> Image1;
 	TArray<FColor> Image2;
+	// scene depth readback in centimetres, in R
+	TArray<FLinearColor> SceneDepth;
 	FRenderCommandFence RenderFence;
+	// Processing, the pipeline's task that sends and releases the frame
+	UE::Tasks::FTask ReleaseTask;
 	bool isPNG;
+	ERenderRequestState State;
+
+	// set at capture time, frames are sent in this order
+	uint64 FrameId;
+	// world time of the capture in seconds
+	double CaptureTime;
+	// CPU time spent in the classify, encode and serialize stages
+	double ProcessingSeconds;
+	// copied from the manager at capture time, so workers never read properties the game thread can change
+	ECaptureWireFormat WireFormat;
+	ECaptureTransport Transport;
+	ESegmentationOutput SegmentationOutput;
+	ESegmentationSource SegmentationSource;
+	ESegmentationMaskEncoding MaskEncoding;
+	bool bInstanceSegmentation;
+	bool bCaptureDepth;
+	EDepthPlaneEncoding DepthPlaneEncoding;
+	int32 DepthPercentile;
+	FFrameCodecSettings PlaneCodecs;
+	FFrameDeltaSettings PlaneDeltas;
+	FObservationSettings Observation;
+	// paint class colors into Image2
+	bool bRecolor;
+	// append the frame and VehicleState to the recording
+	bool bRecord;
+	// send the main camera's planes, false on the frames FullResolutionRateDivisor skips
+	bool bFullResolution;
+	FrameRecording::FVehicleState VehicleState;
+	int32 Width;
+	int32 Height;
+
+	// Replay, the recorded frame the decode stage fills the images from, and its index in the recording
+	TConstArrayView<uint8> ReplayRecord;
+	uint64 ReplayIndex;
+	// the first frame of a replay that started over, the decode stage forgets the planes of the previous pass
+	bool bReplayRestart;
+	// the replayed record couldn't be decoded, the other stages and the send pass it over
+	bool bSkipped;
+
+	// CpuRaster source, the camera and the instances as they were at capture time
+	FMatrix LabelViewProjection;
+	TArray<FLabelInstance> LabelInstances;
+	// keeps its scratch buffers with the pooled request
+	FLabelRasterizer LabelRasterizer;
+
+	// products of the processing pipeline stages
+	TArray<uint8> ClassIds;
+	// bInstanceSegmentation, the instance id of the actor seen in every pixel, 0 for none. Written by the rasterizer of
+	// the CpuRaster source.
+	TArray<uint16> InstanceIds;
+	// bInstanceSegmentation, every instance in InstanceIds sorted by id
+	TArray<FInstanceStats> Instances;
+	// indexed by class id, x,y pairs of every pixel of that class
+	TArray<TArray<uint16>> ClassPixelData;
+	// indexed by class id, filled instead of ClassPixelData for the RunLength mask encoding
+	TArray<FClassMask> ClassMasks;
+	// depth products, only filled when bCaptureDepth
+	TArray<uint16> DepthMm;
+	TArray<FFloat16> DepthHalf;
+	// indexed by class id
+	TArray<FClassDepthStats> ClassDepth;
+	// JsonBase64 wire format
+	FString Base64Image1;
+	FString Base64Image2;
+	TSharedPtr<FJsonObject> Json;
+	// indexed by sensor of SensorRig, read back under the same fence as the images above
+	TArray<FCaptureSensorView> SensorViews;
+	// indexed like the manager's Streams, shrunk from the images above by the classify stage
+	TArray<FCaptureStreamFrame> Streams;
+	// Binary wire format, indexed like GetFramePlanes. Planes with a tile count are sent as their delta plane, and
+	// planes with Delta section data get a Delta section.
+	TArray<TArray<uint8>> DeltaPlanes;
+	TArray<TArray<uint8>> DeltaSections;
+	TArray<int32> DeltaTileCounts;
+	// Binary wire format, data of the Observation section: an FObservationInfo and the packed color image, empty
+	// unless Observation is enabled
+	TArray<uint8> ObservationSection;
+	int32 ObservationElements;
+	// Planes whose encoding is Raw are sent from the images or delta planes above
+	TArray<TArray64<uint8>> EncodedPlanes;
+	TArray<FrameWire::EPlaneEncoding> PlaneEncodings;
+	TArray<uint8> WireData;
+	// slot and sequence of WireData in the shared memory frame ring, INDEX_NONE if it isn't in the ring
+	int32 RingSlot;
+	uint64 RingSequence;
 
 	FRenderRequest() {
 		isPNG = false;
+		State = ERenderRequestState::Free;
+		FrameId = 0;
+		CaptureTime = 0.0;
+		ProcessingSeconds = 0.0;
+		WireFormat = ECaptureWireFormat::Binary;
+		Transport = ECaptureTransport::SocketIO;
+		SegmentationOutput = ESegmentationOutput::ClassIds;
+		SegmentationSource = ESegmentationSource::PostProcess;
+		LabelViewProjection = FMatrix::Identity;
+		MaskEncoding = ESegmentationMaskEncoding::RunLength;
+		bInstanceSegmentation = false;
+		bCaptureDepth = false;
+		DepthPlaneEncoding = EDepthPlaneEncoding::Millimeters;
+		DepthPercentile = 10;
+		bRecolor = false;
+		bRecord = false;
+		bFullResolution = true;
+		FMemory::Memzero(VehicleState);
+		Width = 0;
+		Height = 0;
+		ObservationElements = 0;
+		RingSlot = INDEX_NONE;
+		RingSequence = 0;
+		ReplayIndex = 0;
+		bReplayRestart = false;
+		bSkipped = false;
 	}
 };
 
@@ -30,14 +249,6 @@ struct FScreenImageProperties {
 	int32 height;
 };
 
-USTRUCT()
-struct FModelImageProperties {
-	GENERATED_BODY()
-
-	int32 width;
-	int32 height;
-};
-
 UCLASS(ClassGroup = (Custom), meta = (BlueprintSpawnableComponent))
 class UCaptureManager : public UActorComponent
 {
@@ -53,8 +264,16 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
 	TSoftObjectPtr<ASceneCapture2D> ColorCapture;
 
+	// spawned in BeginPlay when bCaptureDepth is set
+	UPROPERTY(BlueprintReadOnly, Category = "Capture")
+	ASceneCapture2D* DepthCapture = nullptr;
+
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
 	USceneCaptureComponent2D* MySceneCap;
+
+	// extra views sent with every binary frame, looked up on the owner in BeginPlay if not set
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	UCaptureSensorRig* SensorRig = nullptr;
 	
 	// UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
 	// UTextureRenderTarget2D* RenderTarget2D;
@@ -62,49 +281,254 @@ public:
 	UPROPERTY(EditAnywhere, Category="Segmentation Setup")
 	UMaterial* PostProcessMaterial = nullptr;
 
+	// classes told apart by the value PostProcessMaterial writes into R, class ids are assigned in this order from 1
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="Segmentation Setup")
+	TArray<FSegmentationClassDefinition> SegmentationClasses;
+
+	// replaces SegmentationClasses when set, and can have the tagged actors stamped with their marks and instance ids
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="Segmentation Setup")
+	TObjectPtr<USegmentationClassTable> ClassTable;
+
+	// sends the instance id of every pixel and the pixel count and bounds of every actor seen, drawn by the CpuRaster
+	// source. The shipped segmentation material doesn't write ids into G and B, so with the PostProcess source this is
+	// turned off with an error when the next frame is captured.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Segmentation Setup")
+	bool bInstanceSegmentation = false;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Segmentation Setup")
+	ESegmentationOutput SegmentationOutput = ESegmentationOutput::ClassIds;
+
+	// read in BeginPlay, CpuRaster stops the segmentation capture from rendering
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category="Segmentation Setup")
+	ESegmentationSource SegmentationSource = ESegmentationSource::PostProcess;
+
+	// mesh LOD drawn by the CpuRaster source, clamped to the LODs of each mesh. The meshes need Allow CPU Access in
+	// cooked builds.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Segmentation Setup", meta = (ClampMin = "0"))
+	int32 LabelMeshLOD = 0;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Segmentation Setup")
+	ESegmentationMaskEncoding MaskEncoding = ESegmentationMaskEncoding::RunLength;
+
+	// paint each class's DebugColor into the color image. Always on for the JsonBase64 wire format.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Segmentation Setup")
+	bool bRecolorDebugImage = false;
+
+	// read back scene depth with the other two images and send per tag min, mean and percentile distances. The depth
+	// capture is spawned in BeginPlay, so turning this on later only works if it was on then.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Depth")
+	bool bCaptureDepth = false;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Depth")
+	EDepthPlaneEncoding DepthPlaneEncoding = EDepthPlaneEncoding::Millimeters;
+
+	// the per tag percentile distance, low values give a near distance that ignores a few stray pixels
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category="Depth", meta = (ClampMin = "0", ClampMax = "100"))
+	int32 DepthPercentile = 10;
+
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = SocketIO, meta = (AllowPrivateAccess = "true"))
 	class USocketIOClientComponent* SIOClientComponent;
 
 	FString InstanceName = "default";
+
+	// size of the main camera's images, read once in BeginPlay
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Capture", meta = (ClampMin = "16", ClampMax = "4096"))
+	FIntPoint CaptureResolution = FIntPoint(400, 400);
+
+	// lower resolution copies of the main camera's images, each with its own rate and codec. The scene is rendered
+	// once at CaptureResolution and the streams are shrunk from it on the pipeline workers. Binary frames only, read
+	// once in BeginPlay.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Capture")
+	TArray<FCaptureStreamSettings> Streams;
+
+	// the main camera's own planes are sent with every this many frames, the frames between only carry the streams,
+	// the sensor rig views and the sections. Binary frames only.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture", meta = (ClampMin = "1"))
+	int32 FullResolutionRateDivisor = 1;
+
+	// number of preallocated render request slots, i.e. the max number of readbacks in flight
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Capture", meta = (ClampMin = "1", ClampMax = "32"))
+	int32 RenderRequestPoolSize = 4;
+
+	// when to capture, read every tick so it can be changed while playing
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	FCaptureScheduleSettings Schedule;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	ECaptureOverflowPolicy OverflowPolicy = ECaptureOverflowPolicy::DropOldest;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	ECaptureWireFormat WireFormat = ECaptureWireFormat::Binary;
+
+	// how each stream of planes of binary frames is compressed, read at capture time
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	FFrameCodecSettings PlaneCodecs;
+
+	// whether binary frames only carry the tiles that changed since the previous frame, read at capture time
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	FFrameDeltaSettings PlaneDeltas;
+
+	// resize, crop and normalize the color image into a model input tensor on the pipeline workers, so the server
+	// can batch it as is. Binary frames only, read at capture time.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	FObservationSettings Observation;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	ECaptureTransport Transport = ECaptureTransport::SocketIO;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Capture", meta = (ClampMin = "2"))
+	int32 SharedMemoryRingSlots = 8;
+
+	// frames bigger than this are sent over the socket instead
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Capture", meta = (ClampMin = "1"))
+	int32 SharedMemorySlotSizeMB = 4;
+
+	// number of task graph workers that classify and encode frames in parallel
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Capture", meta = (ClampMin = "1", ClampMax = "16"))
+	int32 NumPipelineWorkers = 2;
+
+	// append every frame, with the vehicle state at capture time and the actions the server answers with, to a
+	// FrameRecording file in RecordingDirectory. Read once in BeginPlay.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Recording")
+	bool bRecord = false;
+
+	// Saved/Recordings if empty, files are named after InstanceName and the time the recording started
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Recording")
+	FString RecordingDirectory;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Recording", meta = (ClampMin = "1", ClampMax = "256"))
+	int32 RecordingChunkSizeMB = 8;
+
+	// chunks that may wait for the disk before records are dropped, the recorder holds this many + 1 in memory
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Recording", meta = (ClampMin = "1", ClampMax = "64"))
+	int32 RecordingMaxQueuedChunks = 8;
+
+	// replay the frames of this recording through the pipeline and send path instead of capturing, so the pipeline can
+	// be measured without the renderer. Read once in BeginPlay, nothing is recorded while replaying.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Replay")
+	FString ReplayRecording;
+
+	// 1 replays at the recorded pace, 0 as fast as render request slots free up
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Replay", meta = (ClampMin = "0"))
+	float ReplaySpeed = 0.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Replay")
+	bool bLoopReplay = false;
+
+	// readbacks currently waiting on the gpu
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Capture|Stats")
+	int32 InFlightRenderRequests = 0;
+
+	// frames that have landed and are being processed by the pipeline
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Capture|Stats")
+	int32 ProcessingRenderRequests = 0;
+
+	// captures thrown away because the pool was full
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Capture|Stats")
+	int32 DroppedFrameCount = 0;
+
+	// the rate the scheduler currently aims for
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Capture|Stats")
+	float CaptureRateHz = 0.0f;
+
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Capture|Stats")
+	float AchievedCaptureRateHz = 0.0f;
+
+	// captures that were due but fell between two ticks
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Capture|Stats")
+	int32 SkippedCaptureCount = 0;
+
+	// sent frames the server hasn't acknowledged yet, -1 until it acknowledges one
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Capture|Stats")
+	int32 UnacknowledgedFrameCount = -1;
+
+	// records the recorder had to drop because the disk fell behind
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Recording|Stats")
+	int32 DroppedRecordCount = 0;
+
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Replay|Stats")
+	int32 ReplayedFrameCount = 0;
+
+	/**
+	 * Records the throttles the server answered frame FrameId with. Game thread only, ignored when not recording.
+	 */
+	void RecordAction(uint64 FrameId, float LeftThrottle, float RightThrottle);
 private:
-	// RenderRequest Queue
-	TQueue<FRenderRequest*> RenderRequestQueue;
+	// Fixed pool of render requests, allocated once in BeginPlay. Every slot is on one of the lists below. Readbacks
+	// land and the pipeline releases frames in capture order, but a pending readback can be thrown away while the
+	// pipeline still owns older frames, so the slots aren't kept in a ring.
+	TArray<FRenderRequest> RenderRequestPool;
+	TArray<FRenderRequest*> FreeRenderRequests;
+	// readbacks in flight, oldest first
+	TArray<FRenderRequest*> PendingReadbacks;
+	// frames owned by the pipeline, oldest first
+	TArray<FRenderRequest*> ProcessingFrames;
+	uint64 NextFrameId = 0;
+
+	TUniquePtr<FCapturePipeline> Pipeline;
+	// frames handed back by the pipeline, sent to the server and returned to the pool on the game thread
+	TQueue<FRenderRequest*, EQueueMode::Mpsc> ReleasedRenderRequests;
+
+	// opened in BeginPlay when Transport is SharedMemory, only written by the pipeline's send stage
+	TUniquePtr<FSharedMemoryFrameRing> FrameRing;
+
+	// opened in BeginPlay when bRecord is set, frames are appended by the pipeline's send stage
+	TUniquePtr<FFrameRecorder> Recorder;
+
+	// mapped in BeginPlay when ReplayRecording is set, frames are read straight from the mapping
+	TUniquePtr<IMappedFileHandle> ReplayFile;
+	TUniquePtr<IMappedFileRegion> ReplayRegion;
+	mwrec_reader* ReplayReader = nullptr;
+	uint64 NextReplayFrame = 0;
+	// the replay started over, the next frame submitted restarts the decoder
+	bool bReplayRestart = false;
+	// world time the replay (re)started, and the timestamp of the first frame, for ReplaySpeed
+	double ReplayStartTime = 0.0;
+	double ReplayFirstTimestamp = 0.0;
+	// wall clock for the throughput logged when the replay ends
+	double ReplayStartSeconds = 0.0;
+	bool bReplayFinished = false;
+	// only used by the pipeline's decode stage, which runs one frame at a time in submission order
+	mutable FrameWire::FFrameView ReplayFrame;
+	// rebuilds the whole planes of the recorded frames, planes of ReplayFrame point into it
+	mutable FFrameDeltaDecoder ReplayDecoder;
 
 	FScreenImageProperties ScreenImageProperties = { 0 };
-	// const FModelImageProperties ModelImageProperties = { 640, 480 };
-	const int32 wh = 400;
-	const FModelImageProperties ModelImageProperties = { wh, wh };
 
-	// count of total frames captured
-	int frameCount = 1;
-	// capture every frameMod frames
-	int frameMod = 5;
+	FCaptureScheduler Scheduler;
+	// ids of frames that left the pipeline, oldest first, until the server acknowledges them
+	TArray<uint64> UnacknowledgedFrameIds;
+	static constexpr int32 MaxTrackedUnacknowledgedFrames = 256;
+	bool bServerAcknowledges = false;
+
+	// lookup tables compiled from ClassTable or SegmentationClasses in BeginPlay
+	FSegmentationClassifier Classifier;
+
+	// built in BeginPlay, pipeline workers only encode with it
+	FFrameCodecs FrameCodecs;
 
-	const TMap<int, TPair<FString, FColor>> MapOfMarks = {
-		{133, {"Wall", FColor(255, 0, 0, 255)}},
-		{250, {"Tree", FColor(0, 0, 255, 255)}}
-	};
+	// only used by the pipeline's delta stage, which runs one frame at a time in order. Keyframes are requested from
+	// anywhere.
+	mutable FFrameDeltaEncoder DeltaEncoder;
 
-	const TSet<int> ObjectTagIds = {
-		133,
-		250
-	};
+	// outlines of the meshes DoImageSegmentation has drawn, each built once from its vertices
+	FMeshOutlineCache OutlineCache;
+	// triangles of the meshes the CpuRaster source draws, shared with the pipeline workers
+	FLabelMeshCache LabelMeshCache;
 
 	TMap<FString, TArray<TPair<FVector2d, float>>> MapTagToPixelLocationAndDistance;
 	// store array where x,y,dist are stored one after the other, and store the size for each tag so can pull those from array
 	TMap<FString, int> MapTagToPixelLocationAndDistanceSize;
 	// store array where x,y,dist are stored one after the other, and store the size for each tag so can pull those from array
 	TArray<float> PixelLocationAndDistanceArray;
-	TMap<FString, TArray<float>> MapTagToPixelData;
 
 	
 protected:
 	// Called when the game starts
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
 public:
-	void ProcessImageData(TArray<FColor>& ImageData1, TArray<FColor>& ImageData2);
-
 	virtual void TickComponent(float DeltaTime, ELevelTick TickType,
 	                           FActorComponentTickFunction* ThisTickFunction) override;
 	bool ProjectWorldLocationToCapturedScreen(USceneCaptureComponent2D* InCaptureComponent,
@@ -114,17 +538,60 @@ public:
 	FVector2D ProjectWorldPointToImage(FVector InWorldLocation, USceneCaptureComponent2D* InCaptureComponent);
 	TArray<FVector> GetOutlineOfStaticMesh(UStaticMesh* StaticMesh, FTransform& ComponentToWorldTransform);
 	
+	// @return true if a readback was queued
 	UFUNCTION(BlueprintCallable, Category = "ImageCapture")
-	void CaptureColorNonBlocking(USceneCaptureComponent2D* CaptureComponent, bool IsSegmentation = false);
+	bool CaptureColorNonBlocking(USceneCaptureComponent2D* CaptureComponent, bool IsSegmentation = false);
 
-	void SendImageToServer(TArray<FColor>& ImageData1, TArray<FColor>& ImageData2) const;
-	void FColorImgToB64(TArray<FColor>& ImageData, FString& base64) const;
-	void ColorImageObjects(TArray<FColor>& ImageData1, TArray<FColor>& ImageData2);
+	// Pipeline stages, run on worker threads. They only touch the frame they are given and const members.
+	void DecodeReplayFrame(FRenderRequest& Frame) const;
+	void ClassifyFrame(FRenderRequest& Frame) const;
+	void ColorImageObjects(FRenderRequest& Frame) const;
+	void RasterizeLabels(FRenderRequest& Frame) const;
+	void DownsampleStreams(FRenderRequest& Frame) const;
+	void DiffFrame(FRenderRequest& Frame) const;
+	void EncodeImages(FRenderRequest& Frame) const;
+	void PackObservation(FRenderRequest& Frame) const;
+	void SerializeFrame(FRenderRequest& Frame) const;
+	void WriteFrameRing(FRenderRequest& Frame) const;
+	void RecordFrame(const FRenderRequest& Frame) const;
+	void SerializeFrameJson(FRenderRequest& Frame) const;
+	TSharedPtr<FJsonObject> MasksToJson(const FRenderRequest& Frame) const;
+	TSharedPtr<FJsonObject> DepthToJson(const FRenderRequest& Frame) const;
+	static TArray<TSharedPtr<FJsonValue>> InstancesToJson(const FRenderRequest& Frame);
+	void SerializeFrameBinary(FRenderRequest& Frame) const;
+	void GetFramePlanes(const FRenderRequest& Frame, TArray<FrameWire::FPlane, TInlineAllocator<4>>& OutPlanes) const;
+	void GetDeltaFramePlanes(const FRenderRequest& Frame,
+	                         TArray<FrameWire::FPlane, TInlineAllocator<4>>& OutPlanes) const;
+	static EFrameCodec GetPlaneCodec(const FRenderRequest& Frame, const FrameWire::FPlane& Plane);
+	void FColorImgToB64(const TArray<FColor>& ImageData, int32 Width, int32 Height, FString& base64) const;
 
 	void DoImageSegmentation(TArray<FColor>& ImageData, USceneCaptureComponent2D* InCaptureComponent);
 
 private:
 	void SetupColorCaptureComponent(ASceneCapture2D* ParamCapture);
 	void SetupSegmentationCaptureComponent(ASceneCapture2D* ParamCapture);
-	void SpawnSegmentationCaptureComponent(ASceneCapture2D* ParamCapture);
+	void SetupDepthCaptureComponent(ASceneCapture2D* ParamCapture);
+	ASceneCapture2D* SpawnAttachedCaptureComponent(ASceneCapture2D* ParamCapture);
+
+	void InitRenderRequestPool();
+	void InitStreamFrames(TArray<FCaptureStreamFrame>& OutStreams) const;
+	void GatherLabelInstances(USceneCaptureComponent2D* CaptureComponent, FRenderRequest& RenderRequest);
+	void OpenFrameRing();
+	void OpenRecorder();
+	void GetVehicleState(FrameRecording::FVehicleState& OutState) const;
+	void OpenReplay();
+	void CloseReplay();
+	void ReplayFrames();
+	void FillReplayRequest(const FrameWire::FFrameView& Frame, FRenderRequest& RenderRequest) const;
+	static TConstArrayView<uint8> GetReplayPlanePixels(const FrameWire::FFrameView& Frame, FrameWire::EPlaneKind Kind,
+	                                                   FrameWire::EPixelFormat& OutPixelFormat);
+	FRenderRequest* AcquireRenderRequest();
+	void SubmitOldestInFlightRenderRequest();
+	void DiscardOldestInFlightRenderRequest();
+	void CollectReleasedRenderRequests();
+	// game thread only, the socket.io client isn't safe to emit from the pipeline's workers
+	void SendImageToServer(FRenderRequest& Frame) const;
+	void BindFrameAcknowledgements();
+	void OnFrameAcknowledged(uint64 FrameId);
+	void DrainCompletedRenderRequests();
 };
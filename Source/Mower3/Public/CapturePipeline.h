@@ -0,0 +1,60 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Tasks/Pipe.h"
+#include "Tasks/Task.h"
+
+struct FRenderRequest;
+
+/**
+ * Runs captured frames through classify -> delta -> encode -> serialize -> send on task graph workers, after an
+ * optional decode that runs one frame at a time in submission order, e.g. for replayed frames.
+ *
+ * Frames are handed round robin to NumWorkers pipes, so up to NumWorkers frames are classified and encoded at the
+ * same time. Delta and send each run on their own pipe and wait for the previous frame's delta or send, so frames are
+ * diffed against each other and leave in the order they were submitted. The pipeline doesn't own any memory: every
+ * frame is a slot of the capture pool, which bounds how many frames can be queued between stages. Release is called
+ * last, on the send pipe, to hand the slot back.
+ */
+class FCapturePipeline
+{
+public:
+	using FStageFunction = TFunction<void(FRenderRequest&)>;
+
+	struct FStages
+	{
+		// may be unset
+		FStageFunction Decode;
+		FStageFunction Classify;
+		FStageFunction Delta;
+		FStageFunction Encode;
+		FStageFunction Serialize;
+		FStageFunction Send;
+		FStageFunction Release;
+	};
+
+	FCapturePipeline(int32 NumWorkers, FStages InStages);
+	~FCapturePipeline();
+
+	// Game thread only. Returns the task that sends and releases the frame, which completes after every frame
+	// submitted before it has been released.
+	UE::Tasks::FTask Submit(FRenderRequest& Frame);
+
+	// Blocks until every submitted frame has been released
+	void Flush();
+
+	int32 GetNumWorkers() const { return WorkerPipes.Num(); }
+
+private:
+	FStages Stages;
+	TArray<TUniquePtr<UE::Tasks::FPipe>> WorkerPipes;
+	UE::Tasks::FPipe DecodePipe;
+	UE::Tasks::FTask LastDecodeTask;
+	UE::Tasks::FPipe DeltaPipe;
+	UE::Tasks::FTask LastDeltaTask;
+	UE::Tasks::FPipe SendPipe;
+	UE::Tasks::FTask LastSendTask;
+	int32 NextWorker = 0;
+};
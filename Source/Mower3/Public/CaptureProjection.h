@@ -0,0 +1,44 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ConvexVolume.h"
+
+class USceneCaptureComponent2D;
+
+/**
+ * The view-projection of a scene capture at the time it is built, so a frame's points are projected into the
+ * capture's image against one matrix instead of rebuilding it from the camera for every point.
+ */
+class FCaptureProjection
+{
+public:
+	FCaptureProjection(USceneCaptureComponent2D* CaptureComponent, FIntPoint ImageSize);
+
+	/**
+	 * Same as FSceneView::ProjectWorldToScreen
+	 * @return false if the location is behind the camera
+	 */
+	bool Project(const FVector& WorldLocation, FVector2D& OutPixel) const;
+
+	// false if the bounds are entirely outside the view frustum
+	bool IsVisible(const FBoxSphereBounds& WorldBounds) const;
+
+	/**
+	 * Projects the points of one instance, four at a time, and appends the pixels of the ones in front of the camera.
+	 * Pixels can lie outside the image.
+	 * @param X, Y, Z local coordinates of Num points
+	 */
+	void ProjectPoints(const FMatrix& LocalToWorld, const float* X, const float* Y, const float* Z, int32 Num,
+	                   TArray<FVector2f>& OutPixels) const;
+
+	const FMatrix& GetViewProjection() const { return ViewProjection; }
+	const FIntRect& GetViewRect() const { return ViewRect; }
+	const FConvexVolume& GetFrustum() const { return Frustum; }
+
+private:
+	FMatrix ViewProjection;
+	FIntRect ViewRect;
+	FConvexVolume Frustum;
+};
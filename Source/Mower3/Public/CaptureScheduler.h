@@ -0,0 +1,117 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CaptureScheduler.generated.h"
+
+/** What paces the captures */
+UENUM(BlueprintType)
+enum class ECaptureTrigger : uint8
+{
+	// a fixed rate in simulation time, independent of the render frame rate
+	SimulationTime,
+	// every FramesPerCapture rendered frames, or more when the rate is adapted down
+	FrameCount
+};
+
+USTRUCT(BlueprintType)
+struct FCaptureScheduleSettings
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	ECaptureTrigger Trigger = ECaptureTrigger::SimulationTime;
+
+	// fastest cadence of the FrameCount trigger
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture", meta = (ClampMin = "1"))
+	int32 FramesPerCapture = 5;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture", meta = (ClampMin = "0.1"))
+	float MinRateHz = 1.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture", meta = (ClampMin = "0.1"))
+	float MaxRateHz = 12.0f;
+
+	// lower the rate on backpressure and raise it again while the pipeline and the server keep up,
+	// otherwise always capture at MaxRateHz / every FramesPerCapture frames
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	bool bAdaptive = true;
+
+	// average CPU time capture processing may cost per rendered frame, game thread and pipeline workers together.
+	// 0 for no limit.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture", meta = (ClampMin = "0"))
+	float CpuBudgetMs = 4.0f;
+
+	// back off while the server has more frames than this it hasn't acknowledged. 0 to ignore acknowledgements.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture", meta = (ClampMin = "0"))
+	int32 MaxUnacknowledgedFrames = 4;
+};
+
+/** What the capture manager measured this tick */
+struct FCaptureLoad
+{
+	// readbacks in flight plus frames in the pipeline
+	int32 PendingFrames = 0;
+	int32 MaxPendingFrames = 1;
+	int32 NumWorkers = 1;
+	// INDEX_NONE until the server has acknowledged a frame, servers that never do are not waited for
+	int32 UnacknowledgedFrames = INDEX_NONE;
+};
+
+/**
+ * Decides on which ticks UCaptureManager captures.
+ *
+ * The rate is adapted additive increase, multiplicative decrease: it backs off when every capture slot is taken or
+ * the server falls behind on acknowledgements, holds while the slots are half used, and otherwise creeps back up.
+ * On top of that it is capped by what the pipeline workers can process and by the CPU budget, both from the
+ * measured cost of recent frames. Game thread only.
+ */
+class FCaptureScheduler
+{
+public:
+	void Reset(double Now);
+
+	/**
+	 * @param Now simulation time in seconds
+	 * @return true if a capture is due this tick
+	 */
+	bool Tick(const FCaptureScheduleSettings& Settings, double Now, float DeltaTime, const FCaptureLoad& Load);
+
+	/**
+	 * @param GameThreadSeconds what queuing the capture cost the game thread
+	 */
+	void OnCaptureTaken(double GameThreadSeconds);
+
+	/**
+	 * @param WorkerSeconds CPU time the frame spent in the pipeline's classify, encode and serialize stages
+	 */
+	void OnFrameProcessed(double WorkerSeconds);
+
+	// the rate captures are currently scheduled at
+	float GetRateHz() const { return RateHz; }
+	// captures actually taken per second, over the last second
+	float GetAchievedRateHz() const { return AchievedRateHz; }
+	// capture periods of the SimulationTime trigger that passed between two ticks without a capture
+	int32 GetSkippedCount() const { return SkippedCount; }
+
+private:
+	void Adapt(const FCaptureScheduleSettings& Settings, double Now, const FCaptureLoad& Load, float MinRate,
+	           float MaxRate);
+
+	float RateHz = 0.0f;
+	float AchievedRateHz = 0.0f;
+	int32 SkippedCount = 0;
+
+	double NextCaptureTime = 0.0;
+	int32 FramesSinceCapture = 0;
+	double LastAdaptTime = 0.0;
+
+	double WindowStart = 0.0;
+	int32 WindowCaptures = 0;
+
+	// exponential moving averages, 0 until the first sample
+	float SmoothedFps = 0.0f;
+	double SmoothedWorkerMs = 0.0;
+	double SmoothedGameThreadMs = 0.0;
+};
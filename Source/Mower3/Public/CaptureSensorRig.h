@@ -0,0 +1,111 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/SceneComponent.h"
+#include "Engine/EngineTypes.h"
+#include "FrameWireFormat.h"
+#include "CaptureSensorRig.generated.h"
+
+class UMaterialInterface;
+class USceneCaptureComponent2D;
+class FTextureRenderTargetResource;
+
+USTRUCT(BlueprintType)
+struct FCaptureSensorSettings
+{
+	GENERATED_BODY()
+
+	// sent with the sensor's planes, at most FrameWire::MaxTagLength bytes
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Sensor")
+	FName Name = TEXT("Sensor");
+
+	// relative to the rig
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Sensor")
+	FTransform RelativeTransform;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Sensor", meta = (ClampMin = "16", ClampMax = "4096"))
+	int32 Width = 400;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Sensor", meta = (ClampMin = "16", ClampMax = "4096"))
+	int32 Height = 400;
+
+	// SCS_SceneDepth is sent as a millimetre depth plane, every other source as a BGRA color plane
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Sensor")
+	TEnumAsByte<ESceneCaptureSource> CaptureSource = SCS_FinalColorLDR;
+
+	// e.g. the segmentation material
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Sensor")
+	UMaterialInterface* PostProcessMaterial = nullptr;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Sensor", meta = (ClampMin = "5", ClampMax = "170"))
+	float FOVAngle = 90.0f;
+
+	// captured with every RateDivisor-th frame of the capture manager
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Sensor", meta = (ClampMin = "1"))
+	int32 RateDivisor = 1;
+};
+
+/** One sensor's slot in a pooled render request. The buffers keep their allocation from frame to frame. */
+struct FCaptureSensorView
+{
+	// false if the sensor was not due for this frame
+	bool bCaptured = false;
+	bool bDepth = false;
+	int32 Width = 0;
+	int32 Height = 0;
+	FString Name;
+	FrameWire::FViewInfo Info = {};
+
+	// readback, color sensors fill Pixels and depth sensors SceneDepth (centimetres, in R)
+	TArray<FColor> Pixels;
+	TArray<FLinearColor> SceneDepth;
+	// filled by the pipeline for depth sensors
+	TArray<uint16> DepthMm;
+
+	// only valid between UCaptureSensorRig::CaptureDueSensors and queuing the readback
+	FTextureRenderTargetResource* RenderTarget = nullptr;
+};
+
+/**
+ * Extra cameras around the mower, read back by UCaptureManager together with its own captures.
+ *
+ * Every sensor gets its own scene capture component and render target in BeginPlay. The captures don't render every
+ * frame: when the manager takes a frame, the sensors that are due are rendered right then and their readbacks go into
+ * the same render command as the manager's, so one fence covers all views of the frame. Their planes are sent in the
+ * binary frame next to the main camera's, see FrameWire::FViewInfo. The JsonBase64 format doesn't carry them.
+ */
+UCLASS(ClassGroup = (Custom), meta = (BlueprintSpawnableComponent))
+class UCaptureSensorRig : public USceneComponent
+{
+	GENERATED_BODY()
+
+public:
+	UCaptureSensorRig();
+
+	// read once in BeginPlay
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Sensors")
+	TArray<FCaptureSensorSettings> Sensors;
+
+	// one per entry of Sensors, created in BeginPlay
+	UPROPERTY(Transient, BlueprintReadOnly, Category = "Sensors")
+	TArray<USceneCaptureComponent2D*> CaptureComponents;
+
+	/** Sizes the views of a pooled render request for every sensor */
+	void InitViews(TArray<FCaptureSensorView>& OutViews) const;
+
+	/**
+	 * Renders the sensors that are due for capture number CaptureIndex and marks their views as captured.
+	 * Game thread only, the caller queues the readbacks of the captured views.
+	 * @return number of sensors captured
+	 */
+	int32 CaptureDueSensors(uint64 CaptureIndex, TArray<FCaptureSensorView>& InOutViews);
+
+protected:
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+private:
+	USceneCaptureComponent2D* CreateCaptureComponent(const FCaptureSensorSettings& Sensor);
+};
@@ -0,0 +1,77 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FrameCodec.h"
+#include "FrameWireFormat.h"
+#include "CaptureStreams.generated.h"
+
+USTRUCT(BlueprintType)
+struct FCaptureStreamSettings
+{
+	GENERATED_BODY()
+
+	// tag of the stream's Stream section, at most FrameWire::MaxTagLength bytes
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	FName Name = TEXT("Stream");
+
+	// the stream's images are the main camera's shrunk by this factor in both directions
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture", meta = (ClampMin = "1", ClampMax = "16"))
+	int32 Downsample = 4;
+
+	// sent with every RateDivisor-th frame
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture", meta = (ClampMin = "1"))
+	int32 RateDivisor = 1;
+
+	// of the stream's color plane, its other planes use the codecs of their kind
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	EFrameCodec Codec = EFrameCodec::LZ4;
+
+	// also send class ids, when the segmentation output is class ids
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	bool bClassIds = true;
+
+	// also send millimetre depth, when the manager captures depth
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	bool bDepth = false;
+};
+
+/** One stream's slot in a pooled render request. The buffers keep their allocation from frame to frame. */
+struct FCaptureStreamFrame
+{
+	// false if the stream was not due for this frame
+	bool bDue = false;
+	bool bClassIds = false;
+	bool bDepth = false;
+	EFrameCodec Codec = EFrameCodec::LZ4;
+	int32 Width = 0;
+	int32 Height = 0;
+	FString Name;
+	FrameWire::FStreamInfo Info = {};
+
+	TArray<FColor> Color;
+	TArray<uint8> ClassIds;
+	TArray<uint16> DepthMm;
+};
+
+/**
+ * Shrinks the main camera's images into the planes of lower resolution streams, so the scene is rendered once and
+ * sent at several sizes. Partial blocks at the right and bottom edges become whole output pixels.
+ */
+namespace CaptureStreams
+{
+	constexpr int32 MaxDownsample = 16;
+
+	// size of an image shrunk by Downsample
+	FIntPoint GetSize(int32 Width, int32 Height, int32 Downsample);
+
+	// the average of every Downsample x Downsample block, rounded
+	void DownsampleColor(const FColor* Source, int32 Width, int32 Height, int32 Downsample, FColor* Out);
+
+	// the class of the centre pixel of every block, averaging class ids would make up classes
+	void DownsampleClassIds(const uint8* Source, int32 Width, int32 Height, int32 Downsample, uint8* Out);
+
+	// the nearest depth of every block, so obstacles don't get further away
+	void DownsampleDepth(const uint16* Source, int32 Width, int32 Height, int32 Downsample, uint16* Out);
+}
@@ -0,0 +1,122 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/ActorComponent.h"
+#include "GrassInstanceGrid.h"
+#include "CoverageMap.generated.h"
+
+/**
+ * The mowed part of the lawn as one bit per cell of a uniform grid over X and Y. A cell is mowed once a deck covers
+ * its centre.
+ *
+ * The bits are stored in tiles of 64 by 64 cells, one 64 bit word per tile row, so a deck sets up to 64 cells of a
+ * row at once and touches a few kilobytes. Every tile keeps its count of mowed cells, so the covered fraction of the
+ * lawn or of a region is a sum over tiles rather than cells. Not thread safe.
+ */
+class MOWER3_API FCoverageMap
+{
+public:
+	// cells along a side of a tile
+	static constexpr int32 TileSize = 64;
+
+	/**
+	 * Allocates the map over the area, with nothing mowed
+	 * @param InCellSize side of a cell in centimetres
+	 * @return false if the area is empty or its tiles would hold more than MaxCells cells
+	 */
+	bool Init(const FBox2D& Area, double InCellSize);
+	// forgets what was mowed, keeping the area
+	void Clear();
+	bool IsInitialized() const { return NumCellsX > 0; }
+
+	// marks the cells whose centres are under the deck
+	void AddDeck(const FMowingDeck& Deck);
+	// marks the cells whose centres are inside the area
+	void AddArea(const FMowingArea& Area) { AddConvex(Area.Vertices.GetData(), Area.Vertices.Num()); }
+
+	bool IsCovered(const FVector2D& Location) const;
+	int64 GetNumCells() const { return static_cast<int64>(NumCellsX) * NumCellsY; }
+	int64 GetNumCovered() const { return NumCovered; }
+	double GetCoveredFraction() const;
+	// covered fraction of the cells whose centres are in the region, 0 if there are none
+	double GetCoveredFraction(const FBox2D& Region) const;
+
+	int32 GetNumTilesX() const { return NumTilesX; }
+	int32 GetNumTilesY() const { return NumTilesY; }
+	// mowed cells of the tile, out of TileSize * TileSize
+	int32 GetTileCount(int32 TileX, int32 TileY) const { return TileCounts[TileY * NumTilesX + TileX]; }
+	double GetCellSize() const { return CellSize; }
+	SIZE_T GetAllocatedSize() const { return Words.GetAllocatedSize() + TileCounts.GetAllocatedSize(); }
+
+	// 512 MB of bits, a square kilometre at 2 cm
+	static constexpr int64 MaxCells = 1ll << 32;
+
+private:
+	// marks the cells whose centres are inside the convex polygon, in any winding
+	void AddConvex(const FVector2D* Vertices, int32 NumVertices);
+	// marks cells X0 to X1 of row Y, inclusive
+	void AddSpan(int32 Y, int32 X0, int32 X1);
+	// mowed cells among X0 to X1 of row Y, inclusive
+	int64 CountSpan(int32 Y, int32 X0, int32 X1) const;
+	uint64 GetSpanMask(int32 TileX, int32 X0, int32 X1) const;
+	int64 GetWordIndex(int32 TileX, int32 Y) const
+	{
+		return (static_cast<int64>(Y / TileSize) * NumTilesX + TileX) * TileSize + Y % TileSize;
+	}
+
+	FVector2D Origin = FVector2D::ZeroVector;
+	double CellSize = 5.0;
+	int32 NumCellsX = 0;
+	int32 NumCellsY = 0;
+	int32 NumTilesX = 0;
+	int32 NumTilesY = 0;
+	// tile after tile, each TileSize rows of one word, bit X of a word is cell X of the row
+	TArray<uint64> Words;
+	TArray<uint16> TileCounts;
+	int64 NumCovered = 0;
+};
+
+/**
+ * Keeps an FCoverageMap of what the mower's deck has covered, for rewards and progress that don't have to be
+ * inferred from images. The owner adds the deck, or the area it swept, every tick. The map is allocated with the
+ * first deck, over Area, or over the grass indexed by UGrassMowingSubsystem when Area is empty.
+ */
+UCLASS(ClassGroup = (Custom), meta = (BlueprintSpawnableComponent))
+class MOWER3_API UCoverageMapComponent : public UActorComponent
+{
+	GENERATED_BODY()
+
+public:
+	// side of a cell in centimetres, 5 cm keeps a hectare in 0.5 MB
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Coverage", meta = (ClampMin = "1"))
+	float CellSize = 5.0f;
+
+	// area of the lawn on X and Y, the bounds of the grass when empty
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Coverage")
+	FBox2D Area = FBox2D(ForceInit);
+
+	UCoverageMapComponent();
+
+	void AddDeck(const FMowingDeck& Deck);
+	void AddArea(const FMowingArea& MowedArea);
+
+	UFUNCTION(BlueprintCallable, Category = "Coverage")
+	float GetCoveredFraction() const;
+
+	UFUNCTION(BlueprintCallable, Category = "Coverage")
+	float GetRegionCoveredFraction(FVector2D Min, FVector2D Max) const;
+
+	// forgets what was mowed
+	UFUNCTION(BlueprintCallable, Category = "Coverage")
+	void ClearCoverage();
+
+	const FCoverageMap& GetMap() const { return Map; }
+
+private:
+	bool InitMap();
+
+	FCoverageMap Map;
+	bool bInitFailed = false;
+};
@@ -0,0 +1,128 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FrameWireFormat.h"
+#include "FrameCodec.generated.h"
+
+/** How the planes of one stream of binary frames are compressed */
+UENUM(BlueprintType)
+enum class EFrameCodec : uint8
+{
+	// uncompressed pixels
+	Raw,
+	// LZ4 blocks of the pixels with their bytes grouped by channel, fast and lossless for every pixel format
+	LZ4,
+	// QOI, fast lossless for color. Planes that aren't BGRA8 get LZ4.
+	QOI,
+	// lossless and usually the smallest for class ids and depth, but the slowest to encode
+	PNG,
+	// lossy, for color only. Planes that aren't BGRA8 get PNG.
+	JPEG
+};
+
+USTRUCT(BlueprintType)
+struct FFrameCodecSettings
+{
+	GENERATED_BODY()
+
+	// color planes of the main camera and the sensor rig
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	EFrameCodec Color = EFrameCodec::PNG;
+
+	// the class id or segmentation marks plane
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	EFrameCodec Segmentation = EFrameCodec::PNG;
+
+	// depth planes of the main camera and the sensor rig
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	EFrameCodec Depth = EFrameCodec::PNG;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture", meta = (ClampMin = "1", ClampMax = "100"))
+	int32 JpegQuality = 85;
+
+	// planes are cut into strips of this many rows that are compressed in parallel, 0 for one strip per plane
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture", meta = (ClampMin = "0"))
+	int32 RowsPerStrip = 64;
+
+	EFrameCodec ForPlane(FrameWire::EPlaneKind Kind) const
+	{
+		switch (Kind)
+		{
+		case FrameWire::EPlaneKind::Color:
+			return Color;
+		case FrameWire::EPlaneKind::Depth:
+			return Depth;
+		default:
+			return Segmentation;
+		}
+	}
+};
+
+/** Rows of a plane that are compressed together */
+struct FFrameStrip
+{
+	FrameWire::EPixelFormat PixelFormat = FrameWire::EPixelFormat::BGRA8;
+	int32 Width = 0;
+	int32 NumRows = 0;
+
+	int64 GetNumBytes() const
+	{
+		return static_cast<int64>(Width) * NumRows * FrameWire::BytesPerPixel(PixelFormat);
+	}
+};
+
+/** Compresses strips of plane rows into one FrameWire::EPlaneEncoding. Stateless, used from any thread. */
+class IFrameCodec
+{
+public:
+	virtual ~IFrameCodec() = default;
+
+	virtual FrameWire::EPlaneEncoding GetEncoding() const = 0;
+
+	/**
+	 * Replaces Out with the compressed Strip.GetNumBytes() bytes at Pixels
+	 * @param Quality 1 to 100, only used by lossy codecs
+	 */
+	virtual bool Encode(const uint8* Pixels, const FFrameStrip& Strip, int32 Quality, TArray64<uint8>& Out) const = 0;
+
+	// Decompresses Data into the Strip.GetNumBytes() bytes at OutPixels, false if Data is not a strip of that size
+	virtual bool Decode(TConstArrayView<uint8> Data, const FFrameStrip& Strip, uint8* OutPixels) const = 0;
+};
+
+/**
+ * The codecs of every FrameWire::EPlaneEncoding, and the strip layout of compressed planes around them.
+ *
+ * A plane is cut into strips of FFrameCodecSettings::RowsPerStrip rows, which are compressed on their own in a
+ * ParallelFor and concatenated behind a table of their sizes, see FrameWire::FStripHeader. Strips are what lets a
+ * 1080p PNG use every core, and what Python/mower/frame_format.py decodes one by one.
+ */
+class FFrameCodecs
+{
+public:
+	// Creates the codecs and loads the ImageWrapper module the PNG and JPEG codecs need. Game thread only.
+	void Build();
+
+	bool IsBuilt() const { return Codecs.Num() > 0; }
+
+	// The codec that produces Encoding, nullptr for Raw and unknown encodings
+	const IFrameCodec* Find(FrameWire::EPlaneEncoding Encoding) const;
+
+	// The encoding a plane of PixelFormat gets from Codec
+	static FrameWire::EPlaneEncoding Resolve(EFrameCodec Codec, FrameWire::EPixelFormat PixelFormat);
+
+	/**
+	 * Compresses a raw plane into Out, strip by strip in parallel. Thread safe.
+	 * @return the encoding of Out, Raw with Out empty when the plane should be sent as it is
+	 */
+	FrameWire::EPlaneEncoding Encode(const FrameWire::FPlane& Plane, EFrameCodec Codec,
+	                                 const FFrameCodecSettings& Settings, TArray64<uint8>& Out) const;
+
+	// Decompresses a plane that isn't Raw into OutPixels. Thread safe. False if the plane is malformed.
+	bool Decode(const FrameWire::FPlane& Plane, TArray64<uint8>& OutPixels) const;
+
+private:
+	// indexed by EPlaneEncoding
+	TArray<TUniquePtr<IFrameCodec>> Codecs;
+};
@@ -0,0 +1,116 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FrameWireFormat.h"
+#include "FrameDelta.generated.h"
+
+class FFrameCodecs;
+
+USTRUCT(BlueprintType)
+struct FFrameDeltaSettings
+{
+	GENERATED_BODY()
+
+	// send only the tiles of each plane that changed since the previous frame, binary frames and recordings only
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	bool bEnabled = false;
+
+	// edge of the square tiles planes are compared in, in pixels
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture", meta = (ClampMin = "4", ClampMax = "256"))
+	int32 TileSize = 16;
+
+	// every this many frames all planes are sent whole, so a server that joins late or lost a frame recovers
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture", meta = (ClampMin = "1"))
+	int32 KeyframeInterval = 60;
+
+	// planes with more of their tiles changed than this are sent whole, the delta would hardly be smaller
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture", meta = (ClampMin = "0", ClampMax = "1"))
+	float MaxDirtyFraction = 0.5f;
+};
+
+/**
+ * Diffs the planes of consecutive frames tile by tile against a copy of the last plane of the same kind and view.
+ *
+ * A delta plane keeps the size and pixel format of the plane it stands for. Its changed tiles are copied and the
+ * others zeroed, so every codec still compresses it as an image and the unchanged tiles cost next to nothing. Each
+ * plane the encoder tracks gets a FrameWire::ESectionKind::Delta section saying which tiles it carries. Keyframes
+ * drop every reference, so a plane missing from a keyframe is sent whole the next time it shows up and a frame
+ * without delta planes is always a point a decoder can start from.
+ */
+class FFrameDeltaEncoder
+{
+public:
+	/**
+	 * Starts the next frame. Frames have to be started in the order they are sent, and a frame's planes encoded
+	 * before the next one starts, from one thread at a time.
+	 * @return true if the frame is a keyframe
+	 */
+	bool BeginFrame(uint64 FrameId, const FFrameDeltaSettings& Settings);
+
+	/**
+	 * Compares one plane of the current frame with its reference and makes it the new reference
+	 * @param PlaneIndex index of the plane in the frame's plane table
+	 * @param OutPixels the delta plane, filled when this returns true
+	 * @param OutSection data of the plane's Delta section, an FDeltaInfo and the tile bitmap
+	 * @param OutNumTiles the Count of the Delta section
+	 * @return true if OutPixels should be sent in place of the plane, false to send the plane whole
+	 */
+	bool EncodePlane(int32 PlaneIndex, const FrameWire::FPlane& Plane, const FFrameDeltaSettings& Settings,
+	                 TArray<uint8>& OutPixels, TArray<uint8>& OutSection, int32& OutNumTiles);
+
+	// Makes the next frame a keyframe, e.g. because a frame after the last one never arrived. Thread safe.
+	void RequestKeyframe() { bKeyframeRequested = true; }
+
+private:
+	struct FReference
+	{
+		FrameWire::EPlaneKind Kind;
+		uint8 View;
+		FrameWire::EPixelFormat PixelFormat;
+		int32 Width;
+		int32 Height;
+		uint64 FrameId;
+		TArray<uint8> Pixels;
+	};
+
+	TArray<FReference> References;
+	uint64 FrameId = 0;
+	bool bKeyframe = true;
+	int32 FramesSinceKeyframe = 0;
+	TAtomic<bool> bKeyframeRequested{true};
+};
+
+/**
+ * Rebuilds the whole planes of frames written with an FFrameDeltaEncoder, for replaying recordings.
+ * Frames have to be decoded in the order they were written.
+ */
+class FFrameDeltaDecoder
+{
+public:
+	/**
+	 * Decompresses every plane of Frame and applies its delta. Afterwards the planes are Raw and point into this
+	 * decoder, until the next Decode or Reset.
+	 * @return false if a plane is malformed or its reference is missing, e.g. when decoding starts between two keyframes
+	 */
+	bool Decode(FrameWire::FFrameView& Frame, const FFrameCodecs& Codecs);
+
+	// Forgets every reference, for when decoding jumps to another frame
+	void Reset() { References.Reset(); }
+
+private:
+	struct FReference
+	{
+		FrameWire::EPlaneKind Kind;
+		uint8 View;
+		uint64 FrameId;
+		TArray64<uint8> Pixels;
+	};
+
+	TArray<FReference> References;
+	// pixels of the planes that aren't tracked, indexed like the planes of the last frame
+	TArray<TArray64<uint8>> Untracked;
+	// scratch for delta planes before their tiles are copied into the reference
+	TArray64<uint8> DeltaPixels;
+};
@@ -0,0 +1,225 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/Runnable.h"
+#include "Containers/Queue.h"
+
+class FRunnableThread;
+class IFileHandle;
+class FEvent;
+
+/**
+ * Append-only recording of captured frames and vehicle data, read by Python/mower/recording_reader.py.
+ *
+ * Layout, all little endian:
+ *   FFileHeader (64 bytes)
+ *   chunks                 each ChunkSize bytes: FChunkHeader, then records packed 8 byte aligned, zero padded to
+ *                          the end of the chunk. A record too big for one chunk gets NumChunks chunks to itself.
+ *                          Chunk i starts at HeaderSize + i * ChunkSize.
+ *   FIndexEntry[NumEntries] one per record, in the order they were appended
+ *   FFooter (32 bytes)     at the very end of the file
+ * Each record is an FRecordHeader followed by Size bytes of payload, see ERecordKind. The index and footer are
+ * written when the recording is closed. A file without them, e.g. after a crash, is still readable by walking the
+ * chunks from the start. Bump Version whenever the layout changes.
+ */
+namespace FrameRecording
+{
+	constexpr uint8 FileMagic[4] = {'M', 'W', 'R', 'C'};
+	constexpr uint8 ChunkMagic[4] = {'M', 'W', 'C', 'K'};
+	constexpr uint8 FooterMagic[4] = {'M', 'W', 'I', 'X'};
+	constexpr uint16 Version = 1;
+	constexpr int32 MaxInstanceNameLength = 32;
+	constexpr int32 RecordAlignment = 8;
+
+	enum class ERecordKind : uint8
+	{
+		// a FrameWire frame, see FrameWireFormat.h: its planes, masks and depth
+		Frame = 0,
+		// FVehicleState at the time the frame with the same id was captured
+		VehicleState = 1,
+		// FAction the server answered the frame with the same id with
+		Action = 2
+	};
+
+#pragma pack(push, 1)
+	struct FFileHeader
+	{
+		uint8 Magic[4];
+		uint16 Version;
+		uint16 HeaderSize;
+		uint32 ChunkSize;
+		uint32 Reserved;
+		// unix time the recording started, in seconds
+		double StartTime;
+		ANSICHAR InstanceName[MaxInstanceNameLength];
+		uint8 Padding[8];
+	};
+
+	struct FChunkHeader
+	{
+		uint8 Magic[4];
+		uint32 Index;
+		// 1 unless the chunk holds a single record bigger than ChunkSize
+		uint32 NumChunks;
+		// header and records, the rest of the chunk is zero
+		uint32 UsedBytes;
+	};
+
+	struct FRecordHeader
+	{
+		uint8 Kind;
+		uint8 Reserved[3];
+		uint32 Size;
+		uint64 FrameId;
+		// world time in seconds
+		double Timestamp;
+	};
+
+	struct FIndexEntry
+	{
+		// of the record header, from the start of the file
+		uint64 Offset;
+		uint64 FrameId;
+		double Timestamp;
+		uint32 Size;
+		uint8 Kind;
+		uint8 Reserved[3];
+	};
+
+	struct FFooter
+	{
+		uint64 IndexOffset;
+		uint64 NumEntries;
+		uint64 NumChunks;
+		uint8 Magic[4];
+		uint16 Version;
+		uint16 Reserved;
+	};
+
+	// world space, centimetres and degrees
+	struct FVehicleState
+	{
+		float Location[3];
+		// pitch, yaw, roll
+		float Rotation[3];
+		float Velocity[3];
+		float AngularVelocity[3];
+		float LeftThrottle;
+		float RightThrottle;
+	};
+
+	struct FAction
+	{
+		float LeftThrottle;
+		float RightThrottle;
+	};
+#pragma pack(pop)
+
+	static_assert(sizeof(FFileHeader) == 64, "FrameRecording::FFileHeader layout is part of the file format");
+	static_assert(sizeof(FChunkHeader) == 16, "FrameRecording::FChunkHeader layout is part of the file format");
+	static_assert(sizeof(FRecordHeader) == 24, "FrameRecording::FRecordHeader layout is part of the file format");
+	static_assert(sizeof(FIndexEntry) == 32, "FrameRecording::FIndexEntry layout is part of the file format");
+	static_assert(sizeof(FFooter) == 32, "FrameRecording::FFooter layout is part of the file format");
+	static_assert(sizeof(FVehicleState) == 56, "FrameRecording::FVehicleState layout is part of the file format");
+	static_assert(sizeof(FAction) == 8, "FrameRecording::FAction layout is part of the file format");
+}
+
+/**
+ * Writes a FrameRecording file on its own thread.
+ *
+ * Append reserves room for the record in the current chunk buffer under a lock, then copies it outside the lock. A
+ * full chunk is queued for the writer thread, which waits for the copies into it to finish, writes it with one
+ * sequential write and hands the buffer back. A record bigger than a chunk takes a run of buffers of its own. There
+ * are MaxQueuedChunks + 1 buffers: when the disk can't keep up and not enough of them are free, records are dropped
+ * instead of blocking the caller or allocating more.
+ */
+class FFrameRecorder : public FRunnable
+{
+public:
+	virtual ~FFrameRecorder() override;
+
+	/**
+	 * Creates the file, truncating an existing one, and starts the writer thread
+	 * @param ChunkSize rounded up to a multiple of 64 KB
+	 */
+	bool Open(const FString& InPath, const FString& InstanceName, int32 ChunkSize, int32 MaxQueuedChunks);
+
+	// Writes the chunks still queued, then the index and footer. Blocks until the file is complete.
+	void Close();
+
+	bool IsOpen() const { return Thread != nullptr; }
+	const FString& GetPath() const { return Path; }
+
+	/**
+	 * Copies one record into the recording. Thread safe, the lock is only held to reserve room for the record.
+	 * @return false if the record was dropped because the writer is behind, the record needs more buffers than the
+	 * recorder has, or the recording isn't open
+	 */
+	bool Append(FrameRecording::ERecordKind Kind, uint64 FrameId, double Timestamp, TConstArrayView<uint8> Payload);
+
+	// Appends one of the fixed size record structs, e.g. FVehicleState
+	template <typename RecordType>
+	bool AppendStruct(FrameRecording::ERecordKind Kind, uint64 FrameId, double Timestamp, const RecordType& Record)
+	{
+		return Append(Kind, FrameId, Timestamp,
+		              TConstArrayView<uint8>(reinterpret_cast<const uint8*>(&Record), sizeof(RecordType)));
+	}
+
+	int64 GetNumRecords() const { return NumRecords; }
+	int64 GetNumDroppedRecords() const { return NumDroppedRecords; }
+	int64 GetBytesWritten() const { return BytesWritten; }
+
+private:
+	struct FChunk
+	{
+		// ChunkSize bytes
+		TArray64<uint8> Data;
+		uint32 Index = 0;
+		// chunks of the run this buffer starts, 0 for the buffers that continue a run, which have no header
+		uint32 NumChunks = 1;
+		// bytes of this buffer in use, the rest is zeroed by the writer
+		int64 Used = 0;
+		// UsedBytes of the chunk header, over the whole run
+		int64 RunUsed = 0;
+		// records reserved in the buffer and still being copied, the writer waits for them
+		TAtomic<int32> PendingCopies{0};
+	};
+
+	// buffers of one record, more than one for a record bigger than a chunk
+	using FRecordBuffers = TArray<FChunk*, TInlineAllocator<4>>;
+
+	virtual uint32 Run() override;
+
+	// AppendLock must be held
+	FChunk* AcquireChunk();
+	void SealChunk(FChunk* Chunk);
+	void AddIndexEntry(const FChunk& Chunk, int64 Offset, FrameRecording::ERecordKind Kind, uint64 FrameId,
+	                   double Timestamp, uint32 Size);
+
+	// copies the record at Offset of the buffers, seen as one, then releases them to the writer
+	void CopyRecord(const FRecordBuffers& Buffers, int64 Offset, FrameRecording::ERecordKind Kind, uint64 FrameId,
+	                double Timestamp, TConstArrayView<uint8> Payload) const;
+
+	FString Path;
+	IFileHandle* File = nullptr;
+	FRunnableThread* Thread = nullptr;
+	FEvent* WakeWriter = nullptr;
+	TAtomic<bool> bStopping{false};
+
+	int64 ChunkSize = 0;
+	TArray<TUniquePtr<FChunk>> Chunks;
+	TArray<FChunk*> FreeChunks;
+	TQueue<FChunk*, EQueueMode::Mpsc> FullChunks;
+
+	FCriticalSection AppendLock;
+	FChunk* CurrentChunk = nullptr;
+	uint32 NextChunkIndex = 0;
+	TArray<FrameRecording::FIndexEntry> Index;
+	bool bWarnedTooBig = false;
+
+	TAtomic<int64> NumRecords{0};
+	TAtomic<int64> NumDroppedRecords{0};
+	TAtomic<int64> BytesWritten{0};
+};
@@ -0,0 +1,280 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Versioned binary frame sent to the training server, decoded by Python/mower/frame_format.py.
+ *
+ * Layout, all little endian:
+ *   FHeader (64 bytes)
+ *   FPlaneEntry[NumPlanes]     what each image plane holds, the view it belongs to, its size, format, encoding and
+ *                              offset
+ *   FSectionEntry[NumSections] tag, class id, kind, offset and size of each per tag section
+ *   plane payloads             raw pixels, or for every other EPlaneEncoding an FStripHeader, uint32 size of each
+ *                              strip and the strips: RowsPerStrip rows each, the last one shorter, compressed on their
+ *                              own, see FrameCodec.h
+ *   section payloads           see ESectionKind, 4 byte aligned
+ * Offsets are from the start of the frame. Bump Version whenever the layout changes.
+ */
+namespace FrameWire
+{
+	constexpr uint8 Magic[4] = {'M', 'W', 'F', 'R'};
+	constexpr uint16 Version = 8;
+	constexpr int32 MaxInstanceNameLength = 32;
+	constexpr int32 MaxTagLength = 18;
+
+	enum class EPlaneKind : uint8
+	{
+		// the segmentation readback, class marks in R
+		SegmentationMarks = 0,
+		// the color readback, recolored with class colors when debug recoloring is on
+		Color = 1,
+		// one class id per pixel, 0 is background
+		ClassIds = 2,
+		// scene depth along the view direction, see EPixelFormat for the unit
+		Depth = 3,
+		// R16, the instance id of the actor seen in every pixel, 0 for background
+		InstanceIds = 4
+	};
+
+	enum class EPixelFormat : uint8
+	{
+		BGRA8 = 0,
+		R8 = 1,
+		// uint16, for depth millimetres with 65535 for no hit within 65.5 m
+		R16 = 2,
+		// half float metres
+		R16F = 3
+	};
+
+	enum class EPlaneEncoding : uint8
+	{
+		Raw = 0,
+		// 8 bit BGRA or gray, 16 bit gray for R16 and R16F, which keeps the bits of half floats intact
+		PNG = 1,
+		// an LZ4 block of the strip's bytes grouped by channel: every pixel's byte 0, then every pixel's byte 1...
+		LZ4 = 2,
+		// QOI image of BGRA8 pixels, with B stored in the R channel
+		QOI = 3,
+		// BGRA8 only, lossy
+		JPEG = 4
+	};
+
+	enum class ESectionKind : uint8
+	{
+		// Count packed uint16 x,y pairs
+		Points = 0,
+		// Count FMaskSpan runs of uint16 y, x, length, row major
+		Spans = 1,
+		// Count FMaskRegion, the whole mask followed by its connected components
+		Regions = 2,
+		// one FClassDepthStats
+		DepthStats = 3,
+		// one FViewInfo, tagged with the sensor name. View 0, the main camera, has none.
+		View = 4,
+		// one FDeltaInfo, then for a delta plane a bitmap of its Count tiles, row major, tile i in bit i % 8 of byte
+		// i / 8. Set bits are the tiles the plane carries, the others are zeroed and unchanged since the reference.
+		Delta = 5,
+		// one FObservationInfo, then the Count elements of the model input tensor, see ObservationPacker.h
+		Observation = 6,
+		// one FStreamInfo, tagged with the stream name
+		Stream = 7,
+		// Count FInstanceStats sorted by instance id, tagged "instances"
+		Instances = 8
+	};
+
+#pragma pack(push, 1)
+	struct FHeader
+	{
+		uint8 Magic[4];
+		uint16 Version;
+		uint16 HeaderSize;
+		uint64 FrameId;
+		double Timestamp;
+		uint16 Width;
+		uint16 Height;
+		// 16 bits, a frame with 255 classes has more than 255 per class sections
+		uint16 NumSections;
+		uint8 NumPlanes;
+		uint8 Reserved;
+		ANSICHAR InstanceName[MaxInstanceNameLength];
+	};
+
+	struct FPlaneEntry
+	{
+		uint32 Offset;
+		uint32 Size;
+		uint16 Width;
+		uint16 Height;
+		uint8 Kind;
+		uint8 PixelFormat;
+		uint8 Encoding;
+		// 0 for the main camera, sensor rig views from 1, then the streams
+		uint8 View;
+	};
+
+	struct FSectionEntry
+	{
+		ANSICHAR Tag[MaxTagLength];
+		uint8 ClassId;
+		uint8 Kind;
+		uint32 Offset;
+		uint32 Size;
+		uint32 Count;
+	};
+
+	// where a sensor rig view was taken from, relative to the rig
+	struct FViewInfo
+	{
+		uint8 View;
+		// ESceneCaptureSource
+		uint8 CaptureSource;
+		uint16 RateDivisor;
+		float FOVDegrees;
+		// centimetres
+		float Location[3];
+		// pitch, yaw, roll in degrees
+		float Rotation[3];
+	};
+
+	struct FStripHeader
+	{
+		uint16 NumStrips;
+		uint16 RowsPerStrip;
+	};
+
+	// how a plane of a frame relates to the plane of the same kind and view of an earlier frame, see FrameDelta.h
+	struct FDeltaInfo
+	{
+		// index of the plane in the plane table
+		uint8 Plane;
+		// 1 if the plane is whole and becomes the reference, 0 if it only carries the tiles of its bitmap
+		uint8 Keyframe;
+		uint16 TileSize;
+		uint32 NumDirtyTiles;
+		// the frame the unchanged tiles are taken from, 0 for keyframe planes
+		uint64 ReferenceFrameId;
+	};
+
+	// shape and normalization of an Observation tensor of Channels x Height x Width
+	struct FObservationInfo
+	{
+		uint16 Width;
+		uint16 Height;
+		uint8 Channels;
+		// 0 NCHW, 1 NHWC
+		uint8 Layout;
+		// 0 float16, 1 float32
+		uint8 Precision;
+		uint8 Reserved;
+		// RGB, the tensor holds (value - Mean) / Std of values in 0..1
+		float Mean[3];
+		float Std[3];
+	};
+
+	// a lower resolution stream of the main camera, see CaptureStreams.h
+	struct FStreamInfo
+	{
+		// of the stream's planes
+		uint8 View;
+		// the stream's planes are the main camera's shrunk by this factor
+		uint8 Downsample;
+		// the stream is sent with every RateDivisor-th frame
+		uint16 RateDivisor;
+	};
+#pragma pack(pop)
+
+	static_assert(sizeof(FHeader) == 64, "FrameWire::FHeader layout is part of the wire format");
+	static_assert(sizeof(FPlaneEntry) == 16, "FrameWire::FPlaneEntry layout is part of the wire format");
+	static_assert(sizeof(FSectionEntry) == 32, "FrameWire::FSectionEntry layout is part of the wire format");
+	static_assert(sizeof(FViewInfo) == 32, "FrameWire::FViewInfo layout is part of the wire format");
+	static_assert(sizeof(FStripHeader) == 4, "FrameWire::FStripHeader layout is part of the wire format");
+	static_assert(sizeof(FDeltaInfo) == 16, "FrameWire::FDeltaInfo layout is part of the wire format");
+	static_assert(sizeof(FObservationInfo) == 32, "FrameWire::FObservationInfo layout is part of the wire format");
+	static_assert(sizeof(FStreamInfo) == 4, "FrameWire::FStreamInfo layout is part of the wire format");
+
+	inline int32 BytesPerPixel(EPixelFormat PixelFormat)
+	{
+		switch (PixelFormat)
+		{
+		case EPixelFormat::BGRA8:
+			return 4;
+		case EPixelFormat::R8:
+			return 1;
+		default:
+			return 2;
+		}
+	}
+
+	struct FFrameInfo
+	{
+		uint64 FrameId = 0;
+		double Timestamp = 0.0;
+		FString InstanceName;
+		int32 Width = 0;
+		int32 Height = 0;
+	};
+
+	struct FPlane
+	{
+		EPlaneKind Kind = EPlaneKind::Color;
+		EPixelFormat PixelFormat = EPixelFormat::BGRA8;
+		EPlaneEncoding Encoding = EPlaneEncoding::Raw;
+		uint8 View = 0;
+		int32 Width = 0;
+		int32 Height = 0;
+		TConstArrayView<uint8> Data;
+	};
+
+	struct FSection
+	{
+		FString Tag;
+		uint8 ClassId = 0;
+		ESectionKind Kind = ESectionKind::Points;
+		// number of elements of the section kind, e.g. points, or tiles for Delta
+		uint32 Count = 0;
+		TConstArrayView<uint8> Data;
+	};
+
+	// A decoded frame. Plane and section data point into the buffer that was read, nothing is copied.
+	struct FFrameView
+	{
+		FFrameInfo Info;
+		TArray<FPlane> Planes;
+		TArray<FSection> Sections;
+	};
+
+	// Writes the frame into Out, reusing its allocation
+	void Write(const FFrameInfo& Info, TConstArrayView<FPlane> Planes, TConstArrayView<FSection> Sections,
+	           TArray<uint8>& Out);
+
+	// Returns false if Data is not a complete frame of a known version
+	bool Read(TConstArrayView<uint8> Data, FFrameView& Out);
+
+	// Section data for Count x,y points
+	inline TConstArrayView<uint8> PointsData(TConstArrayView<uint16> Points)
+	{
+		return TConstArrayView<uint8>(reinterpret_cast<const uint8*>(Points.GetData()), Points.Num() * sizeof(uint16));
+	}
+
+	// Section data for an array of wire structs such as FMaskSpan
+	template <typename ItemType>
+	TConstArrayView<uint8> ItemsData(TConstArrayView<ItemType> Items)
+	{
+		return TConstArrayView<uint8>(reinterpret_cast<const uint8*>(Items.GetData()), Items.Num() * sizeof(ItemType));
+	}
+
+	// The Count items of a section returned by Read, empty if the section is too short to hold them
+	template <typename ItemType>
+	TConstArrayView<ItemType> SectionItems(const FSection& Section)
+	{
+		static_assert(alignof(ItemType) <= 4, "sections are only 4 byte aligned");
+		if (static_cast<uint64>(Section.Count) * sizeof(ItemType) > static_cast<uint64>(Section.Data.Num()))
+		{
+			return {};
+		}
+		return TConstArrayView<ItemType>(reinterpret_cast<const ItemType*>(Section.Data.GetData()), Section.Count);
+	}
+}
@@ -0,0 +1,98 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/** The area the mower deck cuts, a rectangle over X and Y oriented along the mower, and the heights it reaches */
+struct FMowingDeck
+{
+	FVector2D Center = FVector2D::ZeroVector;
+	// unit vector along the length of the deck, the width is across it
+	FVector2D Forward = FVector2D(1.0, 0.0);
+	double HalfLength = 0.0;
+	double HalfWidth = 0.0;
+	double MinZ = 0.0;
+	double MaxZ = 0.0;
+
+	FVector2D GetRight() const { return FVector2D(-Forward.Y, Forward.X); }
+	// front left, front right, back right, back left
+	void GetCorners(FVector2D (&OutCorners)[4]) const;
+	FBox2D GetBounds() const;
+};
+
+/** A convex polygon over X and Y and the heights it reaches, such as the area a deck swept between two ticks */
+struct FMowingArea
+{
+	// a hull of two decks has no more
+	static constexpr int32 MaxVertices = 8;
+
+	// counter clockwise with X to the right and Y up
+	TArray<FVector2D, TInlineAllocator<MaxVertices>> Vertices;
+	double MinZ = 0.0;
+	double MaxZ = 0.0;
+
+	FMowingArea() = default;
+	explicit FMowingArea(const FMowingDeck& Deck);
+
+	/**
+	 * The area the deck covers moving from one pose to the next, as convex hulls of consecutive poses. The deck turns
+	 * at most MaxStepAngle between them, so a turning deck doesn't cut much outside of where it went.
+	 * @param MaxStepAngle in radians
+	 */
+	static void Sweep(const FMowingDeck& From, const FMowingDeck& To, double MaxStepAngle,
+	                  TArray<FMowingArea>& OutAreas);
+
+	FBox2D GetBounds() const;
+};
+
+/**
+ * Locations of grass instances in a uniform grid over X and Y. Every cell keeps its instances as separate X, Y and
+ * height arrays, X and Y relative to the cell so floats stay precise far from the origin, and an area is tested four
+ * instances at a time against only the cells under it.
+ *
+ * Instances are known by the handle Add returns, which stays valid until they are removed. Not thread safe.
+ */
+class FGrassInstanceGrid
+{
+public:
+	// side of a grid cell in centimetres, a few hundred instances of dense grass
+	static constexpr double CellSize = 500.0;
+
+	// @param MinZ, MaxZ height range of the instance's bounds
+	int32 Add(const FVector& Location, float MinZ, float MaxZ);
+	void Remove(int32 Handle);
+	void Reset();
+
+	// appends the instances whose location is in the area and whose bounds reach its heights
+	void Query(const FMowingArea& Area, TArray<int32>& OutHandles) const;
+	void Query(const FMowingDeck& Deck, TArray<int32>& OutHandles) const { Query(FMowingArea(Deck), OutHandles); }
+
+	int32 Num() const { return Entries.Num(); }
+	// one past the largest handle in use
+	int32 GetMaxHandle() const { return Entries.GetMaxIndex(); }
+	int32 GetNumCells() const { return Cells.Num(); }
+	SIZE_T GetAllocatedSize() const;
+
+private:
+	struct FCell
+	{
+		TArray<float> X;
+		TArray<float> Y;
+		TArray<float> MinZ;
+		TArray<float> MaxZ;
+		TArray<int32> Handles;
+	};
+
+	struct FEntry
+	{
+		FIntPoint Cell;
+		int32 IndexInCell;
+	};
+
+	static FIntPoint GetCell(double X, double Y);
+	static void QueryCell(const FCell& Cell, FIntPoint CellKey, const FMowingArea& Area, TArray<int32>& OutHandles);
+
+	TSparseArray<FEntry> Entries;
+	TMap<FIntPoint, FCell> Cells;
+};
@@ -0,0 +1,178 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GrassInstanceGrid.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "GrassMowingSubsystem.generated.h"
+
+class UFoliageInstancedStaticMeshComponent;
+class UHierarchicalInstancedStaticMeshComponent;
+
+USTRUCT(BlueprintType)
+struct FGrassMowingSettings
+{
+	GENERATED_BODY()
+
+	// foliage meshes taller than this, in centimetres, are left alone as shrubs and trees
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Mowing", meta = (ClampMin = "0"))
+	float MaxGrassHeight = 200.0f;
+
+	// mowing doesn't need the physics bodies of the grass, turning them off spares physics thousands of bodies
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Mowing")
+	bool bDisableCollision = true;
+
+	// side of the square areas whose stubble shares one instanced component, in centimetres
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Mowing", meta = (ClampMin = "100"))
+	float StubbleChunkSize = 5000.0f;
+};
+
+USTRUCT(BlueprintType)
+struct FGrassMowingStats
+{
+	GENERATED_BODY()
+
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Mowing")
+	int32 NumInstances = 0;
+
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Mowing")
+	int32 NumComponents = 0;
+
+	// occupied grid cells
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Mowing")
+	int32 NumCells = 0;
+
+	// heap memory of the grid and the instance tables
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Mowing")
+	int64 AllocatedBytes = 0;
+
+	// instances removed since the world started
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Mowing")
+	int32 NumMowed = 0;
+
+	// RemoveInstances calls, at most one per component per frame
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Mowing")
+	int32 NumRemoveBatches = 0;
+
+	// instances of stubble added in place of mowed grass
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Mowing")
+	int32 NumStubble = 0;
+
+	// components holding the stubble, one per mesh and chunk
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Mowing")
+	int32 NumStubbleComponents = 0;
+};
+
+/**
+ * The grass instances of the level's foliage in an FGrassInstanceGrid, so mowing looks up what is under the deck
+ * without sweeping the physics scene. Built by Build from every foliage actor, kept up to date as levels stream in
+ * and out and as instances are mowed. Game thread only.
+ *
+ * Instances are known by grid handles, which stay valid while their component changes, so several instances can be
+ * mowed in any order. Removals are queued and applied together as the subsystem ticks, after the actors, so a
+ * component updates its render state once a frame however much of it is mowed. The counters are in
+ * "stat GrassMowing" and GetStats.
+ *
+ * Stubble left in place of mowed grass goes into instanced components of a transient actor, one per mesh and
+ * StubbleChunkSize square, added to together once a frame, so the number of components and draw calls stays bounded
+ * by the mowed area however long the mower runs.
+ */
+UCLASS()
+class MOWER3_API UGrassMowingSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	// indexes the grass of every loaded level
+	void Build(const FGrassMowingSettings& InSettings);
+
+	// the area of the indexed grass on X and Y, invalid if there is none
+	FBox2D GetGrassBounds() const { return GrassBounds; }
+
+	// appends the handles of the instances in the area
+	void Query(const FMowingArea& Area, TArray<int32>& OutHandles) const;
+
+	// the component of the instance and its current index in it, nullptr once it is gone
+	UFoliageInstancedStaticMeshComponent* GetInstance(int32 Handle, int32& OutInstanceIndex) const;
+
+	/**
+	 * Queues the instance for removal at the end of the frame, when every component removes its queued instances at
+	 * once. It stays in queries until then.
+	 * @param OutTransform world transform of the instance, may be null
+	 * @return false if the handle was already removed or queued
+	 */
+	bool QueueRemoval(int32 Handle, FTransform* OutTransform = nullptr);
+
+	// removes the queued instances now, one RemoveInstances call and one async tree rebuild per component
+	void FlushRemovals();
+
+	// queues an instance of the mesh at the transform, in world space, added at the end of the frame
+	void AddStubble(UStaticMesh* Mesh, const FTransform& Transform);
+
+	// adds the queued stubble now, one AddInstances call and one async tree rebuild per component
+	void FlushStubble();
+
+	UFUNCTION(BlueprintCallable, Category = "Mowing")
+	FGrassMowingStats GetStats() const;
+
+private:
+	struct FGrassComponent
+	{
+		TWeakObjectPtr<UFoliageInstancedStaticMeshComponent> Component;
+		// grid handle of every instance, by instance index
+		TArray<int32> Handles;
+		// handles to remove at the next flush
+		TArray<int32> Queued;
+	};
+
+	struct FGrassRef
+	{
+		int32 Component = INDEX_NONE;
+		int32 Instance = INDEX_NONE;
+		bool bQueued = false;
+	};
+
+	void OnLevelAdded(ULevel* Level, UWorld* InWorld);
+	void OnLevelRemoved(ULevel* Level, UWorld* InWorld);
+	void AddLevel(const ULevel* Level);
+	void AddComponent(UFoliageInstancedStaticMeshComponent* Component);
+	void RemoveComponent(int32 Index);
+	// mirrors the component swapping its last instance into the removed one's index
+	void ForgetInstance(int32 ComponentIndex, int32 InstanceIndex);
+	int32 FindOrAddStubbleComponent(UStaticMesh* Mesh, FIntPoint Chunk);
+	void UpdateStats();
+
+	FGrassMowingSettings Settings;
+	bool bBuilt = false;
+	FGrassInstanceGrid Grid;
+	// grows with every indexed instance, never shrinks
+	FBox2D GrassBounds = FBox2D(ForceInit);
+	TSparseArray<FGrassComponent> Components;
+	// by grid handle
+	TArray<FGrassRef> RefOfHandle;
+	// components with queued removals
+	TArray<int32> QueuedComponents;
+
+	UPROPERTY(Transient)
+	TObjectPtr<AActor> StubbleActor;
+
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<UHierarchicalInstancedStaticMeshComponent>> StubbleComponents;
+
+	TMap<TPair<TObjectKey<UStaticMesh>, FIntPoint>, int32> StubbleOfChunk;
+	// world space transforms to add at the next flush, by stubble component
+	TArray<TArray<FTransform>> QueuedStubble;
+	bool bStubbleQueued = false;
+
+	FGrassMowingStats Stats;
+	bool bStatsDirty = false;
+
+	FDelegateHandle LevelAddedHandle;
+	FDelegateHandle LevelRemovedHandle;
+};
@@ -0,0 +1,92 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/** Triangles of one static mesh LOD in local space. Immutable once built, so pipeline workers can share it. */
+struct FLabelMesh
+{
+	TArray<FVector3f> Positions;
+	// three per triangle
+	TArray<uint32> Indices;
+
+	int32 GetNumTriangles() const { return Indices.Num() / 3; }
+};
+
+/** One actor to draw into the label maps */
+struct FLabelInstance
+{
+	TSharedPtr<const FLabelMesh, ESPMode::ThreadSafe> Mesh;
+	FMatrix LocalToWorld = FMatrix::Identity;
+	uint8 ClassId = 0;
+	uint16 InstanceId = 0;
+};
+
+/**
+ * Draws mesh triangles into class id and instance id maps on the CPU, the exact masks of what the camera sees without
+ * the segmentation post process material or a GPU.
+ *
+ * Triangles are transformed, clipped and binned into screen tiles by tasks that each own a range of instances, then
+ * every tile is drawn by one task in the order the triangles were given, so no two tasks write the same pixel and the
+ * output doesn't depend on scheduling. Edges are walked in fixed point with a top-left fill rule, so triangles that
+ * share an edge neither overlap nor leave gaps, and the nearest triangle wins by a depth test on UE's reversed Z.
+ * Both sides of a triangle are drawn. The scratch buffers are kept between frames, one rasterizer per thread.
+ */
+class FLabelRasterizer
+{
+public:
+	static constexpr int32 TileSize = 64;
+	// bits of sub-pixel precision of the vertices
+	static constexpr int32 SubPixelBits = 8;
+	static constexpr int32 MaxSize = 8192;
+
+	/**
+	 * @param ViewProjection world to clip space of the camera, e.g. FCaptureProjection::GetViewProjection
+	 * @param OutClassIds Width x Height, 0 where no triangle covers the pixel
+	 * @param OutInstanceIds Width x Height, 0 where no triangle covers the pixel. May be null.
+	 */
+	void Rasterize(const FMatrix& ViewProjection, int32 Width, int32 Height, TConstArrayView<FLabelInstance> Instances,
+	               uint8* OutClassIds, uint16* OutInstanceIds);
+
+	// triangles that reached the binning step in the last Rasterize, after culling and clipping
+	int32 GetNumBinnedTriangles() const { return NumBinnedTriangles; }
+
+private:
+	struct FTriangle
+	{
+		// fixed point pixel coordinates, wound so that the area is positive
+		int32 X[3];
+		int32 Y[3];
+		// NDC depth, larger is nearer
+		float Z[3];
+		// pixels whose centres may be covered, inclusive
+		int32 MinX;
+		int32 MinY;
+		int32 MaxX;
+		int32 MaxY;
+		uint8 ClassId;
+		uint16 InstanceId;
+	};
+
+	void SetupInstances(int32 Task, const FMatrix& ViewProjection, TConstArrayView<FLabelInstance> Instances);
+	void AddPolygon(int32 Task, const FVector4f* Clip, int32 NumVertices, const FLabelInstance& Instance);
+	void AddTriangle(int32 Task, const FVector4f& A, const FVector4f& B, const FVector4f& C,
+	                 const FLabelInstance& Instance);
+	void RasterizeTile(int32 Tile, uint8* OutClassIds, uint16* OutInstanceIds) const;
+
+	int32 Width = 0;
+	int32 Height = 0;
+	int32 NumTilesX = 0;
+	int32 NumTilesY = 0;
+	int32 NumTasks = 0;
+	int32 NumBinnedTriangles = 0;
+	// first instance of every setup task, and one past the last
+	TArray<int32> TaskInstances;
+	// per setup task, the triangles it set up and its bins of triangle indices, NumTasks x NumTiles
+	TArray<TArray<FTriangle>> TaskTriangles;
+	TArray<TArray<int32>> Bins;
+	// per setup task, clip space positions of the instance being set up
+	TArray<TArray<FVector4f>> TaskClip;
+	TArray<TArray<uint8>> TaskOutcodes;
+};
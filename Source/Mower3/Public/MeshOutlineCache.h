@@ -0,0 +1,54 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LabelRasterizer.h"
+#include "UObject/ObjectKey.h"
+
+class UStaticMesh;
+
+/**
+ * A few local space points on the convex hull of a mesh, enough to outline it in an image. They are the vertices
+ * that reach furthest along the 26 directions of a k-DOP, stored as separate X, Y and Z arrays for batched projection.
+ */
+struct FMeshOutline
+{
+	TArray<float> X;
+	TArray<float> Y;
+	TArray<float> Z;
+
+	int32 Num() const { return X.Num(); }
+
+	void Build(const UStaticMesh* StaticMesh);
+
+private:
+	void Add(const FVector3f& Point);
+};
+
+/** Outlines of the meshes seen so far, built on first use. Game thread only. */
+class FMeshOutlineCache
+{
+public:
+	// nullptr without a mesh
+	const FMeshOutline* Get(const UStaticMesh* StaticMesh);
+
+	void Reset() { Outlines.Reset(); }
+
+private:
+	TMap<TObjectKey<UStaticMesh>, FMeshOutline> Outlines;
+};
+
+/** Triangles of the meshes the label rasterizer has drawn, built on first use. Game thread only. */
+class FLabelMeshCache
+{
+public:
+	// nullptr without a mesh or CPU readable vertices. The mesh stays valid for whoever holds it.
+	TSharedPtr<const FLabelMesh, ESPMode::ThreadSafe> Get(const UStaticMesh* StaticMesh, int32 LODIndex);
+
+	void Reset() { Meshes.Reset(); }
+
+private:
+	// failures are kept as nullptr, so they aren't retried every frame
+	TMap<TPair<TObjectKey<UStaticMesh>, int32>, TSharedPtr<const FLabelMesh, ESPMode::ThreadSafe>> Meshes;
+};
@@ -44,6 +44,8 @@ public:
 	TUniquePtr<Chaos::FSimpleWheeledVehicle> CreatePhysicsVehicle() override;
 	void SetLeftThrottleInput(float Value) { LeftThrottleInput = Value; SetSleeping(false); }
 	void SetRightThrottleInput(float Value) { RightThrottleInput = Value; SetSleeping(false); }
+	float GetLeftThrottleInput() const { return LeftThrottleInput; }
+	float GetRightThrottleInput() const { return RightThrottleInput; }
 	void ProcessSleeping(const FControlInputs& ControlInputs) override;
 
 protected:
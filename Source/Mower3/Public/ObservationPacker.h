@@ -0,0 +1,129 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ObservationPacker.generated.h"
+
+UENUM(BlueprintType)
+enum class EObservationResize : uint8
+{
+	// two taps per axis, only right when the image shrinks by less than half
+	Bilinear,
+	// the average of every source pixel an output pixel covers, what a downscale needs
+	Area
+};
+
+/** Order of the elements of an observation tensor */
+UENUM(BlueprintType)
+enum class EObservationLayout : uint8
+{
+	// channel planes, what most vision models take
+	NCHW,
+	// interleaved channels
+	NHWC
+};
+
+UENUM(BlueprintType)
+enum class EObservationPrecision : uint8
+{
+	Float16,
+	Float32
+};
+
+USTRUCT(BlueprintType)
+struct FObservationSettings
+{
+	GENERATED_BODY()
+
+	// pack the color image into a model input tensor, sent as an Observation section of binary frames
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	bool bEnabled = false;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture", meta = (ClampMin = "1", ClampMax = "4096"))
+	int32 Width = 224;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture", meta = (ClampMin = "1", ClampMax = "4096"))
+	int32 Height = 224;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	EObservationResize Resize = EObservationResize::Area;
+
+	// corners of the part of the image the model sees, as fractions of its width and height
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	FVector2D CropMin = FVector2D(0.0, 0.0);
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	FVector2D CropMax = FVector2D(1.0, 1.0);
+
+	// per RGB channel in 0..1, the tensor holds (value - Mean) / Std. The defaults are ImageNet's.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	FVector Mean = FVector(0.485, 0.456, 0.406);
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	FVector Std = FVector(0.229, 0.224, 0.225);
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	EObservationLayout Layout = EObservationLayout::NCHW;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	EObservationPrecision Precision = EObservationPrecision::Float16;
+};
+
+/**
+ * Crops, resizes and normalizes a BGRA8 image into the RGB float tensor of one model input.
+ *
+ * The resize is separable: an output row is a weighted sum of source rows and an output pixel a weighted sum of the
+ * pixels of that row. The weights of both axes are computed up front with the crop folded in, so packing only reads
+ * the cropped pixels. Output rows are packed in parallel and the sums run over the 4 channels of a pixel at once.
+ */
+class FObservationPacker
+{
+public:
+	static constexpr int32 NumChannels = 3;
+	static constexpr int32 MaxSize = 4096;
+
+	// Computes the resize weights, O(width + height)
+	FObservationPacker(const FObservationSettings& Settings, int32 SourceWidth, int32 SourceHeight);
+
+	int32 GetWidth() const { return Width; }
+	int32 GetHeight() const { return Height; }
+	int64 GetNumElements() const { return static_cast<int64>(Width) * Height * NumChannels; }
+	int64 GetNumBytes() const { return GetNumElements() * (Precision == EObservationPrecision::Float16 ? 2 : 4); }
+
+	/**
+	 * Writes the tensor of one image
+	 * @param Source SourceWidth x SourceHeight pixels
+	 * @param Out GetNumBytes() bytes
+	 */
+	void Pack(const FColor* Source, uint8* Out) const;
+
+private:
+	// the source pixels, or rows, each output pixel, or row, sums up
+	struct FTaps
+	{
+		TArray<int32> First;
+		TArray<int32> Num;
+		// MaxTaps per output, the ones past Num are 0
+		TArray<float> Weights;
+		int32 MaxTaps = 0;
+
+		void Build(EObservationResize Resize, int32 SourceSize, double CropBegin, double CropEnd, int32 OutSize);
+	};
+
+	void WriteRow(const float* Rgb, int32 Y, uint8* Out) const;
+
+	int32 Width;
+	int32 Height;
+	int32 SourceWidth;
+	EObservationLayout Layout;
+	EObservationPrecision Precision;
+	FTaps Columns;
+	FTaps Rows;
+	// source columns the taps read, the vertical pass skips the rest
+	int32 FirstColumn;
+	int32 NumColumns;
+	// value * Scale + Bias normalizes an 8 bit channel, in BGRA order like the pixels
+	float Scale[4];
+	float Bias[4];
+};
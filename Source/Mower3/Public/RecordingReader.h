@@ -0,0 +1,165 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+/**
+ * Read-only access to FrameRecording files (see FrameRecorder.h) through a small C ABI.
+ *
+ * The same code is built into the game module, where replay uses it on a file mapped with IPlatformFile::OpenMapped,
+ * and into a standalone shared library by Tools/RecordingReader, which the Python server loads through ctypes
+ * (Python/mower/recording_reader.py). It only depends on the C++ standard library so both builds share it.
+ *
+ * Nothing is copied out of the recording: records, planes and sections are pointers into the mapping and stay valid
+ * until the reader is closed. A reader is immutable once opened, so any number of threads may read from it at once,
+ * e.g. one per shard from mwrec_shard.
+ */
+
+#include <stdint.h>
+
+#if defined(MWREC_SHARED_LIBRARY)
+#if defined(_WIN32)
+#define MWREC_API __declspec(dllexport)
+#else
+#define MWREC_API __attribute__((visibility("default")))
+#endif
+#else
+#define MWREC_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum
+{
+	MWREC_OK = 0,
+	// the file could not be opened or mapped
+	MWREC_ERROR_IO = 1,
+	// not a recording, or a frame that is not a FrameWire frame of a known version
+	MWREC_ERROR_FORMAT = 2,
+	// an index, kind or frame id that isn't in the recording
+	MWREC_ERROR_RANGE = 3
+};
+
+// FrameRecording::ERecordKind
+enum
+{
+	MWREC_RECORD_FRAME = 0,
+	MWREC_RECORD_VEHICLE_STATE = 1,
+	MWREC_RECORD_ACTION = 2,
+	MWREC_NUM_RECORD_KINDS = 3
+};
+
+typedef struct mwrec_reader mwrec_reader;
+
+// FrameRecording::FIndexEntry
+typedef struct mwrec_index_entry
+{
+	uint64_t offset;
+	uint64_t frame_id;
+	double timestamp;
+	uint32_t size;
+	uint8_t kind;
+	uint8_t reserved[3];
+} mwrec_index_entry;
+
+typedef struct mwrec_record
+{
+	uint64_t frame_id;
+	double timestamp;
+	const uint8_t* data;
+	uint64_t size;
+} mwrec_record;
+
+// FrameWire::FHeader of a frame record
+typedef struct mwrec_frame_info
+{
+	uint64_t frame_id;
+	double timestamp;
+	uint32_t width;
+	uint32_t height;
+	uint32_t num_planes;
+	uint32_t num_sections;
+	char instance_name[33];
+} mwrec_frame_info;
+
+// one FrameWire plane, kind, pixel_format and encoding are the FrameWire enums
+typedef struct mwrec_plane
+{
+	const uint8_t* data;
+	uint64_t size;
+	uint32_t width;
+	uint32_t height;
+	uint8_t kind;
+	uint8_t pixel_format;
+	uint8_t encoding;
+	uint8_t view;
+} mwrec_plane;
+
+// one FrameWire section, e.g. the spans of a tag's mask
+typedef struct mwrec_section
+{
+	const uint8_t* data;
+	uint64_t size;
+	uint32_t count;
+	uint8_t class_id;
+	uint8_t kind;
+	char tag[19];
+} mwrec_section;
+
+/**
+ * Maps the recording at path. A recording without an index, e.g. from a crashed run, is indexed by walking its
+ * chunks, see mwrec_is_complete.
+ */
+MWREC_API int mwrec_open(const char* path, mwrec_reader** out_reader);
+
+// Like mwrec_open for a recording that is already in memory. data must stay valid until the reader is closed.
+MWREC_API int mwrec_open_memory(const void* data, uint64_t size, mwrec_reader** out_reader);
+
+MWREC_API void mwrec_close(mwrec_reader* reader);
+
+// 0 if the recording has no index and footer and was indexed up to its last complete chunk
+MWREC_API int mwrec_is_complete(const mwrec_reader* reader);
+
+// unix time the recording started, in seconds
+MWREC_API double mwrec_start_time(const mwrec_reader* reader);
+
+MWREC_API const char* mwrec_instance_name(const mwrec_reader* reader);
+
+MWREC_API uint64_t mwrec_count(const mwrec_reader* reader, int kind);
+
+/**
+ * The index entries of one kind of record, in timestamp order, which is the order they were recorded in unless the
+ * server answered frames out of order. Record i of a kind below is entry i of this array.
+ */
+MWREC_API const mwrec_index_entry* mwrec_entries(const mwrec_reader* reader, int kind);
+
+MWREC_API int mwrec_get(const mwrec_reader* reader, int kind, uint64_t index, mwrec_record* out_record);
+
+// The records of a kind with begin <= timestamp < end, as a first index and count
+MWREC_API void mwrec_time_range(const mwrec_reader* reader, int kind, double begin, double end, uint64_t* out_first,
+                                uint64_t* out_count);
+
+// Index of the first record of a kind with the given frame id
+MWREC_API int mwrec_find_frame(const mwrec_reader* reader, int kind, uint64_t frame_id, uint64_t* out_index);
+
+// Splits count records into num_shards contiguous shards that differ in size by at most one
+MWREC_API void mwrec_shard(uint64_t count, uint32_t shard, uint32_t num_shards, uint64_t* out_first,
+                           uint64_t* out_count);
+
+// Parses the FrameWire header of a frame record's payload
+MWREC_API int mwrec_read_frame(const uint8_t* frame, uint64_t size, mwrec_frame_info* out_info);
+
+MWREC_API int mwrec_frame_plane(const uint8_t* frame, uint64_t size, uint32_t index, mwrec_plane* out_plane);
+
+// The first plane of the given kind and view, MWREC_ERROR_RANGE if the frame has none
+MWREC_API int mwrec_find_plane(const uint8_t* frame, uint64_t size, uint8_t kind, uint8_t view,
+                               mwrec_plane* out_plane);
+
+MWREC_API int mwrec_frame_section(const uint8_t* frame, uint64_t size, uint32_t index, mwrec_section* out_section);
+
+MWREC_API const char* mwrec_error_string(int error);
+
+#ifdef __cplusplus
+}
+#endif
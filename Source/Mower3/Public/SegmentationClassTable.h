@@ -0,0 +1,33 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+#include "SegmentationClassifier.h"
+#include "SegmentationClassTable.generated.h"
+
+/**
+ * The segmentation classes of a level as an asset, so adding an obstacle type is a new row and an actor tag instead
+ * of code. Up to 255 classes, each with the mark it is segmented by.
+ *
+ * With bStampActors, the tagged actor registry writes the mark of every tagged actor into its custom depth stencil
+ * and its instance id into custom primitive data InstanceIdDataIndex, as the actor registers. A segmentation material
+ * reading those writes the mark into R and the instance id into G (high byte) and B (low byte), which is what
+ * UCaptureManager's instance segmentation reads back.
+ */
+UCLASS(BlueprintType)
+class MOWER3_API USegmentationClassTable : public UDataAsset
+{
+	GENERATED_BODY()
+
+public:
+	// custom primitive data float the instance id is written to
+	static constexpr int32 InstanceIdDataIndex = 0;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Segmentation")
+	TArray<FSegmentationClassDefinition> Classes;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Segmentation")
+	bool bStampActors = true;
+};
@@ -0,0 +1,186 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "SegmentationClassifier.generated.h"
+
+/** One segmentation class, matched on the value the segmentation post process material writes into R */
+USTRUCT(BlueprintType)
+struct FSegmentationClassDefinition
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Segmentation", meta = (ClampMin = "1", ClampMax = "255"))
+	int32 Mark = 1;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Segmentation")
+	FName Tag;
+
+	// color of the class in the recolored debug image
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Segmentation")
+	FColor DebugColor = FColor::White;
+
+	FSegmentationClassDefinition() = default;
+
+	FSegmentationClassDefinition(int32 InMark, FName InTag, FColor InDebugColor)
+		: Mark(InMark), Tag(InTag), DebugColor(InDebugColor)
+	{
+	}
+};
+
+/** A horizontal run of pixels of one class, the unit of the run-length encoding of a class mask */
+struct FMaskSpan
+{
+	uint16 Y;
+	uint16 X;
+	uint16 Length;
+};
+
+/** Inclusive bounding box, pixel area and centroid of a class mask or one of its connected components */
+struct FMaskRegion
+{
+	uint16 MinX;
+	uint16 MinY;
+	uint16 MaxX;
+	uint16 MaxY;
+	uint32 Area;
+	float CentroidX;
+	float CentroidY;
+};
+
+/** Distance of a class from the camera, in millimetres along the view direction */
+struct FClassDepthStats
+{
+	// pixels of the class with a depth hit, the other fields are 0 when this is
+	uint32 NumPixels;
+	uint16 MinMm;
+	uint16 MeanMm;
+	uint16 PercentileMm;
+	// the pixel MinMm was measured at, the nearest point of the obstacle
+	uint16 NearestX;
+	uint16 NearestY;
+	// the percentile PercentileMm is for, 0..100
+	uint8 Percentile;
+	uint8 Reserved;
+};
+
+/** Pixel count and inclusive bounding box of one actor in the image */
+struct FInstanceStats
+{
+	uint16 InstanceId;
+	// the class of its first pixel in row major order
+	uint8 ClassId;
+	uint8 Reserved;
+	uint16 MinX;
+	uint16 MinY;
+	uint16 MaxX;
+	uint16 MaxY;
+	uint32 NumPixels;
+};
+
+static_assert(sizeof(FMaskSpan) == 6 && sizeof(FMaskRegion) == 20 && sizeof(FClassDepthStats) == 16 &&
+              sizeof(FInstanceStats) == 16, "mask, depth and instance layouts are part of the frame wire format");
+
+/** Run-length encoded pixels of one class */
+struct FClassMask
+{
+	// row major, runs never touch each other within a row
+	TArray<FMaskSpan> Spans;
+	// Regions[0] covers the whole mask, then one region per 4-connected component in the order of their first pixel.
+	// Empty when the class isn't in the frame.
+	TArray<FMaskRegion> Regions;
+};
+
+/**
+ * Turns a segmentation readback into class ids with a flat 256 entry table keyed on the red channel.
+ *
+ * Class 0 is background, classes 1..N are the definitions the classifier was built from, in the same order. One
+ * sweep writes the class id plane and optionally recolors marked pixels, and the per class pixel lists are then built
+ * with a parallel count-then-scatter, so the output order is the same row major order a sequential loop would give.
+ */
+class FSegmentationClassifier
+{
+public:
+	static constexpr uint8 BackgroundClass = 0;
+	// saturated depth, beyond 65.5 m or the sky. Left out of the depth stats.
+	static constexpr uint16 NoDepthMm = MAX_uint16;
+	// percentiles are taken from a histogram with bins this wide, so they are within half of it
+	static constexpr int32 DepthHistogramBinMm = 32;
+
+	void Build(TConstArrayView<FSegmentationClassDefinition> Classes);
+
+	/**
+	 * @param Marks segmentation readback, the class is looked up from the R channel
+	 * @param Recolor image marked pixels are painted into with their class color, may be null
+	 * @param OutClassIds one class id per pixel
+	 * @param OutClassPixels indexed by class id, x,y pairs of every pixel of that class. Index 0 is left empty.
+	 */
+	void Classify(const FColor* Marks, FColor* Recolor, uint8* OutClassIds, int32 Width, int32 Height,
+	              TArray<TArray<uint16>>& OutClassPixels) const;
+
+	/**
+	 * Like Classify, but instead of pixel lists every class gets run-length spans, its bounds and its connected
+	 * components. Runs are extracted and labeled per row chunk while the chunk's class ids are still in cache, then
+	 * the chunk borders are merged, so the cost is linear in the number of pixels plus runs.
+	 * @param OutClassMasks indexed by class id. Index 0 is left empty.
+	 */
+	void ClassifyMasks(const FColor* Marks, FColor* Recolor, uint8* OutClassIds, int32 Width, int32 Height,
+	                   TArray<FClassMask>& OutClassMasks) const;
+
+	/**
+	 * Packs scene depth into millimetres and gathers the depth stats of every class, row by row in one pass
+	 * @param SceneDepth depth readback in centimetres, in R
+	 * @param ClassIds class id plane written by Classify or ClassifyMasks
+	 * @param Percentile 0..100, e.g. 10 for a distance that ignores the nearest few stray pixels
+	 * @param OutDepthMm rounded, saturating at NoDepthMm
+	 * @param OutClassDepth indexed by class id. Index 0 is left zeroed.
+	 */
+	void ClassifyDepth(const FLinearColor* SceneDepth, const uint8* ClassIds, int32 Width, int32 Height,
+	                   int32 Percentile, uint16* OutDepthMm, TArray<FClassDepthStats>& OutClassDepth) const;
+
+	/**
+	 * Gathers the pixel count and bounds of every instance in one pass over row chunks, runs of one instance are
+	 * counted at once. Pixels of the background class never belong to an instance.
+	 * @param Marks segmentation readback holding instance ids, high byte in G and low byte in B, or null to take them
+	 * from InstanceIds as they are
+	 * @param InstanceIds one instance id per pixel, 0 for none, written from Marks when they are given
+	 * @param OutInstances sorted by instance id
+	 */
+	static void GatherInstances(const FColor* Marks, const uint8* ClassIds, uint16* InstanceIds, int32 Width,
+	                            int32 Height, TArray<FInstanceStats>& OutInstances);
+
+	/**
+	 * Packs scene depth into millimetres like ClassifyDepth, for depth images without a class id plane
+	 * @param SceneDepth depth readback in centimetres, in R
+	 */
+	static void PackDepth(const FLinearColor* SceneDepth, int32 Width, int32 Height, uint16* OutDepthMm);
+
+	/**
+	 * Writes ClassId into every pixel covered by Spans, the inverse of ClassifyMasks
+	 * @return false if a span lies outside the image, pixels up to that span are written
+	 */
+	static bool DecodeSpans(TConstArrayView<FMaskSpan> Spans, uint8 ClassId, uint8* OutClassIds, int32 Width,
+	                        int32 Height);
+
+	// including background
+	int32 GetNumClasses() const { return ClassTags.Num(); }
+	const FString& GetClassTag(int32 ClassId) const { return ClassTags[ClassId]; }
+	const FColor& GetClassColor(int32 ClassId) const { return ClassColors[ClassId]; }
+	// the R value the segmentation material writes for the class, 0 for background
+	uint8 GetClassMark(int32 ClassId) const { return ClassMarks[ClassId]; }
+
+private:
+	void ClassifyChunk(const FColor* Marks, FColor* Recolor, uint8* OutClassIds, int32 Width, int32 FirstRow,
+	                   int32 NumRows, int32* OutCounts) const;
+
+	template <bool bRecolor>
+	void ClassifyRows(const FColor* Marks, FColor* Recolor, uint8* OutClassIds, int32 NumPixels,
+	                  int32* OutCounts) const;
+
+	uint8 ClassTable[256] = {};
+	TArray<FString> ClassTags;
+	TArray<FColor> ClassColors;
+	// mark value of every class, used by the vector kernel which compares against each mark instead of a gather
+	TArray<uint8> ClassMarks;
+};
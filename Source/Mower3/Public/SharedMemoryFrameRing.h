@@ -0,0 +1,64 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/PlatformMemory.h"
+
+/**
+ * Multi slot ring of frames in a named shared memory region (POSIX shm on Linux), read by
+ * Python/mower/shm_ring.py.
+ *
+ * Layout: FRingHeader, then NumSlots x (FSlotHeader + SlotSize bytes of payload). Frame n goes to slot n % NumSlots.
+ * The writer zeroes the slot sequence, copies the payload, then publishes the sequence, so a reader that sees the
+ * sequence it was told about before and after reading the payload knows the frame wasn't overwritten meanwhile.
+ * Only one thread may write at a time.
+ */
+class FSharedMemoryFrameRing
+{
+public:
+	static constexpr uint32 Version = 1;
+
+	struct FRingHeader
+	{
+		uint8 Magic[4];
+		uint32 Version;
+		uint32 NumSlots;
+		uint32 SlotSize;
+		volatile int64 LastSequence;
+		uint8 Padding[40];
+	};
+
+	struct FSlotHeader
+	{
+		// 0 while the slot is being written
+		volatile int64 Sequence;
+		uint32 Size;
+		uint8 Padding[52];
+	};
+
+	static_assert(sizeof(FRingHeader) == 64 && sizeof(FSlotHeader) == 64, "ring layout is shared with Python");
+
+	~FSharedMemoryFrameRing();
+
+	bool Open(const FString& InName, int32 InNumSlots, int32 InSlotSize);
+	void Close();
+	bool IsOpen() const { return Region != nullptr; }
+	const FString& GetName() const { return Name; }
+
+	/**
+	 * Copies Frame into the next slot
+	 * @return false if the ring isn't open or the frame doesn't fit in a slot
+	 */
+	bool Write(TConstArrayView<uint8> Frame, int32& OutSlot, uint64& OutSequence);
+
+private:
+	FSlotHeader* GetSlot(int32 Slot) const;
+
+	FString Name;
+	FPlatformMemory::FSharedMemoryRegion* Region = nullptr;
+	FRingHeader* Header = nullptr;
+	int32 NumSlots = 0;
+	int32 SlotSize = 0;
+	uint64 LastSequence = 0;
+};
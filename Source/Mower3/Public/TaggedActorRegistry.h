@@ -0,0 +1,157 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "TaggedActorRegistry.generated.h"
+
+class FConvexVolume;
+class FSegmentationClassifier;
+class UStaticMesh;
+class UStaticMeshComponent;
+
+/** An actor tagged with a segmentation class, as the registry last saw it */
+struct FTaggedActor
+{
+	TWeakObjectPtr<AActor> Actor;
+	// the first of the actor's tags that names a class
+	FName Tag;
+	uint8 ClassId = 0;
+	// kept while the actor is registered and reused after it leaves, 0 once 65535 actors are registered at once
+	uint16 InstanceId = 0;
+	// of the actor's static mesh component, or of all its components without one
+	FBoxSphereBounds Bounds;
+	// null if the actor has no static mesh component
+	TWeakObjectPtr<UStaticMeshComponent> MeshComponent;
+	TWeakObjectPtr<UStaticMesh> Mesh;
+	// the bounds of movable actors are refreshed every tick
+	bool bMovable = false;
+	// grid cells the bounds overlap, inclusive
+	FIntPoint MinCell = FIntPoint::ZeroValue;
+	FIntPoint MaxCell = FIntPoint::ZeroValue;
+};
+
+USTRUCT(BlueprintType)
+struct FTaggedActorRegistryStats
+{
+	GENERATED_BODY()
+
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Registry")
+	int32 NumActors = 0;
+
+	// occupied grid cells
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Registry")
+	int32 NumCells = 0;
+
+	// heap memory of the entries, the grid and the tag lists
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Registry")
+	int64 AllocatedBytes = 0;
+
+	// actors added, removed or moved since the world started
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Registry")
+	int32 NumUpdates = 0;
+
+	// time spent keeping the index up to date since the world started, full scans included
+	UPROPERTY(VisibleInstanceOnly, BlueprintReadOnly, Category = "Registry")
+	float UpdateMilliseconds = 0.0f;
+};
+
+/**
+ * Index of the actors whose tags name a segmentation class, so nobody has to scan every actor of the world to find
+ * trees and walls. Kept up to date as actors spawn, are destroyed and as levels stream in and out, and queried by
+ * tag, by frustum and by radius through a uniform grid over X and Y. Game thread only.
+ *
+ * Tags are plain data without change notifications, whoever changes the tags of an actor calls RefreshActor. When
+ * asked to, the registry stamps the class mark and instance id of every actor on its primitive components as it
+ * registers, see USegmentationClassTable.
+ * The counters are in "stat TaggedActors" and GetStats.
+ */
+UCLASS()
+class MOWER3_API UTaggedActorRegistry : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	// side of a grid cell in centimetres
+	static constexpr double CellSize = 2000.0;
+
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	/**
+	 * Tracks the tags of the classifier's classes under their class ids and rebuilds the index from every actor of
+	 * the world
+	 * @param bInStampActors write class marks into the custom depth stencil and instance ids into the custom primitive
+	 * data of the registered actors
+	 */
+	void SetClasses(const FSegmentationClassifier& Classifier, bool bInStampActors = false);
+
+	// adds, updates or removes the actor after its tags, components or location changed
+	void RefreshActor(AActor* Actor);
+
+	// The queries return entries that stay valid until the registry next changes
+
+	// nullptr if the actor has no class tag
+	const FTaggedActor* Find(const AActor* Actor) const;
+	void GetActorsWithTag(FName Tag, TArray<const FTaggedActor*>& OutActors) const;
+	// the actors whose bounds intersect the frustum
+	void QueryFrustum(const FConvexVolume& Frustum, TArray<const FTaggedActor*>& OutActors) const;
+	// the actors whose bounds are within Radius of Center
+	void QueryRadius(const FVector& Center, double Radius, TArray<const FTaggedActor*>& OutActors) const;
+
+	UFUNCTION(BlueprintCallable, Category = "Registry")
+	FTaggedActorRegistryStats GetStats() const;
+
+private:
+	struct FCell
+	{
+		TArray<int32> Entries;
+		// of the bounds of the entries, only grows until the cell is empty
+		double MinZ = MAX_dbl;
+		double MaxZ = -MAX_dbl;
+	};
+
+	// adds the actor if it is new and has a class tag
+	void AddActor(AActor* Actor);
+	void OnActorSpawned(AActor* Actor);
+	void OnActorDestroyed(AActor* Actor);
+	void OnLevelAdded(ULevel* Level, UWorld* InWorld);
+	void OnLevelRemoved(ULevel* Level, UWorld* InWorld);
+
+	// @return false if the actor has no class tag
+	bool Describe(AActor* Actor, FTaggedActor& OutEntry) const;
+	void Add(FTaggedActor&& Entry);
+	void StampActor(const FTaggedActor& Entry) const;
+	void Remove(int32 Index);
+	void InsertIntoGrid(int32 Index);
+	void RemoveFromGrid(int32 Index);
+	static FIntPoint GetCell(double X, double Y);
+	template <typename FunctionType>
+	void ForEachCandidate(FIntPoint MinCell, FIntPoint MaxCell, FunctionType&& Function) const;
+	void AddUpdateTime(double StartSeconds);
+	void UpdateStats();
+
+	TMap<FName, uint8> ClassIds;
+	// indexed by class id
+	TArray<uint8> ClassMarks;
+	bool bStampActors = false;
+	TSparseArray<FTaggedActor> Entries;
+	TMap<TWeakObjectPtr<const AActor>, int32> EntryOfActor;
+	TMap<FName, TArray<int32>> EntriesOfTag;
+	TMap<FIntPoint, FCell> Cells;
+	// entries of movable actors, checked for movement every tick
+	TSet<int32> MovableEntries;
+	// marks entries already returned by a query that visits several cells
+	mutable TBitArray<> Visited;
+
+	FTaggedActorRegistryStats Stats;
+	bool bStatsDirty = false;
+
+	FDelegateHandle ActorSpawnedHandle;
+	FDelegateHandle ActorDestroyedHandle;
+	FDelegateHandle LevelAddedHandle;
+	FDelegateHandle LevelRemovedHandle;
+};